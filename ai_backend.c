@@ -0,0 +1,243 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "ai_backend.h"
+
+// --- Operations shared by the HTTP backends ---
+static int http_submit(AiBackend *backend, const char *model, const char *persona, const GeminiTurn *history, size_t history_len,
+                       const char *prompt, bool short_answer, long timeout_ms, void *user_data, unsigned long *request_id_out) {
+    return gemini_client_submit(&backend->http, model, persona, history, history_len, prompt, short_answer, timeout_ms, user_data,
+                                request_id_out);
+}
+
+static int http_poll(AiBackend *backend, AiResult *out) {
+    gemini_client_perform(&backend->http);
+    return gemini_client_next_result(&backend->http, out);
+}
+
+static int http_cancel(AiBackend *backend, unsigned long request_id) {
+    return gemini_client_cancel(&backend->http, request_id);
+}
+
+static bool http_has_capacity(const AiBackend *backend) {
+    return gemini_client_has_capacity(&backend->http);
+}
+
+static int http_wait(AiBackend *backend, int extra_fd, int timeout_ms, bool *extra_fd_ready) {
+    return gemini_client_wait(&backend->http, extra_fd, timeout_ms, extra_fd_ready);
+}
+
+static void http_cleanup(AiBackend *backend) {
+    gemini_client_cleanup(&backend->http);
+}
+
+static void http_finish_init(AiBackend *backend, GeminiStreamHandler on_stream_text) {
+    gemini_client_warmup(&backend->http);
+    if (on_stream_text) gemini_client_set_stream_handler(&backend->http, on_stream_text);
+}
+
+// Key from the configured environment variable, or fallback when none is set.
+static const char *configured_api_key(const AiBackendConfig *config, const char *fallback) {
+    if (config->key_env[0] == '\0') return fallback;
+    const char *key = getenv(config->key_env);
+    return (key && strlen(key) > 0) ? key : NULL;
+}
+
+// --- gemini ---
+static int gemini_backend_init(AiBackend *backend, const char *api_key, int max_inflight, GeminiStreamHandler on_stream_text) {
+    api_key = configured_api_key(&backend->config, api_key);
+    if (gemini_client_init(&backend->http, api_key, backend->config.model, max_inflight) != 0) return -1;
+    http_finish_init(backend, on_stream_text);
+    return 0;
+}
+
+// --- openai ---
+static int openai_backend_init(AiBackend *backend, const char *api_key, int max_inflight, GeminiStreamHandler on_stream_text) {
+    (void)api_key; // The Gemini key is never sent to another vendor
+    const AiBackendConfig *config = &backend->config;
+    if (config->url[0] == '\0') {
+        app_log("AI_Backend", "ERROR", "The openai backend needs url=<chat completions endpoint>.");
+        return -1;
+    }
+    const char *model = config->model[0] ? config->model : "default";
+    if (gemini_client_init_openai(&backend->http, config->url, model, configured_api_key(config, NULL), max_inflight) != 0) return -1;
+    http_finish_init(backend, on_stream_text);
+    return 0;
+}
+
+// --- fake ---
+// An OpenAI-compatible client whose defaults point at a local fake_ai_server.
+static int fake_backend_init(AiBackend *backend, const char *api_key, int max_inflight, GeminiStreamHandler on_stream_text) {
+    (void)api_key;
+    const AiBackendConfig *config = &backend->config;
+    const char *url = config->url[0] ? config->url : AI_FAKE_BACKEND_URL;
+    const char *model = config->model[0] ? config->model : "fake";
+    if (gemini_client_init_openai(&backend->http, url, model, NULL, max_inflight) != 0) return -1;
+    http_finish_init(backend, on_stream_text);
+    return 0;
+}
+
+static const AiBackendOps GEMINI_BACKEND_OPS = {
+    "gemini", gemini_backend_init, http_submit, http_poll, http_cancel, http_has_capacity, http_wait, http_cleanup
+};
+
+static const AiBackendOps OPENAI_BACKEND_OPS = {
+    "openai", openai_backend_init, http_submit, http_poll, http_cancel, http_has_capacity, http_wait, http_cleanup
+};
+
+static const AiBackendOps FAKE_BACKEND_OPS = {
+    "fake", fake_backend_init, http_submit, http_poll, http_cancel, http_has_capacity, http_wait, http_cleanup
+};
+
+// "name[:slo_ms],..." into config->models.
+static int parse_models(const char *value, AiBackendConfig *config) {
+    char list[MAX_BACKEND_OPTIONS_LEN];
+    snprintf(list, sizeof(list), "%s", value);
+    config->num_models = 0;
+    char *saveptr;
+    for (char *entry = strtok_r(list, ",", &saveptr); entry; entry = strtok_r(NULL, ",", &saveptr)) {
+        if (config->num_models == AI_ROUTE_MAX_MODELS) {
+            app_log("AI_Backend", "ERROR", "Too many models in '%s' (at most %d).", value, AI_ROUTE_MAX_MODELS);
+            return -1;
+        }
+        AiModelRoute *route = &config->models[config->num_models];
+        long slo_ms = 0;
+        char *slo = strchr(entry, ':');
+        if (slo) {
+            *slo++ = '\0';
+            char *end;
+            slo_ms = strtol(slo, &end, 10);
+            if (end == slo || *end != '\0' || slo_ms < 0) {
+                app_log("AI_Backend", "ERROR", "Bad SLO '%s' for model '%s' (milliseconds, 0 for none).", slo, entry);
+                return -1;
+            }
+        }
+        if (entry[0] == '\0' || strlen(entry) >= sizeof(route->name)) {
+            app_log("AI_Backend", "ERROR", "Bad model name in '%s'.", value);
+            return -1;
+        }
+        snprintf(route->name, sizeof(route->name), "%s", entry);
+        route->slo_ms = slo_ms;
+        config->num_models++;
+    }
+    if (config->num_models == 0) {
+        app_log("AI_Backend", "ERROR", "models= needs at least one model.");
+        return -1;
+    }
+    return 0;
+}
+
+int ai_backend_parse_config(const char *options, AiBackendConfig *config) {
+    memset(config, 0, sizeof(*config));
+    config->kind = AI_BACKEND_GEMINI;
+    config->deadline_ms = AI_REQUEST_DEADLINE_MS;
+    config->use_quota = true;
+    config->batch_window_ms = AI_BATCH_WINDOW_MS;
+    config->budget_tokens_per_hour = AI_USAGE_BUDGET_TOKENS_PER_HOUR;
+    if (options == NULL) return 0;
+
+    char buffer[MAX_BACKEND_OPTIONS_LEN];
+    snprintf(buffer, sizeof(buffer), "%s", options);
+    char *saveptr;
+    for (char *token = strtok_r(buffer, " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr)) {
+        char *value = strchr(token, '=');
+        if (value == NULL) {
+            app_log("AI_Backend", "WARN", "Ignoring backend option without a value: '%s'", token);
+            continue;
+        }
+        *value++ = '\0';
+        if (strcmp(token, "backend") == 0) {
+            if (strcmp(value, "gemini") == 0) config->kind = AI_BACKEND_GEMINI;
+            else if (strcmp(value, "openai") == 0) config->kind = AI_BACKEND_OPENAI;
+            else if (strcmp(value, "fake") == 0) config->kind = AI_BACKEND_FAKE;
+            else {
+                app_log("AI_Backend", "ERROR", "Unknown backend '%s'.", value);
+                return -1;
+            }
+        } else if (strcmp(token, "url") == 0) {
+            snprintf(config->url, sizeof(config->url), "%s", value);
+        } else if (strcmp(token, "model") == 0) {
+            snprintf(config->model, sizeof(config->model), "%s", value);
+        } else if (strcmp(token, "key_env") == 0) {
+            snprintf(config->key_env, sizeof(config->key_env), "%s", value);
+        } else if (strcmp(token, "deadline") == 0) {
+            char *end;
+            double seconds = strtod(value, &end);
+            if (end == value || *end != '\0' || seconds <= 0 || seconds > 600) {
+                app_log("AI_Backend", "ERROR", "Bad deadline '%s' (seconds, up to 600).", value);
+                return -1;
+            }
+            config->deadline_ms = (long)(seconds * 1000);
+        } else if (strcmp(token, "quota") == 0) {
+            if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+                app_log("AI_Backend", "ERROR", "Bad quota '%s' (on or off).", value);
+                return -1;
+            }
+            config->use_quota = (strcmp(value, "on") == 0);
+        } else if (strcmp(token, "supersede") == 0) {
+            if (strcmp(value, "on") != 0 && strcmp(value, "off") != 0) {
+                app_log("AI_Backend", "ERROR", "Bad supersede '%s' (on or off).", value);
+                return -1;
+            }
+            config->supersede = (strcmp(value, "on") == 0);
+        } else if (strcmp(token, "batch") == 0) {
+            char *end;
+            long window_ms = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || window_ms < 0 || window_ms > 5000) {
+                app_log("AI_Backend", "ERROR", "Bad batch '%s' (milliseconds, up to 5000).", value);
+                return -1;
+            }
+            config->batch_window_ms = window_ms;
+        } else if (strcmp(token, "budget") == 0) {
+            char *end;
+            long tokens = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || tokens < 0) {
+                app_log("AI_Backend", "ERROR", "Bad budget '%s' (tokens per hour, 0 for none).", value);
+                return -1;
+            }
+            config->budget_tokens_per_hour = tokens;
+        } else if (strcmp(token, "models") == 0) {
+            if (parse_models(value, config) != 0) return -1;
+        } else if (strcmp(token, "route") == 0) {
+            if (strcmp(value, "size") == 0) config->route_policy = AI_ROUTE_SIZE;
+            else if (strcmp(value, "quality") == 0) config->route_policy = AI_ROUTE_QUALITY;
+            else if (strcmp(value, "speed") == 0) config->route_policy = AI_ROUTE_SPEED;
+            else {
+                app_log("AI_Backend", "ERROR", "Bad route '%s' (size, quality or speed).", value);
+                return -1;
+            }
+        } else {
+            app_log("AI_Backend", "WARN", "Ignoring unknown backend option '%s'.", token);
+        }
+    }
+    if (config->kind == AI_BACKEND_GEMINI) { // Only Gemini puts model names into the URL
+        if (config->model[0] && !gemini_model_name_valid(config->model)) {
+            app_log("AI_Backend", "ERROR", "Bad Gemini model name '%s'.", config->model);
+            return -1;
+        }
+        for (int i = 0; i < config->num_models; ++i) {
+            if (!gemini_model_name_valid(config->models[i].name)) {
+                app_log("AI_Backend", "ERROR", "Bad Gemini model name '%s' in models=.", config->models[i].name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void ai_backend_setup(AiBackend *backend, const AiBackendConfig *config) {
+    memset(backend, 0, sizeof(*backend));
+    backend->config = *config;
+    switch (config->kind) {
+    case AI_BACKEND_OPENAI:
+        backend->ops = &OPENAI_BACKEND_OPS;
+        break;
+    case AI_BACKEND_FAKE:
+        backend->ops = &FAKE_BACKEND_OPS;
+        break;
+    default:
+        backend->ops = &GEMINI_BACKEND_OPS;
+        break;
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef AI_BACKEND_H
+#define AI_BACKEND_H
+
+#include "irc_bot.h"
+#include "gemini_integration.h"
+
+// --- AI backends ---
+// A worker talks to its model through an AiBackend, chosen per channel by the
+// options segment in channels.txt (see ai_backend_parse_config()). Every
+// backend implements the same operations, so the worker never depends on a
+// particular vendor:
+//   gemini - Google Gemini generateContent (the default)
+//   openai - any OpenAI-compatible /v1/chat/completions server, e.g. a local model
+//   fake   - the in-repo fake_ai_server, for offline and load testing
+
+typedef enum {
+    AI_BACKEND_GEMINI,
+    AI_BACKEND_OPENAI,
+    AI_BACKEND_FAKE
+} AiBackendKind;
+
+typedef enum {
+    AI_ROUTE_SIZE,    // Long prompts start at the first model, short ones at the last (the default)
+    AI_ROUTE_QUALITY, // Every request starts at the first model
+    AI_ROUTE_SPEED    // Every request goes to the last model
+} AiRoutePolicy;
+
+// A model a channel may route to, from "models=<name>[:<slo ms>],...".
+typedef struct {
+    char name[GEMINI_MODEL_NAME_MAX];
+    long slo_ms; // p95 answer time above which traffic moves on to the next model, 0 = none
+} AiModelRoute;
+
+typedef struct {
+    AiBackendKind kind;
+    char url[256]; // Empty = backend default
+    char model[GEMINI_MODEL_NAME_MAX];
+    char key_env[64]; // Environment variable holding the API key, empty = backend default
+    long deadline_ms; // How long an !ask may take from arrival to answer
+    bool use_quota; // Draw on the shared API quota (off for e.g. a local model)
+    bool supersede; // A new !ask cancels the asker's unanswered earlier ones
+    long batch_window_ms; // Short asks this close together share one request, 0 = never
+    long budget_tokens_per_hour; // 0 = no budget
+    AiModelRoute models[AI_ROUTE_MAX_MODELS]; // Preferred first, fastest last
+    int num_models; // 0 = just the backend's model
+    AiRoutePolicy route_policy;
+} AiBackendConfig;
+
+typedef GeminiResult AiResult;
+typedef struct AiBackend AiBackend;
+
+typedef struct {
+    const char *name;
+    // api_key is the process-wide Gemini key (may be NULL). Returns 0 or -1; call cleanup either way.
+    int (*init)(AiBackend *backend, const char *api_key, int max_inflight, GeminiStreamHandler on_stream_text);
+    // Starts a request to model (NULL for the configured one) without blocking, to be aborted after
+    // timeout_ms. Returns 0, or -1 on error or when the backend is full.
+    int (*submit)(AiBackend *backend, const char *model, const char *persona, const GeminiTurn *history, size_t history_len,
+                  const char *prompt, bool short_answer, long timeout_ms, void *user_data, unsigned long *request_id_out);
+    // Drives transfers and pops one finished request into *out. Returns 1 if a result was produced, 0 otherwise.
+    int (*poll)(AiBackend *backend, AiResult *out);
+    // Abandons a request; it will not show up in poll(). Returns 0, or -1 if it is unknown.
+    int (*cancel)(AiBackend *backend, unsigned long request_id);
+    bool (*has_capacity)(const AiBackend *backend);
+    // Blocks up to timeout_ms for transfer activity or for extra_fd to become readable.
+    int (*wait)(AiBackend *backend, int extra_fd, int timeout_ms, bool *extra_fd_ready);
+    void (*cleanup)(AiBackend *backend);
+} AiBackendOps;
+
+struct AiBackend {
+    const AiBackendOps *ops;
+    AiBackendConfig config;
+    GeminiClient http; // Transport shared by the HTTP backends
+};
+
+// Parses "backend=<gemini|openai|fake> [url=...] [model=...] [key_env=...] [deadline=<seconds>] [quota=on|off]
+// [batch=<ms>] [budget=<tokens per hour>] [models=<name>[:<slo ms>],...] [route=<size|quality|speed>]".
+// NULL or empty options select Gemini with AI_REQUEST_DEADLINE_MS. Returns 0, or -1 on an unknown
+// backend or a bad deadline, quota, batch, budget, models or route value.
+int ai_backend_parse_config(const char *options, AiBackendConfig *config);
+// Picks the operations for config->kind. Call backend->ops->init() next.
+void ai_backend_setup(AiBackend *backend, const AiBackendConfig *config);
+
+#endif // AI_BACKEND_H
@@ -0,0 +1,294 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_cache.h"
+#include <sys/stat.h>
+
+#define AI_CACHE_DISK_MAGIC 0x31434149u // "AIC1"
+#define AI_CACHE_DISK_PROBES 4
+
+// Fixed-size record in the on-disk table. A slot is live when hash != 0 and
+// it has not expired. Answers too long for the response field are kept in
+// memory only.
+struct AiCacheDiskSlot {
+    uint64_t hash;
+    int64_t expires_at;
+    uint32_t key_len;
+    uint32_t response_len;
+    char key[AI_CACHE_DISK_KEY_MAX];
+    char response[AI_CACHE_DISK_RESPONSE_MAX];
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_size;
+    uint64_t slots;
+} AiCacheDiskHeader;
+
+uint64_t ai_hash64(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = 1469598103934665603ULL ^ seed;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void ai_normalize_prompt(const char *prompt, char *out, size_t out_size) {
+    size_t j = 0;
+    bool pending_space = false;
+    for (const char *p = prompt; *p && j + 1 < out_size; ++p) {
+        unsigned char c = (unsigned char)*p;
+        if (isspace(c)) {
+            pending_space = (j > 0);
+            continue;
+        }
+        if (pending_space && j + 2 < out_size) out[j++] = ' ';
+        pending_space = false;
+        out[j++] = (char)tolower(c);
+    }
+    while (j > 0 && (out[j - 1] == '?' || out[j - 1] == '!' || out[j - 1] == '.' || out[j - 1] == ' ')) j--;
+    out[j] = '\0';
+}
+
+static char *build_key(const char *persona, const char *prompt, uint64_t *hash_out) {
+    char normalized[MAX_PIPE_MSG_LEN];
+    ai_normalize_prompt(prompt, normalized, sizeof(normalized));
+    size_t persona_len = strlen(persona);
+    size_t prompt_len = strlen(normalized);
+    char *key = (char *)malloc(persona_len + prompt_len + 2);
+    if (key == NULL) return NULL;
+    memcpy(key, persona, persona_len);
+    key[persona_len] = '\x1f';
+    memcpy(key + persona_len + 1, normalized, prompt_len + 1);
+    *hash_out = ai_hash64(key, persona_len + prompt_len + 1, 0);
+    if (*hash_out == 0) *hash_out = 1; // 0 marks an empty disk slot
+    return key;
+}
+
+// --- LRU list helpers ---
+static void lru_unlink(AiCache *cache, AiCacheEntry *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(AiCache *cache, AiCacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL) cache->lru_tail = entry;
+}
+
+static void remove_entry(AiCache *cache, AiCacheEntry *entry) {
+    AiCacheEntry **link = &cache->buckets[entry->hash % cache->num_buckets];
+    while (*link && *link != entry) link = &(*link)->bucket_next;
+    if (*link) *link = entry->bucket_next;
+    lru_unlink(cache, entry);
+    cache->entries--;
+    cache->bytes_used -= entry->bytes;
+    free(entry->key);
+    free(entry->response);
+    free(entry);
+}
+
+static AiCacheEntry *find_entry(AiCache *cache, uint64_t hash, const char *key) {
+    for (AiCacheEntry *entry = cache->buckets[hash % cache->num_buckets]; entry; entry = entry->bucket_next) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+static void insert_entry(AiCache *cache, uint64_t hash, char *key, const char *response, time_t expires_at) {
+    size_t bytes = sizeof(AiCacheEntry) + strlen(key) + strlen(response) + 2;
+    if (bytes > cache->byte_budget) {
+        free(key);
+        return;
+    }
+    AiCacheEntry *entry = (AiCacheEntry *)calloc(1, sizeof(AiCacheEntry));
+    char *response_copy = strdup(response);
+    if (entry == NULL || response_copy == NULL) {
+        free(entry);
+        free(response_copy);
+        free(key);
+        return;
+    }
+    while (cache->bytes_used + bytes > cache->byte_budget && cache->lru_tail) {
+        remove_entry(cache, cache->lru_tail);
+        cache->evictions++;
+    }
+    entry->hash = hash;
+    entry->key = key;
+    entry->response = response_copy;
+    entry->bytes = bytes;
+    entry->expires_at = expires_at;
+    size_t bucket = hash % cache->num_buckets;
+    entry->bucket_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    cache->entries++;
+    cache->bytes_used += bytes;
+}
+
+// --- Disk table ---
+static AiCacheDiskSlot *disk_find(AiCache *cache, uint64_t hash, const char *key, bool for_write) {
+    AiCacheDiskSlot *oldest = NULL;
+    time_t now = time(NULL);
+    for (int probe = 0; probe < AI_CACHE_DISK_PROBES; ++probe) {
+        AiCacheDiskSlot *slot = &cache->disk[(hash + (uint64_t)probe) % cache->disk_slots];
+        bool matches = slot->hash == hash && slot->key_len < sizeof(slot->key) && strcmp(slot->key, key) == 0;
+        if (matches) return slot;
+        if (!for_write) continue;
+        if (slot->hash == 0 || slot->expires_at <= now) return slot;
+        if (oldest == NULL || slot->expires_at < oldest->expires_at) oldest = slot;
+    }
+    return oldest;
+}
+
+static int disk_open(AiCache *cache, const char *disk_path) {
+    int fd = open(disk_path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        app_log("AI_Cache", "WARN", "Cannot open cache table '%s': %s", disk_path, strerror(errno));
+        return -1;
+    }
+    size_t slots = AI_CACHE_DISK_SLOTS;
+    size_t map_size = sizeof(AiCacheDiskHeader) + slots * sizeof(AiCacheDiskSlot);
+
+    struct stat st;
+    bool fresh = (fstat(fd, &st) == 0 && (size_t)st.st_size != map_size);
+    if (fresh && ftruncate(fd, 0) == -1) fresh = false;
+    if (fresh && ftruncate(fd, (off_t)map_size) == -1) {
+        app_log("AI_Cache", "WARN", "Cannot size cache table '%s': %s", disk_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        app_log("AI_Cache", "WARN", "mmap of cache table '%s' failed: %s", disk_path, strerror(errno));
+        return -1;
+    }
+
+    AiCacheDiskHeader *header = (AiCacheDiskHeader *)map;
+    if (header->magic != AI_CACHE_DISK_MAGIC || header->slot_size != sizeof(AiCacheDiskSlot) || header->slots != slots) {
+        memset(map, 0, map_size);
+        header->magic = AI_CACHE_DISK_MAGIC;
+        header->slot_size = sizeof(AiCacheDiskSlot);
+        header->slots = slots;
+    }
+    cache->disk = (AiCacheDiskSlot *)((char *)map + sizeof(AiCacheDiskHeader));
+    cache->disk_slots = slots;
+    cache->disk_map_size = map_size;
+    return 0;
+}
+
+int ai_cache_init(AiCache *cache, size_t byte_budget, int ttl_seconds, const char *disk_path) {
+    memset(cache, 0, sizeof(*cache));
+    cache->byte_budget = byte_budget;
+    cache->ttl_seconds = ttl_seconds;
+    cache->num_buckets = AI_CACHE_BUCKETS;
+    cache->buckets = (AiCacheEntry **)calloc(cache->num_buckets, sizeof(AiCacheEntry *));
+    if (cache->buckets == NULL) {
+        app_log("AI_Cache", "ERROR", "Failed to allocate cache buckets: %s", strerror(errno));
+        return -1;
+    }
+    if (disk_path != NULL) disk_open(cache, disk_path); // Memory-only if the table can't be opened
+    return 0;
+}
+
+static char *cache_get(AiCache *cache, const char *persona, const char *prompt, bool count_stats) {
+    if (cache->buckets == NULL) return NULL;
+    uint64_t hash;
+    char *key = build_key(persona, prompt, &hash);
+    if (key == NULL) return NULL;
+
+    time_t now = time(NULL);
+    char *result = NULL;
+    AiCacheEntry *entry = find_entry(cache, hash, key);
+    if (entry && entry->expires_at <= now) {
+        remove_entry(cache, entry);
+        entry = NULL;
+    }
+    if (entry) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+        result = strdup(entry->response);
+        if (count_stats) cache->hits++;
+        free(key);
+        return result;
+    }
+
+    if (cache->disk) {
+        AiCacheDiskSlot *slot = disk_find(cache, hash, key, false);
+        if (slot && slot->expires_at > now && slot->response_len < sizeof(slot->response)) {
+            result = strdup(slot->response);
+            if (result) {
+                if (count_stats) {
+                    cache->hits++;
+                    cache->disk_hits++;
+                }
+                insert_entry(cache, hash, key, result, (time_t)slot->expires_at); // Takes ownership of key
+                return result;
+            }
+        }
+    }
+    if (count_stats) cache->misses++;
+    free(key);
+    return NULL;
+}
+
+char *ai_cache_lookup(AiCache *cache, const char *persona, const char *prompt) {
+    return cache_get(cache, persona, prompt, true);
+}
+
+char *ai_cache_peek(AiCache *cache, const char *persona, const char *prompt) {
+    return cache_get(cache, persona, prompt, false);
+}
+
+void ai_cache_store(AiCache *cache, const char *persona, const char *prompt, const char *response) {
+    if (cache->buckets == NULL || response == NULL) return;
+    uint64_t hash;
+    char *key = build_key(persona, prompt, &hash);
+    if (key == NULL) return;
+
+    time_t expires_at = time(NULL) + cache->ttl_seconds;
+    if (cache->disk) {
+        // An answer that does not fit is kept in memory only; an older copy on disk is dropped
+        bool fits = strlen(response) < sizeof(cache->disk->response);
+        AiCacheDiskSlot *slot = disk_find(cache, hash, key, fits);
+        size_t key_len = strlen(key);
+        if (slot && !fits) {
+            slot->hash = 0;
+        } else if (slot && key_len < sizeof(slot->key)) {
+            slot->hash = 0; // Invalidate while rewriting
+            memcpy(slot->key, key, key_len + 1);
+            memcpy(slot->response, response, strlen(response) + 1);
+            slot->key_len = (uint32_t)key_len;
+            slot->response_len = (uint32_t)strlen(slot->response);
+            slot->expires_at = expires_at;
+            slot->hash = hash;
+        }
+    }
+
+    AiCacheEntry *existing = find_entry(cache, hash, key);
+    if (existing) remove_entry(cache, existing);
+    insert_entry(cache, hash, key, response, expires_at);
+}
+
+void ai_cache_cleanup(AiCache *cache) {
+    while (cache->lru_head) remove_entry(cache, cache->lru_head);
+    free(cache->buckets);
+    cache->buckets = NULL;
+    if (cache->disk) {
+        void *map = (char *)cache->disk - sizeof(AiCacheDiskHeader);
+        msync(map, cache->disk_map_size, MS_ASYNC);
+        munmap(map, cache->disk_map_size);
+        cache->disk = NULL;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef AI_CACHE_H
+#define AI_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// --- AI response cache ---
+// Per-worker LRU cache of answers keyed by (persona, normalized prompt), with
+// a TTL and a byte budget. It can also be backed by a memory-mapped, fixed-slot
+// table on disk so answers survive a restart.
+
+typedef struct AiCacheEntry {
+    uint64_t hash;
+    char *key; // persona + '\x1f' + normalized prompt
+    char *response;
+    size_t bytes;
+    time_t expires_at;
+    struct AiCacheEntry *bucket_next;
+    struct AiCacheEntry *lru_prev; // Towards most recently used
+    struct AiCacheEntry *lru_next; // Towards least recently used
+} AiCacheEntry;
+
+typedef struct AiCacheDiskSlot AiCacheDiskSlot;
+
+typedef struct {
+    AiCacheEntry **buckets;
+    size_t num_buckets;
+    AiCacheEntry *lru_head;
+    AiCacheEntry *lru_tail;
+    size_t entries;
+    size_t bytes_used;
+    size_t byte_budget;
+    int ttl_seconds;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long disk_hits;
+    unsigned long evictions;
+    // Optional on-disk table (NULL when disabled)
+    AiCacheDiskSlot *disk;
+    size_t disk_slots;
+    size_t disk_map_size;
+} AiCache;
+
+// FNV-1a, used for cache keys and similarity signatures.
+uint64_t ai_hash64(const void *data, size_t len, uint64_t seed);
+// Lowercases, collapses whitespace and drops trailing punctuation.
+void ai_normalize_prompt(const char *prompt, char *out, size_t out_size);
+
+// disk_path may be NULL to keep the cache in memory only. Returns 0 or -1.
+int ai_cache_init(AiCache *cache, size_t byte_budget, int ttl_seconds, const char *disk_path);
+// Returns a malloc'd copy of the cached answer, or NULL on a miss.
+char *ai_cache_lookup(AiCache *cache, const char *persona, const char *prompt);
+// Same as ai_cache_lookup() but leaves the hit/miss counters alone.
+char *ai_cache_peek(AiCache *cache, const char *persona, const char *prompt);
+void ai_cache_store(AiCache *cache, const char *persona, const char *prompt, const char *response);
+void ai_cache_cleanup(AiCache *cache);
+
+#endif // AI_CACHE_H
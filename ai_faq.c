@@ -0,0 +1,311 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_faq.h"
+#include <sys/stat.h>
+
+#define FAQ_LINE_MAX 1024
+#define FAQ_MAX_TRIGRAMS 512 // Per question or prompt; the rest of a very long prompt is ignored
+
+// Lowercases letters and digits (and non-ASCII bytes), turns every other run
+// into one space, and trims, so "What's  up?" and "whats up" compare alike.
+static size_t normalize(const char *text, char *out, size_t out_size) {
+    size_t len = 0;
+    bool space = false;
+    for (const unsigned char *p = (const unsigned char *)text; *p && len + 2 < out_size; ++p) {
+        if (*p == '\'') continue;
+        if (isalnum(*p) || *p >= 0x80) {
+            if (space && len > 0) out[len++] = ' ';
+            out[len++] = (char)tolower(*p);
+            space = false;
+        } else {
+            space = true;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Distinct trigrams of normalized text padded with a space on each side, in
+// ascending order. Each is its three bytes packed into an integer.
+static size_t trigrams_of(const char *normalized, uint32_t *out, size_t max) {
+    size_t len = strlen(normalized);
+    if (len == 0) return 0;
+    size_t count = 0;
+    for (size_t i = 0; i < len && count < max; ++i) {
+        unsigned char a = i == 0 ? ' ' : (unsigned char)normalized[i - 1];
+        unsigned char b = (unsigned char)normalized[i];
+        unsigned char c = i + 1 == len ? ' ' : (unsigned char)normalized[i + 1];
+        out[count++] = ((uint32_t)a << 16) | ((uint32_t)b << 8) | c;
+    }
+    qsort(out, count, sizeof(uint32_t), compare_u32);
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (distinct == 0 || out[distinct - 1] != out[i]) out[distinct++] = out[i];
+    }
+    return distinct;
+}
+
+static int compare_postings(const void *a, const void *b) {
+    const AiFaqPosting *x = (const AiFaqPosting *)a;
+    const AiFaqPosting *y = (const AiFaqPosting *)b;
+    if (x->trigram != y->trigram) return (x->trigram > y->trigram) - (x->trigram < y->trigram);
+    return (x->question > y->question) - (x->question < y->question);
+}
+
+static char *trim(char *text) {
+    while (isspace((unsigned char)*text)) text++;
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1])) text[--len] = '\0';
+    return text;
+}
+
+static bool add_entry(AiFaq *faq, const char *question) {
+    AiFaqEntry *grown = (AiFaqEntry *)realloc(faq->entries, (faq->num_entries + 1) * sizeof(AiFaqEntry));
+    if (grown == NULL) return false;
+    faq->entries = grown;
+    AiFaqEntry *entry = &faq->entries[faq->num_entries];
+    memset(entry, 0, sizeof(*entry));
+    char key[FAQ_LINE_MAX];
+    normalize(question, key, sizeof(key));
+    entry->question = strdup(question);
+    entry->key = strdup(key);
+    if (entry->question == NULL || entry->key == NULL) {
+        free(entry->question);
+        free(entry->key);
+        return false;
+    }
+    faq->num_entries++;
+    return true;
+}
+
+static bool add_question(AiFaq *faq, size_t entry, const char *question) {
+    char normalized[FAQ_LINE_MAX];
+    uint32_t trigrams[FAQ_MAX_TRIGRAMS];
+    normalize(question, normalized, sizeof(normalized));
+    size_t count = trigrams_of(normalized, trigrams, FAQ_MAX_TRIGRAMS);
+    if (count == 0) return true;
+
+    size_t *entries = (size_t *)realloc(faq->question_entry, (faq->num_questions + 1) * sizeof(size_t));
+    if (entries == NULL) return false;
+    faq->question_entry = entries;
+    uint32_t *sizes = (uint32_t *)realloc(faq->question_trigrams, (faq->num_questions + 1) * sizeof(uint32_t));
+    if (sizes == NULL) return false;
+    faq->question_trigrams = sizes;
+    AiFaqPosting *postings = (AiFaqPosting *)realloc(faq->postings, (faq->num_postings + count) * sizeof(AiFaqPosting));
+    if (postings == NULL) return false;
+    faq->postings = postings;
+
+    uint32_t id = (uint32_t)faq->num_questions;
+    for (size_t i = 0; i < count; ++i) {
+        faq->postings[faq->num_postings].trigram = trigrams[i];
+        faq->postings[faq->num_postings].question = id;
+        faq->num_postings++;
+    }
+    faq->question_entry[id] = entry;
+    faq->question_trigrams[id] = (uint32_t)count;
+    faq->num_questions++;
+    return true;
+}
+
+static void free_contents(AiFaq *faq) {
+    for (size_t i = 0; i < faq->num_entries; ++i) {
+        free(faq->entries[i].question);
+        free(faq->entries[i].key);
+        free(faq->entries[i].answer);
+    }
+    free(faq->entries);
+    free(faq->question_entry);
+    free(faq->question_trigrams);
+    free(faq->postings);
+    free(faq->shared);
+    faq->entries = NULL;
+    faq->question_entry = NULL;
+    faq->question_trigrams = NULL;
+    faq->postings = NULL;
+    faq->shared = NULL;
+    faq->num_entries = faq->num_questions = faq->num_postings = 0;
+}
+
+// Applies the generated answers saved in the side file to entries still
+// asking for them. Lines are "generated_at\tkey\tanswer".
+static void load_answers(AiFaq *faq) {
+    if (faq->answers_path[0] == '\0') return;
+    FILE *fp = fopen(faq->answers_path, "r");
+    if (fp == NULL) return;
+    char line[FAQ_LINE_MAX * 2];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *key = strchr(line, '\t');
+        char *answer = key ? strchr(key + 1, '\t') : NULL;
+        if (answer == NULL) continue;
+        *key++ = '\0';
+        *answer++ = '\0';
+        for (size_t i = 0; i < faq->num_entries; ++i) {
+            AiFaqEntry *entry = &faq->entries[i];
+            if (entry->fixed || entry->answer || strcmp(entry->key, key) != 0) continue;
+            entry->answer = strdup(answer);
+            entry->generated_at = (time_t)strtoll(line, NULL, 10);
+        }
+    }
+    fclose(fp);
+}
+
+// Writes the generated answers to a temporary file and renames it over the
+// side file, so a crash leaves either the old or the new version.
+static void save_answers(const AiFaq *faq) {
+    if (faq->answers_path[0] == '\0') return;
+    char tmp_path[sizeof(faq->answers_path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", faq->answers_path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        app_log("AI_FAQ", "WARN", "Cannot write %s: %s", tmp_path, strerror(errno));
+        return;
+    }
+    for (size_t i = 0; i < faq->num_entries; ++i) {
+        const AiFaqEntry *entry = &faq->entries[i];
+        if (entry->fixed || entry->answer == NULL) continue;
+        fprintf(fp, "%lld\t%s\t%s\n", (long long)entry->generated_at, entry->key, entry->answer);
+    }
+    if (fclose(fp) != 0 || rename(tmp_path, faq->answers_path) != 0) {
+        app_log("AI_FAQ", "WARN", "Cannot save %s: %s", faq->answers_path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+static int load(AiFaq *faq) {
+    struct stat st;
+    if (stat(faq->path, &st) != 0) {
+        faq->mtime = 0;
+        return 0; // No FAQ for this channel
+    }
+    faq->mtime = st.st_mtime;
+    FILE *fp = fopen(faq->path, "r");
+    if (fp == NULL) {
+        app_log("AI_FAQ", "ERROR", "Cannot open %s: %s", faq->path, strerror(errno));
+        return -1;
+    }
+    char buffer[FAQ_LINE_MAX];
+    bool open_entry = false; // Questions and an answer still join the last entry
+    bool ok = true;
+    while (ok && fgets(buffer, sizeof(buffer), fp)) {
+        char *line = trim(buffer);
+        if (line[0] == '#') continue;
+        if (line[0] == '\0') {
+            open_entry = false;
+        } else if (strncasecmp(line, "Q:", 2) == 0) {
+            char *question = trim(line + 2);
+            if (!open_entry || faq->entries[faq->num_entries - 1].answer) {
+                ok = add_entry(faq, question);
+                open_entry = ok;
+            }
+            if (ok) ok = add_question(faq, faq->num_entries - 1, question);
+        } else if (strncasecmp(line, "A:", 2) == 0 && open_entry && faq->entries[faq->num_entries - 1].answer == NULL) {
+            AiFaqEntry *entry = &faq->entries[faq->num_entries - 1];
+            entry->answer = strdup(trim(line + 2));
+            entry->fixed = true;
+            ok = entry->answer != NULL;
+        } else {
+            app_log("AI_FAQ", "WARN", "Ignoring line in %s: '%s'", faq->path, line);
+        }
+    }
+    fclose(fp);
+    if (ok && faq->num_questions > 0) {
+        faq->shared = (uint32_t *)calloc(faq->num_questions, sizeof(uint32_t));
+        ok = faq->shared != NULL;
+    }
+    if (!ok) {
+        app_log("AI_FAQ", "ERROR", "Out of memory loading %s.", faq->path);
+        free_contents(faq);
+        return -1;
+    }
+    qsort(faq->postings, faq->num_postings, sizeof(AiFaqPosting), compare_postings);
+    load_answers(faq);
+    return 0;
+}
+
+int ai_faq_open(AiFaq *faq, const char *path, const char *answers_path) {
+    memset(faq, 0, sizeof(*faq));
+    snprintf(faq->path, sizeof(faq->path), "%s", path);
+    if (answers_path) snprintf(faq->answers_path, sizeof(faq->answers_path), "%s", answers_path);
+    return load(faq);
+}
+
+bool ai_faq_reload_if_changed(AiFaq *faq) {
+    struct stat st;
+    time_t mtime = stat(faq->path, &st) == 0 ? st.st_mtime : 0;
+    if (mtime == faq->mtime) return false;
+    free_contents(faq);
+    load(faq);
+    return true;
+}
+
+int ai_faq_match(AiFaq *faq, const char *prompt, double threshold, double *similarity_out) {
+    if (similarity_out) *similarity_out = 0;
+    if (faq->num_questions == 0) return -1;
+    char normalized[FAQ_LINE_MAX];
+    uint32_t trigrams[FAQ_MAX_TRIGRAMS];
+    normalize(prompt, normalized, sizeof(normalized));
+    size_t count = trigrams_of(normalized, trigrams, FAQ_MAX_TRIGRAMS);
+    if (count == 0) return -1;
+
+    memset(faq->shared, 0, faq->num_questions * sizeof(uint32_t));
+    for (size_t i = 0; i < count; ++i) {
+        size_t lo = 0, hi = faq->num_postings; // First posting of this trigram
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (faq->postings[mid].trigram < trigrams[i]) lo = mid + 1;
+            else hi = mid;
+        }
+        for (; lo < faq->num_postings && faq->postings[lo].trigram == trigrams[i]; ++lo) faq->shared[faq->postings[lo].question]++;
+    }
+
+    int best = -1;
+    double best_similarity = 0;
+    for (size_t q = 0; q < faq->num_questions; ++q) {
+        if (faq->shared[q] == 0) continue;
+        double similarity = 2.0 * faq->shared[q] / (double)(count + faq->question_trigrams[q]);
+        if (similarity > best_similarity) {
+            best_similarity = similarity;
+            best = (int)faq->question_entry[q];
+        }
+    }
+    if (similarity_out) *similarity_out = best_similarity;
+    return best_similarity >= threshold ? best : -1;
+}
+
+int ai_faq_next_stale(const AiFaq *faq, time_t now, long refresh_seconds) {
+    int stale = -1;
+    for (size_t i = 0; i < faq->num_entries; ++i) {
+        const AiFaqEntry *entry = &faq->entries[i];
+        if (entry->fixed || entry->next_try > now) continue;
+        if (entry->answer == NULL) return (int)i; // Unanswered entries go first
+        if (now - entry->generated_at >= refresh_seconds &&
+            (stale < 0 || entry->generated_at < faq->entries[stale].generated_at)) stale = (int)i;
+    }
+    return stale;
+}
+
+void ai_faq_set_answer(AiFaq *faq, int entry, const char *answer, time_t now) {
+    char *copy = strdup(answer);
+    if (copy == NULL) return;
+    for (char *p = copy; *p; ++p) {
+        if (*p == '\n' || *p == '\r' || *p == '\t') *p = ' '; // One IRC line, one side file line
+    }
+    free(faq->entries[entry].answer);
+    faq->entries[entry].answer = copy;
+    faq->entries[entry].generated_at = now;
+    save_answers(faq);
+}
+
+void ai_faq_cleanup(AiFaq *faq) {
+    free_contents(faq);
+}
@@ -0,0 +1,62 @@
+#ifndef AI_FAQ_H
+#define AI_FAQ_H
+
+#include "irc_bot.h"
+#include <time.h>
+
+// --- Channel FAQ ---
+// Questions from a channel's FAQ file, indexed by the character trigrams of
+// their normalized text so an !ask can be matched against all of them with a
+// few binary searches. An entry's answer is either written in the file or,
+// when the file leaves it out, generated by the worker while it is idle and
+// regenerated once it is older than the refresh period. Generated answers are
+// kept in a side file so they survive restarts and edits of the FAQ file.
+//
+// File format: entries are separated by blank lines; each has one or more
+// "Q: ..." lines (ways of asking the same thing) and at most one "A: ..."
+// line. Lines starting with '#' are comments.
+
+typedef struct {
+    char *question; // The entry's first question as written, used to generate its answer
+    char *key; // Normalized first question, names the entry in the side file
+    char *answer; // NULL until generated
+    bool fixed; // Answer written in the FAQ file; never regenerated
+    time_t generated_at;
+    time_t next_try; // A failed generation is not retried before this
+} AiFaqEntry;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t question;
+} AiFaqPosting;
+
+typedef struct {
+    char path[256];
+    char answers_path[256]; // Side file of generated answers, "" for none
+    time_t mtime; // Of the FAQ file when it was loaded, 0 if there was none
+    AiFaqEntry *entries;
+    size_t num_entries;
+    size_t *question_entry; // Entry of each indexed question
+    uint32_t *question_trigrams; // Number of distinct trigrams in each indexed question
+    size_t num_questions;
+    AiFaqPosting *postings; // Sorted by trigram
+    size_t num_postings;
+    uint32_t *shared; // Match scratch: trigrams each question shares with the prompt
+} AiFaq;
+
+// Loads the FAQ at path; a missing file is an empty FAQ. answers_path may be
+// NULL. Returns 0, or -1 if the file could not be read.
+int ai_faq_open(AiFaq *faq, const char *path, const char *answers_path);
+// Reloads the FAQ if its file changed since it was loaded. Returns true if it did.
+bool ai_faq_reload_if_changed(AiFaq *faq);
+// Returns the entry whose question best matches prompt, if its trigram (Dice)
+// similarity reaches threshold, or -1. The entry may have no answer yet.
+int ai_faq_match(AiFaq *faq, const char *prompt, double threshold, double *similarity_out);
+// Returns the entry most in need of a generated answer (none yet, or one
+// older than refresh_seconds), or -1 if none is due.
+int ai_faq_next_stale(const AiFaq *faq, time_t now, long refresh_seconds);
+// Stores a generated answer and saves the side file.
+void ai_faq_set_answer(AiFaq *faq, int entry, const char *answer, time_t now);
+void ai_faq_cleanup(AiFaq *faq);
+
+#endif // AI_FAQ_H
@@ -0,0 +1,181 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_cache.h"
+#include "ai_flight.h"
+
+typedef enum {
+    FLIGHT_EMPTY = 0,
+    FLIGHT_PENDING,
+    FLIGHT_DONE,
+    FLIGHT_FAILED
+} FlightState;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t generation; // Bumped on every claim so stale tickets can be detected
+    int32_t state;
+    int32_t owner_worker;
+    pid_t owner_pid;
+    uint64_t request_id;
+    int64_t updated_at;
+    uint32_t followers;
+    char key[AI_FLIGHT_KEY_MAX]; // persona + '\x1f' + normalized prompt
+    char response[AI_FLIGHT_RESPONSE_MAX];
+} AiFlightSlot;
+
+typedef struct {
+    sem_t lock;
+    AiFlightSlot slots[AI_FLIGHT_SLOTS];
+} AiFlightTable;
+
+static AiFlightTable *g_flights = NULL;
+
+static bool flight_lock(void) {
+    while (sem_wait(&g_flights->lock) == -1) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+static void flight_unlock(void) {
+    sem_post(&g_flights->lock);
+}
+
+int ai_flight_init(void) {
+    char parent_tag[32];
+    snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
+    g_flights = (AiFlightTable *)mmap(NULL, sizeof(AiFlightTable), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_flights == MAP_FAILED) {
+        app_log(parent_tag, "ERROR", "mmap for the in-flight request table failed: %s", strerror(errno));
+        g_flights = NULL;
+        return EXIT_FAILURE;
+    }
+    memset(g_flights, 0, sizeof(AiFlightTable));
+    if (sem_init(&g_flights->lock, 1, 1) == -1) {
+        app_log(parent_tag, "ERROR", "sem_init for the in-flight request table failed: %s", strerror(errno));
+        munmap(g_flights, sizeof(AiFlightTable));
+        g_flights = NULL;
+        return EXIT_FAILURE;
+    }
+    app_log(parent_tag, "INFO", "In-flight request table initialized (%d slots).", AI_FLIGHT_SLOTS);
+    return EXIT_SUCCESS;
+}
+
+void ai_flight_cleanup(void) {
+    if (g_flights == NULL) return;
+    sem_destroy(&g_flights->lock);
+    munmap(g_flights, sizeof(AiFlightTable));
+    g_flights = NULL;
+}
+
+static bool build_flight_key(const char *persona, const char *prompt, char *key, size_t key_size, uint64_t *hash_out) {
+    char normalized[MAX_PIPE_MSG_LEN];
+    ai_normalize_prompt(prompt, normalized, sizeof(normalized));
+    int len = snprintf(key, key_size, "%s\x1f%s", persona, normalized);
+    if (len < 0 || (size_t)len >= key_size) return false; // Too long to compare reliably
+    *hash_out = ai_hash64(key, (size_t)len, 0);
+    return true;
+}
+
+// A pending entry whose owner exited or has been silent for too long will never complete.
+static bool owner_gone(const AiFlightSlot *slot, time_t now) {
+    if (now - slot->updated_at > AI_FLIGHT_STALE_SECONDS) return true;
+    return kill(slot->owner_pid, 0) == -1 && errno == ESRCH;
+}
+
+static bool slot_reusable(const AiFlightSlot *slot, time_t now) {
+    switch (slot->state) {
+    case FLIGHT_EMPTY:
+        return true;
+    case FLIGHT_PENDING:
+        return owner_gone(slot, now);
+    default:
+        return now - slot->updated_at > AI_FLIGHT_LINGER_SECONDS;
+    }
+}
+
+AiFlightRole ai_flight_claim(const char *persona, const char *prompt, int worker_id, unsigned long request_id, AiFlightTicket *ticket) {
+    if (g_flights == NULL) return AI_FLIGHT_UNAVAILABLE;
+    char key[AI_FLIGHT_KEY_MAX];
+    uint64_t hash;
+    if (!build_flight_key(persona, prompt, key, sizeof(key), &hash)) return AI_FLIGHT_UNAVAILABLE;
+    if (!flight_lock()) return AI_FLIGHT_UNAVAILABLE;
+
+    // The table is small, so every slot is checked rather than keeping probe chains intact.
+    time_t now = time(NULL);
+    AiFlightSlot *free_slot = NULL;
+    for (int i = 0; i < AI_FLIGHT_SLOTS; ++i) {
+        AiFlightSlot *slot = &g_flights->slots[(hash + (uint64_t)i) % AI_FLIGHT_SLOTS];
+        if (slot_reusable(slot, now)) {
+            if (free_slot == NULL) free_slot = slot;
+            continue;
+        }
+        if (slot->hash != hash || strcmp(slot->key, key) != 0) continue;
+        if (slot->state == FLIGHT_FAILED) continue; // Let this caller retry with a fresh entry
+        // Pending, or finished recently enough that late arrivals can still share it.
+        slot->followers++;
+        ticket->slot = (int)(slot - g_flights->slots);
+        ticket->generation = slot->generation;
+        flight_unlock();
+        return AI_FLIGHT_FOLLOWER;
+    }
+    if (free_slot == NULL) {
+        flight_unlock();
+        return AI_FLIGHT_UNAVAILABLE;
+    }
+    free_slot->hash = hash;
+    free_slot->generation++;
+    free_slot->state = FLIGHT_PENDING;
+    free_slot->owner_worker = worker_id;
+    free_slot->owner_pid = getpid();
+    free_slot->request_id = request_id;
+    free_slot->updated_at = now;
+    free_slot->followers = 0;
+    memcpy(free_slot->key, key, sizeof(key));
+    free_slot->response[0] = '\0';
+    ticket->slot = (int)(free_slot - g_flights->slots);
+    ticket->generation = free_slot->generation;
+    flight_unlock();
+    return AI_FLIGHT_LEADER;
+}
+
+void ai_flight_complete(const AiFlightTicket *ticket, const char *response) {
+    if (g_flights == NULL || !flight_lock()) return;
+    AiFlightSlot *slot = &g_flights->slots[ticket->slot];
+    if (slot->generation == ticket->generation && slot->state == FLIGHT_PENDING) {
+        // Answers that don't fit are not truncated; followers send their own request instead.
+        if (response && strlen(response) < sizeof(slot->response)) {
+            strcpy(slot->response, response);
+            slot->state = FLIGHT_DONE;
+        } else {
+            slot->state = FLIGHT_FAILED;
+        }
+        slot->updated_at = time(NULL);
+    }
+    flight_unlock();
+}
+
+AiFlightStatus ai_flight_poll(const AiFlightTicket *ticket, char **response_out) {
+    *response_out = NULL;
+    if (g_flights == NULL || !flight_lock()) return AI_FLIGHT_ABANDONED;
+    AiFlightSlot *slot = &g_flights->slots[ticket->slot];
+    AiFlightStatus status = AI_FLIGHT_ABANDONED;
+    if (slot->generation == ticket->generation) {
+        if (slot->state == FLIGHT_DONE) {
+            *response_out = strdup(slot->response);
+            if (*response_out) status = AI_FLIGHT_READY;
+        } else if (slot->state == FLIGHT_PENDING) {
+            if (owner_gone(slot, time(NULL))) {
+                slot->state = FLIGHT_FAILED;
+                slot->updated_at = time(NULL);
+            } else {
+                status = AI_FLIGHT_WAITING;
+            }
+        }
+    }
+    flight_unlock();
+    return status;
+}
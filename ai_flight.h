@@ -0,0 +1,41 @@
+#ifndef AI_FLIGHT_H
+#define AI_FLIGHT_H
+
+#include "irc_bot.h"
+#include <stdint.h>
+
+// --- Single-flight coalescing across workers ---
+// The parent maps a small table in shared memory before forking. Each pending
+// Gemini request is recorded there under its (persona, normalized prompt) key
+// together with the owning worker and request id. A worker that gets the same
+// question while it is pending attaches to the entry instead of sending its own
+// request, and picks up the answer once the owner publishes it.
+
+typedef enum {
+    AI_FLIGHT_LEADER,     // No matching request pending: caller sends it and must complete the ticket
+    AI_FLIGHT_FOLLOWER,   // Attached to another request: poll the ticket for the answer
+    AI_FLIGHT_UNAVAILABLE // Table missing or full: send the request without coalescing
+} AiFlightRole;
+
+typedef enum {
+    AI_FLIGHT_WAITING,
+    AI_FLIGHT_READY,
+    AI_FLIGHT_ABANDONED // The owner failed or went away; send the request yourself
+} AiFlightStatus;
+
+typedef struct {
+    int slot;
+    uint32_t generation;
+} AiFlightTicket;
+
+// Called by the parent before forking. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int ai_flight_init(void);
+void ai_flight_cleanup(void);
+
+AiFlightRole ai_flight_claim(const char *persona, const char *prompt, int worker_id, unsigned long request_id, AiFlightTicket *ticket);
+// Publishes the leader's answer; NULL marks the request as failed.
+void ai_flight_complete(const AiFlightTicket *ticket, const char *response);
+// On AI_FLIGHT_READY, *response_out is a malloc'd copy of the answer.
+AiFlightStatus ai_flight_poll(const AiFlightTicket *ticket, char **response_out);
+
+#endif // AI_FLIGHT_H
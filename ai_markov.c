@@ -0,0 +1,317 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_cache.h"
+#include "ai_markov.h"
+#include <sys/stat.h>
+
+#define AI_MARKOV_MAGIC 0x314b524du // "MRK1"
+#define MARKOV_WORD_MAX 24 // Longer words (URLs and such) are not learnt
+#define MARKOV_PROBES 8
+#define MARKOV_MAX_TOKENS 64 // Words learnt per message
+
+// Word hashes below 4 are reserved for these markers.
+#define MARKOV_EMPTY 0u
+#define MARKOV_START 1u // Before the first word of a message
+#define MARKOV_END 2u // After the last one
+#define MARKOV_ANY 3u // First key of a single-word context
+
+struct AiMarkovHeader {
+    uint32_t magic;
+    uint32_t word_slots;
+    uint32_t context_slots;
+    uint32_t followers;
+    uint64_t messages;
+    uint32_t clock; // Bumped per message; a word's last_seen dates it
+    uint32_t reserved;
+};
+
+struct AiMarkovWord {
+    uint32_t hash; // Of the lowercased word, MARKOV_EMPTY if unused
+    uint32_t last_seen;
+    char text[MARKOV_WORD_MAX];
+};
+
+// Followers are word hashes, so a recycled word slot never makes a context
+// point at the wrong word; such a follower is just skipped.
+struct AiMarkovContext {
+    uint32_t first; // MARKOV_ANY for a single-word context
+    uint32_t second;
+    uint32_t next[AI_MARKOV_FOLLOWERS];
+    uint16_t count[AI_MARKOV_FOLLOWERS];
+};
+
+static size_t map_size_for_tables(void) {
+    return sizeof(AiMarkovHeader) + AI_MARKOV_WORD_SLOTS * sizeof(AiMarkovWord) +
+           AI_MARKOV_CONTEXT_SLOTS * sizeof(AiMarkovContext);
+}
+
+static bool header_matches(const AiMarkovHeader *header) {
+    return header->magic == AI_MARKOV_MAGIC && header->word_slots == AI_MARKOV_WORD_SLOTS &&
+           header->context_slots == AI_MARKOV_CONTEXT_SLOTS && header->followers == AI_MARKOV_FOLLOWERS;
+}
+
+static void *map_file(const char *path, size_t map_size) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        app_log("AI_Markov", "WARN", "Cannot open offline model '%s': %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    bool resize = (fstat(fd, &st) == 0 && (size_t)st.st_size != map_size);
+    if (resize && (ftruncate(fd, 0) == -1 || ftruncate(fd, (off_t)map_size) == -1)) {
+        app_log("AI_Markov", "WARN", "Cannot size offline model '%s': %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        app_log("AI_Markov", "WARN", "mmap of offline model '%s' failed: %s", path, strerror(errno));
+        return NULL;
+    }
+    return map;
+}
+
+int ai_markov_open(AiMarkov *model, const char *path) {
+    memset(model, 0, sizeof(*model));
+    size_t map_size = map_size_for_tables();
+    void *map = path ? map_file(path, map_size) : NULL;
+    if (map == NULL) {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            app_log("AI_Markov", "ERROR", "mmap for the offline model failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    AiMarkovHeader *header = (AiMarkovHeader *)map;
+    if (!header_matches(header)) {
+        memset(map, 0, map_size);
+        header->magic = AI_MARKOV_MAGIC;
+        header->word_slots = AI_MARKOV_WORD_SLOTS;
+        header->context_slots = AI_MARKOV_CONTEXT_SLOTS;
+        header->followers = AI_MARKOV_FOLLOWERS;
+    }
+    model->header = header;
+    model->words = (AiMarkovWord *)((char *)map + sizeof(AiMarkovHeader));
+    model->contexts = (AiMarkovContext *)(model->words + AI_MARKOV_WORD_SLOTS);
+    model->map_size = map_size;
+    model->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    return 0;
+}
+
+void ai_markov_close(AiMarkov *model) {
+    if (model->header == NULL) return;
+    msync(model->header, model->map_size, MS_ASYNC);
+    munmap(model->header, model->map_size);
+    model->header = NULL;
+}
+
+unsigned long ai_markov_messages(const AiMarkov *model) {
+    return model->header ? (unsigned long)model->header->messages : 0;
+}
+
+static uint32_t word_hash(const char *word, size_t len) {
+    char lowered[MARKOV_WORD_MAX];
+    for (size_t i = 0; i < len; ++i) lowered[i] = (char)tolower((unsigned char)word[i]);
+    uint32_t hash = (uint32_t)ai_hash64(lowered, len, 0);
+    return hash <= MARKOV_ANY ? hash + MARKOV_ANY + 1 : hash;
+}
+
+static AiMarkovWord *find_word(const AiMarkov *model, uint32_t hash) {
+    for (int probe = 0; probe < MARKOV_PROBES; ++probe) {
+        AiMarkovWord *slot = &model->words[(hash + (uint32_t)probe) % AI_MARKOV_WORD_SLOTS];
+        if (slot->hash == hash) return slot;
+        if (slot->hash == MARKOV_EMPTY) return NULL;
+    }
+    return NULL;
+}
+
+// Records a sighting of word, taking the least recently seen slot near its
+// home position if it is new.
+static uint32_t intern_word(AiMarkov *model, const char *word, size_t len) {
+    uint32_t hash = word_hash(word, len);
+    AiMarkovWord *victim = NULL;
+    for (int probe = 0; probe < MARKOV_PROBES; ++probe) {
+        AiMarkovWord *slot = &model->words[(hash + (uint32_t)probe) % AI_MARKOV_WORD_SLOTS];
+        if (slot->hash == hash) {
+            slot->last_seen = model->header->clock;
+            return hash;
+        }
+        if (slot->hash == MARKOV_EMPTY) {
+            victim = slot;
+            break;
+        }
+        if (victim == NULL || slot->last_seen < victim->last_seen) victim = slot;
+    }
+    victim->hash = hash;
+    victim->last_seen = model->header->clock;
+    memcpy(victim->text, word, len);
+    victim->text[len] = '\0';
+    return hash;
+}
+
+static uint32_t context_home(uint32_t first, uint32_t second) {
+    uint32_t key[2] = { first, second };
+    return (uint32_t)(ai_hash64(key, sizeof(key), 0) % AI_MARKOV_CONTEXT_SLOTS);
+}
+
+static unsigned long context_weight(const AiMarkovContext *context) {
+    unsigned long total = 0;
+    for (int i = 0; i < AI_MARKOV_FOLLOWERS; ++i) total += context->count[i];
+    return total;
+}
+
+static AiMarkovContext *find_context(const AiMarkov *model, uint32_t first, uint32_t second) {
+    uint32_t home = context_home(first, second);
+    for (int probe = 0; probe < MARKOV_PROBES; ++probe) {
+        AiMarkovContext *slot = &model->contexts[(home + (uint32_t)probe) % AI_MARKOV_CONTEXT_SLOTS];
+        if (slot->first == first && slot->second == second) return slot;
+        if (slot->first == MARKOV_EMPTY) return NULL;
+    }
+    return NULL;
+}
+
+static void add_transition(AiMarkov *model, uint32_t first, uint32_t second, uint32_t next) {
+    uint32_t home = context_home(first, second);
+    AiMarkovContext *context = NULL;
+    AiMarkovContext *victim = NULL;
+    for (int probe = 0; probe < MARKOV_PROBES; ++probe) {
+        AiMarkovContext *slot = &model->contexts[(home + (uint32_t)probe) % AI_MARKOV_CONTEXT_SLOTS];
+        if (slot->first == first && slot->second == second) {
+            context = slot;
+            break;
+        }
+        if (slot->first == MARKOV_EMPTY) {
+            victim = slot;
+            break;
+        }
+        if (victim == NULL || context_weight(slot) < context_weight(victim)) victim = slot;
+    }
+    if (context == NULL) {
+        context = victim; // The lightest context nearby makes room
+        memset(context, 0, sizeof(*context));
+        context->first = first;
+        context->second = second;
+    }
+
+    int weakest = 0;
+    for (int i = 0; i < AI_MARKOV_FOLLOWERS; ++i) {
+        if (context->count[i] > 0 && context->next[i] == next) {
+            if (context->count[i] == UINT16_MAX) {
+                for (int j = 0; j < AI_MARKOV_FOLLOWERS; ++j) context->count[j] = (uint16_t)((context->count[j] + 1) / 2);
+            }
+            context->count[i]++;
+            return;
+        }
+        if (context->count[i] < context->count[weakest]) weakest = i;
+    }
+    context->next[weakest] = next; // An empty slot, or the rarest follower gives way
+    context->count[weakest] = 1;
+}
+
+// Splits text at whitespace into at most max words, skipping overlong ones.
+static int split_words(const char *text, const char **starts, size_t *lens, int max) {
+    int count = 0;
+    const char *p = text;
+    while (*p && count < max) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        const char *start = p;
+        while (*p && !isspace((unsigned char)*p)) p++;
+        size_t len = (size_t)(p - start);
+        if (len > 0 && len < MARKOV_WORD_MAX) {
+            starts[count] = start;
+            lens[count] = len;
+            count++;
+        }
+    }
+    return count;
+}
+
+void ai_markov_learn(AiMarkov *model, const char *text) {
+    if (model->header == NULL) return;
+    const char *starts[MARKOV_MAX_TOKENS];
+    size_t lens[MARKOV_MAX_TOKENS];
+    int count = split_words(text, starts, lens, MARKOV_MAX_TOKENS);
+    if (count == 0) return;
+
+    model->header->clock++;
+    uint32_t before = MARKOV_START, last = MARKOV_START;
+    for (int i = 0; i <= count; ++i) {
+        uint32_t word = i < count ? intern_word(model, starts[i], lens[i]) : MARKOV_END;
+        add_transition(model, before, last, word);
+        if (last != MARKOV_START) add_transition(model, MARKOV_ANY, last, word);
+        before = last;
+        last = word;
+    }
+    model->header->messages++;
+}
+
+// Picks a follower in proportion to its count, skipping words that have
+// since been recycled. Returns MARKOV_EMPTY if there is none.
+static uint32_t pick_follower(AiMarkov *model, const AiMarkovContext *context) {
+    if (context == NULL) return MARKOV_EMPTY;
+    unsigned long total = 0;
+    bool usable[AI_MARKOV_FOLLOWERS];
+    for (int i = 0; i < AI_MARKOV_FOLLOWERS; ++i) {
+        usable[i] = context->count[i] > 0 && (context->next[i] == MARKOV_END || find_word(model, context->next[i]) != NULL);
+        if (usable[i]) total += context->count[i];
+    }
+    if (total == 0) return MARKOV_EMPTY;
+    unsigned long roll = (unsigned long)rand_r(&model->seed) % total;
+    for (int i = 0; i < AI_MARKOV_FOLLOWERS; ++i) {
+        if (!usable[i]) continue;
+        if (roll < context->count[i]) return context->next[i];
+        roll -= context->count[i];
+    }
+    return MARKOV_EMPTY;
+}
+
+static bool append_word(char *out, size_t out_size, size_t *len, const char *word) {
+    size_t word_len = strlen(word);
+    if (*len + word_len + 2 > out_size) return false;
+    if (*len > 0) out[(*len)++] = ' ';
+    memcpy(out + *len, word, word_len + 1);
+    *len += word_len;
+    return true;
+}
+
+bool ai_markov_reply(AiMarkov *model, const char *prompt, char *out, size_t out_size) {
+    if (model->header == NULL || out_size == 0) return false;
+    out[0] = '\0';
+
+    // Start from a random word of the question that the model has seen followed by something
+    const char *starts[MARKOV_MAX_TOKENS];
+    size_t lens[MARKOV_MAX_TOKENS];
+    uint32_t known[MARKOV_MAX_TOKENS];
+    int num_known = 0;
+    int count = split_words(prompt, starts, lens, MARKOV_MAX_TOKENS);
+    for (int i = 0; i < count; ++i) {
+        if (lens[i] < 4) continue; // Skip little words, which say little about the topic
+        uint32_t hash = word_hash(starts[i], lens[i]);
+        if (find_word(model, hash) && find_context(model, MARKOV_ANY, hash)) known[num_known++] = hash;
+    }
+
+    uint32_t before = MARKOV_START, last = MARKOV_START;
+    size_t len = 0;
+    int words = 0;
+    if (num_known > 0) {
+        last = known[rand_r(&model->seed) % num_known];
+        before = MARKOV_ANY;
+        append_word(out, out_size, &len, find_word(model, last)->text);
+        words++;
+    }
+    while (words < AI_MARKOV_MAX_REPLY_WORDS) {
+        // The two-word context first, backing off to the last word alone
+        uint32_t next = pick_follower(model, find_context(model, before, last));
+        if (next == MARKOV_EMPTY && last != MARKOV_START) next = pick_follower(model, find_context(model, MARKOV_ANY, last));
+        if (next == MARKOV_EMPTY || next == MARKOV_END) break;
+        if (!append_word(out, out_size, &len, find_word(model, next)->text)) break;
+        words++;
+        before = last;
+        last = next;
+    }
+    return words >= 2;
+}
@@ -0,0 +1,39 @@
+#ifndef AI_MARKOV_H
+#define AI_MARKOV_H
+
+#include "irc_bot.h"
+
+// --- Offline fallback model ---
+// A word-level Markov chain learnt from a channel's own messages, used to
+// answer when the AI backend is missing or down. Each context (the previous
+// two words, and the previous word alone for backing off) keeps its most
+// frequent followers with counts. Words and contexts live in fixed-size
+// open-addressed tables, memory-mapped from a file so the model survives
+// restarts; when a table is full the least used entries near the home slot
+// are recycled, so memory per channel never grows. Answers start from a word
+// of the question the model knows and take microseconds, with no network.
+
+typedef struct AiMarkovHeader AiMarkovHeader;
+typedef struct AiMarkovWord AiMarkovWord;
+typedef struct AiMarkovContext AiMarkovContext;
+
+typedef struct {
+    AiMarkovHeader *header; // NULL when the model could not be set up
+    AiMarkovWord *words;
+    AiMarkovContext *contexts;
+    size_t map_size;
+    unsigned int seed; // For picking followers
+} AiMarkov;
+
+// Maps the model from path, creating or resetting it if needed, or keeps it
+// in memory only when path is NULL or cannot be used. Returns 0 or -1.
+int ai_markov_open(AiMarkov *model, const char *path);
+// Learns one channel message.
+void ai_markov_learn(AiMarkov *model, const char *text);
+// Writes a reply to prompt into out. Returns false if the model knows too little.
+bool ai_markov_reply(AiMarkov *model, const char *prompt, char *out, size_t out_size);
+// Messages learnt since the model was created.
+unsigned long ai_markov_messages(const AiMarkov *model);
+void ai_markov_close(AiMarkov *model);
+
+#endif // AI_MARKOV_H
@@ -0,0 +1,100 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_memory.h"
+#include <strings.h>
+
+#define AI_MEMORY_TURN_OVERHEAD_TOKENS 4 // Role and framing per history entry
+
+int ai_estimate_tokens(size_t text_len) {
+    return (int)((text_len + 3) / 4);
+}
+
+int ai_memory_init(AiMemory *mem, size_t arena_size) {
+    memset(mem, 0, sizeof(*mem));
+    mem->arena = (char *)malloc(arena_size);
+    if (mem->arena == NULL) {
+        app_log("AI_Memory", "ERROR", "Failed to allocate %zu byte history arena: %s", arena_size, strerror(errno));
+        return -1;
+    }
+    mem->arena_size = arena_size;
+    return 0;
+}
+
+static void evict_oldest(AiMemory *mem) {
+    mem->first = (mem->first + 1) % AI_MEMORY_MAX_TURNS;
+    mem->count--;
+    if (mem->count == 0) mem->head = mem->tail = 0;
+    else mem->tail = mem->turns[mem->first].offset;
+}
+
+// Finds room for len contiguous bytes, evicting the oldest turns as needed.
+// Live turns occupy [tail, head), or [tail, end) plus [0, head) once wrapped.
+static size_t reserve_bytes(AiMemory *mem, size_t len) {
+    if (mem->count == AI_MEMORY_MAX_TURNS) evict_oldest(mem);
+    for (;;) {
+        if (mem->count == 0) return 0;
+        if (mem->head > mem->tail) {
+            if (mem->arena_size - mem->head >= len) return mem->head;
+            if (mem->tail >= len) return 0; // Wrap to the start
+        } else if (mem->tail - mem->head >= len) {
+            return mem->head;
+        }
+        evict_oldest(mem);
+    }
+}
+
+void ai_memory_add(AiMemory *mem, const char *nick, bool from_model, const char *text) {
+    if (mem->arena == NULL) return;
+    size_t nick_len = strnlen(nick, MAX_NICK_LEN - 1);
+    size_t text_len = strnlen(text, AI_MEMORY_TURN_MAX_CHARS);
+    size_t len = nick_len + text_len + 2;
+    if (len > mem->arena_size) return;
+
+    size_t offset = reserve_bytes(mem, len);
+    char *dest = mem->arena + offset;
+    memcpy(dest, nick, nick_len);
+    dest[nick_len] = '\0';
+    memcpy(dest + nick_len + 1, text, text_len);
+    dest[nick_len + 1 + text_len] = '\0';
+    mem->head = offset + len;
+    if (mem->count == 0) mem->tail = offset;
+
+    AiMemoryTurn *turn = &mem->turns[(mem->first + mem->count) % AI_MEMORY_MAX_TURNS];
+    turn->offset = (uint32_t)offset;
+    turn->nick_len = (uint16_t)nick_len;
+    turn->text_len = (uint16_t)text_len;
+    turn->from_model = from_model;
+    turn->at = time(NULL);
+    mem->count++;
+}
+
+int ai_memory_window(const AiMemory *mem, const char *nick, int token_budget, const AiMemoryTurn **out, int max_out) {
+    if (mem->arena == NULL || token_budget <= 0) return 0;
+    time_t oldest_allowed = time(NULL) - AI_MEMORY_MAX_AGE_SECONDS;
+    int selected = 0;
+    // Walk newest to oldest, then reverse so the window reads in conversation order.
+    for (int i = mem->count - 1; i >= 0 && selected < max_out; --i) {
+        const AiMemoryTurn *turn = &mem->turns[(mem->first + i) % AI_MEMORY_MAX_TURNS];
+        if (turn->at < oldest_allowed) break;
+        if (nick && !irc_nick_equal(ai_memory_turn_nick(mem, turn), nick)) continue;
+        int cost = ai_estimate_tokens(turn->nick_len + turn->text_len + 2) + AI_MEMORY_TURN_OVERHEAD_TOKENS;
+        if (cost > token_budget) break;
+        token_budget -= cost;
+        out[selected++] = turn;
+    }
+    for (int i = 0; i < selected / 2; ++i) {
+        const AiMemoryTurn *swap = out[i];
+        out[i] = out[selected - 1 - i];
+        out[selected - 1 - i] = swap;
+    }
+    return selected;
+}
+
+void ai_memory_cleanup(AiMemory *mem) {
+    free(mem->arena);
+    mem->arena = NULL;
+    mem->count = 0;
+}
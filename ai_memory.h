@@ -0,0 +1,47 @@
+#ifndef AI_MEMORY_H
+#define AI_MEMORY_H
+
+#include "irc_bot.h"
+#include <stdint.h>
+
+// --- Per-channel conversation memory ---
+// Recent !ask turns (each question and its answer) live in a fixed-size byte
+// arena used as a ring. A new turn overwrites the oldest ones once the arena
+// or the turn table is full, so nothing is allocated per turn. A request picks
+// the newest turns that fit its token budget and sends them as history.
+
+typedef struct {
+    uint32_t offset; // Into the arena: "nick\0text\0"
+    uint16_t nick_len;
+    uint16_t text_len;
+    bool from_model;
+    time_t at;
+} AiMemoryTurn;
+
+typedef struct {
+    char *arena;
+    size_t arena_size;
+    size_t head; // Next write position
+    size_t tail; // Offset of the oldest live turn
+    AiMemoryTurn turns[AI_MEMORY_MAX_TURNS];
+    int first; // Index of the oldest turn in turns[]
+    int count;
+} AiMemory;
+
+int ai_memory_init(AiMemory *mem, size_t arena_size);
+// text is cut to AI_MEMORY_TURN_MAX_CHARS.
+void ai_memory_add(AiMemory *mem, const char *nick, bool from_model, const char *text);
+// Fills out[] with the newest unexpired turns (only nick's when nick is not
+// NULL) whose estimated size fits token_budget, oldest first. Returns the count.
+int ai_memory_window(const AiMemory *mem, const char *nick, int token_budget, const AiMemoryTurn **out, int max_out);
+static inline const char *ai_memory_turn_nick(const AiMemory *mem, const AiMemoryTurn *turn) {
+    return mem->arena + turn->offset;
+}
+static inline const char *ai_memory_turn_text(const AiMemory *mem, const AiMemoryTurn *turn) {
+    return mem->arena + turn->offset + turn->nick_len + 1;
+}
+// Rough token count (about four bytes per token), good enough for budgeting.
+int ai_estimate_tokens(size_t text_len);
+void ai_memory_cleanup(AiMemory *mem);
+
+#endif // AI_MEMORY_H
@@ -0,0 +1,203 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_quota.h"
+
+#define QUOTA_NICK_PROBES 8 // Slots searched for a nick before one is recycled
+
+// Holds up to one minute's allowance and refills continuously.
+typedef struct {
+    double level;
+    int64_t updated_ms;
+} QuotaBucket;
+
+typedef struct {
+    uint64_t hash;
+    char nick[MAX_NICK_LEN]; // Lowercased
+    QuotaBucket requests;
+} QuotaNickSlot;
+
+typedef struct {
+    sem_t lock;
+    QuotaBucket requests;
+    QuotaBucket tokens;
+    unsigned long granted;
+    unsigned long deferred;
+    unsigned long rejected;
+    QuotaNickSlot nicks[AI_QUOTA_NICK_SLOTS];
+    int num_channels;
+    QuotaBucket channels[]; // One per worker
+} AiQuotaTable;
+
+static AiQuotaTable *g_quota = NULL;
+static size_t g_quota_size = 0;
+
+static bool quota_lock(void) {
+    while (sem_wait(&g_quota->lock) == -1) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+static void quota_unlock(void) {
+    sem_post(&g_quota->lock);
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void bucket_fill(QuotaBucket *bucket, double per_minute, int64_t now) {
+    bucket->level = per_minute;
+    bucket->updated_ms = now;
+}
+
+static void bucket_refill(QuotaBucket *bucket, double per_minute, int64_t now) {
+    bucket->level += (double)(now - bucket->updated_ms) * per_minute / 60000.0;
+    if (bucket->level > per_minute) bucket->level = per_minute;
+    bucket->updated_ms = now;
+}
+
+// Milliseconds until the bucket holds cost, 0 if it already does.
+static long bucket_wait_ms(const QuotaBucket *bucket, double per_minute, double cost) {
+    if (cost > per_minute) cost = per_minute; // An oversized ask waits for a full bucket, not forever
+    if (bucket->level >= cost) return 0;
+    return (long)((cost - bucket->level) * 60000.0 / per_minute) + 1;
+}
+
+int ai_quota_init(int num_channels) {
+    char parent_tag[32];
+    snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
+    if (num_channels < 0) num_channels = 0;
+    g_quota_size = sizeof(AiQuotaTable) + (size_t)num_channels * sizeof(QuotaBucket);
+    g_quota = (AiQuotaTable *)mmap(NULL, g_quota_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_quota == MAP_FAILED) {
+        app_log(parent_tag, "ERROR", "mmap for the API quota table failed: %s", strerror(errno));
+        g_quota = NULL;
+        return EXIT_FAILURE;
+    }
+    memset(g_quota, 0, g_quota_size);
+    if (sem_init(&g_quota->lock, 1, 1) == -1) {
+        app_log(parent_tag, "ERROR", "sem_init for the API quota table failed: %s", strerror(errno));
+        munmap(g_quota, g_quota_size);
+        g_quota = NULL;
+        return EXIT_FAILURE;
+    }
+    int64_t now = monotonic_ms();
+    bucket_fill(&g_quota->requests, AI_QUOTA_REQUESTS_PER_MINUTE, now);
+    bucket_fill(&g_quota->tokens, AI_QUOTA_TOKENS_PER_MINUTE, now);
+    g_quota->num_channels = num_channels;
+    for (int i = 0; i < num_channels; ++i) bucket_fill(&g_quota->channels[i], AI_QUOTA_CHANNEL_REQUESTS_PER_MINUTE, now);
+    app_log(parent_tag, "INFO", "API quota initialized: %d requests/min, %d tokens/min, %d/min per channel, %d/min per nick.",
+            AI_QUOTA_REQUESTS_PER_MINUTE, AI_QUOTA_TOKENS_PER_MINUTE, AI_QUOTA_CHANNEL_REQUESTS_PER_MINUTE, AI_QUOTA_NICK_REQUESTS_PER_MINUTE);
+    return EXIT_SUCCESS;
+}
+
+void ai_quota_cleanup(void) {
+    if (g_quota == NULL) return;
+    sem_destroy(&g_quota->lock);
+    munmap(g_quota, g_quota_size);
+    g_quota = NULL;
+}
+
+// Finds the nick's bucket, or recycles the least recently used slot near its
+// home position for it. Caller holds the lock.
+static QuotaBucket *nick_bucket(const char *nick, int64_t now) {
+    char lowered[MAX_NICK_LEN];
+    uint64_t hash = irc_nick_fold(nick, lowered, sizeof(lowered));
+
+    QuotaNickSlot *victim = NULL;
+    for (int probe = 0; probe < QUOTA_NICK_PROBES; ++probe) {
+        QuotaNickSlot *slot = &g_quota->nicks[(hash + (uint64_t)probe) % AI_QUOTA_NICK_SLOTS];
+        if (slot->hash == hash && strcmp(slot->nick, lowered) == 0) return &slot->requests;
+        if (victim == NULL || slot->requests.updated_ms < victim->requests.updated_ms) victim = slot;
+    }
+    victim->hash = hash;
+    snprintf(victim->nick, sizeof(victim->nick), "%s", lowered);
+    bucket_fill(&victim->requests, AI_QUOTA_NICK_REQUESTS_PER_MINUTE, now);
+    return &victim->requests;
+}
+
+AiQuotaVerdict ai_quota_acquire(int channel, const char *nick, long tokens, long *wait_ms_out) {
+    *wait_ms_out = 0;
+    if (g_quota == NULL || !quota_lock()) return AI_QUOTA_GRANTED;
+
+    int64_t now = monotonic_ms();
+    bucket_refill(&g_quota->requests, AI_QUOTA_REQUESTS_PER_MINUTE, now);
+    bucket_refill(&g_quota->tokens, AI_QUOTA_TOKENS_PER_MINUTE, now);
+    QuotaBucket *channel_bucket = (channel >= 0 && channel < g_quota->num_channels) ? &g_quota->channels[channel] : NULL;
+    if (channel_bucket) bucket_refill(channel_bucket, AI_QUOTA_CHANNEL_REQUESTS_PER_MINUTE, now);
+    QuotaBucket *user_bucket = nick_bucket(nick, now);
+    bucket_refill(user_bucket, AI_QUOTA_NICK_REQUESTS_PER_MINUTE, now);
+
+    // The narrowest limit is reported, since that is the one the asker can do something about
+    AiQuotaVerdict verdict = AI_QUOTA_GRANTED;
+    long wait = bucket_wait_ms(user_bucket, AI_QUOTA_NICK_REQUESTS_PER_MINUTE, 1);
+    if (wait > 0) verdict = AI_QUOTA_NICK;
+    long channel_wait = channel_bucket ? bucket_wait_ms(channel_bucket, AI_QUOTA_CHANNEL_REQUESTS_PER_MINUTE, 1) : 0;
+    if (channel_wait > 0 && verdict == AI_QUOTA_GRANTED) verdict = AI_QUOTA_CHANNEL;
+    if (channel_wait > wait) wait = channel_wait;
+    long global_wait = bucket_wait_ms(&g_quota->requests, AI_QUOTA_REQUESTS_PER_MINUTE, 1);
+    long token_wait = bucket_wait_ms(&g_quota->tokens, AI_QUOTA_TOKENS_PER_MINUTE, (double)tokens);
+    if (token_wait > global_wait) global_wait = token_wait;
+    if (global_wait > 0 && verdict == AI_QUOTA_GRANTED) verdict = AI_QUOTA_GLOBAL;
+    if (global_wait > wait) wait = global_wait;
+
+    if (verdict == AI_QUOTA_GRANTED) {
+        g_quota->requests.level -= 1;
+        g_quota->tokens.level -= (double)tokens;
+        if (channel_bucket) channel_bucket->level -= 1;
+        user_bucket->level -= 1;
+        g_quota->granted++;
+    }
+    quota_unlock();
+    *wait_ms_out = wait;
+    return verdict;
+}
+
+void ai_quota_settle(long estimated_tokens, long actual_tokens) {
+    if (g_quota == NULL || estimated_tokens == actual_tokens || !quota_lock()) return;
+    g_quota->tokens.level += (double)(estimated_tokens - actual_tokens); // May go negative after an underestimate
+    if (g_quota->tokens.level > AI_QUOTA_TOKENS_PER_MINUTE) g_quota->tokens.level = AI_QUOTA_TOKENS_PER_MINUTE;
+    quota_unlock();
+}
+
+void ai_quota_note_rejected(void) {
+    if (g_quota == NULL || !quota_lock()) return;
+    g_quota->rejected++;
+    quota_unlock();
+}
+
+void ai_quota_note_deferred(void) {
+    if (g_quota == NULL || !quota_lock()) return;
+    g_quota->deferred++;
+    quota_unlock();
+}
+
+bool ai_quota_status(AiQuotaStatus *out) {
+    memset(out, 0, sizeof(*out));
+    if (g_quota == NULL || !quota_lock()) return false;
+    int64_t now = monotonic_ms();
+    bucket_refill(&g_quota->requests, AI_QUOTA_REQUESTS_PER_MINUTE, now);
+    bucket_refill(&g_quota->tokens, AI_QUOTA_TOKENS_PER_MINUTE, now);
+    out->requests_left = g_quota->requests.level;
+    out->tokens_left = g_quota->tokens.level;
+    out->granted = g_quota->granted;
+    out->deferred = g_quota->deferred;
+    out->rejected = g_quota->rejected;
+    quota_unlock();
+    return true;
+}
+
+const char *ai_quota_verdict_name(AiQuotaVerdict verdict) {
+    switch (verdict) {
+    case AI_QUOTA_GLOBAL: return "global";
+    case AI_QUOTA_CHANNEL: return "channel";
+    case AI_QUOTA_NICK: return "nick";
+    default: return "granted";
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef AI_QUOTA_H
+#define AI_QUOTA_H
+
+#include "irc_bot.h"
+
+// --- Shared API quota ---
+// The parent maps a set of token buckets in shared memory before forking, so
+// all workers draw on one budget instead of each assuming it has the whole
+// API key to itself. A send needs a request from the global requests/min
+// bucket, its estimated tokens from the global tokens/min bucket, and a
+// request from both its channel's and its asker's sub-limit buckets; nothing
+// is taken unless every bucket can pay. Token estimates are settled against
+// the real usage once the answer arrives.
+
+typedef enum {
+    AI_QUOTA_GRANTED,
+    AI_QUOTA_GLOBAL,  // The key's requests or tokens per minute are used up
+    AI_QUOTA_CHANNEL, // This channel's share is used up
+    AI_QUOTA_NICK     // The asker's share is used up
+} AiQuotaVerdict;
+
+typedef struct {
+    double requests_left;
+    double tokens_left;
+    unsigned long granted;
+    unsigned long deferred; // Sends put off until a bucket refilled
+    unsigned long rejected; // Asks turned away because the wait would pass their deadline
+} AiQuotaStatus;
+
+// Called by the parent before forking. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int ai_quota_init(int num_channels);
+void ai_quota_cleanup(void);
+
+// Takes one request and tokens from every bucket that applies. When refused,
+// *wait_ms_out is how long until all of them could pay. Always grants if the
+// table is missing.
+AiQuotaVerdict ai_quota_acquire(int channel, const char *nick, long tokens, long *wait_ms_out);
+// Credits the shared tokens bucket with estimated minus actual usage (a debit
+// after an underestimate).
+void ai_quota_settle(long estimated_tokens, long actual_tokens);
+// Counts an ask whose quota wait was too long to queue for.
+void ai_quota_note_rejected(void);
+void ai_quota_note_deferred(void);
+bool ai_quota_status(AiQuotaStatus *out);
+const char *ai_quota_verdict_name(AiQuotaVerdict verdict);
+
+#endif // AI_QUOTA_H
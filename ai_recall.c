@@ -0,0 +1,326 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_cache.h"
+#include "ai_recall.h"
+#include <math.h>
+
+#define RECALL_BM25_K1 1.2
+#define RECALL_BM25_B 0.75
+#define RECALL_MAX_TERMS 64 // Distinct terms taken from one message or query
+#define RECALL_TERM_MAX 32
+
+struct AiRecallTerm {
+    uint64_t hash; // 0 = empty slot
+    uint8_t *bytes; // Postings: varint((delta << 2) | min(count, 3))
+    uint32_t len;
+    uint32_t cap;
+    uint32_t head; // Byte offset of the first live posting
+    uint32_t head_seq; // Its message number; its own delta is never read again
+    uint32_t last_seq; // The last posting's message number, the base for the next delta
+    uint32_t postings; // Live postings, the term's document frequency
+};
+
+typedef struct {
+    uint64_t hash;
+    int count;
+} RecallToken;
+
+static const char *const STOP_WORDS[] = {
+    "the", "and", "you", "that", "for", "are", "was", "with", "this", "have", "not", "but", "what", "its", "it's",
+    "can", "just", "all", "any", "how", "who", "why", "when", "does", "did", "about", "from", "there", "they", "your",
+    "is", "it", "to", "of", "in", "on", "a", "an", "i", "me", "my", "we", "be", "so", "do", "or", "at", "as", "if", "no"
+};
+
+static bool is_stop_word(const char *word) {
+    for (size_t i = 0; i < sizeof(STOP_WORDS) / sizeof(STOP_WORDS[0]); ++i) {
+        if (strcmp(word, STOP_WORDS[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Lowercased runs of letters, digits and non-ASCII bytes, minus stop words;
+// repeats are counted. Returns the number of distinct terms.
+static int tokenize(const char *text, RecallToken *tokens, int max, int *total_out) {
+    int count = 0, total = 0;
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p) {
+        while (*p && !(isalnum(*p) || *p >= 0x80)) p++;
+        char word[RECALL_TERM_MAX];
+        size_t len = 0;
+        while (*p && (isalnum(*p) || *p >= 0x80)) {
+            if (len + 1 < sizeof(word)) word[len++] = (char)tolower(*p);
+            p++;
+        }
+        word[len] = '\0';
+        if (len < 2 || is_stop_word(word)) continue;
+        uint64_t hash = ai_hash64(word, len, 0);
+        if (hash == 0) hash = 1;
+        total++;
+        int i = 0;
+        while (i < count && tokens[i].hash != hash) i++;
+        if (i < count) {
+            tokens[i].count++;
+        } else if (count < max) {
+            tokens[count].hash = hash;
+            tokens[count].count = 1;
+            count++;
+        }
+    }
+    if (total_out) *total_out = total;
+    return count;
+}
+
+static uint32_t read_varint(const uint8_t *bytes, uint32_t *pos) {
+    uint32_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = bytes[(*pos)++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+static bool append_posting(AiRecallTerm *term, uint32_t seq, int count) {
+    if (term->len + 5 > term->cap) {
+        uint32_t new_cap = term->cap ? term->cap * 2 : 8;
+        uint8_t *grown = (uint8_t *)realloc(term->bytes, new_cap);
+        if (grown == NULL) return false;
+        term->bytes = grown;
+        term->cap = new_cap;
+    }
+    uint32_t value = ((seq - term->last_seq) << 2) | (uint32_t)(count > 3 ? 3 : count);
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        term->bytes[term->len++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    if (term->postings == 0) {
+        term->head = term->len - 1;
+        while (term->head > 0 && (term->bytes[term->head - 1] & 0x80)) term->head--;
+        term->head_seq = seq;
+    }
+    term->last_seq = seq;
+    term->postings++;
+    return true;
+}
+
+static uint32_t oldest_live_seq(const AiRecall *recall) {
+    return recall->next_seq - (uint32_t)recall->live;
+}
+
+// Drops postings for messages that have left the window, and gives back the
+// front of the byte string once it is mostly dead.
+static void prune_term(const AiRecall *recall, AiRecallTerm *term) {
+    uint32_t oldest = oldest_live_seq(recall);
+    while (term->postings > 0 && term->head_seq < oldest) {
+        read_varint(term->bytes, &term->head);
+        term->postings--;
+        if (term->postings > 0) {
+            uint32_t pos = term->head;
+            term->head_seq += read_varint(term->bytes, &pos) >> 2;
+        }
+    }
+    if (term->postings == 0) {
+        term->len = term->head = 0;
+    } else if (term->head > 64 && term->head * 2 > term->len) {
+        memmove(term->bytes, term->bytes + term->head, term->len - term->head);
+        term->len -= term->head;
+        term->head = 0;
+    }
+}
+
+static AiRecallTerm *find_term(const AiRecall *recall, uint64_t hash) {
+    size_t mask = recall->term_slots - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        AiRecallTerm *slot = &recall->terms[i];
+        if (slot->hash == hash) return slot;
+        if (slot->hash == 0) return NULL;
+    }
+}
+
+// Rebuilds the term table at a size fitting the live terms, leaving out those
+// with no postings left. Returns false (table unchanged) if out of memory.
+static bool rebuild_terms(AiRecall *recall) {
+    size_t live = 0;
+    for (size_t i = 0; i < recall->term_slots; ++i) {
+        AiRecallTerm *term = &recall->terms[i];
+        if (term->hash == 0) continue;
+        prune_term(recall, term);
+        if (term->postings > 0) live++;
+    }
+    size_t slots = 64;
+    while (slots < live * 4) slots *= 2; // Room to grow to half full before the next rebuild
+    AiRecallTerm *table = (AiRecallTerm *)calloc(slots, sizeof(AiRecallTerm));
+    if (table == NULL) return false;
+    for (size_t i = 0; i < recall->term_slots; ++i) {
+        AiRecallTerm *term = &recall->terms[i];
+        if (term->hash == 0) continue;
+        if (term->postings == 0) {
+            free(term->bytes);
+            continue;
+        }
+        size_t j = (size_t)term->hash & (slots - 1);
+        while (table[j].hash != 0) j = (j + 1) & (slots - 1);
+        table[j] = *term;
+    }
+    free(recall->terms);
+    recall->terms = table;
+    recall->term_slots = slots;
+    recall->term_count = live;
+    return true;
+}
+
+static AiRecallTerm *add_term(AiRecall *recall, uint64_t hash) {
+    AiRecallTerm *term = find_term(recall, hash);
+    if (term) return term;
+    if ((recall->term_count + 1) * 2 > recall->term_slots && !rebuild_terms(recall)) return NULL;
+    size_t mask = recall->term_slots - 1;
+    size_t i = (size_t)hash & mask;
+    while (recall->terms[i].hash != 0) i = (i + 1) & mask;
+    term = &recall->terms[i];
+    term->hash = hash;
+    recall->term_count++;
+    return term;
+}
+
+int ai_recall_init(AiRecall *recall, size_t window) {
+    memset(recall, 0, sizeof(*recall));
+    recall->window = window;
+    recall->next_seq = 1;
+    recall->term_slots = 64;
+    recall->messages = (AiRecallMessage *)calloc(window, sizeof(AiRecallMessage));
+    recall->terms = (AiRecallTerm *)calloc(recall->term_slots, sizeof(AiRecallTerm));
+    recall->scores = (float *)calloc(window, sizeof(float));
+    recall->touched = (uint32_t *)malloc(window * sizeof(uint32_t));
+    if (window == 0 || !recall->messages || !recall->terms || !recall->scores || !recall->touched) {
+        app_log("AI_Recall", "ERROR", "Failed to allocate the message index for %zu messages.", window);
+        ai_recall_cleanup(recall);
+        return -1;
+    }
+    return 0;
+}
+
+void ai_recall_add(AiRecall *recall, const char *nick, const char *text) {
+    if (recall->messages == NULL) return;
+    RecallToken tokens[RECALL_MAX_TERMS];
+    int total = 0;
+    int count = tokenize(text, tokens, RECALL_MAX_TERMS, &total);
+    if (count == 0) return;
+
+    uint32_t seq = recall->next_seq;
+    AiRecallMessage *message = &recall->messages[seq % recall->window];
+    if (message->seq != 0) { // The oldest message leaves the window; its postings go lazily
+        recall->live--;
+        recall->live_terms -= message->terms;
+        free(message->line);
+    }
+    size_t line_len = strlen(nick) + strlen(text) + 4;
+    if (line_len > AI_RECALL_LINE_MAX) line_len = AI_RECALL_LINE_MAX;
+    message->line = (char *)malloc(line_len);
+    if (message->line) snprintf(message->line, line_len, "<%s> %s", nick, text);
+    message->seq = seq;
+    message->terms = (uint16_t)(total > UINT16_MAX ? UINT16_MAX : total);
+    recall->next_seq++;
+    recall->live++;
+    recall->live_terms += message->terms;
+
+    for (int i = 0; i < count; ++i) {
+        AiRecallTerm *term = add_term(recall, tokens[i].hash);
+        if (term == NULL) continue;
+        prune_term(recall, term);
+        append_posting(term, seq, tokens[i].count);
+    }
+    if (++recall->adds_since_sweep >= recall->window) {
+        rebuild_terms(recall);
+        recall->adds_since_sweep = 0;
+    }
+}
+
+static int compare_seq(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+int ai_recall_query(AiRecall *recall, const char *query, int k, double min_score, char *out, size_t out_size) {
+    if (out_size > 0) out[0] = '\0';
+    if (recall->messages == NULL || recall->live == 0 || k <= 0) return 0;
+    RecallToken tokens[RECALL_MAX_TERMS];
+    int count = tokenize(query, tokens, RECALL_MAX_TERMS, NULL);
+
+    double docs = (double)recall->live;
+    double avg_len = (double)recall->live_terms / docs;
+    size_t num_touched = 0;
+    for (int i = 0; i < count; ++i) {
+        AiRecallTerm *term = find_term(recall, tokens[i].hash);
+        if (term == NULL) continue;
+        prune_term(recall, term);
+        if (term->postings == 0) continue;
+        double idf = log(1.0 + (docs - term->postings + 0.5) / (term->postings + 0.5));
+        uint32_t pos = term->head;
+        uint32_t seq = term->head_seq;
+        for (uint32_t n = 0; n < term->postings; ++n) {
+            uint32_t value = read_varint(term->bytes, &pos);
+            if (n > 0) seq += value >> 2;
+            double tf = (double)(value & 3);
+            size_t slot = seq % recall->window;
+            double norm = RECALL_BM25_K1 * (1.0 - RECALL_BM25_B + RECALL_BM25_B * recall->messages[slot].terms / avg_len);
+            if (recall->scores[slot] == 0.0f) recall->touched[num_touched++] = seq;
+            recall->scores[slot] += (float)(idf * tf * (RECALL_BM25_K1 + 1.0) / (tf + norm));
+        }
+    }
+
+    // Keep the k best in a small sorted array, then clear the scratch scores
+    uint32_t best[AI_RECALL_MAX_K];
+    int num_best = 0;
+    if (k > AI_RECALL_MAX_K) k = AI_RECALL_MAX_K;
+    for (size_t i = 0; i < num_touched; ++i) {
+        uint32_t seq = recall->touched[i];
+        float score = recall->scores[seq % recall->window];
+        if (score < min_score) continue;
+        int pos = num_best < k ? num_best : k;
+        while (pos > 0 && recall->scores[best[pos - 1] % recall->window] < score) {
+            if (pos < k) best[pos] = best[pos - 1];
+            pos--;
+        }
+        if (pos >= k) continue;
+        best[pos] = seq;
+        if (num_best < k) num_best++;
+    }
+    for (size_t i = 0; i < num_touched; ++i) recall->scores[recall->touched[i] % recall->window] = 0.0f;
+
+    qsort(best, (size_t)num_best, sizeof(best[0]), compare_seq);
+    size_t len = 0;
+    int written = 0;
+    for (int i = 0; i < num_best; ++i) {
+        const char *line = recall->messages[best[i] % recall->window].line;
+        if (line == NULL) continue;
+        size_t line_len = strlen(line);
+        if (len + line_len + 2 > out_size) break;
+        memcpy(out + len, line, line_len);
+        len += line_len;
+        out[len++] = '\n';
+        out[len] = '\0';
+        written++;
+    }
+    return written;
+}
+
+void ai_recall_cleanup(AiRecall *recall) {
+    if (recall->messages) {
+        for (size_t i = 0; i < recall->window; ++i) free(recall->messages[i].line);
+    }
+    if (recall->terms) {
+        for (size_t i = 0; i < recall->term_slots; ++i) free(recall->terms[i].bytes);
+    }
+    free(recall->messages);
+    free(recall->terms);
+    free(recall->scores);
+    free(recall->touched);
+    memset(recall, 0, sizeof(*recall));
+}
@@ -0,0 +1,46 @@
+#ifndef AI_RECALL_H
+#define AI_RECALL_H
+
+#include "irc_bot.h"
+
+// --- Retrieval over recent channel messages ---
+// An incremental inverted index over the last `window` messages of a channel,
+// searched with BM25 so an !ask can be sent with the earlier lines it is
+// about. Messages sit in a ring; each term's posting list is a byte string of
+// varint-coded message number deltas with the term's count folded into the
+// low two bits. Messages leave the window in order, so expired postings are
+// always at the front of a list and are dropped lazily when the list is next
+// touched; every `window` messages a sweep drops terms left with no postings.
+
+typedef struct AiRecallTerm AiRecallTerm;
+
+typedef struct {
+    uint32_t seq; // 0 = empty
+    uint16_t terms; // Indexed terms, the BM25 document length
+    char *line; // "<nick> text"
+} AiRecallMessage;
+
+typedef struct {
+    AiRecallMessage *messages; // Ring of window entries, indexed by seq % window
+    size_t window;
+    uint32_t next_seq;
+    size_t live; // Messages in the window
+    unsigned long live_terms; // Sum of their lengths
+    AiRecallTerm *terms; // Open-addressed by term hash
+    size_t term_slots; // Power of two
+    size_t term_count;
+    uint32_t adds_since_sweep;
+    float *scores; // Query scratch, indexed like messages
+    uint32_t *touched;
+} AiRecall;
+
+// Returns 0, or -1 if memory for the window cannot be had.
+int ai_recall_init(AiRecall *recall, size_t window);
+void ai_recall_add(AiRecall *recall, const char *nick, const char *text);
+// Writes the up to k lines that best match query (BM25 score at least
+// min_score) into out, oldest first and one per line, stopping before
+// out_size would be exceeded. Returns the number of lines written.
+int ai_recall_query(AiRecall *recall, const char *query, int k, double min_score, char *out, size_t out_size);
+void ai_recall_cleanup(AiRecall *recall);
+
+#endif // AI_RECALL_H
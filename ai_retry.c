@@ -0,0 +1,101 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "ai_retry.h"
+
+AiFailureClass ai_classify_result(const GeminiResult *result) {
+    if (result->text) return AI_FAILURE_NONE;
+    switch (result->curl_code) {
+    case CURLE_OK: // HTTP error statuses too, since their bodies are read for error.message
+        if (result->http_code == 408 || result->http_code == 429 || result->http_code >= 500) return AI_FAILURE_RETRYABLE;
+        return AI_FAILURE_FATAL; // Other 4xx, or HTTP 200 without a usable answer, e.g. blocked content
+    case CURLE_OPERATION_TIMEDOUT:
+        return AI_FAILURE_TIMEOUT;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+        return AI_FAILURE_RETRYABLE;
+    default:
+        return AI_FAILURE_FATAL;
+    }
+}
+
+long ai_backoff_ms(int attempt, long retry_after_ms) {
+    static unsigned int seed = 0;
+    if (seed == 0) seed = (unsigned int)(time(NULL) ^ getpid()); // Forked workers must not retry in lockstep
+
+    long ceiling = AI_RETRY_BASE_MS;
+    for (int i = 1; i < attempt && ceiling < AI_RETRY_MAX_BACKOFF_MS; ++i) ceiling *= 2;
+    if (ceiling > AI_RETRY_MAX_BACKOFF_MS) ceiling = AI_RETRY_MAX_BACKOFF_MS;
+    long delay = (long)(rand_r(&seed) % (ceiling + 1));
+    return delay > retry_after_ms ? delay : retry_after_ms;
+}
+
+bool ai_breaker_allow(AiBreaker *breaker, const char *tag) {
+    switch (breaker->state) {
+    case AI_BREAKER_CLOSED:
+        return true;
+    case AI_BREAKER_OPEN:
+        if (time(NULL) - breaker->opened_at < AI_BREAKER_OPEN_SECONDS) return false;
+        breaker->state = AI_BREAKER_HALF_OPEN;
+        breaker->probe_inflight = false;
+        app_log(tag, "AI_BREAKER", "Circuit half-open: sending a probe request.");
+        // fall through
+    case AI_BREAKER_HALF_OPEN:
+        if (breaker->probe_inflight) return false;
+        breaker->probe_inflight = true;
+        return true;
+    }
+    return true;
+}
+
+void ai_breaker_record(AiBreaker *breaker, AiFailureClass outcome, const char *tag) {
+    if (outcome == AI_FAILURE_RETRYABLE || outcome == AI_FAILURE_TIMEOUT) {
+        breaker->consecutive_failures++;
+        if (breaker->state == AI_BREAKER_HALF_OPEN ||
+            (breaker->state == AI_BREAKER_CLOSED && breaker->consecutive_failures >= AI_BREAKER_FAILURE_THRESHOLD)) {
+            breaker->state = AI_BREAKER_OPEN;
+            breaker->opened_at = time(NULL);
+            breaker->probe_inflight = false;
+            app_log(tag, "AI_BREAKER", "Circuit open after %d consecutive failure(s); failing fast for %d s.",
+                    breaker->consecutive_failures, AI_BREAKER_OPEN_SECONDS);
+        }
+        return;
+    }
+    // Answers and non-retryable errors both show the backend is reachable
+    if (breaker->state != AI_BREAKER_CLOSED) app_log(tag, "AI_BREAKER", "Circuit closed: the backend is answering again.");
+    breaker->state = AI_BREAKER_CLOSED;
+    breaker->consecutive_failures = 0;
+    breaker->probe_inflight = false;
+}
+
+void ai_breaker_release(AiBreaker *breaker) {
+    breaker->probe_inflight = false;
+}
+
+void ai_latency_add(AiLatencyWindow *window, long ms) {
+    window->samples[window->next] = ms;
+    window->next = (window->next + 1) % AI_LATENCY_WINDOW;
+    if (window->count < AI_LATENCY_WINDOW) window->count++;
+}
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+long ai_latency_percentile(const AiLatencyWindow *window, int pct, int min_samples) {
+    if (window->count == 0 || window->count < min_samples) return -1;
+    long sorted[AI_LATENCY_WINDOW];
+    memcpy(sorted, window->samples, (size_t)window->count * sizeof(long));
+    qsort(sorted, (size_t)window->count, sizeof(long), compare_long);
+    int index = (window->count * pct + 99) / 100 - 1;
+    if (index < 0) index = 0;
+    return sorted[index];
+}
@@ -0,0 +1,59 @@
+#ifndef AI_RETRY_H
+#define AI_RETRY_H
+
+#include "irc_bot.h"
+#include "gemini_integration.h"
+
+// --- Failure handling for AI requests ---
+// Failed requests are classified: rate limits, server errors and dropped
+// connections are retried after a jittered exponential backoff (or the
+// server's Retry-After, if longer); anything else is final. A per-backend
+// circuit breaker opens after a run of retryable failures so requests fail
+// fast while the service is down, and lets a single probe through once the
+// open period is over. A rolling latency window provides the p95 used to
+// decide when a slow request is worth hedging with a second copy.
+
+typedef enum {
+    AI_FAILURE_NONE,      // Answered
+    AI_FAILURE_RETRYABLE, // 408/429/5xx or a connection-level error
+    AI_FAILURE_TIMEOUT,   // The request ran out of time
+    AI_FAILURE_FATAL      // Any other error; retrying would not help
+} AiFailureClass;
+
+typedef enum {
+    AI_BREAKER_CLOSED,
+    AI_BREAKER_OPEN,
+    AI_BREAKER_HALF_OPEN // One probe request allowed through
+} AiBreakerState;
+
+typedef struct {
+    AiBreakerState state;
+    int consecutive_failures;
+    time_t opened_at;
+    bool probe_inflight;
+} AiBreaker;
+
+typedef struct {
+    long samples[AI_LATENCY_WINDOW]; // Milliseconds, ring buffer
+    int count;
+    int next;
+} AiLatencyWindow;
+
+AiFailureClass ai_classify_result(const GeminiResult *result);
+// Delay before retry number attempt (1-based): full jitter over an exponential
+// ceiling, but never less than the server's Retry-After.
+long ai_backoff_ms(int attempt, long retry_after_ms);
+
+// Whether a request may be sent now. In HALF_OPEN this claims the probe.
+bool ai_breaker_allow(AiBreaker *breaker, const char *tag);
+// Records the outcome of a request that ai_breaker_allow() let through.
+// Retryable failures and timeouts count against the backend.
+void ai_breaker_record(AiBreaker *breaker, AiFailureClass outcome, const char *tag);
+// For a request cancelled before it finished: lets another probe through.
+void ai_breaker_release(AiBreaker *breaker);
+
+void ai_latency_add(AiLatencyWindow *window, long ms);
+// Returns the pct-th percentile of the window, or -1 with fewer than min_samples.
+long ai_latency_percentile(const AiLatencyWindow *window, int pct, int min_samples);
+
+#endif // AI_RETRY_H
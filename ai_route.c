@@ -0,0 +1,106 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "ai_route.h"
+
+static const long HISTOGRAM_BOUNDS[] = AI_ROUTE_HISTOGRAM_BOUNDS;
+
+void ai_route_init(AiRouter *router, const AiBackendConfig *config, const char *default_model, AiModelStats *stats,
+                   int *num_stats_out, const char *tag) {
+    memset(router, 0, sizeof(*router));
+    router->policy = config->route_policy;
+    router->stats = stats;
+    router->tag = tag;
+    if (config->num_models > 0) {
+        router->count = config->num_models;
+        for (int i = 0; i < router->count; ++i) router->models[i].route = config->models[i];
+    } else {
+        router->count = 1;
+        snprintf(router->models[0].route.name, sizeof(router->models[0].route.name), "%s", default_model);
+    }
+    for (int i = 0; i < router->count; ++i) {
+        memset(&stats[i], 0, sizeof(stats[i]));
+        snprintf(stats[i].name, sizeof(stats[i].name), "%s", router->models[i].route.name);
+        stats[i].slo_ms = router->models[i].route.slo_ms;
+        stats[i].p95_ms = -1;
+    }
+    *num_stats_out = router->count;
+}
+
+static bool over_slo(const AiRouter *router, int model) {
+    return router->stats[model].over_slo;
+}
+
+// Whether a model over its SLO has gone long enough without traffic to be tried again.
+static bool probe_due(const AiRouteModel *model) {
+    struct timeval now, elapsed;
+    gettimeofday(&now, NULL);
+    timersub(&now, &model->last_sent, &elapsed);
+    return elapsed.tv_sec * 1000L + elapsed.tv_usec / 1000 >= AI_ROUTE_PROBE_MS;
+}
+
+int ai_route_pick(AiRouter *router, long request_tokens) {
+    int last = router->count - 1;
+    int start;
+    switch (router->policy) {
+    case AI_ROUTE_QUALITY: start = 0; break;
+    case AI_ROUTE_SPEED: start = last; break;
+    default: start = request_tokens >= AI_ROUTE_LONG_PROMPT_TOKENS ? 0 : last; break;
+    }
+    int pick = start;
+    bool probe = false;
+    while (pick < last && over_slo(router, pick)) {
+        if (probe_due(&router->models[pick])) {
+            probe = true;
+            break;
+        }
+        pick++;
+    }
+
+    AiModelStats *stats = &router->stats[pick];
+    stats->routed++;
+    if (probe) stats->probes++;
+    if (pick != start) stats->fallbacks++;
+    gettimeofday(&router->models[pick].last_sent, NULL);
+    if (probe) {
+        app_log(router->tag, "AI_ROUTE", "Probing %s (p%d %ld ms, SLO %ld ms).", stats->name, AI_ROUTE_PERCENTILE,
+                stats->p95_ms, stats->slo_ms);
+    } else if (pick != start) {
+        app_log(router->tag, "DEBUG", "Routed a ~%ld token request to %s instead of %s (over its SLO).", request_tokens,
+                stats->name, router->stats[start].name);
+    }
+    return pick;
+}
+
+const char *ai_route_model_name(const AiRouter *router, int model) {
+    return router->models[model].route.name;
+}
+
+void ai_route_record(AiRouter *router, int model, long latency_ms, bool answered) {
+    if (model < 0 || model >= router->count) return;
+    AiRouteModel *route = &router->models[model];
+    AiModelStats *stats = &router->stats[model];
+    int bucket = 0;
+    while (bucket < AI_ROUTE_HISTOGRAM_BUCKETS - 1 && latency_ms > HISTOGRAM_BOUNDS[bucket]) bucket++;
+    stats->histogram[bucket]++;
+
+    long slo_ms = route->route.slo_ms;
+    if (stats->over_slo && answered && latency_ms <= slo_ms) {
+        // Back within its SLO: forget the slow samples rather than wait for them to age out
+        memset(&route->latency, 0, sizeof(route->latency));
+    }
+    ai_latency_add(&route->latency, latency_ms);
+    stats->p95_ms = ai_latency_percentile(&route->latency, AI_ROUTE_PERCENTILE, AI_ROUTE_MIN_SAMPLES);
+
+    bool now_over = slo_ms > 0 && stats->p95_ms > slo_ms;
+    if (now_over != stats->over_slo) {
+        if (now_over) {
+            app_log(router->tag, "AI_ROUTE", "%s p%d is %ld ms, over its %ld ms SLO; %s.", stats->name, AI_ROUTE_PERCENTILE,
+                    stats->p95_ms, slo_ms, model < router->count - 1 ? "shifting traffic to the next model" : "no faster model to shift to");
+        } else {
+            app_log(router->tag, "AI_ROUTE", "%s answered within its %ld ms SLO again; routing to it resumes.", stats->name, slo_ms);
+        }
+        stats->over_slo = now_over;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef AI_ROUTE_H
+#define AI_ROUTE_H
+
+#include "irc_bot.h"
+#include "ai_backend.h"
+#include "ai_retry.h"
+
+// --- Model routing ---
+// A channel may list several models with "models=", the preferred (usually
+// largest) first and the fastest last, each with an optional p95 latency SLO.
+// The channel's route= policy picks where a request starts: by its estimated
+// size, always the first model, or always the last. While the starting
+// model's rolling p95 answer time is over its SLO, the request moves on to the
+// next model in the list. A model over its SLO still gets one probe request
+// every AI_ROUTE_PROBE_MS; once a request to it answers within the SLO its
+// window is cleared so it is judged afresh. Decisions and latency histograms are
+// published to the worker's shared stats for !models.
+
+typedef struct {
+    AiModelRoute route;
+    AiLatencyWindow latency;
+    struct timeval last_sent;
+} AiRouteModel;
+
+typedef struct {
+    AiRouteModel models[AI_ROUTE_MAX_MODELS];
+    int count;
+    AiRoutePolicy policy;
+    AiModelStats *stats; // count slots in the worker's shared stats
+    const char *tag;
+} AiRouter;
+
+// Takes the models from config, or default_model alone when it lists none.
+void ai_route_init(AiRouter *router, const AiBackendConfig *config, const char *default_model, AiModelStats *stats,
+                   int *num_stats_out, const char *tag);
+// Picks the model for a request of about request_tokens and counts the
+// decision. Returns its index.
+int ai_route_pick(AiRouter *router, long request_tokens);
+// Name to pass to the backend for model.
+const char *ai_route_model_name(const AiRouter *router, int model);
+// Records how long a request to model took; answered is false for a timeout.
+void ai_route_record(AiRouter *router, int model, long latency_ms, bool answered);
+
+#endif // AI_ROUTE_H
@@ -0,0 +1,160 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_cache.h"
+#include "ai_similar.h"
+
+// Per-hash-function multipliers and offsets, derived once from a fixed seed.
+static uint64_t g_minhash_a[AI_SIMILAR_HASHES];
+static uint64_t g_minhash_b[AI_SIMILAR_HASHES];
+static bool g_minhash_seeded = false;
+
+static uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void seed_minhash(void) {
+    if (g_minhash_seeded) return;
+    uint64_t state = 0x5EED1234ULL;
+    for (int i = 0; i < AI_SIMILAR_HASHES; ++i) {
+        g_minhash_a[i] = splitmix64(&state) | 1; // Odd, so the multiply is a bijection
+        g_minhash_b[i] = splitmix64(&state);
+    }
+    g_minhash_seeded = true;
+}
+
+// Shingles ignore spaces and punctuation, so "whats unix" and "what's unix" match.
+static bool compute_signature(const char *normalized, uint32_t signature[AI_SIMILAR_HASHES]) {
+    char compact[MAX_PIPE_MSG_LEN];
+    size_t len = 0;
+    for (const char *p = normalized; *p && len + 1 < sizeof(compact); ++p) {
+        if (isalnum((unsigned char)*p)) compact[len++] = *p;
+    }
+    if (len < AI_SIMILAR_SHINGLE) return false;
+
+    for (int i = 0; i < AI_SIMILAR_HASHES; ++i) signature[i] = UINT32_MAX;
+    for (size_t start = 0; start + AI_SIMILAR_SHINGLE <= len; ++start) {
+        uint64_t shingle_hash = ai_hash64(compact + start, AI_SIMILAR_SHINGLE, 0);
+        for (int i = 0; i < AI_SIMILAR_HASHES; ++i) {
+            uint32_t h = (uint32_t)((g_minhash_a[i] * shingle_hash + g_minhash_b[i]) >> 32);
+            if (h < signature[i]) signature[i] = h;
+        }
+    }
+    return true;
+}
+
+static size_t band_bucket(const AiSimilarIndex *index, uint64_t persona_hash, const uint32_t *signature, int band) {
+    uint64_t h = ai_hash64(&signature[band * AI_SIMILAR_ROWS], AI_SIMILAR_ROWS * sizeof(uint32_t), persona_hash + (uint64_t)band);
+    return (size_t)band * index->num_buckets + (size_t)(h % index->num_buckets);
+}
+
+static double estimate_similarity(const uint32_t *a, const uint32_t *b) {
+    int equal = 0;
+    for (int i = 0; i < AI_SIMILAR_HASHES; ++i) equal += (a[i] == b[i]);
+    return (double)equal / AI_SIMILAR_HASHES;
+}
+
+int ai_similar_init(AiSimilarIndex *index, size_t capacity, double threshold) {
+    memset(index, 0, sizeof(*index));
+    seed_minhash();
+    index->capacity = capacity;
+    index->threshold = threshold;
+    index->num_buckets = capacity * 2;
+    index->entries = (AiSimilarEntry *)calloc(capacity, sizeof(AiSimilarEntry));
+    index->band_heads = (int32_t *)malloc(AI_SIMILAR_BANDS * index->num_buckets * sizeof(int32_t));
+    if (index->entries == NULL || index->band_heads == NULL) {
+        app_log("AI_Similar", "ERROR", "Failed to allocate similarity index: %s", strerror(errno));
+        ai_similar_cleanup(index);
+        return -1;
+    }
+    for (size_t i = 0; i < AI_SIMILAR_BANDS * index->num_buckets; ++i) index->band_heads[i] = -1;
+    return 0;
+}
+
+const char *ai_similar_lookup(AiSimilarIndex *index, const char *persona, const char *prompt, double *similarity_out) {
+    if (index->entries == NULL) return NULL;
+    char normalized[MAX_PIPE_MSG_LEN];
+    uint32_t signature[AI_SIMILAR_HASHES];
+    ai_normalize_prompt(prompt, normalized, sizeof(normalized));
+    if (!compute_signature(normalized, signature)) return NULL;
+    index->lookups++;
+
+    uint64_t persona_hash = ai_hash64(persona, strlen(persona), 0);
+    const AiSimilarEntry *best = NULL;
+    double best_similarity = 0;
+    int candidates = 0;
+    for (int band = 0; band < AI_SIMILAR_BANDS && candidates < AI_SIMILAR_MAX_CANDIDATES; ++band) {
+        for (int32_t i = index->band_heads[band_bucket(index, persona_hash, signature, band)];
+             i != -1 && candidates < AI_SIMILAR_MAX_CANDIDATES; i = index->entries[i].band_next[band]) {
+            const AiSimilarEntry *entry = &index->entries[i];
+            candidates++;
+            if (entry->persona_hash != persona_hash || entry == best) continue;
+            double similarity = estimate_similarity(signature, entry->signature);
+            if (similarity >= index->threshold && similarity > best_similarity) {
+                best = entry;
+                best_similarity = similarity;
+            }
+        }
+    }
+    if (best == NULL) return NULL;
+    index->matches++;
+    if (similarity_out) *similarity_out = best_similarity;
+    return best->prompt;
+}
+
+static void unlink_entry(AiSimilarIndex *index, int32_t slot) {
+    AiSimilarEntry *entry = &index->entries[slot];
+    for (int band = 0; band < AI_SIMILAR_BANDS; ++band) {
+        int32_t prev = entry->band_prev[band], next = entry->band_next[band];
+        if (prev == -1) index->band_heads[band_bucket(index, entry->persona_hash, entry->signature, band)] = next;
+        else index->entries[prev].band_next[band] = next;
+        if (next != -1) index->entries[next].band_prev[band] = prev;
+    }
+    free(entry->prompt);
+    entry->prompt = NULL;
+    index->count--;
+}
+
+void ai_similar_insert(AiSimilarIndex *index, const char *persona, const char *prompt) {
+    if (index->entries == NULL) return;
+    char normalized[MAX_PIPE_MSG_LEN];
+    uint32_t signature[AI_SIMILAR_HASHES];
+    ai_normalize_prompt(prompt, normalized, sizeof(normalized));
+    if (!compute_signature(normalized, signature)) return;
+
+    char *prompt_copy = strdup(normalized);
+    if (prompt_copy == NULL) return;
+
+    int32_t slot = (int32_t)index->next_slot;
+    index->next_slot = (index->next_slot + 1) % index->capacity;
+    if (index->entries[slot].prompt != NULL) unlink_entry(index, slot);
+
+    AiSimilarEntry *entry = &index->entries[slot];
+    entry->persona_hash = ai_hash64(persona, strlen(persona), 0);
+    memcpy(entry->signature, signature, sizeof(signature));
+    entry->prompt = prompt_copy;
+    for (int band = 0; band < AI_SIMILAR_BANDS; ++band) {
+        int32_t *head = &index->band_heads[band_bucket(index, entry->persona_hash, signature, band)];
+        entry->band_next[band] = *head;
+        entry->band_prev[band] = -1;
+        if (*head != -1) index->entries[*head].band_prev[band] = slot;
+        *head = slot;
+    }
+    index->count++;
+}
+
+void ai_similar_cleanup(AiSimilarIndex *index) {
+    if (index->entries) {
+        for (size_t i = 0; i < index->capacity; ++i) free(index->entries[i].prompt);
+    }
+    free(index->entries);
+    free(index->band_heads);
+    index->entries = NULL;
+    index->band_heads = NULL;
+    index->count = 0;
+}
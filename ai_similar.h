@@ -0,0 +1,46 @@
+#ifndef AI_SIMILAR_H
+#define AI_SIMILAR_H
+
+#include "irc_bot.h"
+#include <stdint.h>
+
+// --- Near-duplicate prompt index ---
+// MinHash signatures over character shingles of the normalized prompt, split
+// into LSH bands. Prompts that share a band with a new prompt are candidates,
+// and a candidate is accepted when its estimated Jaccard similarity reaches
+// the threshold. The persona is mixed into every band key so each persona
+// effectively has its own index. Capacity is fixed; the oldest entry is
+// overwritten once it is full. Band chains are newest first and a lookup
+// compares at most AI_SIMILAR_MAX_CANDIDATES entries, so its cost does not
+// grow with capacity.
+
+#define AI_SIMILAR_HASHES (AI_SIMILAR_BANDS * AI_SIMILAR_ROWS)
+
+typedef struct {
+    uint64_t persona_hash;
+    uint32_t signature[AI_SIMILAR_HASHES];
+    char *prompt; // Normalized prompt, used as the cache key on a match
+    int32_t band_next[AI_SIMILAR_BANDS];
+    int32_t band_prev[AI_SIMILAR_BANDS]; // -1 at the head of a chain
+} AiSimilarEntry;
+
+typedef struct {
+    AiSimilarEntry *entries;
+    size_t capacity;
+    size_t count;
+    size_t next_slot; // Ring position for the next insert
+    int32_t *band_heads; // AI_SIMILAR_BANDS * num_buckets chain heads, -1 = empty
+    size_t num_buckets;
+    double threshold;
+    unsigned long lookups;
+    unsigned long matches;
+} AiSimilarIndex;
+
+int ai_similar_init(AiSimilarIndex *index, size_t capacity, double threshold);
+// Returns the stored prompt most similar to prompt (at or above the threshold),
+// or NULL. The pointer stays valid until the next insert.
+const char *ai_similar_lookup(AiSimilarIndex *index, const char *persona, const char *prompt, double *similarity_out);
+void ai_similar_insert(AiSimilarIndex *index, const char *persona, const char *prompt);
+void ai_similar_cleanup(AiSimilarIndex *index);
+
+#endif // AI_SIMILAR_H
@@ -0,0 +1,235 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "ai_usage.h"
+
+#define USAGE_NICK_PROBES 8 // Slots searched for a nick before one is recycled
+
+typedef struct {
+    int64_t hour; // Hours since the epoch
+    AiUsageCounts counts;
+} UsageHour;
+
+// Hourly buckets indexed by hour % AI_USAGE_HOURS; a stale bucket is reset when reused.
+typedef struct {
+    UsageHour hours[AI_USAGE_HOURS];
+    AiUsageCounts lifetime;
+} UsageRing;
+
+typedef struct {
+    uint64_t hash;
+    char nick[MAX_NICK_LEN]; // Lowercased
+    int64_t last_hour;
+    UsageRing usage;
+} UsageNickSlot;
+
+typedef struct {
+    UsageRing usage;
+    long budget_per_hour;
+} UsageChannel;
+
+typedef struct {
+    sem_t lock;
+    UsageNickSlot nicks[AI_USAGE_NICK_SLOTS];
+    int num_channels;
+    UsageChannel channels[]; // One per worker
+} AiUsageTable;
+
+static AiUsageTable *g_usage = NULL;
+static size_t g_usage_size = 0;
+
+static bool usage_lock(void) {
+    while (sem_wait(&g_usage->lock) == -1) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+static void usage_unlock(void) {
+    sem_post(&g_usage->lock);
+}
+
+static int64_t current_hour(void) {
+    return (int64_t)time(NULL) / 3600;
+}
+
+static void counts_add(AiUsageCounts *to, const AiUsageCounts *from) {
+    to->requests += from->requests;
+    to->prompt_tokens += from->prompt_tokens;
+    to->output_tokens += from->output_tokens;
+    to->total_tokens += from->total_tokens;
+}
+
+static void ring_add(UsageRing *ring, int64_t hour, const AiUsageCounts *counts) {
+    UsageHour *bucket = &ring->hours[hour % AI_USAGE_HOURS];
+    if (bucket->hour != hour) {
+        memset(bucket, 0, sizeof(*bucket));
+        bucket->hour = hour;
+    }
+    counts_add(&bucket->counts, counts);
+    counts_add(&ring->lifetime, counts);
+}
+
+static AiUsageCounts ring_hour(const UsageRing *ring, int64_t hour) {
+    const UsageHour *bucket = &ring->hours[hour % AI_USAGE_HOURS];
+    AiUsageCounts counts = {0, 0, 0, 0};
+    if (bucket->hour == hour) counts = bucket->counts;
+    return counts;
+}
+
+static AiUsageCounts ring_day(const UsageRing *ring, int64_t hour) {
+    AiUsageCounts counts = {0, 0, 0, 0};
+    for (int i = 0; i < AI_USAGE_HOURS; ++i) {
+        const UsageHour *bucket = &ring->hours[i];
+        if (bucket->hour > hour - AI_USAGE_HOURS && bucket->hour <= hour) counts_add(&counts, &bucket->counts);
+    }
+    return counts;
+}
+
+int ai_usage_init(int num_channels) {
+    char parent_tag[32];
+    snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
+    if (num_channels < 0) num_channels = 0;
+    g_usage_size = sizeof(AiUsageTable) + (size_t)num_channels * sizeof(UsageChannel);
+    g_usage = (AiUsageTable *)mmap(NULL, g_usage_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_usage == MAP_FAILED) {
+        app_log(parent_tag, "ERROR", "mmap for the token usage table failed: %s", strerror(errno));
+        g_usage = NULL;
+        return EXIT_FAILURE;
+    }
+    memset(g_usage, 0, g_usage_size);
+    if (sem_init(&g_usage->lock, 1, 1) == -1) {
+        app_log(parent_tag, "ERROR", "sem_init for the token usage table failed: %s", strerror(errno));
+        munmap(g_usage, g_usage_size);
+        g_usage = NULL;
+        return EXIT_FAILURE;
+    }
+    g_usage->num_channels = num_channels;
+    app_log(parent_tag, "INFO", "Token usage table initialized: %d channel(s), %d nick slots, %d hours kept.",
+            num_channels, AI_USAGE_NICK_SLOTS, AI_USAGE_HOURS);
+    return EXIT_SUCCESS;
+}
+
+void ai_usage_cleanup(void) {
+    if (g_usage == NULL) return;
+    sem_destroy(&g_usage->lock);
+    munmap(g_usage, g_usage_size);
+    g_usage = NULL;
+}
+
+static UsageChannel *channel_slot(int channel) {
+    return (channel >= 0 && channel < g_usage->num_channels) ? &g_usage->channels[channel] : NULL;
+}
+
+// Finds the nick's slot, or recycles the one near its home position that was
+// used longest ago. Caller holds the lock.
+static UsageNickSlot *nick_slot(const char *nick, int64_t hour) {
+    char lowered[MAX_NICK_LEN];
+    uint64_t hash = irc_nick_fold(nick, lowered, sizeof(lowered));
+
+    UsageNickSlot *victim = NULL;
+    for (int probe = 0; probe < USAGE_NICK_PROBES; ++probe) {
+        UsageNickSlot *slot = &g_usage->nicks[(hash + (uint64_t)probe) % AI_USAGE_NICK_SLOTS];
+        if (slot->hash == hash && strcmp(slot->nick, lowered) == 0) return slot;
+        if (victim == NULL || slot->last_hour < victim->last_hour) victim = slot;
+    }
+    memset(victim, 0, sizeof(*victim));
+    victim->hash = hash;
+    snprintf(victim->nick, sizeof(victim->nick), "%s", lowered);
+    victim->last_hour = hour;
+    return victim;
+}
+
+void ai_usage_set_budget(int channel, long tokens_per_hour) {
+    if (g_usage == NULL || !usage_lock()) return;
+    UsageChannel *slot = channel_slot(channel);
+    if (slot) slot->budget_per_hour = tokens_per_hour;
+    usage_unlock();
+}
+
+void ai_usage_record(int channel, const char *nick, long prompt_tokens, long output_tokens, long total_tokens) {
+    if (g_usage == NULL || !usage_lock()) return;
+    if (total_tokens <= 0) total_tokens = prompt_tokens + output_tokens;
+    AiUsageCounts counts = {1, (unsigned long)prompt_tokens, (unsigned long)output_tokens, (unsigned long)total_tokens};
+    int64_t hour = current_hour();
+    UsageChannel *slot = channel_slot(channel);
+    if (slot) ring_add(&slot->usage, hour, &counts);
+    UsageNickSlot *user = nick_slot(nick, hour);
+    user->last_hour = hour;
+    ring_add(&user->usage, hour, &counts);
+    usage_unlock();
+}
+
+AiBudgetState ai_usage_budget_state(int channel, long *minutes_left_out) {
+    time_t now = time(NULL);
+    *minutes_left_out = (3600 - (long)(now % 3600) + 59) / 60;
+    if (g_usage == NULL || !usage_lock()) return AI_BUDGET_OK;
+    AiBudgetState state = AI_BUDGET_OK;
+    UsageChannel *slot = channel_slot(channel);
+    if (slot && slot->budget_per_hour > 0) {
+        unsigned long used = ring_hour(&slot->usage, current_hour()).total_tokens;
+        unsigned long budget = (unsigned long)slot->budget_per_hour;
+        if (used >= budget) state = AI_BUDGET_EXHAUSTED;
+        else if (used * 100 >= budget * AI_USAGE_THROTTLE_PERCENT) state = AI_BUDGET_THROTTLED;
+    }
+    usage_unlock();
+    return state;
+}
+
+bool ai_usage_channel_report(int channel, AiUsageReport *out) {
+    memset(out, 0, sizeof(*out));
+    if (g_usage == NULL || !usage_lock()) return false;
+    UsageChannel *slot = channel_slot(channel);
+    if (slot) {
+        int64_t hour = current_hour();
+        out->hour = ring_hour(&slot->usage, hour);
+        out->day = ring_day(&slot->usage, hour);
+        out->lifetime = slot->usage.lifetime;
+        out->budget_per_hour = slot->budget_per_hour;
+    }
+    usage_unlock();
+    return slot != NULL;
+}
+
+bool ai_usage_total_report(AiUsageReport *out) {
+    memset(out, 0, sizeof(*out));
+    if (g_usage == NULL || !usage_lock()) return false;
+    int64_t hour = current_hour();
+    for (int i = 0; i < g_usage->num_channels; ++i) {
+        const UsageChannel *slot = &g_usage->channels[i];
+        AiUsageCounts counts = ring_hour(&slot->usage, hour);
+        counts_add(&out->hour, &counts);
+        counts = ring_day(&slot->usage, hour);
+        counts_add(&out->day, &counts);
+        counts_add(&out->lifetime, &slot->usage.lifetime);
+        out->budget_per_hour += slot->budget_per_hour;
+    }
+    usage_unlock();
+    return true;
+}
+
+int ai_usage_top_nicks(AiUsageNick *out, int max) {
+    if (g_usage == NULL || max <= 0 || !usage_lock()) return 0;
+    int64_t hour = current_hour();
+    int count = 0;
+    for (int i = 0; i < AI_USAGE_NICK_SLOTS; ++i) {
+        const UsageNickSlot *slot = &g_usage->nicks[i];
+        if (slot->nick[0] == '\0') continue;
+        AiUsageCounts day = ring_day(&slot->usage, hour);
+        if (day.requests == 0) continue;
+        // Insertion into the short sorted list
+        int pos = count < max ? count : max;
+        while (pos > 0 && out[pos - 1].day.total_tokens < day.total_tokens) {
+            if (pos < max) out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos >= max) continue;
+        snprintf(out[pos].nick, sizeof(out[pos].nick), "%s", slot->nick);
+        out[pos].day = day;
+        if (count < max) count++;
+    }
+    usage_unlock();
+    return count;
+}
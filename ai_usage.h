@@ -0,0 +1,59 @@
+#ifndef AI_USAGE_H
+#define AI_USAGE_H
+
+#include "irc_bot.h"
+
+// --- Token accounting ---
+// Token counts reported by the backend (usageMetadata, or usage for
+// OpenAI-compatible servers) are added up in shared memory mapped by the
+// parent before forking: per channel and per nick, each in a ring of hourly
+// buckets covering the last AI_USAGE_HOURS hours. A channel may have an
+// hourly token budget; past AI_USAGE_THROTTLE_PERCENT of it the channel's
+// worker sends one request at a time, and once it is spent new asks are
+// refused until the hour is over.
+
+typedef struct {
+    unsigned long requests;
+    unsigned long prompt_tokens;
+    unsigned long output_tokens;
+    unsigned long total_tokens;
+} AiUsageCounts;
+
+typedef struct {
+    AiUsageCounts hour; // The current clock hour
+    AiUsageCounts day; // The last AI_USAGE_HOURS hours, current one included
+    AiUsageCounts lifetime;
+    long budget_per_hour; // Tokens, 0 = no budget
+} AiUsageReport;
+
+typedef struct {
+    char nick[MAX_NICK_LEN];
+    AiUsageCounts day;
+} AiUsageNick;
+
+typedef enum {
+    AI_BUDGET_OK,
+    AI_BUDGET_THROTTLED, // Past AI_USAGE_THROTTLE_PERCENT of this hour's budget
+    AI_BUDGET_EXHAUSTED
+} AiBudgetState;
+
+// Called by the parent before forking. Returns EXIT_SUCCESS or EXIT_FAILURE.
+int ai_usage_init(int num_channels);
+void ai_usage_cleanup(void);
+
+// Sets channel's hourly token budget (0 for none); each worker sets its own.
+void ai_usage_set_budget(int channel, long tokens_per_hour);
+// Adds one request's usage. A total of 0 is taken as prompt + output.
+void ai_usage_record(int channel, const char *nick, long prompt_tokens, long output_tokens, long total_tokens);
+// Where channel stands against its budget this hour. *minutes_left_out is
+// the time until the hour rolls over.
+AiBudgetState ai_usage_budget_state(int channel, long *minutes_left_out);
+
+bool ai_usage_channel_report(int channel, AiUsageReport *out);
+// Adds up every channel. Returns false if the table is missing.
+bool ai_usage_total_report(AiUsageReport *out);
+// Fills out with up to max nicks by tokens used over the last AI_USAGE_HOURS
+// hours, most first. Returns how many were filled in.
+int ai_usage_top_nicks(AiUsageNick *out, int max);
+
+#endif // AI_USAGE_H
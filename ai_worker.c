@@ -0,0 +1,1359 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "ai_worker.h"
+#include <poll.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+static AiWorkerStats g_unshared_stats; // Used if the shared block could not be mapped
+
+static long elapsed_ms_since(const struct timeval *start) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_usec - start->tv_usec) / 1000L;
+}
+
+static void set_after_ms(struct timeval *tv, const struct timeval *base, long ms) {
+    tv->tv_sec = base->tv_sec + ms / 1000;
+    tv->tv_usec = base->tv_usec + (ms % 1000) * 1000;
+    if (tv->tv_usec >= 1000000) {
+        tv->tv_sec++;
+        tv->tv_usec -= 1000000;
+    }
+}
+
+// Negative once the deadline has passed.
+static long deadline_ms_left(const AiJob *job) {
+    return -elapsed_ms_since(&job->deadline);
+}
+
+static void free_job(AiJob *job) {
+    free(job->persona);
+    free(job->prompt);
+    free(job->history);
+    free(job->context_persona);
+    free(job->response);
+    free(job->stream_partial);
+    free(job->held_lines);
+    free(job);
+}
+
+// Whether job's answer may be posted: nothing earlier is still unposted, or,
+// with fair scheduling, nothing earlier from the same asker.
+static bool is_next_in_line(const AiWorker *aw, const AiJob *job) {
+    if (AI_OUT_OF_ORDER_REPLIES) return true;
+    for (const AiJob *earlier = aw->head; earlier && earlier != job; earlier = earlier->next) {
+        if (!AI_SCHED_FAIR || irc_nick_equal(earlier->nick, job->nick)) return false;
+    }
+    return true;
+}
+
+// --- Streamed line delivery ---
+static bool can_post_now(AiWorker *aw, AiJob *job) {
+    return is_next_in_line(aw, job);
+}
+
+static void post_line(AiWorker *aw, AiJob *job, const char *line) {
+    send_irc(aw->socket_fd, "PRIVMSG %s :%s: %s", aw->channel->name, job->nick, line);
+    if (job->first_line_ms < 0) {
+        job->first_line_ms = elapsed_ms_since(&job->enqueued_at);
+        aw->stats->first_line_ms_total += (unsigned long)job->first_line_ms;
+        aw->stats->first_line_samples++;
+    }
+}
+
+static void flush_held_lines(AiWorker *aw, AiJob *job) {
+    if (job->held_len == 0) return;
+    char *saveptr;
+    for (char *line = strtok_r(job->held_lines, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        post_line(aw, job, line);
+    }
+    job->held_len = 0;
+    job->held_lines[0] = '\0';
+}
+
+static void emit_stream_line(AiWorker *aw, AiJob *job, const char *line, size_t len) {
+    while (len > 0 && isspace((unsigned char)*line)) { line++; len--; }
+    while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+    if (len == 0) return;
+    job->streamed = true;
+
+    if (can_post_now(aw, job)) {
+        flush_held_lines(aw, job);
+        char line_copy[AI_STREAM_MAX_LINE + 1];
+        snprintf(line_copy, sizeof(line_copy), "%.*s", (int)len, line);
+        post_line(aw, job, line_copy);
+        return;
+    }
+    char *grown = (char *)realloc(job->held_lines, job->held_len + len + 2);
+    if (grown == NULL) return;
+    job->held_lines = grown;
+    memcpy(job->held_lines + job->held_len, line, len);
+    job->held_len += len;
+    job->held_lines[job->held_len++] = '\n';
+    job->held_lines[job->held_len] = '\0';
+}
+
+// Finds where the next line ends in text: a newline, the last sentence end
+// past AI_STREAM_MIN_LINE, or a wrap point once AI_STREAM_MAX_LINE is reached.
+// Returns the line length and sets *skip to the number of bytes to consume;
+// *skip is 0 when no line is complete yet.
+static size_t next_line_length(const char *text, size_t len, bool final, size_t *skip) {
+    size_t limit = len < AI_STREAM_MAX_LINE ? len : AI_STREAM_MAX_LINE;
+    const char *newline = memchr(text, '\n', limit);
+    if (newline) {
+        *skip = (size_t)(newline - text) + 1;
+        return (size_t)(newline - text);
+    }
+    size_t sentence_end = 0;
+    for (size_t i = AI_STREAM_MIN_LINE; i + 1 < limit; ++i) {
+        if ((text[i] == '.' || text[i] == '!' || text[i] == '?') && text[i + 1] == ' ') sentence_end = i + 1;
+    }
+    if (sentence_end > 0) {
+        *skip = sentence_end;
+        return sentence_end;
+    }
+    if (len >= AI_STREAM_MAX_LINE) {
+        size_t wrap = limit;
+        while (wrap > AI_STREAM_MIN_LINE && text[wrap - 1] != ' ') wrap--;
+        if (wrap == AI_STREAM_MIN_LINE) wrap = limit;
+        *skip = wrap;
+        return wrap;
+    }
+    *skip = final ? len : 0;
+    return final ? len : 0;
+}
+
+static void drain_stream_lines(AiWorker *aw, AiJob *job, bool final) {
+    size_t offset = 0;
+    while (offset < job->stream_partial_len) {
+        size_t skip = 0;
+        size_t line_len = next_line_length(job->stream_partial + offset, job->stream_partial_len - offset, final, &skip);
+        if (skip == 0) break;
+        emit_stream_line(aw, job, job->stream_partial + offset, line_len);
+        offset += skip;
+    }
+    memmove(job->stream_partial, job->stream_partial + offset, job->stream_partial_len - offset);
+    job->stream_partial_len -= offset;
+}
+
+static void on_stream_text(void *user_data, const char *text) {
+    AiAttempt *attempt = (AiAttempt *)user_data;
+    // A batch's JSON is only useful once complete, and an FAQ answer is only stored
+    if (attempt == NULL || attempt->batch || attempt->job == NULL) return;
+    AiJob *job = attempt->job;
+    // With a hedge in flight, whichever copy speaks first owns the posted lines
+    if (job->stream_source == NULL) {
+        job->stream_source = attempt;
+        ai_latency_add(&job->owner->latency, elapsed_ms_since(&attempt->sent_at)); // Hedging looks at time to first text
+    } else if (job->stream_source != attempt) {
+        return;
+    }
+    size_t len = strlen(text);
+    char *grown = (char *)realloc(job->stream_partial, job->stream_partial_len + len + 1);
+    if (grown == NULL) return;
+    job->stream_partial = grown;
+    memcpy(job->stream_partial + job->stream_partial_len, text, len);
+    job->stream_partial_len += len;
+    drain_stream_lines(job->owner, job, false);
+}
+
+static void publish_cache_stats(AiWorker *aw) {
+    aw->stats->cache_hits = aw->cache.hits;
+    aw->stats->cache_misses = aw->cache.misses;
+    aw->stats->cache_entries = aw->cache.entries;
+    aw->stats->cache_bytes = aw->cache.bytes_used;
+}
+
+int ai_worker_init(AiWorker *aw, int worker_id, const char *tag, const ChannelInfo *channel, int socket_fd, const char *api_key) {
+    memset(aw, 0, sizeof(*aw));
+    aw->worker_id = worker_id;
+    aw->tag = tag;
+    aw->channel = channel;
+    aw->socket_fd = socket_fd;
+    aw->stats = g_ai_stats ? &g_ai_stats[worker_id] : &g_unshared_stats;
+
+    char cache_path[256];
+    const char *disk_path = NULL;
+    if (AI_CACHE_DISK_ENABLED && (mkdir(AI_CACHE_DIR, 0755) == 0 || errno == EEXIST)) {
+        snprintf(cache_path, sizeof(cache_path), "%s/%s.bin", AI_CACHE_DIR, channel->name);
+        disk_path = cache_path;
+    }
+    ai_cache_init(&aw->cache, AI_CACHE_MEMORY_BUDGET, AI_CACHE_TTL_SECONDS, disk_path);
+    if (AI_SIMILAR_ENABLED) ai_similar_init(&aw->similar, AI_SIMILAR_MAX_ENTRIES, AI_SIMILAR_THRESHOLD);
+    if (AI_MEMORY_ENABLED) ai_memory_init(&aw->memory, AI_MEMORY_ARENA_BYTES);
+    if (AI_MARKOV_ENABLED) {
+        char markov_path[256];
+        bool on_disk = (mkdir(AI_CACHE_DIR, 0755) == 0 || errno == EEXIST);
+        if (on_disk) snprintf(markov_path, sizeof(markov_path), "%s/%s.markov", AI_CACHE_DIR, channel->name);
+        if (ai_markov_open(&aw->markov, on_disk ? markov_path : NULL) == 0) {
+            app_log(tag, "INFO", "Offline model ready (%lu messages learnt).", ai_markov_messages(&aw->markov));
+        }
+    }
+    if (AI_RECALL_ENABLED) ai_recall_init(&aw->recall, AI_RECALL_WINDOW);
+    if (AI_FAQ_ENABLED) {
+        char faq_path[256], answers_path[256];
+        snprintf(faq_path, sizeof(faq_path), "%s/%s.txt", AI_FAQ_DIR, channel->name);
+        snprintf(answers_path, sizeof(answers_path), "%s/%s.faq", AI_CACHE_DIR, channel->name);
+        if (ai_faq_open(&aw->faq, faq_path, disk_path ? answers_path : NULL) == 0 && aw->faq.num_entries > 0) {
+            app_log(tag, "INFO", "Loaded %zu FAQ entries (%zu questions) from %s.", aw->faq.num_entries, aw->faq.num_questions, faq_path);
+        }
+        gettimeofday(&aw->faq_checked_at, NULL);
+    }
+
+    aw->deadline_ms = AI_REQUEST_DEADLINE_MS;
+    AiBackendConfig backend_config;
+    if (ai_backend_parse_config(channel->backend_options, &backend_config) != 0) {
+        app_log(tag, "ERROR", "Invalid backend options '%s'. AI features will be disabled for this worker.", channel->backend_options);
+        return -1;
+    }
+    ai_backend_setup(&aw->backend, &backend_config);
+    aw->deadline_ms = backend_config.deadline_ms;
+    aw->use_quota = AI_QUOTA_ENABLED && backend_config.use_quota;
+    aw->supersede = backend_config.supersede;
+    aw->batch_window_ms = backend_config.batch_window_ms;
+    ai_usage_set_budget(worker_id, backend_config.budget_tokens_per_hour);
+    if (backend_config.kind == AI_BACKEND_GEMINI && api_key == NULL && backend_config.key_env[0] == '\0') return 0;
+    if (aw->backend.ops->init(&aw->backend, api_key, AI_MAX_CONCURRENT_REQUESTS, AI_STREAMING_ENABLED ? on_stream_text : NULL) != 0) {
+        app_log(tag, "ERROR", "Failed to initialize the %s backend. AI features will be disabled for this worker.", aw->backend.ops->name);
+        aw->backend.ops->cleanup(&aw->backend);
+        return -1;
+    }
+    aw->backend_ready = true;
+    ai_route_init(&aw->router, &backend_config, aw->backend.http.model, aw->stats->models, &aw->stats->num_models, tag);
+    char model_names[AI_ROUTE_MAX_MODELS * 64] = "";
+    size_t names_len = 0;
+    for (int i = 0; i < aw->router.count && names_len < sizeof(model_names); ++i) {
+        names_len += (size_t)snprintf(model_names + names_len, sizeof(model_names) - names_len, "%s%s", i ? "," : "",
+                                      ai_route_model_name(&aw->router, i));
+    }
+    app_log(tag, "INFO", "AI backend '%s' ready (model %s, up to %d concurrent requests, %ld ms deadline, %s%s replies, cache %s).",
+            aw->backend.ops->name, model_names, AI_MAX_CONCURRENT_REQUESTS, aw->deadline_ms,
+            AI_OUT_OF_ORDER_REPLIES ? "out-of-order" : "in-order", AI_STREAMING_ENABLED ? " streamed" : "",
+            aw->cache.disk ? "memory+disk" : "memory");
+    return 0;
+}
+
+static AiJob *new_job(AiWorker *aw, const char *nick, const char *persona, const char *prompt, bool priority) {
+    AiJob *job = (AiJob *)calloc(1, sizeof(AiJob));
+    if (job == NULL) {
+        app_log(aw->tag, "ERROR", "Failed to allocate AI job: %s", strerror(errno));
+        return NULL;
+    }
+    snprintf(job->nick, sizeof(job->nick), "%s", nick);
+    job->owner = aw;
+    job->priority = priority;
+    job->first_line_ms = -1;
+    job->persona = strdup(persona);
+    job->prompt = strdup(prompt);
+    if (job->persona == NULL || job->prompt == NULL) {
+        app_log(aw->tag, "ERROR", "strdup failed for AI job: %s", strerror(errno));
+        free_job(job);
+        return NULL;
+    }
+    job->seq = ++aw->next_seq;
+    job->state = AI_JOB_QUEUED;
+    gettimeofday(&job->enqueued_at, NULL);
+    set_after_ms(&job->deadline, &job->enqueued_at, aw->deadline_ms);
+    return job;
+}
+
+// Copies the conversation window that fits next to persona and prompt into one
+// block the job owns, since the arena may be overwritten before it is sent.
+static GeminiTurn *snapshot_history(AiWorker *aw, const char *nick, const char *persona, const char *prompt,
+                                    size_t *len_out, uint64_t *fingerprint_out) {
+    *len_out = 0;
+    *fingerprint_out = 0;
+    int budget = AI_MEMORY_TOKEN_BUDGET - ai_estimate_tokens(strlen(persona)) - ai_estimate_tokens(strlen(prompt));
+    const AiMemoryTurn *window[AI_MEMORY_MAX_TURNS];
+    int count = ai_memory_window(&aw->memory, AI_MEMORY_PER_NICK ? nick : NULL, budget, window, AI_MEMORY_MAX_TURNS);
+    if (count == 0) return NULL;
+
+    size_t bytes = (size_t)count * sizeof(GeminiTurn);
+    for (int i = 0; i < count; ++i) bytes += window[i]->nick_len + window[i]->text_len + 3;
+    GeminiTurn *turns = (GeminiTurn *)malloc(bytes);
+    if (turns == NULL) return NULL;
+
+    char *text = (char *)(turns + count);
+    uint64_t fingerprint = 0;
+    for (int i = 0; i < count; ++i) {
+        const AiMemoryTurn *turn = window[i];
+        int written = turn->from_model
+                          ? sprintf(text, "%s", ai_memory_turn_text(&aw->memory, turn))
+                          : sprintf(text, "%s: %s", ai_memory_turn_nick(&aw->memory, turn), ai_memory_turn_text(&aw->memory, turn));
+        turns[i].from_model = turn->from_model;
+        turns[i].text = text;
+        fingerprint = ai_hash64(text, (size_t)written + 1, fingerprint + turn->from_model);
+        text += written + 1;
+    }
+    *len_out = (size_t)count;
+    *fingerprint_out = fingerprint;
+    return turns;
+}
+
+static const char *job_cache_persona(const AiJob *job) {
+    return job->context_persona ? job->context_persona : job->persona;
+}
+
+static void append_job(AiWorker *aw, AiJob *job) {
+    if (aw->tail) aw->tail->next = job;
+    else aw->head = job;
+    aw->tail = job;
+}
+
+static void publish_flight(AiJob *job) {
+    if (!job->flight_owner) return;
+    ai_flight_complete(&job->flight, job->response);
+    job->flight_owner = false;
+}
+
+// Prompt tokens of a request plus the most the answer can use.
+static long estimate_request_tokens(const char *persona, const GeminiTurn *history, size_t history_len, const char *prompt) {
+    size_t chars = strlen(persona) + strlen(prompt);
+    for (size_t i = 0; i < history_len; ++i) chars += strlen(history[i].text);
+    return ai_estimate_tokens(chars) + AI_MAX_OUTPUT_TOKENS;
+}
+
+static long estimate_job_tokens(const AiJob *job) {
+    return estimate_request_tokens(job->persona, job->history, job->history_len, job->prompt);
+}
+
+// Guesses how long an answer the question asks for: a fraction of
+// AI_MAX_OUTPUT_TOKENS for "briefly" or "yes or no", all of it for "explain
+// in detail" or "step by step", half otherwise.
+static long requested_output_tokens(const char *prompt) {
+    static const char *const brief_cues[] = { "brief", "short", "quick", "one word", "one sentence", "yes or no", "tl;dr", "tldr" };
+    static const char *const long_cues[] = { "detail", "explain", "step by step", "essay", "in depth", "compare", "list ", "write " };
+    char lowered[512];
+    size_t len = 0;
+    for (; prompt[len] && len + 1 < sizeof(lowered); ++len) lowered[len] = (char)tolower((unsigned char)prompt[len]);
+    lowered[len] = '\0';
+    for (size_t i = 0; i < sizeof(brief_cues) / sizeof(brief_cues[0]); ++i) {
+        if (strstr(lowered, brief_cues[i])) return AI_MAX_OUTPUT_TOKENS / 5;
+    }
+    for (size_t i = 0; i < sizeof(long_cues) / sizeof(long_cues[0]); ++i) {
+        if (strstr(lowered, long_cues[i])) return AI_MAX_OUTPUT_TOKENS;
+    }
+    return AI_MAX_OUTPUT_TOKENS / 2;
+}
+
+// The scheduler's cost of a job; unlike estimate_job_tokens() it uses the expected answer size.
+static long estimate_job_cost(const AiJob *job) {
+    return estimate_job_tokens(job) - AI_MAX_OUTPUT_TOKENS + requested_output_tokens(job->prompt);
+}
+
+// Whether job may wait for others to share a request with: a short, unsent
+// question that does not ask for a long answer.
+static bool is_batchable(const AiWorker *aw, const AiJob *job) {
+    return aw->batch_window_ms > 0 && job->state == AI_JOB_QUEUED && job->sends == 0 && !job->unbatched && !job->priority &&
+           !timerisset(&job->retry_at) && strlen(job->prompt) <= AI_BATCH_MAX_PROMPT_CHARS &&
+           requested_output_tokens(job->prompt) < AI_MAX_OUTPUT_TOKENS;
+}
+
+static bool send_attempt(AiWorker *aw, AiJob *job, AiAttempt *attempt, long time_left) {
+    attempt->job = job;
+    attempt->model = ai_route_pick(&aw->router, estimate_request_tokens(job->persona, job->history, job->history_len, job->prompt));
+    bool short_answer = aw->overload_level >= 1 && !job->priority;
+    if (aw->backend.ops->submit(&aw->backend, ai_route_model_name(&aw->router, attempt->model), job->persona, job->history, job->history_len, job->prompt,
+                                short_answer, time_left, attempt, &attempt->request_id) != 0) return false;
+    attempt->active = true;
+    gettimeofday(&attempt->sent_at, NULL);
+    aw->stats->api_calls++;
+    return true;
+}
+
+// Gives back the tokens charged for a request that produced none.
+static void refund_quota(AiAttempt *attempt) {
+    if (attempt->quota_tokens > 0) ai_quota_settle(attempt->quota_tokens, 0);
+    attempt->quota_tokens = 0;
+}
+
+// Aborts a request whose answer is no longer wanted; it counts as wasted.
+static void cancel_attempt(AiWorker *aw, AiAttempt *attempt) {
+    if (!attempt->active) return;
+    aw->backend.ops->cancel(&aw->backend, attempt->request_id);
+    attempt->active = false;
+    aw->stats->wasted_calls++;
+    ai_breaker_release(&aw->breaker);
+}
+
+// Takes job out of its batch. The batch request is aborted once no job is left on it.
+static void leave_batch(AiWorker *aw, AiJob *job) {
+    AiBatch *batch = job->batch;
+    if (batch == NULL) return;
+    job->batch = NULL;
+    bool others_left = false;
+    for (int i = 0; i < batch->count; ++i) {
+        if (batch->jobs[i] == job) batch->jobs[i] = NULL;
+        else if (batch->jobs[i]) others_left = true;
+    }
+    if (others_left) return;
+    cancel_attempt(aw, &batch->attempt);
+    refund_quota(&batch->attempt);
+    free(batch);
+}
+
+// Stops all work on a job that will not be answered. In-flight requests are
+// aborted and counted as wasted; jobs attached to its flight send on their own.
+static void abandon_job(AiWorker *aw, AiJob *job) {
+    leave_batch(aw, job);
+    cancel_attempt(aw, &job->attempts[0]);
+    cancel_attempt(aw, &job->attempts[1]);
+    free(job->response);
+    job->response = NULL;
+    job->state = AI_JOB_DONE;
+    publish_flight(job);
+}
+
+static void expire_job(AiWorker *aw, AiJob *job) {
+    app_log(aw->tag, "AI_TIMEOUT", "!ask #%lu from %s passed its %ld ms deadline %s.", job->seq, job->nick, aw->deadline_ms,
+            job->state == AI_JOB_INFLIGHT ? "in flight; aborting it" : "before it was sent");
+    if (job->state == AI_JOB_INFLIGHT && job->batch == NULL) ai_breaker_record(&aw->breaker, AI_FAILURE_TIMEOUT, aw->tag);
+    abandon_job(aw, job);
+    job->expired = true;
+    aw->stats->expired++;
+}
+
+static void drop_job(AiWorker *aw, AiJob *job, const char *reason) {
+    app_log(aw->tag, "AI_CANCEL", "Dropping !ask #%lu from %s: %s.", job->seq, job->nick, reason);
+    if (job->state == AI_JOB_DONE) {
+        if (job->response && !job->cached && !job->coalesced) aw->stats->wasted_calls++;
+    } else {
+        abandon_job(aw, job);
+    }
+    job->dropped = true;
+    aw->stats->cancelled++;
+}
+
+void ai_worker_drop_nick(AiWorker *aw, const char *nick) {
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (!job->dropped && irc_nick_equal(job->nick, nick)) drop_job(aw, job, "asker left");
+    }
+}
+
+// --- Overload control ---
+static const char *const OVERLOAD_LEVEL_NAMES[] = { "normal", "short answers", "no history", "busy" };
+
+static void apply_overload_level(AiWorker *aw, int level, int queued, long oldest_ms) {
+    int old_level = aw->overload_level;
+    aw->overload_level = level;
+    aw->stats->overload_level = level;
+    if (level > old_level) aw->stats->overload_raises++;
+    else aw->stats->overload_recoveries++;
+    app_log(aw->tag, "AI_OVERLOAD", "Overload level %d -> %d (%s): %d queued, oldest waiting %ld ms.", old_level, level,
+            OVERLOAD_LEVEL_NAMES[level], queued, oldest_ms);
+}
+
+// Sets the overload level from the number of asks waiting to be sent and how
+// long the oldest has waited. It rises as soon as a threshold is reached and
+// drops one level once load has stayed under AI_OVERLOAD_RECOVER_PERCENT of
+// the current level's thresholds for AI_OVERLOAD_RECOVER_MS.
+static void update_overload(AiWorker *aw) {
+    static const int queue_levels[] = AI_OVERLOAD_QUEUE_LEVELS;
+    static const long age_levels[] = AI_OVERLOAD_AGE_LEVELS_MS;
+    int queued = 0;
+    long oldest_ms = 0;
+    for (const AiJob *job = aw->head; job; job = job->next) {
+        if (job->state != AI_JOB_QUEUED) continue;
+        queued++;
+        long waited = elapsed_ms_since(&job->enqueued_at);
+        if (waited > oldest_ms) oldest_ms = waited;
+    }
+
+    int target = 0;
+    for (int level = 1; level <= 3; ++level) {
+        if (queued >= queue_levels[level - 1] || oldest_ms >= age_levels[level - 1]) target = level;
+    }
+    if (target > aw->overload_level) {
+        apply_overload_level(aw, target, queued, oldest_ms);
+        timerclear(&aw->overload_calm_since);
+        return;
+    }
+    if (aw->overload_level == 0) return;
+
+    int level = aw->overload_level;
+    bool calm = queued * 100 < queue_levels[level - 1] * AI_OVERLOAD_RECOVER_PERCENT &&
+                oldest_ms * 100 < age_levels[level - 1] * AI_OVERLOAD_RECOVER_PERCENT;
+    if (!calm) {
+        timerclear(&aw->overload_calm_since);
+    } else if (!timerisset(&aw->overload_calm_since)) {
+        gettimeofday(&aw->overload_calm_since, NULL);
+    } else if (elapsed_ms_since(&aw->overload_calm_since) >= AI_OVERLOAD_RECOVER_MS) {
+        apply_overload_level(aw, level - 1, queued, oldest_ms);
+        timerclear(&aw->overload_calm_since); // The next level down needs its own calm spell
+    }
+}
+
+void ai_worker_observe(AiWorker *aw, const char *nick, const char *text) {
+    ai_markov_learn(&aw->markov, text);
+    ai_recall_add(&aw->recall, nick, text);
+}
+
+// Answers prompt from the channel FAQ if it matches a question with an
+// answer. Goes through the job list so in-order replies stay ordered.
+static bool answer_from_faq(AiWorker *aw, const char *nick, const char *persona, const char *prompt, bool priority) {
+    double similarity = 0;
+    int entry = ai_faq_match(&aw->faq, prompt, AI_FAQ_THRESHOLD, &similarity);
+    if (entry < 0 || aw->faq.entries[entry].answer == NULL) return false;
+    AiJob *job = new_job(aw, nick, persona, prompt, priority);
+    if (job == NULL) return false;
+    job->response = strdup(aw->faq.entries[entry].answer);
+    if (job->response == NULL) {
+        free_job(job);
+        return false;
+    }
+    job->state = AI_JOB_DONE;
+    job->faq = true;
+    append_job(aw, job);
+    aw->stats->faq_answers++;
+    app_log(aw->tag, "AI_FAQ", "Answering !ask #%lu from [%s] with FAQ entry '%s' (similarity %.2f).", job->seq, nick,
+            aw->faq.entries[entry].question, similarity);
+    return true;
+}
+
+// Appends the earlier channel lines that best match prompt to the persona, so
+// the model can see what was said. Returns persona itself if nothing matched.
+static const char *recall_context(AiWorker *aw, const char *nick, const char *persona, const char *prompt,
+                                  char *out, size_t out_size) {
+    char lines[AI_RECALL_MAX_CHARS + 1];
+    int found = ai_recall_query(&aw->recall, prompt, AI_RECALL_TOP_K, AI_RECALL_MIN_SCORE, lines, sizeof(lines));
+    if (found == 0) return persona;
+    snprintf(out, out_size, "%s\n\nEarlier messages in %s that may be relevant:\n%s", persona, aw->channel->name, lines);
+    aw->stats->recalled_asks++;
+    app_log(aw->tag, "AI_RECALL", "Recalled %d earlier line(s) for the ask from %s.", found, nick);
+    return out;
+}
+
+// Answers from the offline model. Returns false if it had nothing to say.
+static bool post_offline_answer(AiWorker *aw, const char *nick, const char *prompt) {
+    char reply[512];
+    if (!ai_markov_reply(&aw->markov, prompt, reply, sizeof(reply))) return false;
+    send_irc(aw->socket_fd, "PRIVMSG %s :%s: (offline) %s", aw->channel->name, nick, reply);
+    aw->stats->offline_answers++;
+    app_log(aw->tag, "AI_OFFLINE", "Answered %s from the offline model.", nick);
+    return true;
+}
+
+void ai_worker_enqueue(AiWorker *aw, const char *nick, const char *persona, const char *prompt, bool priority) {
+    aw->stats->asks++;
+    if (priority) aw->stats->priority_asks++;
+    if (AI_OVERLOAD_ENABLED && aw->backend_ready) update_overload(aw);
+    if (aw->supersede) { // Off by default: the scheduler takes turns between askers instead
+        for (AiJob *job = aw->head; job; job = job->next) {
+            if (job->state != AI_JOB_DONE && irc_nick_equal(job->nick, nick)) drop_job(aw, job, "superseded by a newer !ask");
+        }
+    }
+
+    // FAQ answers cost no API call, so they are given even when overloaded or offline.
+    if (AI_FAQ_ENABLED && answer_from_faq(aw, nick, persona, prompt, priority)) return;
+
+    // Recalled lines travel in the persona, so they are part of every key as they are.
+    bool lean = aw->overload_level >= 2 && !priority;
+    char grounded[MAX_PIPE_MSG_LEN + AI_RECALL_MAX_CHARS + 128];
+    const char *request_persona = lean ? persona : recall_context(aw, nick, persona, prompt, grounded, sizeof(grounded));
+
+    // An answer given with history depends on it, so the history fingerprint becomes part of every key.
+    size_t history_len = 0;
+    uint64_t fingerprint = 0;
+    GeminiTurn *history = lean ? NULL : snapshot_history(aw, nick, request_persona, prompt, &history_len, &fingerprint);
+    char context_persona[sizeof(grounded) + 24];
+    const char *key_persona = request_persona;
+    if (history) {
+        snprintf(context_persona, sizeof(context_persona), "%s\x1e%016llx", request_persona, (unsigned long long)fingerprint);
+        key_persona = context_persona;
+    }
+
+    // Cache hits skip the network; they still go through the job list so in-order replies stay ordered.
+    char *cached = ai_cache_lookup(&aw->cache, key_persona, prompt);
+    if (cached == NULL && aw->similar.entries) {
+        double similarity = 0;
+        const char *similar_prompt = ai_similar_lookup(&aw->similar, key_persona, prompt, &similarity);
+        if (similar_prompt) cached = ai_cache_peek(&aw->cache, key_persona, similar_prompt);
+        if (cached) {
+            aw->stats->similar_hits++;
+            app_log(aw->tag, "AI_CACHE", "Reusing answer for similar prompt '%s' (similarity %.2f).", similar_prompt, similarity);
+        }
+    }
+    publish_cache_stats(aw);
+    if (cached) {
+        free(history);
+        AiJob *job = new_job(aw, nick, persona, prompt, priority);
+        if (job == NULL) {
+            free(cached);
+            return;
+        }
+        job->response = cached;
+        job->state = AI_JOB_DONE;
+        job->cached = true;
+        append_job(aw, job);
+        app_log(aw->tag, "AI_CACHE", "Cache hit for !ask #%lu from [%s].", job->seq, nick);
+        return;
+    }
+
+    if (!aw->backend_ready) {
+        free(history);
+        app_log(aw->tag, "AI_SKIP", "AI backend not available. Cannot process !ask from %s.", nick);
+        if (!post_offline_answer(aw, nick, prompt)) {
+            send_irc(aw->socket_fd, "PRIVMSG %s :%s, AI features are currently disabled.", aw->channel->name, nick);
+        }
+        return;
+    }
+    if (aw->overload_level >= 3 && !priority) {
+        free(history);
+        aw->stats->overload_shed++;
+        app_log(aw->tag, "AI_OVERLOAD", "Turned away !ask from %s: too busy.", nick);
+        send_irc(aw->socket_fd, "PRIVMSG %s :%s, I'm too busy to take new questions right now. Please try again in a minute.",
+                 aw->channel->name, nick);
+        return;
+    }
+
+    AiJob *job = new_job(aw, nick, request_persona, prompt, priority);
+    if (job == NULL) {
+        free(history);
+        return;
+    }
+    job->history = history;
+    job->history_len = history_len;
+    job->cost = estimate_job_cost(job);
+    if (history) job->context_persona = strdup(context_persona);
+    append_job(aw, job);
+    // Workers on other backends must not share answers, so the flight key names the backend and model.
+    char flight_persona[sizeof(context_persona) + 128];
+    snprintf(flight_persona, sizeof(flight_persona), "%s/%s\x1d%s", aw->backend.ops->name, aw->backend.http.model, key_persona);
+    AiFlightRole role = AI_FLIGHT_ENABLED ? ai_flight_claim(flight_persona, prompt, aw->worker_id, job->seq, &job->flight)
+                                          : AI_FLIGHT_UNAVAILABLE;
+    if (role == AI_FLIGHT_FOLLOWER) {
+        job->state = AI_JOB_ATTACHED;
+        app_log(aw->tag, "AI_REQUEST", "Attached !ask #%lu from [%s] to an identical pending request. Prompt: '%s'",
+                job->seq, nick, prompt);
+        return;
+    }
+    job->flight_owner = (role == AI_FLIGHT_LEADER);
+    app_log(aw->tag, "AI_REQUEST", "Queued !ask #%lu from [%s]%s with persona: '%s', %zu history turn(s), cost ~%ld tokens. Prompt: '%s'",
+            job->seq, nick, priority ? " (priority)" : "", persona, history_len, job->cost, prompt);
+}
+
+static bool has_attached_jobs(const AiWorker *aw) {
+    for (const AiJob *job = aw->head; job; job = job->next) {
+        if (job->state == AI_JOB_ATTACHED) return true;
+    }
+    return false;
+}
+
+static void remember_answer(AiWorker *aw, AiJob *job) {
+    if (job->history && job->context_persona == NULL) return; // No key that captures the history
+    ai_cache_store(&aw->cache, job_cache_persona(job), job->prompt, job->response);
+    if (aw->similar.entries) ai_similar_insert(&aw->similar, job_cache_persona(job), job->prompt);
+    publish_cache_stats(aw);
+}
+
+// Picks up answers for jobs attached to another worker's request. If that
+// request failed or its owner went away, the job is sent on its own.
+static void poll_attached_jobs(AiWorker *aw) {
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (job->state != AI_JOB_ATTACHED) continue;
+        char *response = NULL;
+        AiFlightStatus status = ai_flight_poll(&job->flight, &response);
+        if (status == AI_FLIGHT_READY) {
+            job->response = response;
+            job->state = AI_JOB_DONE;
+            job->coalesced = true;
+            aw->stats->coalesced++;
+            remember_answer(aw, job);
+        } else if (status == AI_FLIGHT_ABANDONED) {
+            job->state = AI_JOB_QUEUED;
+            app_log(aw->tag, "AI_REQUEST", "Shared request for !ask #%lu was abandoned; sending it directly.", job->seq);
+        }
+    }
+}
+
+// Expires unsent and in-flight jobs whose deadline has passed.
+static void check_deadlines(AiWorker *aw) {
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (job->state != AI_JOB_DONE && deadline_ms_left(job) <= 0) expire_job(aw, job);
+    }
+}
+
+// Milliseconds until the nearest deadline or retry time of an unfinished job, or -1 if none.
+static long next_timer_ms(const AiWorker *aw) {
+    long nearest = -1;
+    for (const AiJob *job = aw->head; job; job = job->next) {
+        if (job->state == AI_JOB_DONE) continue;
+        long left = deadline_ms_left(job);
+        if (job->state == AI_JOB_QUEUED && timerisset(&job->retry_at)) {
+            long until_retry = -elapsed_ms_since(&job->retry_at);
+            if (until_retry < left) left = until_retry;
+        }
+        if (is_batchable(aw, job)) {
+            long until_window_end = aw->batch_window_ms - elapsed_ms_since(&job->enqueued_at);
+            if (until_window_end < left) left = until_window_end;
+        }
+        if (left < 0) left = 0;
+        if (nearest < 0 || left < nearest) nearest = left;
+    }
+    return nearest;
+}
+
+bool ai_worker_wait(AiWorker *aw, int pipe_fd, int timeout_ms) {
+    if (timeout_ms > AI_FLIGHT_POLL_MS && has_attached_jobs(aw)) timeout_ms = AI_FLIGHT_POLL_MS;
+    long until_timer = next_timer_ms(aw);
+    if (until_timer >= 0 && until_timer < timeout_ms) timeout_ms = (int)until_timer;
+    if (aw->backend_ready) {
+        bool pipe_ready = false;
+        aw->backend.ops->wait(&aw->backend, pipe_fd, timeout_ms, &pipe_ready);
+        if (pipe_ready) return true;
+        timeout_ms = 0; // curl only reports POLLIN; recheck without blocking so a closed pipe is noticed
+    }
+
+    struct pollfd pfd = { pipe_fd, POLLIN, 0 };
+    int activity = poll(&pfd, 1, timeout_ms);
+    if (activity < 0 && errno != EINTR) {
+        app_log(aw->tag, "ERROR", "poll error: %s", strerror(errno));
+    }
+    return activity > 0 && (pfd.revents & (POLLIN | POLLHUP));
+}
+
+// Pays for one send of job from the shared quota. Over quota, the job waits
+// for the refill when that fits inside its deadline and is refused otherwise.
+static bool charge_quota(AiWorker *aw, AiJob *job, AiAttempt *attempt, long time_left) {
+    attempt->quota_tokens = 0;
+    if (!aw->use_quota) return true;
+    long tokens = estimate_job_tokens(job);
+    long wait_ms = 0;
+    AiQuotaVerdict verdict = ai_quota_acquire(aw->worker_id, job->nick, tokens, &wait_ms);
+    if (verdict == AI_QUOTA_GRANTED) {
+        attempt->quota_tokens = tokens;
+        return true;
+    }
+    if (wait_ms < time_left) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        set_after_ms(&job->retry_at, &now, wait_ms);
+        if (!job->quota_waited) {
+            job->quota_waited = true;
+            aw->stats->quota_waits++;
+            ai_quota_note_deferred();
+            app_log(aw->tag, "AI_QUOTA", "!ask #%lu from %s is over the %s quota; holding it %ld ms.",
+                    job->seq, job->nick, ai_quota_verdict_name(verdict), wait_ms);
+        }
+        return false;
+    }
+    app_log(aw->tag, "AI_QUOTA", "!ask #%lu from %s is over the %s quota for %ld ms, past its deadline; refusing it.",
+            job->seq, job->nick, ai_quota_verdict_name(verdict), wait_ms);
+    job->state = AI_JOB_DONE;
+    job->quota_refused = verdict;
+    job->quota_wait_ms = wait_ms;
+    aw->stats->quota_rejects++;
+    ai_quota_note_rejected();
+    publish_flight(job);
+    return false;
+}
+
+// --- Scheduling ---
+static unsigned long last_turn(const AiWorker *aw, const char *nick) {
+    for (int i = 0; i < AI_SCHED_NICK_SLOTS; ++i) {
+        if (aw->turns[i].turn && irc_nick_equal(aw->turns[i].nick, nick)) return aw->turns[i].turn;
+    }
+    return 0; // Never served, or not for a long while
+}
+
+// Records that nick just had a job sent, taking the slot of whoever waited longest since theirs.
+static void take_turn(AiWorker *aw, const char *nick) {
+    AiNickTurn *slot = &aw->turns[0];
+    for (int i = 0; i < AI_SCHED_NICK_SLOTS; ++i) {
+        if (aw->turns[i].turn && irc_nick_equal(aw->turns[i].nick, nick)) {
+            slot = &aw->turns[i];
+            break;
+        }
+        if (aw->turns[i].turn < slot->turn) slot = &aw->turns[i];
+    }
+    snprintf(slot->nick, sizeof(slot->nick), "%s", nick);
+    slot->turn = ++aw->turn_clock;
+}
+
+// Whether a should be sent before b: priority askers first, then whoever
+// was served least recently, then the cheaper job, then the older one.
+static bool scheduled_before(const AiWorker *aw, const AiJob *a, const AiJob *b) {
+    if (a->priority != b->priority) return a->priority;
+    unsigned long turn_a = last_turn(aw, a->nick), turn_b = last_turn(aw, b->nick);
+    if (turn_a != turn_b) return turn_a < turn_b;
+    if (a->cost != b->cost) return a->cost < b->cost;
+    return a->seq < b->seq;
+}
+
+// The next queued job this pass has not looked at yet, in schedule order.
+static AiJob *next_queued_job(AiWorker *aw) {
+    AiJob *best = NULL;
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (job->state != AI_JOB_QUEUED || job->sched_pass == aw->sched_pass) continue;
+        if (!AI_SCHED_FAIR) return job;
+        if (best == NULL || scheduled_before(aw, job, best)) best = job;
+    }
+    return best;
+}
+
+// Tells askers whose job has to wait behind others where they stand, once.
+static void report_queue_positions(AiWorker *aw) {
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (job->state != AI_JOB_QUEUED || job->position_reported || job->sends > 0 || timerisset(&job->retry_at)) continue;
+        if (is_batchable(aw, job)) continue; // Held for a batch on purpose
+        int position = 1;
+        for (const AiJob *other = aw->head; other; other = other->next) {
+            if (other != job && other->state == AI_JOB_QUEUED && (AI_SCHED_FAIR ? scheduled_before(aw, other, job) : other->seq < job->seq)) position++;
+        }
+        job->position_reported = true;
+        if (position < AI_SCHED_REPORT_POSITION) continue;
+        send_irc(aw->socket_fd, "PRIVMSG %s :%s, you're number %d in line; I'll answer as soon as I can.", aw->channel->name, job->nick, position);
+    }
+}
+
+// Bookkeeping for a job whose first request just went out.
+static void note_first_send(AiWorker *aw, AiJob *job) {
+    aw->stats->queue_wait_ms_total += (unsigned long)elapsed_ms_since(&job->enqueued_at);
+    aw->stats->queue_wait_samples++;
+    take_turn(aw, job->nick);
+}
+
+// --- Batching ---
+// Sends jobs (which share persona and history) as one request. Returns false
+// if nothing was sent; the jobs are then left QUEUED.
+static bool send_batch(AiWorker *aw, AiJob **jobs, int count) {
+    long time_left = deadline_ms_left(jobs[0]);
+    for (int i = 1; i < count; ++i) {
+        if (deadline_ms_left(jobs[i]) < time_left) time_left = deadline_ms_left(jobs[i]);
+    }
+    if (time_left <= 0 || !ai_breaker_allow(&aw->breaker, aw->tag)) return false;
+
+    // Batches never hold priority asks, so they get short answers under overload
+    bool short_answer = aw->overload_level >= 1;
+    int output_tokens = short_answer ? AI_OVERLOAD_SHORT_OUTPUT_TOKENS : AI_MAX_OUTPUT_TOKENS;
+    char prompt[AI_BATCH_MAX_ASKS * (AI_BATCH_MAX_PROMPT_CHARS + MAX_NICK_LEN + 16) + 512];
+    int len = snprintf(prompt, sizeof(prompt),
+                       "Answer each of the following %d questions from different people on its own. Reply with only a JSON array "
+                       "of %d strings, the answer to question 1 first, and keep each answer under %d words.\n",
+                       count, count, output_tokens * 3 / 4 / count);
+    for (int i = 0; i < count && len > 0 && (size_t)len < sizeof(prompt); ++i) {
+        len += snprintf(prompt + len, sizeof(prompt) - (size_t)len, "%d. %s: %s\n", i + 1, jobs[i]->nick, jobs[i]->prompt);
+    }
+
+    AiBatch *batch = (AiBatch *)calloc(1, sizeof(AiBatch));
+    if (batch == NULL) {
+        ai_breaker_release(&aw->breaker);
+        return false;
+    }
+    batch->attempt.batch = batch;
+    if (aw->use_quota) {
+        long tokens = estimate_request_tokens(jobs[0]->persona, jobs[0]->history, jobs[0]->history_len, prompt);
+        long wait_ms;
+        if (ai_quota_acquire(aw->worker_id, jobs[0]->nick, tokens, &wait_ms) != AI_QUOTA_GRANTED) {
+            ai_breaker_release(&aw->breaker); // The jobs go alone and wait for the quota there
+            free(batch);
+            return false;
+        }
+        batch->attempt.quota_tokens = tokens;
+    }
+    long request_tokens = estimate_request_tokens(jobs[0]->persona, jobs[0]->history, jobs[0]->history_len, prompt);
+    batch->attempt.model = ai_route_pick(&aw->router, request_tokens);
+    if (aw->backend.ops->submit(&aw->backend, ai_route_model_name(&aw->router, batch->attempt.model), jobs[0]->persona,
+                                jobs[0]->history, jobs[0]->history_len, prompt, short_answer, time_left, &batch->attempt,
+                                &batch->attempt.request_id) != 0) {
+        ai_breaker_release(&aw->breaker);
+        refund_quota(&batch->attempt);
+        free(batch);
+        return false;
+    }
+    batch->attempt.active = true;
+    gettimeofday(&batch->attempt.sent_at, NULL);
+    aw->stats->api_calls++;
+    aw->stats->batches++;
+    aw->stats->batched_asks += (unsigned long)count;
+
+    for (int i = 0; i < count; ++i) {
+        batch->jobs[i] = jobs[i];
+        jobs[i]->batch = batch;
+        jobs[i]->state = AI_JOB_INFLIGHT;
+        jobs[i]->sends++;
+        note_first_send(aw, jobs[i]);
+    }
+    batch->count = count;
+    app_log(aw->tag, "AI_BATCH", "Sent %d asks (#%lu first) as one request.", count, jobs[0]->seq);
+    return true;
+}
+
+// Collects short asks into batches. While the oldest one's window is open and
+// the batch has room, every batchable job is held back for this pass; a job
+// left alone when its window closes is sent the normal way.
+static void submit_batches(AiWorker *aw) {
+    if (aw->budget != AI_BUDGET_OK) return; // Budget checks are made per job
+    while (aw->backend.ops->has_capacity(&aw->backend)) {
+        AiJob *oldest = NULL;
+        for (AiJob *job = aw->head; job && oldest == NULL; job = job->next) {
+            if (job->sched_pass != aw->sched_pass && is_batchable(aw, job)) oldest = job;
+        }
+        if (oldest == NULL) return;
+
+        AiJob *members[AI_BATCH_MAX_ASKS];
+        int count = 0;
+        for (AiJob *job = oldest; job && count < AI_BATCH_MAX_ASKS; job = job->next) {
+            if (job->sched_pass == aw->sched_pass || !is_batchable(aw, job)) continue;
+            if (strcmp(job_cache_persona(job), job_cache_persona(oldest)) == 0) members[count++] = job;
+        }
+        if (count < AI_BATCH_MAX_ASKS && elapsed_ms_since(&oldest->enqueued_at) < aw->batch_window_ms) {
+            for (AiJob *job = aw->head; job; job = job->next) {
+                if (is_batchable(aw, job)) job->sched_pass = aw->sched_pass;
+            }
+            return;
+        }
+        if (count == 1 || !send_batch(aw, members, count)) {
+            for (int i = 0; i < count; ++i) members[i]->unbatched = true;
+        }
+    }
+}
+
+// Splits a batch answer into its count strings. Returns the array, or NULL if
+// the text is not a JSON array of count non-empty strings (code fences and
+// other text around it are tolerated).
+static cJSON *parse_batch_answers(const char *text, int count) {
+    if (text == NULL) return NULL;
+    const char *start = strchr(text, '[');
+    const char *end = strrchr(text, ']');
+    if (start == NULL || end == NULL || end < start) return NULL;
+    cJSON *answers = cJSON_ParseWithLength(start, (size_t)(end - start) + 1);
+    bool valid = cJSON_IsArray(answers) && cJSON_GetArraySize(answers) == count;
+    for (const cJSON *answer = valid ? answers->child : NULL; answer; answer = answer->next) {
+        if (!cJSON_IsString(answer) || answer->valuestring[0] == '\0') valid = false;
+    }
+    if (!valid) {
+        cJSON_Delete(answers);
+        return NULL;
+    }
+    return answers;
+}
+
+// Feeds the answer time to the routed model's window; a timeout counts as a slow answer.
+static void record_route_latency(AiWorker *aw, const AiAttempt *attempt, AiFailureClass outcome, const AiResult *result) {
+    if (outcome == AI_FAILURE_NONE) ai_route_record(&aw->router, attempt->model, (long)result->total_ms, true);
+    else if (outcome == AI_FAILURE_TIMEOUT) ai_route_record(&aw->router, attempt->model, elapsed_ms_since(&attempt->sent_at), false);
+}
+
+// Hands each job of a finished batch its answer, or puts them all back in the
+// queue to be sent one by one if the request failed or its reply cannot be split.
+static void finish_batch(AiWorker *aw, AiBatch *batch, AiResult *result) {
+    batch->attempt.active = false;
+    AiFailureClass outcome = ai_classify_result(result);
+    ai_breaker_record(&aw->breaker, outcome, aw->tag);
+    record_route_latency(aw, &batch->attempt, outcome, result);
+    if (outcome != AI_FAILURE_NONE) {
+        refund_quota(&batch->attempt);
+    } else if (batch->attempt.quota_tokens > 0 && result->prompt_tokens + result->output_tokens > 0) {
+        ai_quota_settle(batch->attempt.quota_tokens, result->prompt_tokens + result->output_tokens);
+    }
+
+    int members = 0;
+    for (int i = 0; i < batch->count; ++i) members += batch->jobs[i] != NULL;
+    for (int i = 0; i < batch->count; ++i) {
+        if (batch->jobs[i] == NULL) continue; // Each member is billed an equal share
+        ai_usage_record(aw->worker_id, batch->jobs[i]->nick, result->prompt_tokens / members, result->output_tokens / members,
+                        result->total_tokens / members);
+    }
+
+    cJSON *answers = parse_batch_answers(result->text, batch->count);
+    if (answers == NULL) {
+        aw->stats->batch_fallbacks++;
+        app_log(aw->tag, "AI_BATCH", "Batch of %d asks %s; sending them one by one.", batch->count,
+                outcome == AI_FAILURE_NONE ? "came back without a usable JSON array" : "failed");
+    }
+    for (int i = 0; i < batch->count; ++i) {
+        AiJob *job = batch->jobs[i];
+        if (job == NULL) continue;
+        job->batch = NULL;
+        if (answers == NULL) {
+            job->state = AI_JOB_QUEUED;
+            job->unbatched = true;
+            continue;
+        }
+        job->response = strdup(cJSON_GetArrayItem(answers, i)->valuestring);
+        job->state = AI_JOB_DONE;
+        publish_flight(job);
+        if (job->response) remember_answer(aw, job);
+    }
+    cJSON_Delete(answers);
+    free(result->text);
+    free(batch);
+}
+
+static int count_inflight_jobs(const AiWorker *aw) {
+    int count = 0;
+    for (const AiJob *job = aw->head; job; job = job->next) count += job->state == AI_JOB_INFLIGHT;
+    return count;
+}
+
+// Applies the channel's token budget to a job about to be sent. Returns false
+// if it may not go now: refused once the budget is spent, held while another
+// request is in flight once the budget is nearly spent.
+static bool within_budget(AiWorker *aw, AiJob *job) {
+    if (aw->budget == AI_BUDGET_EXHAUSTED) {
+        app_log(aw->tag, "AI_BUDGET", "Refusing !ask #%lu from %s: the channel's token budget is spent for %ld more minute(s).",
+                job->seq, job->nick, aw->budget_minutes_left);
+        job->state = AI_JOB_DONE;
+        job->over_budget_minutes = aw->budget_minutes_left;
+        aw->stats->budget_rejects++;
+        publish_flight(job);
+        return false;
+    }
+    if (aw->budget == AI_BUDGET_THROTTLED && count_inflight_jobs(aw) > 0) {
+        if (!job->budget_held) {
+            job->budget_held = true;
+            aw->stats->budget_holds++;
+        }
+        return false;
+    }
+    return true;
+}
+
+static void submit_queued_jobs(AiWorker *aw) {
+    aw->sched_pass++;
+    aw->budget = ai_usage_budget_state(aw->worker_id, &aw->budget_minutes_left);
+    submit_batches(aw);
+    AiJob *job;
+    while (aw->backend.ops->has_capacity(&aw->backend) && (job = next_queued_job(aw)) != NULL) {
+        job->sched_pass = aw->sched_pass;
+        long time_left = deadline_ms_left(job);
+        if (time_left <= 0) {
+            expire_job(aw, job);
+            continue;
+        }
+        if (timerisset(&job->retry_at) && elapsed_ms_since(&job->retry_at) < 0) continue; // Backing off or waiting for quota
+        if (!within_budget(aw, job)) continue;
+        if (!ai_breaker_allow(&aw->breaker, aw->tag)) {
+            if (aw->breaker.state == AI_BREAKER_HALF_OPEN) continue; // Wait for the probe's verdict
+            job->state = AI_JOB_DONE;
+            job->unavailable = true;
+            aw->stats->breaker_rejects++;
+            publish_flight(job);
+            continue;
+        }
+        if (!charge_quota(aw, job, &job->attempts[0], time_left)) {
+            ai_breaker_release(&aw->breaker);
+            continue;
+        }
+        if (send_attempt(aw, job, &job->attempts[0], time_left)) {
+            job->state = AI_JOB_INFLIGHT;
+            if (job->sends++ == 0) note_first_send(aw, job);
+            else take_turn(aw, job->nick);
+        } else {
+            ai_breaker_release(&aw->breaker);
+            refund_quota(&job->attempts[0]);
+            job->state = AI_JOB_DONE; // response stays NULL: reported as an error
+            publish_flight(job);
+        }
+    }
+}
+
+// Sends a hedge for requests that have taken longer than the recent p95 and
+// have not started streaming, and cancels the losing copy once one of a
+// hedged pair has started streaming.
+static void manage_hedges(AiWorker *aw) {
+    long threshold = ai_latency_percentile(&aw->latency, AI_HEDGE_PERCENTILE, AI_HEDGE_MIN_SAMPLES);
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (job->state != AI_JOB_INFLIGHT) continue;
+        if (job->hedged) {
+            if (job->stream_source) cancel_attempt(aw, &job->attempts[job->stream_source == &job->attempts[0] ? 1 : 0]);
+            continue;
+        }
+        if (threshold < 0 || job->stream_source || !job->attempts[0].active) continue;
+        if (elapsed_ms_since(&job->attempts[0].sent_at) <= threshold) continue;
+        if (aw->breaker.state != AI_BREAKER_CLOSED || aw->budget != AI_BUDGET_OK || !aw->backend.ops->has_capacity(&aw->backend)) continue;
+        long time_left = deadline_ms_left(job);
+        if (time_left <= 0) continue;
+        long wait_ms;
+        AiAttempt *hedge = &job->attempts[1];
+        hedge->quota_tokens = 0;
+        if (aw->use_quota) {
+            if (ai_quota_acquire(aw->worker_id, job->nick, estimate_job_tokens(job), &wait_ms) != AI_QUOTA_GRANTED) continue;
+            hedge->quota_tokens = estimate_job_tokens(job);
+        }
+        if (!send_attempt(aw, job, hedge, time_left)) {
+            refund_quota(hedge);
+            continue;
+        }
+        job->hedged = true;
+        aw->stats->hedges++;
+        app_log(aw->tag, "AI_HEDGE", "!ask #%lu is slower than p%d (%ld ms); sent a hedge request.", job->seq, AI_HEDGE_PERCENTILE, threshold);
+    }
+}
+
+// Puts a failed job back in the queue after a backoff, if it is worth another
+// try: the failure is retryable, no lines have been posted yet, tries remain
+// and the backoff ends before the deadline.
+static bool schedule_retry(AiWorker *aw, AiJob *job, AiFailureClass outcome, long retry_after_ms) {
+    if (outcome != AI_FAILURE_RETRYABLE || job->streamed || job->sends >= AI_RETRY_MAX_ATTEMPTS) return false;
+    long delay = ai_backoff_ms(job->sends, retry_after_ms);
+    if (delay >= deadline_ms_left(job)) return false;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    set_after_ms(&job->retry_at, &now, delay);
+    job->state = AI_JOB_QUEUED;
+    job->hedged = false;
+    job->stream_source = NULL;
+    job->stream_partial_len = 0;
+    aw->stats->retries++;
+    app_log(aw->tag, "AI_RETRY", "Retrying !ask #%lu in %ld ms (try %d of %d%s).", job->seq, delay, job->sends + 1,
+            AI_RETRY_MAX_ATTEMPTS, retry_after_ms > 0 ? ", server asked to wait" : "");
+    return true;
+}
+
+// While the worker has nothing queued, picks up FAQ file changes and
+// generates one missing or stale FAQ answer at a time.
+static void refresh_faq(AiWorker *aw) {
+    if (aw->faq_attempt.active || aw->head != NULL) return;
+    if (elapsed_ms_since(&aw->faq_checked_at) >= AI_FAQ_CHECK_MS) {
+        gettimeofday(&aw->faq_checked_at, NULL);
+        if (ai_faq_reload_if_changed(&aw->faq)) {
+            app_log(aw->tag, "AI_FAQ", "FAQ file changed; %zu entries (%zu questions) loaded.", aw->faq.num_entries, aw->faq.num_questions);
+        }
+    }
+    time_t now = time(NULL);
+    int entry = ai_faq_next_stale(&aw->faq, now, AI_FAQ_REFRESH_SECONDS);
+    if (entry < 0 || aw->budget != AI_BUDGET_OK || aw->breaker.state != AI_BREAKER_CLOSED ||
+        !aw->backend.ops->has_capacity(&aw->backend)) return;
+
+    AiAttempt *attempt = &aw->faq_attempt;
+    const char *question = aw->faq.entries[entry].question;
+    long tokens = estimate_request_tokens(aw->channel->persona, NULL, 0, question);
+    memset(attempt, 0, sizeof(*attempt));
+    if (aw->use_quota) {
+        long wait_ms;
+        if (ai_quota_acquire(aw->worker_id, AI_FAQ_USAGE_NICK, tokens, &wait_ms) != AI_QUOTA_GRANTED) return; // Idle work never waits
+        attempt->quota_tokens = tokens;
+    }
+    if (!ai_breaker_allow(&aw->breaker, aw->tag)) {
+        refund_quota(attempt);
+        return;
+    }
+    attempt->model = ai_route_pick(&aw->router, tokens);
+    if (aw->backend.ops->submit(&aw->backend, ai_route_model_name(&aw->router, attempt->model), aw->channel->persona, NULL, 0,
+                                question, false, aw->deadline_ms, attempt, &attempt->request_id) != 0) {
+        ai_breaker_release(&aw->breaker);
+        refund_quota(attempt);
+        aw->faq.entries[entry].next_try = now + AI_FAQ_RETRY_SECONDS;
+        return;
+    }
+    attempt->active = true;
+    gettimeofday(&attempt->sent_at, NULL);
+    aw->faq_entry = entry;
+    aw->stats->api_calls++;
+    app_log(aw->tag, "AI_FAQ", "Generating the answer to FAQ entry '%s' while idle.", question);
+}
+
+static void finish_faq_refresh(AiWorker *aw, AiResult *result) {
+    AiAttempt *attempt = &aw->faq_attempt;
+    attempt->active = false;
+    AiFailureClass outcome = ai_classify_result(result);
+    ai_breaker_record(&aw->breaker, outcome, aw->tag);
+    record_route_latency(aw, attempt, outcome, result);
+    ai_usage_record(aw->worker_id, AI_FAQ_USAGE_NICK, result->prompt_tokens, result->output_tokens, result->total_tokens);
+    if (outcome != AI_FAILURE_NONE) {
+        refund_quota(attempt);
+    } else if (attempt->quota_tokens > 0 && result->prompt_tokens + result->output_tokens > 0) {
+        ai_quota_settle(attempt->quota_tokens, result->prompt_tokens + result->output_tokens);
+    }
+    // The FAQ file is not reloaded while this is in flight, so the entry is still the one asked about.
+    if (outcome == AI_FAILURE_NONE && result->text) {
+        ai_faq_set_answer(&aw->faq, aw->faq_entry, result->text, time(NULL));
+        aw->stats->faq_refreshes++;
+        app_log(aw->tag, "AI_FAQ", "Generated the answer to FAQ entry '%s'.", aw->faq.entries[aw->faq_entry].question);
+    } else {
+        aw->faq.entries[aw->faq_entry].next_try = time(NULL) + AI_FAQ_RETRY_SECONDS;
+        app_log(aw->tag, "AI_FAQ", "Could not generate the answer to FAQ entry '%s'; trying again in %d s.",
+                aw->faq.entries[aw->faq_entry].question, AI_FAQ_RETRY_SECONDS);
+    }
+    free(result->text);
+}
+
+static void collect_results(AiWorker *aw) {
+    AiResult result;
+    while (aw->backend.ops->poll(&aw->backend, &result) == 1) {
+        AiAttempt *attempt = (AiAttempt *)result.user_data;
+        if (attempt == NULL) {
+            free(result.text);
+            continue;
+        }
+        if (attempt == &aw->faq_attempt) {
+            finish_faq_refresh(aw, &result);
+            continue;
+        }
+        if (attempt->batch) {
+            finish_batch(aw, attempt->batch, &result);
+            continue;
+        }
+        AiJob *job = attempt->job;
+        AiAttempt *other = &job->attempts[attempt == &job->attempts[0] ? 1 : 0];
+        attempt->active = false;
+        AiFailureClass outcome = ai_classify_result(&result);
+        ai_breaker_record(&aw->breaker, outcome, aw->tag);
+        record_route_latency(aw, attempt, outcome, &result);
+        ai_usage_record(aw->worker_id, job->nick, result.prompt_tokens, result.output_tokens, result.total_tokens);
+        if (outcome != AI_FAILURE_NONE) {
+            refund_quota(attempt);
+        } else if (attempt->quota_tokens > 0 && result.prompt_tokens + result.output_tokens > 0) {
+            ai_quota_settle(attempt->quota_tokens, result.prompt_tokens + result.output_tokens);
+        }
+
+        if (outcome == AI_FAILURE_NONE) {
+            if (job->stream_source && job->stream_source != attempt && other->active) {
+                free(result.text); // The other copy's lines are already out; let it finish them
+                continue;
+            }
+            if (job->stream_source == NULL) ai_latency_add(&aw->latency, (long)result.total_ms);
+            if (attempt == &job->attempts[1]) aw->stats->hedge_wins++;
+            cancel_attempt(aw, other);
+        } else if (other->active || schedule_retry(aw, job, outcome, result.retry_after_ms)) {
+            continue; // The other copy or a later try may still answer
+        }
+        job->response = result.text;
+        job->state = AI_JOB_DONE;
+        publish_flight(job);
+        if (job->response) {
+            remember_answer(aw, job);
+        } else if (outcome == AI_FAILURE_TIMEOUT || deadline_ms_left(job) <= 0) {
+            app_log(aw->tag, "AI_TIMEOUT", "!ask #%lu from %s was aborted at its %ld ms deadline.", job->seq, job->nick, aw->deadline_ms);
+            job->expired = true;
+            aw->stats->expired++;
+            aw->stats->wasted_calls++;
+        }
+    }
+}
+
+// Counts a delivered answer and adds the exchange to the conversation memory.
+static void finish_answer(AiWorker *aw, AiJob *job, long total_ms) {
+    aw->stats->answered++;
+    aw->stats->latency_ms_total += (unsigned long)total_ms;
+    ai_memory_add(&aw->memory, job->nick, false, job->prompt);
+    ai_memory_add(&aw->memory, job->nick, true, job->response);
+}
+
+static void deliver_job(AiWorker *aw, AiJob *job) {
+    long total_ms = elapsed_ms_since(&job->enqueued_at);
+    if (job->dropped) return;
+    if (job->quota_refused != AI_QUOTA_GRANTED) {
+        long seconds = (job->quota_wait_ms + 999) / 1000;
+        if (job->quota_refused == AI_QUOTA_NICK) {
+            send_irc(aw->socket_fd, "PRIVMSG %s :%s, you're asking faster than I can answer. Please wait %ld s before your next question.",
+                     aw->channel->name, job->nick, seconds);
+        } else {
+            send_irc(aw->socket_fd, "PRIVMSG %s :%s, %s has used up its AI quota for now. Please try again in %ld s.", aw->channel->name,
+                     job->nick, job->quota_refused == AI_QUOTA_CHANNEL ? "this channel" : "the bot", seconds);
+        }
+        return;
+    }
+    if (job->over_budget_minutes > 0) {
+        send_irc(aw->socket_fd, "PRIVMSG %s :%s, this channel has used up its AI budget for the hour. Please try again in %ld min.",
+                 aw->channel->name, job->nick, job->over_budget_minutes);
+        return;
+    }
+    if (job->unavailable) {
+        if (post_offline_answer(aw, job->nick, job->prompt)) return;
+        send_irc(aw->socket_fd, "PRIVMSG %s :%s, the AI service is unavailable right now. Please try again in a minute.", aw->channel->name, job->nick);
+        return;
+    }
+    if (job->expired) {
+        if (job->streamed || job->stream_partial_len > 0) {
+            drain_stream_lines(aw, job, true);
+            flush_held_lines(aw, job);
+            send_irc(aw->socket_fd, "PRIVMSG %s :%s: (answer cut short, it took too long)", aw->channel->name, job->nick);
+        } else {
+            send_irc(aw->socket_fd, "PRIVMSG %s :%s, sorry, that took too long to answer. Please try again.", aw->channel->name, job->nick);
+        }
+        return;
+    }
+    if (job->streamed || job->stream_partial_len > 0) {
+        // Most of the answer is already out; post what the stream left behind.
+        drain_stream_lines(aw, job, true);
+        flush_held_lines(aw, job);
+        if (job->response) {
+            app_log(aw->tag, "AI_REPLY", "Answered !ask #%lu from %s: first line %ld ms, total %ld ms (streamed).",
+                    job->seq, job->nick, job->first_line_ms, total_ms);
+            finish_answer(aw, job, total_ms);
+            return;
+        }
+    } else if (job->response) {
+        for (char *p = job->response; *p; ++p) {
+            if (*p == '\n' || *p == '\r') {
+                *p = ' ';
+            }
+        }
+        send_irc(aw->socket_fd, "PRIVMSG %s :%s: %s", aw->channel->name, job->nick, job->response);
+        app_log(aw->tag, "AI_REPLY", "Answered !ask #%lu from %s in %ld ms%s.", job->seq, job->nick,
+                total_ms, job->faq ? " (FAQ)" : job->cached ? " (cached)" : job->coalesced ? " (coalesced)" : "");
+        finish_answer(aw, job, total_ms);
+        return;
+    }
+    aw->stats->errors++;
+    app_log(aw->tag, "AI_ERROR", "Failed to get AI response for prompt from %s.", job->nick);
+    if (!job->streamed && post_offline_answer(aw, job->nick, job->prompt)) return;
+    send_irc(aw->socket_fd, "PRIVMSG %s :%s, I encountered an error trying to process your request.", aw->channel->name, job->nick);
+}
+
+// Posts finished jobs. In-order mode stops at the first unfinished job so
+// answers appear in the order they were asked; with fair scheduling only
+// the same asker's earlier jobs hold an answer back.
+static void deliver_finished_jobs(AiWorker *aw) {
+    AiJob **link = &aw->head;
+    AiJob *prev = NULL;
+    while (*link) {
+        AiJob *job = *link;
+        if (job->state != AI_JOB_DONE || !is_next_in_line(aw, job)) {
+            if (!AI_OUT_OF_ORDER_REPLIES && !AI_SCHED_FAIR) break;
+            prev = job;
+            link = &job->next;
+            continue;
+        }
+        deliver_job(aw, job);
+        *link = job->next;
+        if (aw->tail == job) aw->tail = prev;
+        free_job(job);
+    }
+}
+
+void ai_worker_process(AiWorker *aw) {
+    if (!aw->backend_ready) {
+        deliver_finished_jobs(aw); // Cache hits still need posting
+        return;
+    }
+    poll_attached_jobs(aw);
+    check_deadlines(aw);
+    if (AI_OVERLOAD_ENABLED) update_overload(aw);
+    submit_queued_jobs(aw);
+    collect_results(aw);
+    submit_queued_jobs(aw); // Refill slots freed by finished requests
+    if (AI_HEDGE_ENABLED) manage_hedges(aw);
+    report_queue_positions(aw);
+    deliver_finished_jobs(aw);
+    if (AI_FAQ_ENABLED) refresh_faq(aw);
+    for (AiJob *job = aw->head; job; job = job->next) {
+        if (job->state == AI_JOB_INFLIGHT && job->held_len > 0 && is_next_in_line(aw, job)) flush_held_lines(aw, job); // It just became next in line
+    }
+}
+
+void ai_worker_cleanup(AiWorker *aw) {
+    while (aw->head) {
+        AiJob *job = aw->head;
+        aw->head = job->next;
+        leave_batch(aw, job);
+        publish_flight(job); // Release waiters on other workers
+        free_job(job);
+    }
+    aw->tail = NULL;
+    if (aw->backend_ready) aw->backend.ops->cleanup(&aw->backend);
+    aw->backend_ready = false;
+    ai_cache_cleanup(&aw->cache);
+    ai_similar_cleanup(&aw->similar);
+    ai_memory_cleanup(&aw->memory);
+    ai_markov_close(&aw->markov);
+    ai_recall_cleanup(&aw->recall);
+    ai_faq_cleanup(&aw->faq);
+}
@@ -0,0 +1,185 @@
+#ifndef AI_WORKER_H
+#define AI_WORKER_H
+
+#include "irc_bot.h"
+#include "gemini_integration.h"
+#include "ai_backend.h"
+#include "ai_cache.h"
+#include "ai_similar.h"
+#include "ai_flight.h"
+#include "ai_memory.h"
+#include "ai_retry.h"
+#include "ai_quota.h"
+#include "ai_usage.h"
+#include "ai_route.h"
+#include "ai_markov.h"
+#include "ai_recall.h"
+#include "ai_faq.h"
+
+// --- Worker-side AI request pipeline ---
+// Each worker keeps its !ask jobs in arrival order. Queued jobs are submitted
+// to the channel's AI backend while it has capacity, and finished answers are posted
+// back in request order (or as soon as they finish with AI_OUT_OF_ORDER_REPLIES).
+// With AI_SCHED_FAIR, admin channel members go first, the other askers take
+// turns, and each asker's cheapest job (estimated prompt plus requested answer
+// size) is sent first; answers then only keep their order per asker, and
+// someone far back in line is told their place. With a batch window set,
+// short asks arriving within it are sent as one request asking for a JSON
+// array of answers; if that cannot be split up, each ask is sent alone.
+// The tokens each request used are recorded against the channel and asker;
+// a channel near its hourly token budget sends one request at a time, and
+// one past it refuses new asks until the hour is over. Each request (hedges
+// and batches included) goes to the model the channel's router picks. When
+// asks pile up, the overload level rises: shorter answers, then no history,
+// then new asks from anyone but admins are turned away as busy; it steps back
+// down once the queue has stayed short for a while.
+// With AI_STREAMING_ENABLED, answers arrive over SSE and each complete line or
+// sentence is posted as soon as it is known. A question that another worker
+// (or this one) already has in flight is attached to that request rather than
+// sent again. Recent turns from the channel's conversation memory go along
+// with each request, and answers given with history are cached under a key
+// that includes a fingerprint of that history. Every job carries a deadline:
+// it is never sent once that has passed, and an in-flight request is aborted
+// when it passes or when the asker leaves the channel. Failed requests are
+// retried with backoff while the deadline allows, the backend's circuit
+// breaker fails jobs fast during an outage, and a request slower than the
+// recent p95 gets a hedge: a second copy, of which the first answer wins.
+// Every send is paid for from the quota shared by all workers; a job that is
+// over quota waits for a refill if its deadline allows and is refused if not.
+// When there is no backend, its circuit is open or a request fails for good,
+// the answer comes from the channel's offline model instead.
+
+typedef enum {
+    AI_JOB_QUEUED,
+    AI_JOB_ATTACHED, // Waiting on an identical request owned by some worker
+    AI_JOB_INFLIGHT,
+    AI_JOB_DONE
+} AiJobState;
+
+struct AiWorker;
+struct AiJob;
+struct AiBatch;
+
+// One request sent for a job: the original or its hedge.
+typedef struct {
+    struct AiJob *job;
+    unsigned long request_id;
+    bool active;
+    struct timeval sent_at;
+    long quota_tokens; // Tokens charged to the shared quota for this request
+    struct AiBatch *batch; // Set on a request that carries several jobs; job is then NULL
+    int model; // Index into the worker's router
+} AiAttempt;
+
+// One request asking several questions at once, answered with a JSON array.
+typedef struct AiBatch {
+    AiAttempt attempt;
+    struct AiJob *jobs[AI_BATCH_MAX_ASKS]; // In question order; NULL once a job has left
+    int count;
+} AiBatch;
+
+typedef struct AiJob {
+    struct AiWorker *owner;
+    unsigned long seq;
+    char nick[MAX_NICK_LEN];
+    char *persona;
+    char *prompt;
+    GeminiTurn *history; // One block: the turn array followed by its text
+    size_t history_len;
+    char *context_persona; // persona + history fingerprint, the cache key when history is sent
+    AiJobState state;
+    char *response; // Set when DONE; NULL means the request failed
+    bool cached; // Answered from the response cache
+    bool faq; // Answered from the channel FAQ
+    bool coalesced; // Answered by another pending request
+    bool expired; // Ran past its deadline
+    bool dropped; // The asker left or asked again; nothing is posted
+    bool unavailable; // Failed fast by the open circuit breaker
+    AiQuotaVerdict quota_refused; // Turned away by this quota limit, AI_QUOTA_GRANTED if not
+    long quota_wait_ms; // How long the refusing limit needed to refill
+    bool quota_waited; // Held back for the quota at least once
+    AiFlightTicket flight;
+    bool flight_owner; // This job's answer must be published to the in-flight table
+    // Streaming: text not yet forming a full line, and full lines held back
+    // until every earlier job has been answered (in-order mode).
+    char *stream_partial;
+    size_t stream_partial_len;
+    char *held_lines; // '\n'-separated
+    size_t held_len;
+    bool streamed; // At least one line was produced from the stream
+    long first_line_ms; // Time to first line, -1 until one is sent
+    struct timeval enqueued_at;
+    struct timeval deadline; // Not sent after this, aborted if still in flight
+    struct timeval retry_at; // A QUEUED job is not sent before this (retry backoff or quota refill)
+    int sends; // Requests sent so far, hedges not included
+    AiAttempt attempts[2]; // [0] the request, [1] its hedge; INFLIGHT while either is active
+    bool hedged;
+    AiAttempt *stream_source; // The attempt whose stream is being posted
+    bool priority; // Asked by an admin channel member
+    long cost; // Estimated tokens, prompt plus the answer the question calls for
+    unsigned long sched_pass; // Last submit pass that considered this job
+    bool position_reported;
+    AiBatch *batch; // The shared request this INFLIGHT job rides on, if any
+    bool unbatched; // Sent on its own from now on: alone in its window, or its batch failed
+    bool budget_held; // Held back at least once by the channel's token budget
+    long over_budget_minutes; // Refused because the token budget is spent: minutes until it renews, 0 if not
+    struct AiJob *next;
+} AiJob;
+
+// When an asker last had a job sent, in sends counted by the worker.
+typedef struct {
+    char nick[MAX_NICK_LEN];
+    unsigned long turn;
+} AiNickTurn;
+
+typedef struct AiWorker {
+    int worker_id;
+    const char *tag;
+    const ChannelInfo *channel;
+    int socket_fd;
+    AiWorkerStats *stats; // This worker's shared slot
+    AiBackend backend; // Chosen by the channel's backend options
+    bool backend_ready;
+    long deadline_ms; // Per-ask time budget from the channel's options
+    bool use_quota;
+    bool supersede;
+    long batch_window_ms;
+    AiBudgetState budget; // As of the last submit pass
+    long budget_minutes_left;
+    AiBreaker breaker;
+    AiLatencyWindow latency; // Time to answer, or to first text when streaming; sets the hedging threshold
+    AiRouter router;
+    int overload_level; // 0 = normal, see AI_OVERLOAD_*
+    struct timeval overload_calm_since; // Load has been low enough to step down since then; unset if not
+    AiCache cache;
+    AiSimilarIndex similar;
+    AiMemory memory;
+    AiMarkov markov; // Offline fallback, learnt from the channel's messages
+    AiRecall recall; // Recent channel messages, searched for context to send with an ask
+    AiFaq faq;
+    AiAttempt faq_attempt; // Generating an FAQ answer while idle
+    int faq_entry; // The entry it is for
+    struct timeval faq_checked_at; // Last look for changes to the FAQ file
+    AiJob *head; // Undelivered jobs, oldest first
+    AiJob *tail;
+    unsigned long next_seq;
+    AiNickTurn turns[AI_SCHED_NICK_SLOTS];
+    unsigned long turn_clock;
+    unsigned long sched_pass;
+} AiWorker;
+
+// api_key is the Gemini key and may be NULL; a Gemini channel then only serves cached answers.
+int ai_worker_init(AiWorker *aw, int worker_id, const char *tag, const ChannelInfo *channel, int socket_fd, const char *api_key);
+// priority is set for admin channel members.
+void ai_worker_enqueue(AiWorker *aw, const char *nick, const char *persona, const char *prompt, bool priority);
+// Learns from and indexes a message said in the channel (not a command).
+void ai_worker_observe(AiWorker *aw, const char *nick, const char *text);
+// Drops every unposted job from nick (who left the channel or quit), aborting in-flight requests.
+void ai_worker_drop_nick(AiWorker *aw, const char *nick);
+// Blocks up to timeout_ms for transfer activity or input on pipe_fd. Returns true if pipe_fd is readable.
+bool ai_worker_wait(AiWorker *aw, int pipe_fd, int timeout_ms);
+// Drives transfers, submits queued jobs and posts finished answers.
+void ai_worker_process(AiWorker *aw);
+void ai_worker_cleanup(AiWorker *aw);
+
+#endif // AI_WORKER_H
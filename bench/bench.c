@@ -0,0 +1,163 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#define _XOPEN_SOURCE 700 // nftw
+
+#include "bench.h"
+#include <arpa/inet.h>
+#include <ftw.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+// The globals main.c would define; benchmarks link every other object of the bot.
+volatile sig_atomic_t shutdown_requested = 0;
+volatile sig_atomic_t child_exit_flag = 0;
+int socket_fd = -1;
+pid_t pinger_child_pid = -1;
+int *worker_write_pipe_fds = NULL;
+pid_t *worker_child_pids = NULL;
+int numChildren = 0;
+int numWorkerChildren = 0;
+sem_t *socket_lock = NULL;
+AiWorkerStats *g_ai_stats = NULL;
+ChannelInfo *g_channel_infos = NULL;
+const char *ADMIN_CHANNEL_NAME_CONST = NULL;
+MuteSet g_muted_users = { NULL, 0, 0 };
+const char *g_gemini_api_key = NULL;
+
+FILE *bench_out = NULL;
+
+static char g_root_dir[PATH_MAX];
+static char g_scratch_dir[PATH_MAX];
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_scratch_dir(void) {
+    if (chdir(g_root_dir) == 0 && g_scratch_dir[0] != '\0') nftw(g_scratch_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+int bench_init(const char *name) {
+    int out_fd = dup(STDOUT_FILENO);
+    bench_out = (out_fd == -1) ? NULL : fdopen(out_fd, "w");
+    if (bench_out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "%s: cannot set up output: %s\n", name, strerror(errno));
+        return -1;
+    }
+    setvbuf(bench_out, NULL, _IOLBF, 0);
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(g_scratch_dir, sizeof(g_scratch_dir), "%s/bench-%s-XXXXXX", tmp ? tmp : "/tmp", name);
+    if (getcwd(g_root_dir, sizeof(g_root_dir)) == NULL || mkdtemp(g_scratch_dir) == NULL || chdir(g_scratch_dir) == -1) {
+        fprintf(stderr, "%s: cannot make a scratch directory: %s\n", name, strerror(errno));
+        g_scratch_dir[0] = '\0';
+        return -1;
+    }
+    atexit(remove_scratch_dir);
+    return 0;
+}
+
+double bench_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_report(const char *label, double *samples, int n, const char *unit) {
+    if (n <= 0) {
+        fprintf(bench_out, "  %-36s no samples\n", label);
+        return;
+    }
+    double sum = 0;
+    for (int i = 0; i < n; ++i) sum += samples[i];
+    qsort(samples, (size_t)n, sizeof(double), compare_doubles);
+    fprintf(bench_out, "  %-36s mean %9.2f  p50 %9.2f  p99 %9.2f  max %9.2f %s (n=%d)\n", label, sum / n, samples[n / 2],
+            samples[(int)((long)n * 99 / 100)], samples[n - 1], unit, n);
+}
+
+pid_t bench_start_fake_server(int port, int latency_ms) {
+    char path[PATH_MAX + 32], port_arg[16], latency_arg[16];
+    snprintf(path, sizeof(path), "%s/fake_ai_server", g_root_dir);
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+    snprintf(latency_arg, sizeof(latency_arg), "%d", latency_ms);
+
+    pid_t pid = fork();
+    if (pid == -1) return -1;
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execl(path, path, "-p", port_arg, "-l", latency_arg, "-j", "0", (char *)NULL);
+        _exit(127);
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int tries = 0; tries < 200; ++tries) { // Up to 2 s
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        bool up = (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        if (fd != -1) close(fd);
+        if (up) return pid;
+        if (waitpid(pid, NULL, WNOHANG) == pid) break;
+        usleep(10000);
+    }
+    fprintf(stderr, "fake_ai_server did not start on port %d (run make first)\n", port);
+    bench_stop_fake_server(pid);
+    return -1;
+}
+
+void bench_stop_fake_server(pid_t pid) {
+    if (pid <= 0) return;
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+int bench_vocabulary_init(BenchVocabulary *vocabulary, int size, unsigned int seed) {
+    vocabulary->words = calloc((size_t)size, sizeof(*vocabulary->words));
+    vocabulary->cumulative = (double *)calloc((size_t)size, sizeof(double));
+    vocabulary->size = size;
+    if (vocabulary->words == NULL || vocabulary->cumulative == NULL) {
+        bench_vocabulary_cleanup(vocabulary);
+        return -1;
+    }
+    double total = 0;
+    for (int i = 0; i < size; ++i) {
+        int len = 2 + (int)(rand_r(&seed) % 8);
+        for (int j = 0; j < len; ++j) vocabulary->words[i][j] = (char)('a' + rand_r(&seed) % 26);
+        vocabulary->words[i][len] = '\0';
+        total += 1.0 / (i + 1);
+        vocabulary->cumulative[i] = total;
+    }
+    for (int i = 0; i < size; ++i) vocabulary->cumulative[i] /= total;
+    return 0;
+}
+
+const char *bench_vocabulary_word(const BenchVocabulary *vocabulary, unsigned int *seed) {
+    double u = (double)rand_r(seed) / RAND_MAX;
+    int lo = 0, hi = vocabulary->size - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (vocabulary->cumulative[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return vocabulary->words[lo];
+}
+
+void bench_vocabulary_cleanup(BenchVocabulary *vocabulary) {
+    free(vocabulary->words);
+    free(vocabulary->cumulative);
+    vocabulary->words = NULL;
+    vocabulary->cumulative = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "irc_bot.h"
+
+// --- Benchmark harness ---
+// Each program under bench/ times one part of the bot and prints a few result
+// lines; `make bench` builds them at -O2 against the bot's sources and runs
+// them all. A program works in a scratch directory that is removed when it
+// exits, so logs, transcripts and cache files never land in the checkout. The
+// bot's own console logging is discarded; results go to bench_out.
+
+#define BENCH_FAKE_PORT 18089 // Away from fake_ai_server's default, so a running one is left alone
+
+extern FILE *bench_out;
+
+// Moves into a fresh scratch directory and silences stdout. Call first; returns 0 or -1.
+int bench_init(const char *name);
+double bench_now_us(void);
+// Sorts samples in place and prints their mean, p50, p99 and max.
+void bench_report(const char *label, double *samples, int n, const char *unit);
+// Starts ./fake_ai_server from the directory `make bench` ran in, without
+// jitter, and waits until it accepts connections. Returns its pid or -1.
+pid_t bench_start_fake_server(int port, int latency_ms);
+void bench_stop_fake_server(pid_t pid);
+
+// Generated words of 2-9 letters, drawn with a Zipf distribution as words in
+// channel text are.
+typedef struct {
+    char (*words)[16];
+    double *cumulative; // CDF over words
+    int size;
+} BenchVocabulary;
+
+int bench_vocabulary_init(BenchVocabulary *vocabulary, int size, unsigned int seed);
+const char *bench_vocabulary_word(const BenchVocabulary *vocabulary, unsigned int *seed);
+void bench_vocabulary_cleanup(BenchVocabulary *vocabulary);
+
+#endif // BENCH_H
@@ -0,0 +1,112 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "../gemini_integration.c" // For the static body builder
+
+// Building a Gemini request body (persona, three history turns, prompt) into
+// the client's reused buffer from the pre-serialized template, against the
+// cJSON tree the client used to build and print for every request.
+//
+//   bench/body [samples]
+
+#define BENCH_BODIES_PER_SAMPLE 100
+
+static const char *const PERSONA = "You are a friendly assistant in an IRC channel about \"Linux\". Keep answers short.";
+static const char *const PROMPT = "how do I find which process is listening on port 8080?";
+static const GeminiTurn HISTORY[] = {
+    { false, "alice: what does lsof do?" },
+    { true, "lsof lists open files, and sockets count as files, so it shows which process has what open." },
+    { false, "alice: and ss -ltnp?" },
+};
+
+static bool cjson_add_part(cJSON *contents, cJSON **parts, const char **current_role, const char *role, const char *text) {
+    if (*parts == NULL || strcmp(*current_role, role) != 0) {
+        cJSON *message = cJSON_CreateObject();
+        *parts = cJSON_CreateArray();
+        if (message == NULL || *parts == NULL) {
+            cJSON_Delete(message);
+            cJSON_Delete(*parts);
+            return false;
+        }
+        cJSON_AddStringToObject(message, "role", role);
+        cJSON_AddItemToObject(message, "parts", *parts);
+        cJSON_AddItemToArray(contents, message);
+        *current_role = role;
+    }
+    cJSON *part = cJSON_CreateObject();
+    if (part == NULL) return false;
+    cJSON_AddStringToObject(part, "text", text);
+    cJSON_AddItemToArray(*parts, part);
+    return true;
+}
+
+// The per-request cJSON build the template replaced.
+static char *cjson_body(const char *persona, const GeminiTurn *history, size_t history_len, const char *prompt) {
+    static const char *categories[] = { "HARM_CATEGORY_HARASSMENT", "HARM_CATEGORY_HATE_SPEECH",
+                                        "HARM_CATEGORY_SEXUALLY_EXPLICIT", "HARM_CATEGORY_DANGEROUS_CONTENT" };
+    cJSON *root = cJSON_CreateObject();
+    cJSON *contents = cJSON_AddArrayToObject(root, "contents");
+    cJSON *parts = NULL;
+    const char *role = NULL;
+    bool built = contents && cjson_add_part(contents, &parts, &role, "user", persona);
+    for (size_t i = 0; built && i < history_len; ++i) {
+        built = cjson_add_part(contents, &parts, &role, history[i].from_model ? "model" : "user", history[i].text);
+    }
+    if (built) built = cjson_add_part(contents, &parts, &role, "user", prompt);
+    cJSON *safety = cJSON_AddArrayToObject(root, "safetySettings");
+    for (size_t i = 0; built && safety && i < sizeof(categories) / sizeof(categories[0]); ++i) {
+        cJSON *setting = cJSON_CreateObject();
+        cJSON_AddStringToObject(setting, "category", categories[i]);
+        cJSON_AddStringToObject(setting, "threshold", "BLOCK_NONE");
+        cJSON_AddItemToArray(safety, setting);
+    }
+    cJSON *config = cJSON_AddObjectToObject(root, "generationConfig");
+    cJSON_AddNumberToObject(config, "temperature", AI_TEMPERATURE);
+    cJSON_AddNumberToObject(config, "maxOutputTokens", AI_MAX_OUTPUT_TOKENS);
+    char *body = built ? cJSON_PrintUnformatted(root) : NULL;
+    cJSON_Delete(root);
+    return body;
+}
+
+int main(int argc, char **argv) {
+    int samples_wanted = (argc > 1) ? atoi(argv[1]) : 2000;
+    if (samples_wanted <= 0 || bench_init("body") != 0) return 1;
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    GeminiClient client;
+    if (gemini_client_init(&client, "bench-key", NULL, AI_MAX_CONCURRENT_REQUESTS) != 0) return 1;
+    double *samples = (double *)malloc((size_t)samples_wanted * sizeof(double));
+    if (samples == NULL) return 1;
+    size_t history_len = sizeof(HISTORY) / sizeof(HISTORY[0]);
+
+    size_t body_len = 0;
+    for (int i = 0; i < samples_wanted; ++i) {
+        double start = bench_now_us();
+        for (int j = 0; j < BENCH_BODIES_PER_SAMPLE; ++j) {
+            build_request_payload(&client, client.model, PERSONA, HISTORY, history_len, PROMPT, false, false);
+        }
+        samples[i] = (bench_now_us() - start) / BENCH_BODIES_PER_SAMPLE;
+        body_len = client.payload.len;
+    }
+    fprintf(bench_out, "body: persona, %zu history turns and a prompt, per body\n", history_len);
+    bench_report("template into reused buffer", samples, samples_wanted, "us");
+
+    char *reference = cjson_body(PERSONA, HISTORY, history_len, PROMPT);
+    bool same = reference && strlen(reference) == body_len && memcmp(reference, client.payload.data, body_len) == 0;
+    free(reference);
+    for (int i = 0; i < samples_wanted; ++i) {
+        double start = bench_now_us();
+        for (int j = 0; j < BENCH_BODIES_PER_SAMPLE; ++j) {
+            free(cjson_body(PERSONA, HISTORY, history_len, PROMPT));
+        }
+        samples[i] = (bench_now_us() - start) / BENCH_BODIES_PER_SAMPLE;
+    }
+    bench_report("cJSON tree, printed and freed", samples, samples_wanted, "us");
+    fprintf(bench_out, "  %zu-byte body, %s the cJSON one\n", body_len, same ? "identical to" : "DIFFERENT from");
+
+    free(samples);
+    gemini_client_cleanup(&client);
+    curl_global_cleanup();
+    return 0;
+}
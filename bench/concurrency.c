@@ -0,0 +1,65 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "gemini_integration.h"
+
+// A burst of asks arriving at once, served with 1, 4, 8 and 16 requests in
+// flight on one client. Latency counts from the burst, so it includes the
+// time an ask spent waiting for a free slot.
+//
+//   bench/concurrency [asks] [server latency ms]
+
+static void run(const char *url, int asks, int max_inflight) {
+    GeminiClient client;
+    if (gemini_client_init_openai(&client, url, "fake", NULL, max_inflight) != 0) return;
+    double *samples = (double *)malloc((size_t)asks * sizeof(double));
+    if (samples == NULL) {
+        gemini_client_cleanup(&client);
+        return;
+    }
+    double start = bench_now_us();
+    int sent = 0, done = 0;
+    while (done < asks) {
+        unsigned long id;
+        while (sent < asks && gemini_client_has_capacity(&client) &&
+               gemini_client_submit(&client, NULL, "You are terse.", NULL, 0, "hi", false, 600000, NULL, &id) == 0) {
+            sent++;
+        }
+        gemini_client_wait(&client, -1, 100, NULL);
+        gemini_client_perform(&client);
+        GeminiResult result;
+        while (gemini_client_next_result(&client, &result)) {
+            if (result.http_code != 200) fprintf(stderr, "concurrency: HTTP %ld\n", result.http_code);
+            samples[done++] = (bench_now_us() - start) / 1e6;
+            free(result.text);
+        }
+    }
+    double total_s = (bench_now_us() - start) / 1e6;
+    char label[64];
+    snprintf(label, sizeof(label), "%2d in flight, %5.2f asks/s", max_inflight, asks / total_s);
+    bench_report(label, samples, asks, "s");
+    free(samples);
+    gemini_client_cleanup(&client);
+}
+
+int main(int argc, char **argv) {
+    int asks = (argc > 1) ? atoi(argv[1]) : 32;
+    int latency_ms = (argc > 2) ? atoi(argv[2]) : 200;
+    if (asks <= 0 || bench_init("concurrency") != 0) return 1;
+    pid_t server = bench_start_fake_server(BENCH_FAKE_PORT, latency_ms);
+    if (server == -1) return 1;
+    char url[128];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/v1/chat/completions", BENCH_FAKE_PORT);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    fprintf(bench_out, "concurrency: %d asks at once, server answers in %d ms (AI_MAX_CONCURRENT_REQUESTS is %d)\n", asks,
+            latency_ms, AI_MAX_CONCURRENT_REQUESTS);
+    static const int inflight[] = { 1, 4, 8, 16 };
+    for (size_t i = 0; i < sizeof(inflight) / sizeof(inflight[0]); ++i) run(url, asks, inflight[i]);
+
+    curl_global_cleanup();
+    bench_stop_fake_server(server);
+    return 0;
+}
@@ -0,0 +1,84 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "../gemini_integration.c" // For the static extractors
+
+// Pulling the answer, error and token counts out of a Gemini response with
+// the path-directed scanner, against the full cJSON parse it falls back to.
+// The response carries the safety ratings, citations and usage metadata a
+// real one does, around answers of a few sizes.
+//
+//   bench/json_scan [samples]
+
+#define BENCH_PARSES_PER_SAMPLE 100
+
+static char *make_response(size_t answer_len) {
+    static const char *categories[] = { "HARM_CATEGORY_HARASSMENT", "HARM_CATEGORY_HATE_SPEECH",
+                                        "HARM_CATEGORY_SEXUALLY_EXPLICIT", "HARM_CATEGORY_DANGEROUS_CONTENT" };
+    static const char words[] = "The \\\"quick\\\" brown fox\\njumps over the lazy dog \\u00e9t\\u00e9 "; // Escaped as on the wire
+    size_t size = answer_len + 4096; // Room for one extra copy of words and the rest
+    char *json = (char *)malloc(size);
+    if (json == NULL) return NULL;
+    size_t len = (size_t)snprintf(json, size, "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"");
+    for (size_t start = len; len - start < answer_len; len += sizeof(words) - 1) memcpy(json + len, words, sizeof(words) - 1);
+    len += (size_t)snprintf(json + len, size - len, "\"}],\"role\":\"model\"},\"finishReason\":\"STOP\",\"index\":0,\"safetyRatings\":[");
+    for (size_t i = 0; i < sizeof(categories) / sizeof(categories[0]); ++i) {
+        len += (size_t)snprintf(json + len, size - len, "%s{\"category\":\"%s\",\"probability\":\"NEGLIGIBLE\",\"blocked\":false}",
+                                i ? "," : "", categories[i]);
+    }
+    snprintf(json + len, size - len,
+             "],\"citationMetadata\":{\"citationSources\":[{\"startIndex\":12,\"endIndex\":140,\"uri\":\"https://example.com/a\"},"
+             "{\"startIndex\":200,\"endIndex\":320,\"uri\":\"https://example.com/b\",\"license\":\"\"}]}}],"
+             "\"usageMetadata\":{\"promptTokenCount\":412,\"candidatesTokenCount\":187,\"totalTokenCount\":599,"
+             "\"promptTokensDetails\":[{\"modality\":\"TEXT\",\"tokenCount\":412}]},\"modelVersion\":\"gemini-2.0-flash\"}");
+    return json;
+}
+
+static void run(size_t answer_len, double *samples, int samples_wanted) {
+    char *json = make_response(answer_len);
+    if (json == NULL) return;
+    fprintf(bench_out, "  %zu-byte response (about %zu bytes of escaped answer):\n", strlen(json), answer_len);
+
+    ResponseFields scanned = { 0 }, parsed = { 0 };
+    bool same = extract_response(json, GEMINI_RESPONSE_PATHS, &scanned) && extract_response_dom(json, GEMINI_RESPONSE_PATHS, &parsed) &&
+                scanned.text && parsed.text && strcmp(scanned.text, parsed.text) == 0 && scanned.total_tokens == parsed.total_tokens;
+    free_response_fields(&scanned);
+    free_response_fields(&parsed);
+    if (!same) fprintf(bench_out, "  the scanner and cJSON DISAGREE on this response\n");
+
+    for (int i = 0; i < samples_wanted; ++i) {
+        double start = bench_now_us();
+        for (int j = 0; j < BENCH_PARSES_PER_SAMPLE; ++j) {
+            ResponseFields fields;
+            extract_response(json, GEMINI_RESPONSE_PATHS, &fields);
+            free_response_fields(&fields);
+        }
+        samples[i] = (bench_now_us() - start) / BENCH_PARSES_PER_SAMPLE;
+    }
+    bench_report("json_scan", samples, samples_wanted, "us");
+    for (int i = 0; i < samples_wanted; ++i) {
+        double start = bench_now_us();
+        for (int j = 0; j < BENCH_PARSES_PER_SAMPLE; ++j) {
+            ResponseFields fields = { 0 };
+            extract_response_dom(json, GEMINI_RESPONSE_PATHS, &fields);
+            free_response_fields(&fields);
+        }
+        samples[i] = (bench_now_us() - start) / BENCH_PARSES_PER_SAMPLE;
+    }
+    bench_report("cJSON_Parse + lookups + delete", samples, samples_wanted, "us");
+    free(json);
+}
+
+int main(int argc, char **argv) {
+    int samples_wanted = (argc > 1) ? atoi(argv[1]) : 1000;
+    if (samples_wanted <= 0 || bench_init("json_scan") != 0) return 1;
+    double *samples = (double *)malloc((size_t)samples_wanted * sizeof(double));
+    if (samples == NULL) return 1;
+    fprintf(bench_out, "json_scan: answer, error.message and usageMetadata from a Gemini response, per response\n");
+    static const size_t answer_sizes[] = { 200, 1000, 8000 };
+    for (size_t i = 0; i < sizeof(answer_sizes) / sizeof(answer_sizes[0]); ++i) run(answer_sizes[i], samples, samples_wanted);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "ai_markov.h"
+
+// The offline model: learning channel messages and answering prompts, on a
+// model file mapped from disk as a worker has it. Messages are drawn from a
+// fixed set of generated channel lines with Zipf-distributed words, replayed
+// until the requested count.
+//
+//   bench/markov [messages] [replies]
+
+#define BENCH_VOCABULARY 3000
+#define BENCH_CORPUS_LINES 5000
+#define BENCH_LEARN_PER_SAMPLE 100
+
+static BenchVocabulary g_vocabulary;
+static char *g_corpus[BENCH_CORPUS_LINES];
+
+static char *make_line(unsigned int *seed) {
+    char line[MAX_PIPE_MSG_LEN];
+    int words = 3 + (int)(rand_r(seed) % 15);
+    size_t len = 0;
+    line[0] = '\0';
+    for (int i = 0; i < words && len + 20 < sizeof(line); ++i) {
+        len += (size_t)snprintf(line + len, sizeof(line) - len, "%s%s", i ? " " : "", bench_vocabulary_word(&g_vocabulary, seed));
+    }
+    return strdup(line);
+}
+
+int main(int argc, char **argv) {
+    long messages = (argc > 1) ? atol(argv[1]) : 200000;
+    int replies = (argc > 2) ? atoi(argv[2]) : 20000;
+    if (messages < BENCH_LEARN_PER_SAMPLE || replies <= 0 || bench_init("markov") != 0) return 1;
+    unsigned int seed = 3;
+    if (bench_vocabulary_init(&g_vocabulary, BENCH_VOCABULARY, seed) != 0) return 1;
+    for (int i = 0; i < BENCH_CORPUS_LINES; ++i) {
+        if ((g_corpus[i] = make_line(&seed)) == NULL) return 1;
+    }
+    AiMarkov model;
+    if (ai_markov_open(&model, "bench.markov") != 0) return 1;
+
+    int samples_wanted = (int)(messages / BENCH_LEARN_PER_SAMPLE);
+    int most = samples_wanted > replies ? samples_wanted : replies;
+    double *samples = (double *)malloc((size_t)most * sizeof(double));
+    if (samples == NULL) return 1;
+    for (int i = 0; i < samples_wanted; ++i) {
+        double start = bench_now_us();
+        for (int j = 0; j < BENCH_LEARN_PER_SAMPLE; ++j) {
+            ai_markov_learn(&model, g_corpus[(i * BENCH_LEARN_PER_SAMPLE + j) % BENCH_CORPUS_LINES]);
+        }
+        samples[i] = (bench_now_us() - start) / BENCH_LEARN_PER_SAMPLE;
+    }
+    fprintf(bench_out, "markov: %ld messages from %d distinct lines, %d-word Zipf vocabulary, model file %zu KB\n", messages,
+            BENCH_CORPUS_LINES, BENCH_VOCABULARY, model.map_size / 1024);
+    bench_report("learn, per message", samples, samples_wanted, "us");
+
+    int answered = 0;
+    for (int i = 0; i < replies; ++i) {
+        char prompt[MAX_PIPE_MSG_LEN], reply[MAX_PIPE_MSG_LEN];
+        snprintf(prompt, sizeof(prompt), "what about %s?", g_corpus[rand_r(&seed) % BENCH_CORPUS_LINES]);
+        double start = bench_now_us();
+        answered += ai_markov_reply(&model, prompt, reply, sizeof(reply));
+        samples[i] = bench_now_us() - start;
+    }
+    bench_report("reply", samples, replies, "us");
+    fprintf(bench_out, "  %d of %d prompts answered\n", answered, replies);
+
+    ai_markov_close(&model);
+    for (int i = 0; i < BENCH_CORPUS_LINES; ++i) free(g_corpus[i]);
+    bench_vocabulary_cleanup(&g_vocabulary);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include <ctype.h>
+
+// The mute list: loading it at startup, the check every PRIVMSG makes, and
+// !mute / !unmute with their journal records. Lookups are half for muted
+// nicks in another capitalization and half for nicks that are not muted,
+// against a strcmp scan over the same nicks as the list used to do.
+//
+//   bench/mute [muted nicks] [lookups]
+
+#define BENCH_LOOKUPS_PER_SAMPLE 100
+#define BENCH_CHURN 20000 // Mute and unmute pairs, at most one per lookup sample
+
+static void make_nick(char *out, size_t out_size, long i) {
+    snprintf(out, out_size, "user%ld_%lx", i, (unsigned long)i * 2654435761UL % 0xfffff);
+}
+
+static void flip_case(char *nick) {
+    for (; *nick; ++nick) {
+        unsigned char c = (unsigned char)*nick;
+        *nick = (char)(islower(c) ? toupper(c) : tolower(c));
+    }
+}
+
+static bool linear_find(char **nicks, long count, const char *nick) {
+    for (long i = 0; i < count; ++i) {
+        if (strcmp(nicks[i], nick) == 0) return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    long count = (argc > 1) ? atol(argv[1]) : 100000;
+    int lookups = (argc > 2) ? atoi(argv[2]) : 1000000;
+    if (count <= 0 || lookups < BENCH_LOOKUPS_PER_SAMPLE || bench_init("mute") != 0) return 1;
+
+    char **nicks = (char **)calloc((size_t)count, sizeof(char *));
+    FILE *file = fopen(MUTED_USERS_FILE_PATH, "w");
+    if (nicks == NULL || file == NULL) return 1;
+    for (long i = 0; i < count; ++i) {
+        char nick[MAX_NICK_LEN];
+        make_nick(nick, sizeof(nick), i);
+        if ((nicks[i] = strdup(nick)) == NULL) return 1;
+        fprintf(file, "%s\n", nick);
+    }
+    fclose(file);
+
+    double start = bench_now_us();
+    int loaded = load_muted_users_from_file(MUTED_USERS_FILE_PATH);
+    double load_ms = (bench_now_us() - start) / 1000;
+    fprintf(bench_out, "mute: %d muted nicks, loaded in %.1f ms; lookups half muted (case flipped), half not\n", loaded, load_ms);
+
+    // Queries prepared up front, so only the lookup is timed
+    int queries_count = 4096;
+    char (*queries)[MAX_NICK_LEN] = calloc((size_t)queries_count, MAX_NICK_LEN);
+    if (queries == NULL) return 1;
+    unsigned int seed = 13;
+    for (int i = 0; i < queries_count; ++i) {
+        if (i % 2 == 0) {
+            snprintf(queries[i], MAX_NICK_LEN, "%s", nicks[rand_r(&seed) % count]);
+            flip_case(queries[i]);
+        } else {
+            make_nick(queries[i], MAX_NICK_LEN, count + rand_r(&seed) % count);
+        }
+    }
+
+    int samples_wanted = lookups / BENCH_LOOKUPS_PER_SAMPLE;
+    double *samples = (double *)malloc((size_t)samples_wanted * sizeof(double));
+    if (samples == NULL) return 1;
+    int hits = 0;
+    for (int i = 0; i < samples_wanted; ++i) {
+        start = bench_now_us();
+        for (int j = 0; j < BENCH_LOOKUPS_PER_SAMPLE; ++j) {
+            hits += is_user_globally_muted(queries[(i * BENCH_LOOKUPS_PER_SAMPLE + j) % queries_count]);
+        }
+        samples[i] = (bench_now_us() - start) * 1000 / BENCH_LOOKUPS_PER_SAMPLE;
+    }
+    bench_report("is_user_globally_muted", samples, samples_wanted, "ns");
+    fprintf(bench_out, "  %d of %d lookups muted\n", hits, samples_wanted * BENCH_LOOKUPS_PER_SAMPLE);
+
+    // The scan takes a sample per lookup; a few hundred are plenty at this cost
+    int scans = samples_wanted < 500 ? samples_wanted : 500;
+    int found = 0;
+    for (int i = 0; i < scans; ++i) {
+        const char *query = queries[i % queries_count];
+        start = bench_now_us();
+        found += linear_find(nicks, count, query);
+        samples[i] = bench_now_us() - start;
+    }
+    bench_report("linear strcmp scan", samples, scans, "us");
+    fprintf(bench_out, "  %d of %d scans found the nick; strcmp misses the other capitalization\n", found, scans);
+
+    int churn = BENCH_CHURN < samples_wanted ? BENCH_CHURN : samples_wanted;
+    for (int i = 0; i < churn; ++i) {
+        char nick[MAX_NICK_LEN];
+        snprintf(nick, sizeof(nick), "Churn%d", i);
+        start = bench_now_us();
+        add_muted_user(nick);
+        remove_muted_user(nick);
+        samples[i] = bench_now_us() - start;
+    }
+    bench_report("!mute + !unmute, journaled", samples, churn, "us");
+
+    free_muted_users_memory();
+    for (long i = 0; i < count; ++i) free(nicks[i]);
+    free(nicks);
+    free(queries);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "ai_recall.h"
+
+// Channel recall: indexing each message as it arrives and the BM25 query an
+// !ask runs before it is sent, at the bot's window and at a larger one.
+// Messages and queries are drawn from a Zipf vocabulary, so common words have
+// long posting lists as they do in a busy channel. Each window is filled and
+// then run through once more before timing, so expiry is part of every add.
+//
+//   bench/recall [large window] [queries]
+
+#define BENCH_VOCABULARY 50000
+#define BENCH_ADDS_PER_SAMPLE 100
+
+static BenchVocabulary g_vocabulary;
+
+static void make_words(char *out, size_t out_size, int words, unsigned int *seed) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i < words && len + 20 < out_size; ++i) {
+        len += (size_t)snprintf(out + len, out_size - len, "%s%s", i ? " " : "", bench_vocabulary_word(&g_vocabulary, seed));
+    }
+}
+
+static void add_message(AiRecall *recall, long i, unsigned int *seed) {
+    char nick[MAX_NICK_LEN], text[AI_RECALL_LINE_MAX];
+    snprintf(nick, sizeof(nick), "user%ld", i % 50);
+    make_words(text, sizeof(text), 4 + (int)(rand_r(seed) % 16), seed);
+    ai_recall_add(recall, nick, text);
+}
+
+static void run(size_t window, int queries, double *samples) {
+    AiRecall recall;
+    if (ai_recall_init(&recall, window) != 0) return;
+    unsigned int seed = 11;
+    fprintf(bench_out, "  window of %zu messages:\n", window);
+
+    for (long i = 0; i < (long)window; ++i) add_message(&recall, i, &seed);
+    int adds_wanted = (int)(window / BENCH_ADDS_PER_SAMPLE);
+    for (int i = 0; i < adds_wanted; ++i) {
+        double start = bench_now_us();
+        for (int j = 0; j < BENCH_ADDS_PER_SAMPLE; ++j) add_message(&recall, (long)i * BENCH_ADDS_PER_SAMPLE + j, &seed);
+        samples[i] = (bench_now_us() - start) / BENCH_ADDS_PER_SAMPLE;
+    }
+    bench_report("add, per message", samples, adds_wanted, "us");
+
+    long recalled = 0;
+    for (int i = 0; i < queries; ++i) {
+        char query[MAX_PIPE_MSG_LEN], out[AI_RECALL_MAX_CHARS];
+        make_words(query, sizeof(query), 3 + (int)(rand_r(&seed) % 10), &seed);
+        double start = bench_now_us();
+        recalled += ai_recall_query(&recall, query, AI_RECALL_TOP_K, AI_RECALL_MIN_SCORE, out, sizeof(out));
+        samples[i] = bench_now_us() - start;
+    }
+    bench_report("query", samples, queries, "us");
+    fprintf(bench_out, "  %zu distinct terms indexed, %.2f lines recalled per query\n", recall.term_count, (double)recalled / queries);
+    ai_recall_cleanup(&recall);
+}
+
+int main(int argc, char **argv) {
+    size_t large_window = (argc > 1) ? (size_t)atol(argv[1]) : 200000;
+    int queries = (argc > 2) ? atoi(argv[2]) : 2000;
+    if (large_window < BENCH_ADDS_PER_SAMPLE || queries <= 0 || bench_init("recall") != 0) return 1;
+    if (bench_vocabulary_init(&g_vocabulary, BENCH_VOCABULARY, 5) != 0) return 1;
+    size_t most = large_window / BENCH_ADDS_PER_SAMPLE > (size_t)queries ? large_window / BENCH_ADDS_PER_SAMPLE : (size_t)queries;
+    double *samples = (double *)malloc(most * sizeof(double));
+    if (samples == NULL) return 1;
+
+    fprintf(bench_out, "recall: BM25 over recent channel messages, %d-word Zipf vocabulary, top %d\n", BENCH_VOCABULARY, AI_RECALL_TOP_K);
+    run(AI_RECALL_WINDOW, queries, samples);
+    if (large_window != AI_RECALL_WINDOW) run(large_window, queries, samples);
+
+    free(samples);
+    bench_vocabulary_cleanup(&g_vocabulary);
+    return 0;
+}
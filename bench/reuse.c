@@ -0,0 +1,78 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "gemini_integration.h"
+
+// Client-side cost of a request with a fresh GeminiClient per !ask (new
+// handles, connection and, over HTTPS, TLS handshake every time) against the
+// persistent per-worker client, and the first ask with and without warmup.
+// The fake server answers at once, so what is left is connection cost. It
+// speaks plain HTTP; to see the TLS share, pass the https:// URL of an
+// OpenAI-compatible server whose certificate the system trusts.
+//
+//   bench/reuse [requests] [url]
+
+#define BENCH_FIRST_ASK_RUNS 50
+
+static double one_request_ms(GeminiClient *client) {
+    double start = bench_now_us();
+    unsigned long id;
+    if (gemini_client_submit(client, NULL, "You are terse.", NULL, 0, "hi", false, 10000, NULL, &id) != 0) return -1;
+    GeminiResult result;
+    for (;;) {
+        gemini_client_wait(client, -1, 50, NULL);
+        gemini_client_perform(client);
+        if (gemini_client_next_result(client, &result)) break;
+    }
+    if (result.http_code != 200) fprintf(stderr, "reuse: HTTP %ld, curl %d\n", result.http_code, (int)result.curl_code);
+    free(result.text);
+    return (bench_now_us() - start) / 1000;
+}
+
+static double first_request_ms(const char *url, bool warm) {
+    GeminiClient client;
+    if (gemini_client_init_openai(&client, url, "fake", NULL, AI_MAX_CONCURRENT_REQUESTS) != 0) return -1;
+    if (warm) gemini_client_warmup(&client); // Done at worker start, before anyone asks
+    double ms = one_request_ms(&client);
+    gemini_client_cleanup(&client);
+    return ms;
+}
+
+int main(int argc, char **argv) {
+    int requests = (argc > 1) ? atoi(argv[1]) : 200;
+    if (requests <= 0 || bench_init("reuse") != 0) return 1;
+    char url[256];
+    pid_t server = -1;
+    if (argc > 2) {
+        snprintf(url, sizeof(url), "%s", argv[2]);
+    } else {
+        if ((server = bench_start_fake_server(BENCH_FAKE_PORT, 0)) == -1) return 1;
+        snprintf(url, sizeof(url), "http://127.0.0.1:%d/v1/chat/completions", BENCH_FAKE_PORT);
+    }
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    fprintf(bench_out, "reuse: request round trip against %s\n", url);
+
+    double *samples = (double *)malloc((size_t)requests * sizeof(double));
+    if (samples == NULL) return 1;
+    for (int i = 0; i < requests; ++i) samples[i] = first_request_ms(url, false); // Each one builds and tears down a client
+    bench_report("fresh client per request", samples, requests, "ms");
+
+    GeminiClient client;
+    if (gemini_client_init_openai(&client, url, "fake", NULL, AI_MAX_CONCURRENT_REQUESTS) != 0) return 1;
+    for (int i = 0; i < requests; ++i) samples[i] = one_request_ms(&client);
+    bench_report("persistent client", samples, requests, "ms");
+    gemini_client_cleanup(&client);
+
+    double first[BENCH_FIRST_ASK_RUNS];
+    for (int i = 0; i < BENCH_FIRST_ASK_RUNS; ++i) first[i] = first_request_ms(url, false);
+    bench_report("first ask, no warmup", first, BENCH_FIRST_ASK_RUNS, "ms");
+    for (int i = 0; i < BENCH_FIRST_ASK_RUNS; ++i) first[i] = first_request_ms(url, true);
+    bench_report("first ask after warmup", first, BENCH_FIRST_ASK_RUNS, "ms");
+
+    free(samples);
+    curl_global_cleanup();
+    bench_stop_fake_server(server);
+    return 0;
+}
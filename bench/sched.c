@@ -0,0 +1,164 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "ai_worker.h"
+#include <sys/socket.h>
+
+// A worker under a skewed load: an ask every 25 ms, 80% of them long ones
+// from two heavy users and the rest short ones from twenty light users, sent
+// to fake_ai_server answering in 200 ms. The worker's replies are read back
+// from its IRC socket, and each ask's latency runs from enqueue to its
+// answer, per kind of asker. Asks turned away by overload control are
+// counted apart.
+//
+//   bench/sched [asks] [interval ms] [server latency ms]
+
+#define BENCH_HEAVY_USERS 2
+#define BENCH_LIGHT_USERS 20
+#define BENCH_HEAVY_PERCENT 80
+#define BENCH_DRAIN_MS 60000 // Longest wait for the last answers once everything is asked
+
+typedef struct {
+    char nick[MAX_NICK_LEN];
+    bool heavy;
+    double *asked_at; // FIFO of enqueue times; answers to one nick come in ask order
+    int head;
+    int tail;
+} Asker;
+
+typedef struct {
+    Asker askers[BENCH_HEAVY_USERS + BENCH_LIGHT_USERS];
+    double *latency[2]; // Per kind, indexed by heavy
+    int answered[2];
+    int turned_away[2];
+    int other[2];
+    int pending;
+    char input[16384];
+    size_t buffered;
+} Bench;
+
+static Asker *find_asker(Bench *bench, const char *nick, size_t len) {
+    for (int i = 0; i < BENCH_HEAVY_USERS + BENCH_LIGHT_USERS; ++i) {
+        if (strlen(bench->askers[i].nick) == len && strncmp(bench->askers[i].nick, nick, len) == 0) return &bench->askers[i];
+    }
+    return NULL;
+}
+
+// Matches one "PRIVMSG #chan :<nick>: answer" or "...:<nick>, notice" line to the asker's oldest open ask.
+static void handle_line(Bench *bench, const char *line) {
+    const char *text = strstr(line, " :");
+    if (strncmp(line, "PRIVMSG ", 8) != 0 || text == NULL) return;
+    text += 2;
+    size_t nick_len = strcspn(text, ":,");
+    Asker *asker = find_asker(bench, text, nick_len);
+    if (asker == NULL || text[nick_len] == '\0' || asker->head == asker->tail) return;
+    const char *rest = text + nick_len + 1;
+    if (strstr(rest, "in line;") != NULL) return; // Queue position notice, the answer is still to come
+    int kind = asker->heavy ? 1 : 0;
+    double waited_ms = (bench_now_us() - asker->asked_at[asker->head++]) / 1000;
+    if (text[nick_len] == ':') bench->latency[kind][bench->answered[kind]++] = waited_ms;
+    else if (strstr(rest, "too busy") != NULL) bench->turned_away[kind]++;
+    else bench->other[kind]++;
+    bench->pending--;
+}
+
+static void read_replies(Bench *bench, int fd) {
+    for (;;) {
+        ssize_t n = read(fd, bench->input + bench->buffered, sizeof(bench->input) - 1 - bench->buffered);
+        if (n <= 0) return;
+        bench->buffered += (size_t)n;
+        bench->input[bench->buffered] = '\0';
+        char *line = bench->input, *end;
+        while ((end = strstr(line, "\r\n")) != NULL) {
+            *end = '\0';
+            handle_line(bench, line);
+            line = end + 2;
+        }
+        bench->buffered -= (size_t)(line - bench->input);
+        memmove(bench->input, line, bench->buffered);
+    }
+}
+
+// Drives the worker until until_us, collecting replies as they are posted.
+static void run_until(AiWorker *aw, Bench *bench, int reply_fd, double until_us) {
+    for (;;) {
+        double left_ms = (until_us - bench_now_us()) / 1000;
+        if (left_ms <= 0) return;
+        ai_worker_wait(aw, reply_fd, left_ms < 20 ? (int)left_ms + 1 : 20);
+        ai_worker_process(aw);
+        read_replies(bench, reply_fd);
+    }
+}
+
+static void random_words(char *out, size_t out_size, int words, unsigned int *seed) {
+    static const char *vocabulary[] = { "kernel", "socket", "thread", "memory", "cache", "buffer", "pointer", "signal",
+                                        "process", "packet", "router", "compiler", "linker", "syscall", "mutex", "queue",
+                                        "latency", "throughput", "scheduler", "page", "inode", "journal", "shell", "pipe" };
+    size_t len = 0;
+    for (int i = 0; i < words && len + 16 < out_size; ++i) {
+        len += (size_t)snprintf(out + len, out_size - len, " %s", vocabulary[rand_r(seed) % (sizeof(vocabulary) / sizeof(vocabulary[0]))]);
+    }
+}
+
+int main(int argc, char **argv) {
+    int asks = (argc > 1) ? atoi(argv[1]) : 200;
+    int interval_ms = (argc > 2) ? atoi(argv[2]) : 25;
+    int latency_ms = (argc > 3) ? atoi(argv[3]) : 200;
+    if (asks <= 0 || interval_ms < 0 || bench_init("sched") != 0) return 1;
+    pid_t server = bench_start_fake_server(BENCH_FAKE_PORT, latency_ms);
+    if (server == -1) return 1;
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) return 1;
+    fcntl(sockets[1], F_SETFL, O_NONBLOCK);
+    char options[MAX_BACKEND_OPTIONS_LEN];
+    snprintf(options, sizeof(options), "backend=fake url=http://127.0.0.1:%d/v1/chat/completions quota=off deadline=120",
+             BENCH_FAKE_PORT);
+    ChannelInfo channel = { "#bench", "You are terse.", options };
+    AiWorker aw;
+    if (ai_worker_init(&aw, 0, "Bench", &channel, sockets[0], NULL) != 0) return 1;
+
+    static Bench bench;
+    for (int i = 0; i < BENCH_HEAVY_USERS + BENCH_LIGHT_USERS; ++i) {
+        Asker *asker = &bench.askers[i];
+        asker->heavy = (i < BENCH_HEAVY_USERS);
+        snprintf(asker->nick, sizeof(asker->nick), "%s%d", asker->heavy ? "heavy" : "light", asker->heavy ? i : i - BENCH_HEAVY_USERS);
+        asker->asked_at = (double *)calloc((size_t)asks, sizeof(double));
+    }
+    bench.latency[0] = (double *)calloc((size_t)asks, sizeof(double));
+    bench.latency[1] = (double *)calloc((size_t)asks, sizeof(double));
+
+    unsigned int seed = 7;
+    double next_us = bench_now_us();
+    for (int i = 0; i < asks; ++i) {
+        bool heavy = (int)(rand_r(&seed) % 100) < BENCH_HEAVY_PERCENT;
+        Asker *asker = &bench.askers[heavy ? rand_r(&seed) % BENCH_HEAVY_USERS : BENCH_HEAVY_USERS + rand_r(&seed) % BENCH_LIGHT_USERS];
+        char prompt[MAX_PIPE_MSG_LEN];
+        int len = snprintf(prompt, sizeof(prompt), heavy ? "explain in great detail, with examples, ask %d:" : "briefly, ask %d:", i);
+        random_words(prompt + len, sizeof(prompt) - (size_t)len, heavy ? 40 : 4, &seed);
+        char persona[64]; // One per ask keeps the answer cache and near-duplicate index out of the measurement
+        snprintf(persona, sizeof(persona), "%s (%d)", channel.persona, i);
+        asker->asked_at[asker->tail++] = bench_now_us();
+        bench.pending++;
+        ai_worker_enqueue(&aw, asker->nick, persona, prompt, false);
+        next_us += interval_ms * 1000.0;
+        run_until(&aw, &bench, sockets[1], next_us);
+    }
+    double deadline_us = bench_now_us() + BENCH_DRAIN_MS * 1000.0;
+    while (bench.pending > 0 && bench_now_us() < deadline_us) run_until(&aw, &bench, sockets[1], bench_now_us() + 50000);
+
+    fprintf(bench_out, "sched: %d asks every %d ms, %d%% from %d heavy users, server %d ms, %d in flight\n", asks, interval_ms,
+            BENCH_HEAVY_PERCENT, BENCH_HEAVY_USERS, latency_ms, AI_MAX_CONCURRENT_REQUESTS);
+    bench_report("light askers, answered", bench.latency[0], bench.answered[0], "ms");
+    bench_report("heavy askers, answered", bench.latency[1], bench.answered[1], "ms");
+    fprintf(bench_out, "  turned away as busy: %d light, %d heavy; other replies: %d; unanswered: %d\n", bench.turned_away[0],
+            bench.turned_away[1], bench.other[0] + bench.other[1], bench.pending);
+
+    ai_worker_cleanup(&aw);
+    curl_global_cleanup();
+    bench_stop_fake_server(server);
+    return 0;
+}
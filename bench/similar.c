@@ -0,0 +1,124 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include "ai_similar.h"
+
+// Near-duplicate index: inserts, lookups that miss, and lookups of a prompt
+// stored 100 inserts earlier with one letter changed, after the ring has
+// wrapped. Prompts are 4-13 words drawn from a generated vocabulary whose
+// words are built from common English syllables, so prompts share their
+// frequent bigrams much as real ones do.
+//
+//   bench/similar [capacity...]
+
+#define BENCH_VOCABULARY 20000
+#define BENCH_LOOKUPS 20000
+#define BENCH_TYPO_DISTANCE 100
+
+static char g_words[BENCH_VOCABULARY][12];
+
+static void make_vocabulary(void) {
+    static const char *syllables[] = { "th", "he", "in", "er", "an", "re", "on", "at", "en", "nd", "ti", "es", "or", "te",
+                                       "of", "ed", "is", "it", "al", "ar", "st", "to", "nt", "ng", "se", "ha", "as", "ou",
+                                       "io", "le", "ve", "co", "me", "de", "hi", "ri", "ro", "ic", "ne", "ea", "ra", "ce",
+                                       "li", "ch", "ll", "be", "ma", "si", "om", "ur", "a", "e", "i", "o", "u", "y", "s" };
+    size_t num_syllables = sizeof(syllables) / sizeof(syllables[0]);
+    unsigned int seed = 7;
+    for (int i = 0; i < BENCH_VOCABULARY; ++i) {
+        int parts = 2 + (int)(rand_r(&seed) % 4);
+        size_t len = 0;
+        for (int j = 0; j < parts; ++j) {
+            const char *syllable = syllables[rand_r(&seed) % num_syllables];
+            size_t syllable_len = strlen(syllable);
+            memcpy(g_words[i] + len, syllable, syllable_len);
+            len += syllable_len;
+        }
+        g_words[i][len] = '\0';
+    }
+}
+
+static void make_prompt(char *out, size_t out_size, unsigned int *seed) {
+    int words = 4 + (int)(rand_r(seed) % 10);
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i < words && len + 16 < out_size; ++i) {
+        len += (size_t)snprintf(out + len, out_size - len, "%s%s", i ? " " : "", g_words[rand_r(seed) % BENCH_VOCABULARY]);
+    }
+}
+
+static long rss_kb(void) {
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL) return 0;
+    char line[256];
+    long kb = 0;
+    while (fgets(line, sizeof(line), status)) {
+        if (strncmp(line, "VmRSS:", 6) == 0) kb = atol(line + 6);
+    }
+    fclose(status);
+    return kb;
+}
+
+static void run(size_t capacity, double *samples) {
+    long rss_before = rss_kb();
+    AiSimilarIndex index;
+    if (ai_similar_init(&index, capacity, AI_SIMILAR_THRESHOLD) != 0) return;
+    unsigned int seed = 1;
+    char prompt[400];
+
+    double start = bench_now_us();
+    for (size_t i = 0; i < capacity; ++i) {
+        make_prompt(prompt, sizeof(prompt), &seed);
+        ai_similar_insert(&index, "persona", prompt);
+    }
+    double insert_us = (bench_now_us() - start) / (double)capacity;
+    for (size_t i = 0; i < capacity / 4; ++i) { // Wrap the ring so lookups see overwritten slots
+        make_prompt(prompt, sizeof(prompt), &seed);
+        ai_similar_insert(&index, "persona", prompt);
+    }
+    fprintf(bench_out, "  %zu entries: insert %.1f us, index RSS %ld MB\n", capacity, insert_us, (rss_kb() - rss_before) / 1024);
+
+    int false_hits = 0;
+    for (int i = 0; i < BENCH_LOOKUPS; ++i) {
+        make_prompt(prompt, sizeof(prompt), &seed);
+        start = bench_now_us();
+        false_hits += ai_similar_lookup(&index, "persona", prompt, NULL) != NULL;
+        samples[i] = bench_now_us() - start;
+    }
+    bench_report("lookup, miss", samples, BENCH_LOOKUPS, "us");
+
+    static char recent[BENCH_TYPO_DISTANCE][400];
+    int found = 0, asked = 0;
+    for (int i = 0; i < BENCH_LOOKUPS + BENCH_TYPO_DISTANCE; ++i) {
+        make_prompt(recent[i % BENCH_TYPO_DISTANCE], sizeof(recent[0]), &seed);
+        ai_similar_insert(&index, "persona", recent[i % BENCH_TYPO_DISTANCE]);
+        if (i < BENCH_TYPO_DISTANCE) continue;
+        snprintf(prompt, sizeof(prompt), "%s", recent[(i + 1) % BENCH_TYPO_DISTANCE]); // Stored 99 inserts ago
+        size_t len = strlen(prompt);
+        prompt[len / 2] = (prompt[len / 2] == 'q') ? 'z' : 'q';
+        start = bench_now_us();
+        found += ai_similar_lookup(&index, "persona", prompt, NULL) != NULL;
+        samples[asked++] = bench_now_us() - start;
+    }
+    bench_report("lookup, one-letter typo", samples, asked, "us");
+    fprintf(bench_out, "  typos found %.2f%%, false hits on misses %d\n", 100.0 * found / asked, false_hits);
+    ai_similar_cleanup(&index);
+}
+
+int main(int argc, char **argv) {
+    if (bench_init("similar") != 0) return 1;
+    double *samples = (double *)malloc(BENCH_LOOKUPS * sizeof(double));
+    if (samples == NULL) return 1;
+    make_vocabulary();
+    fprintf(bench_out, "similar: MinHash/LSH index, %d bands x %d rows, at most %d candidates per lookup\n", AI_SIMILAR_BANDS,
+            AI_SIMILAR_ROWS, AI_SIMILAR_MAX_CANDIDATES);
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) run((size_t)atol(argv[i]), samples);
+    } else {
+        run(AI_SIMILAR_MAX_ENTRIES, samples);
+        run(65536, samples);
+    }
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "bench.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+// !history range queries against a generated transcript of one line per
+// second, warm and with the file dropped from the page cache, next to the
+// linear scan from the start of the log that the sparse index avoids.
+//
+//   bench/transcript [lines] [queries]
+
+#define BENCH_CHANNEL "#bench"
+#define BENCH_FIRST_TS 1700000000LL
+#define BENCH_WINDOW_SECONDS 3600
+
+typedef struct {
+    int64_t ts;
+    int64_t offset;
+} IndexRecord; // Same layout as transcript.c writes
+
+static int g_lines_emitted;
+
+static void count_line(const char *line, void *ctx) {
+    (void)line;
+    (void)ctx;
+    g_lines_emitted++;
+}
+
+// Writes the log and index the way transcript_append() would over `lines` seconds.
+static int generate(long lines) {
+    static const char *nicks[] = { "alice", "bob", "carol", "dave_", "eve" };
+    if (mkdir(TRANSCRIPT_DIR, 0755) == -1 && errno != EEXIST) return -1;
+    FILE *log = fopen(TRANSCRIPT_DIR "/" BENCH_CHANNEL ".log", "w");
+    FILE *idx = fopen(TRANSCRIPT_DIR "/" BENCH_CHANNEL ".idx", "w");
+    if (log == NULL || idx == NULL) return -1;
+    int64_t size = 0, last_indexed = -1;
+    for (long i = 0; i < lines; ++i) {
+        char line[256];
+        int64_t ts = BENCH_FIRST_TS + i;
+        int len = snprintf(line, sizeof(line), "%lld\t%s\tmessage number %ld about something or other %ld\n",
+                           (long long)ts, nicks[i % 5], i, (i * 7919) % 100003);
+        if (last_indexed == -1 || size - last_indexed >= TRANSCRIPT_INDEX_STRIDE_BYTES) {
+            IndexRecord rec = { ts, size };
+            fwrite(&rec, sizeof(rec), 1, idx);
+            last_indexed = size;
+        }
+        fwrite(line, 1, (size_t)len, log);
+        size += len;
+    }
+    fflush(log);
+    fflush(idx);
+    fsync(fileno(log)); // Clean pages, so they can be dropped for the cold runs
+    fsync(fileno(idx));
+    fclose(log);
+    fclose(idx);
+    fprintf(bench_out, "  %ld lines, %.1f MB of log\n", lines, (double)size / (1024 * 1024));
+    return 0;
+}
+
+static void drop_page_cache(void) {
+    static const char *paths[] = { TRANSCRIPT_DIR "/" BENCH_CHANNEL ".log", TRANSCRIPT_DIR "/" BENCH_CHANNEL ".idx" };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+        int fd = open(paths[i], O_RDONLY);
+        if (fd == -1) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void run_queries(const char *label, long lines, int queries, bool cold) {
+    double *samples = (double *)malloc((size_t)queries * sizeof(double));
+    if (samples == NULL) return;
+    srand(1);
+    for (int i = 0; i < queries; ++i) {
+        time_t from = (time_t)(BENCH_FIRST_TS + (long long)((double)rand() / RAND_MAX * (double)(lines - BENCH_WINDOW_SECONDS)));
+        if (cold) drop_page_cache();
+        g_lines_emitted = 0;
+        double start = bench_now_us();
+        transcript_query(BENCH_CHANNEL, from, from + BENCH_WINDOW_SECONDS, HISTORY_MAX_REPLY_LINES, count_line, NULL);
+        samples[i] = bench_now_us() - start;
+    }
+    bench_report(label, samples, queries, "us");
+    free(samples);
+}
+
+// Reads from the top of the log to the first line at or after target, as a query without the index must.
+static double linear_scan_ms(int64_t target) {
+    int fd = open(TRANSCRIPT_DIR "/" BENCH_CHANNEL ".log", O_RDONLY);
+    if (fd == -1) return -1;
+    double start = bench_now_us();
+    char buffer[16384];
+    size_t buffered = 0;
+    off_t offset = 0;
+    bool found = false;
+    while (!found) {
+        ssize_t n = pread(fd, buffer + buffered, sizeof(buffer) - buffered, offset);
+        if (n <= 0) break;
+        offset += n;
+        buffered += (size_t)n;
+        char *line_start = buffer, *newline;
+        while ((newline = memchr(line_start, '\n', buffered - (size_t)(line_start - buffer))) != NULL) {
+            if (strtoll(line_start, NULL, 10) >= target) {
+                found = true;
+                break;
+            }
+            line_start = newline + 1;
+        }
+        buffered -= (size_t)(line_start - buffer);
+        memmove(buffer, line_start, buffered);
+    }
+    close(fd);
+    return (bench_now_us() - start) / 1000;
+}
+
+int main(int argc, char **argv) {
+    long lines = (argc > 1) ? atol(argv[1]) : 1000000;
+    int queries = (argc > 2) ? atoi(argv[2]) : 2000;
+    if (lines <= BENCH_WINDOW_SECONDS || queries <= 0 || bench_init("transcript") != 0) return 1;
+
+    fprintf(bench_out, "transcript: 1-hour !history queries capped at %d lines\n", HISTORY_MAX_REPLY_LINES);
+    if (generate(lines) != 0) {
+        fprintf(stderr, "transcript: cannot write the transcript: %s\n", strerror(errno));
+        return 1;
+    }
+    ChannelInfo channel = { BENCH_CHANNEL, "", NULL };
+    g_channel_infos = &channel;
+    numChildren = 1;
+    if (transcript_init() != 0) return 1;
+
+    run_queries("indexed query, warm", lines, queries, false);
+    run_queries("indexed query, page cache dropped", lines, queries / 10 > 0 ? queries / 10 : 1, true);
+    double samples[5];
+    for (int i = 0; i < 5; ++i) samples[i] = linear_scan_ms(BENCH_FIRST_TS + lines / 2);
+    bench_report("linear scan to the middle, warm", samples, 5, "ms");
+
+    transcript_close_all();
+    return 0;
+}
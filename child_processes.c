@@ -4,6 +4,7 @@
 
 #include "irc_bot.h"
 #include "gemini_integration.h"
+#include "ai_worker.h"
 
 // Pinger Child Process
 void child_PING(int sock_param, const char* ip_override) {
@@ -34,6 +35,62 @@ void child_PING(int sock_param, const char* ip_override) {
     _exit(EXIT_SUCCESS);
 }
 
+// Handles one newline-stripped pipe message from the parent.
+static void handle_worker_pipe_line(const char *worker_tag, const ChannelInfo *channel_info, int local_socket_fd, AiWorker *ai_worker, char *pipe_line) {
+    app_log_sampled(worker_tag, "PIPE_RECV", channel_info->name, "Raw: '%s'", pipe_line);
+
+    char *line_saveptr;
+    char *command_type = strtok_r(pipe_line, PIPE_MSG_DELIMITER_STR, &line_saveptr);
+    app_log(worker_tag, "DEBUG", "Parsed command type: '%s'", command_type ? command_type : "NULL");
+    if (command_type == NULL) return;
+
+    if (strcmp(command_type, "HELLO") == 0) {
+        char *sender_nick = strtok_r(NULL, PIPE_MSG_DELIMITER_STR, &line_saveptr);
+        char *message_text = strtok_r(NULL, "", &line_saveptr);
+        if (sender_nick && message_text) {
+            app_log(worker_tag, "DEBUG", "HELLO command: sender='%s', message='%s'", sender_nick, message_text);
+            send_irc(local_socket_fd, "PRIVMSG %s :Hello %s! Worker for %s received your message: \"%s\"",
+                     channel_info->name, sender_nick, channel_info->name, message_text);
+        } else {
+             app_log(worker_tag, "WARN", "HELLO command missing parts.");
+        }
+    } else if (strcmp(command_type, "ASK") == 0) {
+        char *sender_nick = strtok_r(NULL, PIPE_MSG_DELIMITER_STR, &line_saveptr);
+        char *priority = strtok_r(NULL, PIPE_MSG_DELIMITER_STR, &line_saveptr); // "1" for admin channel members
+        char *persona_from_pipe = strtok_r(NULL, PIPE_MSG_DELIMITER_STR, &line_saveptr); // This is the channel's specific persona
+        char *user_prompt = strtok_r(NULL, "", &line_saveptr);
+
+        app_log(worker_tag, "DEBUG", "ASK command: sender='%s', priority='%s', persona='%s', prompt='%s'",
+                sender_nick ? sender_nick : "NULL",
+                priority ? priority : "NULL",
+                persona_from_pipe ? persona_from_pipe : "NULL",
+                user_prompt ? user_prompt : "NULL");
+
+        if (sender_nick && priority && persona_from_pipe && user_prompt) {
+            ai_worker_enqueue(ai_worker, sender_nick, persona_from_pipe, user_prompt, strcmp(priority, "1") == 0);
+        } else {
+             app_log(worker_tag, "WARN", "Could not parse ASK command from pipe.");
+        }
+    } else if (strcmp(command_type, "MSG") == 0) {
+        char *sender_nick = strtok_r(NULL, PIPE_MSG_DELIMITER_STR, &line_saveptr);
+        char *message_text = strtok_r(NULL, "", &line_saveptr);
+        if (sender_nick && message_text) {
+            ai_worker_observe(ai_worker, sender_nick, message_text);
+        } else {
+             app_log(worker_tag, "WARN", "MSG command missing parts.");
+        }
+    } else if (strcmp(command_type, "GONE") == 0) {
+        char *nick = strtok_r(NULL, PIPE_MSG_DELIMITER_STR, &line_saveptr);
+        if (nick) {
+            ai_worker_drop_nick(ai_worker, nick);
+        } else {
+             app_log(worker_tag, "WARN", "GONE command missing nick.");
+        }
+    } else {
+        app_log(worker_tag, "WARN", "Unknown command type from pipe: '%s'", command_type);
+    }
+}
+
 // Worker Child Process - THE SLAVES
 void child_WORKER(int worker_id, const ChannelInfo* channel_info, int local_socket_fd, int pipe_read_fd) {
     char worker_tag[128];
@@ -55,9 +112,9 @@ void child_WORKER(int worker_id, const ChannelInfo* channel_info, int local_sock
     app_log(worker_tag, "INFO", "Worker Started. Persona: '%s'. Pipe_read_fd: %d, socket_fd: %d.",
             channel_info->persona ? channel_info->persona : "Default", pipe_read_fd, local_socket_fd);
 
-    fd_set current_read_fds;
-    struct timeval tv;
-    char pipe_buffer[MAX_PIPE_MSG_LEN];
+    // Pipe messages are newline terminated; a read may hold several or a partial one.
+    char pipe_buffer[2 * MAX_PIPE_MSG_LEN];
+    size_t pipe_buffered = 0;
 
     // Read Gemini API Key once at the start of the child worker
     const char *api_key_for_child = getenv("GEMINIAI_API_KEY");
@@ -67,115 +124,58 @@ void child_WORKER(int worker_id, const ChannelInfo* channel_info, int local_sock
         api_key_for_child = NULL; 
     }
 
-    while (!child_exit_flag) {
-
-        sleep(30); // Sleep to reduce CPU usage
-        send_irc(local_socket_fd, "PRIVMSG %s :My commands [ID %d]: !ask <prompt> !hello.", channel_info->name, worker_id + 1);
+    AiWorker ai_worker;
+    ai_worker_init(&ai_worker, worker_id, worker_tag, channel_info, local_socket_fd, api_key_for_child);
 
+    time_t last_advert = time(NULL);
+    while (!child_exit_flag) {
 
-        FD_ZERO(&current_read_fds);
-        FD_SET(pipe_read_fd, &current_read_fds);
-
-        tv.tv_sec = 1; tv.tv_usec = 0; // Short timeout to check child_exit_flag regularly
-        int activity = select(pipe_read_fd + 1, &current_read_fds, NULL, NULL, &tv);
-
-        if (activity < 0) {
-            if (errno == EINTR && !child_exit_flag) continue; // Interrupted by a signal, but not shutdown
-            app_log(worker_tag, "ERROR", "select error: %s", strerror(errno));
-            break;
+        if (time(NULL) - last_advert >= WORKER_ADVERT_INTERVAL_SECONDS) {
+            send_irc(local_socket_fd, "PRIVMSG %s :My commands [ID %d]: !ask <prompt> !hello.", channel_info->name, worker_id + 1);
+            last_advert = time(NULL);
         }
+        log_sampler_flush(worker_tag, false);
+
+        // Short timeout to check child_exit_flag regularly
+        bool pipe_ready = ai_worker_wait(&ai_worker, pipe_read_fd, 1000);
+        if (child_exit_flag) break;
 
-        if (FD_ISSET(pipe_read_fd, &current_read_fds)) {
+        if (pipe_ready) {
             app_log(worker_tag, "DEBUG", "Pipe has data. Attempting to read...");
-            clearBuffer(pipe_buffer, sizeof(pipe_buffer));
-            ssize_t bytes_read = read(pipe_read_fd, pipe_buffer, sizeof(pipe_buffer) - 1);
+            ssize_t bytes_read = read(pipe_read_fd, pipe_buffer + pipe_buffered, sizeof(pipe_buffer) - 1 - pipe_buffered);
 
             if (bytes_read > 0) {
-                pipe_buffer[bytes_read] = '\0';
-                // Remove trailing newline if present
-                if (bytes_read > 0 && pipe_buffer[bytes_read - 1] == '\n') pipe_buffer[bytes_read - 1] = '\0';
-
-                app_log(worker_tag, "PIPE_RECV", "Raw: '%s' (Bytes: %zd)", pipe_buffer, bytes_read);
-
-                // Use a copy for strtok as strtok modifies the string in place
-                char *pipe_buffer_copy = strdup(pipe_buffer);
-                if (!pipe_buffer_copy) {
-                    app_log(worker_tag, "ERROR", "strdup failed for pipe message: %s", strerror(errno));
-                    continue;
+                pipe_buffered += (size_t)bytes_read;
+                pipe_buffer[pipe_buffered] = '\0';
+
+                char *line_start = pipe_buffer;
+                char *newline;
+                while ((newline = strchr(line_start, '\n')) != NULL) {
+                    *newline = '\0';
+                    if (*line_start) handle_worker_pipe_line(worker_tag, channel_info, local_socket_fd, &ai_worker, line_start);
+                    line_start = newline + 1;
                 }
-
-                char *command_type = strtok(pipe_buffer_copy, PIPE_MSG_DELIMITER_STR);
-                app_log(worker_tag, "DEBUG", "Parsed command type: '%s'", command_type ? command_type : "NULL");
-
-
-                if (command_type != NULL) {
-                    if (strcmp(command_type, "HELLO") == 0) {
-                        char *sender_nick = strtok(NULL, PIPE_MSG_DELIMITER_STR);
-                        char *message_text = strtok(NULL, "");
-                        if (sender_nick && message_text) {
-                            app_log(worker_tag, "DEBUG", "HELLO command: sender='%s', message='%s'", sender_nick, message_text);
-                            send_irc(local_socket_fd, "PRIVMSG %s :Hello %s! Worker for %s received your message: \"%s\"",
-                                     channel_info->name, sender_nick, channel_info->name, message_text);
-                        } else {
-                             app_log(worker_tag, "WARN", "HELLO command missing parts. Raw: '%s'", pipe_buffer);
-                        }
-                    } else if (strcmp(command_type, "ASK") == 0) {
-                        char *sender_nick = strtok(NULL, PIPE_MSG_DELIMITER_STR);
-                        char *persona_from_pipe = strtok(NULL, PIPE_MSG_DELIMITER_STR); // This is the channel's specific persona
-                        char *user_prompt = strtok(NULL, "");
-
-                        app_log(worker_tag, "DEBUG", "ASK command: sender='%s', persona='%s', prompt='%s'",
-                                sender_nick ? sender_nick : "NULL",
-                                persona_from_pipe ? persona_from_pipe : "NULL",
-                                user_prompt ? user_prompt : "NULL");
-
-
-                        if (sender_nick && persona_from_pipe && user_prompt) {
-                            if (api_key_for_child) { // Check if API key was successfully loaded
-                                app_log(worker_tag, "AI_REQUEST", "Processing !ask from [%s] with persona: '%s'. Prompt: '%s'",
-                                        sender_nick, persona_from_pipe, user_prompt);
-
-                                // CALL GEMINI API
-                                char* ai_response = get_gemini_response(persona_from_pipe, user_prompt, api_key_for_child);
-
-                                if (ai_response) {
-                                    for (char *p = ai_response; *p; ++p) {
-                                        if (*p == '\n' || *p == '\r') {
-                                            *p = ' ';
-                                        }
-                                    }
-                                    // Acquire semaphore lock before sending IRC message
-                                    app_log(worker_tag, "DEBUG", "Attempting to acquire socket_lock for AI response.");
-                                    send_irc(local_socket_fd, "PRIVMSG %s :%s: %s", channel_info->name, sender_nick, ai_response);
-                                    app_log(worker_tag, "DEBUG", "Socket_lock released for AI response.");
-                                    free(ai_response); // Free the dynamically allocated response
-                                } else {
-                                    app_log(worker_tag, "AI_ERROR", "Failed to get AI response for prompt from %s.", sender_nick);
-                                    send_irc(local_socket_fd, "PRIVMSG %s :%s, I encountered an error trying to process your request.", channel_info->name, sender_nick);
-                                }
-                            } else {
-                                app_log(worker_tag, "AI_SKIP", "Gemini API key not available. Cannot process !ask from %s.", sender_nick);
-                                send_irc(local_socket_fd, "PRIVMSG %s :%s, AI features are currently disabled.", channel_info->name, sender_nick);
-                            }
-                        } else {
-                             app_log(worker_tag, "WARN", "Could not parse ASK command from pipe: '%s'", pipe_buffer);
-                        }
-                    } else {
-                        app_log(worker_tag, "WARN", "Unknown command type from pipe: '%s'", command_type);
-                    }
+                pipe_buffered -= (size_t)(line_start - pipe_buffer);
+                if (pipe_buffered == sizeof(pipe_buffer) - 1) {
+                    app_log(worker_tag, "WARN", "Dropping overlong pipe message.");
+                    pipe_buffered = 0;
                 }
-                free(pipe_buffer_copy); // Free the duplicated string
+                memmove(pipe_buffer, line_start, pipe_buffered);
             } else if (bytes_read == 0) {
                 app_log(worker_tag, "INFO", "Parent closed pipe. Assuming shutdown.");
                 child_exit_flag = 1; // Signal for child to exit
-            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
                 app_log(worker_tag, "ERROR", "Read from pipe failed: %s", strerror(errno));
                 child_exit_flag = 1; // Signal for child to exit on critical error
             } else {
                 app_log(worker_tag, "DEBUG", "Pipe is empty (EAGAIN/EWOULDBLOCK). No message to process.");
             }
         }
+
+        ai_worker_process(&ai_worker);
     }
+    ai_worker_cleanup(&ai_worker);
+    log_sampler_flush(worker_tag, true);
     close(pipe_read_fd); // Close the read end of the pipe
     app_log(worker_tag, "INFO", "Worker Exiting due to child_exit_flag.");
     _exit(EXIT_SUCCESS); // Ensure child process exits cleanly
@@ -0,0 +1,343 @@
+// fake_ai_server - a tiny OpenAI-compatible chat completions server.
+//
+// Stands in for a real model when running the bot offline or under load.
+// Every POST gets a canned answer after a configurable delay, and a share of
+// requests can be made to fail or to stall (10x the latency) so retry, error
+// and hedging paths get exercised. A prompt asking for "a JSON array of N
+// strings" (a batch of questions) gets such an array, unless -n is given to
+// exercise the bot's fallback to single requests. -m gives one model its own
+// latency, to exercise the bot's model routing.
+//
+//   ./fake_ai_server [-p port] [-l latency_ms] [-j jitter_ms] [-e error_rate] [-t slow_rate] [-s response_bytes] [-n]
+//                    [-m model:latency_ms]
+//
+// Point a channel at it with "#chan;persona;backend=fake" in channels.txt.
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FAKE_DEFAULT_PORT 8089
+#define FAKE_MAX_REQUEST (256 * 1024)
+#define FAKE_STREAM_CHUNK 64 // Answer bytes per SSE event
+#define FAKE_STREAM_INTERVAL_MS 20 // Between SSE events after the first
+#define FAKE_BATCH_MARKER "a JSON array of " // Followed by the number of answers wanted
+#define FAKE_BATCH_MAX 16
+
+typedef struct {
+    int port;
+    int latency_ms;
+    int jitter_ms;
+    double error_rate;
+    double slow_rate;
+    int response_bytes;
+    bool plain_batches; // Answer batch prompts with plain text
+    char slow_model[64]; // Requests naming this model use slow_model_latency_ms instead of latency_ms
+    int slow_model_latency_ms;
+} FakeConfig;
+
+static FakeConfig g_config = {FAKE_DEFAULT_PORT, 200, 100, 0.0, 0.0, 200, false, "", 0};
+
+static void sleep_ms(int ms) {
+    if (ms <= 0) return;
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Fills out with len bytes of readable filler text that needs no JSON escaping.
+static void make_answer(char *out, int len) {
+    static const char words[] = "the quick brown fox jumps over the lazy dog ";
+    for (int i = 0; i < len; ++i) out[i] = words[i % (int)(sizeof(words) - 1)];
+    out[len] = '\0';
+}
+
+// Fills out (at least count * (len + 6) + 3 bytes) with a JSON array of count
+// filler answers, its quotes escaped to sit inside a JSON string.
+static void make_batch_answer(char *out, int count, int len) {
+    char *p = out;
+    *p++ = '[';
+    for (int i = 0; i < count; ++i) {
+        if (i > 0) *p++ = ',';
+        memcpy(p, "\\\"", 2);
+        make_answer(p + 2, len);
+        p += 2 + len;
+        memcpy(p, "\\\"", 2);
+        p += 2;
+    }
+    *p++ = ']';
+    *p = '\0';
+}
+
+static int send_error(int fd, int status, const char *reason, bool keep_alive) {
+    char body[256];
+    int body_len = snprintf(body, sizeof(body), "{\"error\":{\"message\":\"fake_ai_server: injected %d\",\"code\":%d}}", status, status);
+    char head[512];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n%s%s\r\n",
+                            status, reason, body_len, status == 429 ? "Retry-After: 1\r\n" : "",
+                            keep_alive ? "" : "Connection: close\r\n");
+    if (write_all(fd, head, (size_t)head_len) != 0) return -1;
+    return write_all(fd, body, (size_t)body_len);
+}
+
+static int send_completion(int fd, const char *model, const char *answer, int prompt_tokens, bool keep_alive) {
+    size_t body_cap = strlen(answer) + strlen(model) + 512;
+    char *body = (char *)malloc(body_cap);
+    if (body == NULL) return -1;
+    int completion_tokens = ((int)strlen(answer) + 3) / 4;
+    int body_len = snprintf(body, body_cap,
+                            "{\"id\":\"fake-1\",\"object\":\"chat.completion\",\"model\":\"%s\","
+                            "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"%s\"},\"finish_reason\":\"stop\"}],"
+                            "\"usage\":{\"prompt_tokens\":%d,\"completion_tokens\":%d,\"total_tokens\":%d}}",
+                            model, answer, prompt_tokens, completion_tokens, prompt_tokens + completion_tokens);
+    char head[256];
+    int head_len = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %d\r\n%s\r\n",
+                            body_len, keep_alive ? "" : "Connection: close\r\n");
+    int rc = write_all(fd, head, (size_t)head_len) == 0 ? write_all(fd, body, (size_t)body_len) : -1;
+    free(body);
+    return rc;
+}
+
+// Streams the answer as server-sent events, a chunk at a time. The latency is
+// spent before the first chunk, like a model's time to first token. The
+// connection is closed afterwards.
+static int send_stream(int fd, const char *model, const char *answer, int prompt_tokens, int delay_ms) {
+    static const char head[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+    if (write_all(fd, head, sizeof(head) - 1) != 0) return -1;
+
+    int len = (int)strlen(answer);
+    char event[FAKE_STREAM_CHUNK + 256];
+    for (int offset = 0; offset < len;) {
+        int take = len - offset < FAKE_STREAM_CHUNK ? len - offset : FAKE_STREAM_CHUNK;
+        if (offset + take < len && answer[offset + take - 1] == '\\') take--; // Keep escapes whole
+        sleep_ms(offset == 0 ? delay_ms : FAKE_STREAM_INTERVAL_MS);
+        int n = snprintf(event, sizeof(event),
+                         "data: {\"object\":\"chat.completion.chunk\",\"model\":\"%s\",\"choices\":[{\"index\":0,\"delta\":{\"content\":\"%.*s\"}}]}\n\n",
+                         model, take, answer + offset);
+        if (write_all(fd, event, (size_t)n) != 0) return -1;
+        offset += take;
+    }
+    int n = snprintf(event, sizeof(event),
+                     "data: {\"object\":\"chat.completion.chunk\",\"model\":\"%s\",\"choices\":[],"
+                     "\"usage\":{\"prompt_tokens\":%d,\"completion_tokens\":%d,\"total_tokens\":%d}}\n\ndata: [DONE]\n\n",
+                     model, prompt_tokens, (len + 3) / 4, prompt_tokens + (len + 3) / 4);
+    return write_all(fd, event, (size_t)n);
+}
+
+// Copies the string value of "key" from a flat JSON body, good enough for "model".
+static void find_string_field(const char *body, const char *key, char *out, size_t out_size) {
+    char needle[64];
+    snprintf(needle, sizeof(needle), "\"%s\":\"", key);
+    const char *p = strstr(body, needle);
+    if (p == NULL) {
+        snprintf(out, out_size, "fake");
+        return;
+    }
+    p += strlen(needle);
+    size_t i = 0;
+    while (*p && *p != '"' && i + 1 < out_size) {
+        if (*p == '\\') break; // Not worth unescaping for an echo
+        out[i++] = *p++;
+    }
+    out[i] = '\0';
+}
+
+// Serves requests on one connection until the client closes it.
+static void serve_connection(int fd) {
+    char *buffer = (char *)malloc(FAKE_MAX_REQUEST + 1);
+    char *answer = (char *)malloc((size_t)g_config.response_bytes + 1);
+    char *batch_answer = (char *)malloc((size_t)FAKE_BATCH_MAX * ((size_t)g_config.response_bytes + 6) + 3);
+    if (buffer == NULL || answer == NULL || batch_answer == NULL) goto done;
+    make_answer(answer, g_config.response_bytes);
+    size_t have = 0;
+    buffer[0] = '\0';
+
+    for (;;) {
+        // Read until the end of the headers
+        char *headers_end = NULL;
+        while ((headers_end = strstr(buffer, "\r\n\r\n")) == NULL) {
+            if (have >= FAKE_MAX_REQUEST) goto done;
+            ssize_t n = recv(fd, buffer + have, FAKE_MAX_REQUEST - have, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) goto done;
+            have += (size_t)n;
+            buffer[have] = '\0';
+        }
+        size_t header_len = (size_t)(headers_end - buffer) + 4;
+
+        size_t content_length = 0;
+        bool keep_alive = true;
+        for (char *line = strstr(buffer, "\r\n"); line && line < headers_end; line = strstr(line + 2, "\r\n")) {
+            const char *field = line + 2;
+            if (strncasecmp(field, "Content-Length:", 15) == 0) content_length = strtoul(field + 15, NULL, 10);
+            else if (strncasecmp(field, "Connection: close", 17) == 0) keep_alive = false;
+        }
+        if (header_len + content_length > FAKE_MAX_REQUEST) goto done;
+
+        while (have < header_len + content_length) {
+            ssize_t n = recv(fd, buffer + have, FAKE_MAX_REQUEST - have, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) goto done;
+            have += (size_t)n;
+        }
+        char saved = buffer[header_len + content_length];
+        buffer[header_len + content_length] = '\0';
+        const char *body = buffer + header_len;
+
+        char model[64];
+        find_string_field(body, "model", model, sizeof(model));
+        bool stream = strstr(body, "\"stream\":true") != NULL;
+        int prompt_tokens = (int)(content_length + 3) / 4;
+        int latency = (g_config.slow_model[0] && strcmp(model, g_config.slow_model) == 0) ? g_config.slow_model_latency_ms : g_config.latency_ms;
+        int delay = latency + (g_config.jitter_ms > 0 ? rand() % (g_config.jitter_ms + 1) : 0);
+        if (g_config.slow_rate > 0 && (double)rand() / RAND_MAX < g_config.slow_rate) delay *= 10;
+        const char *reply = answer;
+        const char *batch = strstr(body, FAKE_BATCH_MARKER);
+        int batch_count = batch ? atoi(batch + strlen(FAKE_BATCH_MARKER)) : 0;
+        if (batch_count > 0 && batch_count <= FAKE_BATCH_MAX && !g_config.plain_batches) {
+            make_batch_answer(batch_answer, batch_count, g_config.response_bytes / batch_count);
+            reply = batch_answer;
+        }
+
+        int rc;
+        if (strncmp(buffer, "HEAD ", 5) == 0) { // Connection warmup: headers only
+            static const char head[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+            rc = write_all(fd, head, sizeof(head) - 1);
+        } else if (strncmp(buffer, "POST ", 5) != 0) {
+            rc = send_error(fd, 405, "Method Not Allowed", keep_alive);
+        } else if (g_config.error_rate > 0 && (double)rand() / RAND_MAX < g_config.error_rate) {
+            sleep_ms(delay / 4); // Errors tend to come back faster than answers
+            rc = (rand() % 2) ? send_error(fd, 429, "Too Many Requests", keep_alive)
+                              : send_error(fd, 500, "Internal Server Error", keep_alive);
+        } else if (stream) {
+            rc = send_stream(fd, model, reply, prompt_tokens, delay);
+            keep_alive = false;
+        } else {
+            sleep_ms(delay);
+            rc = send_completion(fd, model, reply, prompt_tokens, keep_alive);
+        }
+        if (rc != 0 || !keep_alive) goto done;
+
+        // Keep any pipelined bytes of the next request
+        buffer[header_len + content_length] = saved;
+        have -= header_len + content_length;
+        memmove(buffer, buffer + header_len + content_length, have);
+        buffer[have] = '\0';
+    }
+
+done:
+    free(buffer);
+    free(answer);
+    free(batch_answer);
+    close(fd);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [-p port] [-l latency_ms] [-j jitter_ms] [-e error_rate 0..1] [-t slow_rate 0..1] [-s response_bytes] [-n] [-m model:latency_ms]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:j:e:t:s:nm:h")) != -1) {
+        switch (opt) {
+        case 'p': g_config.port = atoi(optarg); break;
+        case 'l': g_config.latency_ms = atoi(optarg); break;
+        case 'j': g_config.jitter_ms = atoi(optarg); break;
+        case 'e': g_config.error_rate = atof(optarg); break;
+        case 't': g_config.slow_rate = atof(optarg); break;
+        case 's': g_config.response_bytes = atoi(optarg); break;
+        case 'n': g_config.plain_batches = true; break;
+        case 'm': {
+            char *colon = strrchr(optarg, ':');
+            if (colon == NULL || colon == optarg || (size_t)(colon - optarg) >= sizeof(g_config.slow_model)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            snprintf(g_config.slow_model, sizeof(g_config.slow_model), "%.*s", (int)(colon - optarg), optarg);
+            g_config.slow_model_latency_ms = atoi(colon + 1);
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (g_config.port <= 0 || g_config.port > 65535 || g_config.latency_ms < 0 || g_config.jitter_ms < 0 || g_config.slow_model_latency_ms < 0 ||
+        g_config.response_bytes < 0 || g_config.error_rate < 0 || g_config.error_rate > 1 ||
+        g_config.slow_rate < 0 || g_config.slow_rate > 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGCHLD, SIG_IGN); // Connection handlers are never waited for
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)g_config.port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+        perror("bind/listen");
+        close(listen_fd);
+        return EXIT_FAILURE;
+    }
+    printf("fake_ai_server listening on 127.0.0.1:%d (latency %d+-%d ms, error rate %.2f, slow rate %.2f, %d byte answers)\n",
+           g_config.port, g_config.latency_ms, g_config.jitter_ms, g_config.error_rate, g_config.slow_rate, g_config.response_bytes);
+    fflush(stdout);
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            srand((unsigned)(time(NULL) ^ getpid()));
+            serve_connection(fd);
+            _exit(EXIT_SUCCESS);
+        }
+        if (pid < 0) perror("fork");
+        close(fd);
+    }
+    close(listen_fd);
+    return EXIT_FAILURE;
+}
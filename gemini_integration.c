@@ -5,10 +5,14 @@
 #include "irc_bot.h"
 #include "gemini_integration.h" 
 #include "cJSON.h" 
+#include "json_scan.h"
 
 // --- Constants for Gemini API ---
 #define GEMINI_MODEL "gemini-1.5-flash"
-#define GEMINI_API_ENDPOINT "https://generativelanguage.googleapis.com/v1beta/models/" GEMINI_MODEL ":generateContent"
+#define GEMINI_API_BASE "https://generativelanguage.googleapis.com/v1beta/models/"
+
+// Generation settings shared by both request formats
+#define AI_TEMPERATURE 0.7
 
 // Structure to hold response data from libcurl
 struct MemoryStruct {
@@ -35,76 +39,54 @@ static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, voi
   return realsize;
 }
 
-char* get_gemini_response(const char* persona, const char* user_prompt, const char* api_key) {
-    if (api_key == NULL || strlen(api_key) == 0) {
-        app_log("Gemini_API", "ERROR", "API key is not set. Cannot make request.");
-        return NULL;
-    }
-    if (user_prompt == NULL || strlen(user_prompt) == 0) {
-        app_log("Gemini_API", "ERROR", "User prompt is empty. Cannot make request.");
-        return NULL;
-    }
-
-    CURL *curl_handle = NULL;
-    CURLcode res;
-    struct MemoryStruct chunk;
-    chunk.memory = (char*)malloc(1);
-    chunk.size = 0;
-
-    struct curl_slist *headers = NULL;
-    cJSON *json_root = NULL;
-    char *json_payload = NULL;
-    char *response_text = NULL;
+static bool append_memory(struct MemoryStruct *mem, const char *data, size_t len) {
+  char *ptr = (char*)realloc(mem->memory, mem->size + len + 1);
+  if(ptr == NULL) {
+    app_log("Gemini_API", "ERROR", "not enough memory (realloc returned NULL)");
+    return false;
+  }
+  mem->memory = ptr;
+  memcpy(&(mem->memory[mem->size]), data, len);
+  mem->size += len;
+  mem->memory[mem->size] = 0;
+  return true;
+}
 
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl_handle = curl_easy_init();
+// --- Request body ---
+// Everything after the message list is identical for every request, so it is
+// serialized once per client into a template suffix. Each request only
+// escapes the persona, history and prompt into the client's reusable buffer.
 
-    if (curl_handle == NULL) {
-        app_log("Gemini_API", "ERROR", "curl_easy_init() failed.");
-        goto cleanup;
+// Prints fields and returns it as a malloc'd "],...}" suffix that closes the
+// message array and the body, or NULL. Takes ownership of fields.
+static char *finish_template(cJSON *fields) {
+    char *template_suffix = NULL;
+    char *printed = cJSON_PrintUnformatted(fields);
+    if (printed == NULL) {
+        app_log("Gemini_API", "ERROR", "Failed to print JSON request template to string.");
+    } else {
+        template_suffix = (char *)malloc(strlen(printed) + 2);
+        if (template_suffix != NULL) sprintf(template_suffix, "],%s", printed + 1); // Drop the object's opening '{'
     }
+    free(printed);
+    cJSON_Delete(fields);
+    return template_suffix;
+}
 
-    // Construct JSON payload for Gemini API
-    json_root = cJSON_CreateObject();
+// Serializes the fixed safetySettings and generationConfig of a Gemini body.
+static char *build_request_template(long max_output_tokens) {
+    cJSON *json_root = cJSON_CreateObject();
     if (json_root == NULL) {
-        app_log("Gemini_API", "ERROR", "Failed to create JSON object for request.");
-        goto cleanup;
-    }
-
-    cJSON *contents_array = cJSON_CreateArray();
-    if (contents_array == NULL) {
-        app_log("Gemini_API", "ERROR", "Failed to create JSON contents array.");
-        goto cleanup;
-    }
-    cJSON_AddItemToObject(json_root, "contents", contents_array);
-
-    // Add persona/system message (as a 'user' role for prompt instruction)
-    if (persona && strlen(persona) > 0) {
-        cJSON *persona_message_obj = cJSON_CreateObject();
-        cJSON_AddStringToObject(persona_message_obj, "role", "user");
-        cJSON *persona_parts_array = cJSON_CreateArray();
-        cJSON *persona_text_part = cJSON_CreateObject();
-        cJSON_AddStringToObject(persona_text_part, "text", persona);
-        cJSON_AddItemToArray(persona_parts_array, persona_text_part);
-        cJSON_AddItemToObject(persona_message_obj, "parts", persona_parts_array);
-        cJSON_AddItemToArray(contents_array, persona_message_obj);
-    }
-
-    // Add user message (prompt)
-    cJSON *user_message_obj = cJSON_CreateObject();
-    cJSON_AddStringToObject(user_message_obj, "role", "user");
-    cJSON *user_parts_array = cJSON_CreateArray();
-    cJSON *user_text_part = cJSON_CreateObject();
-    cJSON_AddStringToObject(user_text_part, "text", user_prompt);
-    cJSON_AddItemToArray(user_parts_array, user_text_part);
-    cJSON_AddItemToObject(user_message_obj, "parts", user_parts_array);
-    cJSON_AddItemToArray(contents_array, user_message_obj);
+        app_log("Gemini_API", "ERROR", "Failed to create JSON object for request template.");
+        return NULL;
+    }
 
     // Add optional safety settings
     cJSON *safety_settings_array = cJSON_CreateArray();
     if (safety_settings_array == NULL) {
         app_log("Gemini_API", "ERROR", "Failed to create JSON safety settings array.");
-        goto cleanup;
+        cJSON_Delete(json_root);
+        return NULL;
     }
     const char *categories[] = {
         "HARM_CATEGORY_HARASSMENT",
@@ -124,106 +106,774 @@ char* get_gemini_response(const char* persona, const char* user_prompt, const ch
     cJSON *generation_config_obj = cJSON_CreateObject();
     if (generation_config_obj == NULL) {
         app_log("Gemini_API", "ERROR", "Failed to create JSON generation config object.");
-        goto cleanup;
+        cJSON_Delete(json_root);
+        return NULL;
     }
-    cJSON_AddNumberToObject(generation_config_obj, "temperature", 0.7); 
-    cJSON_AddNumberToObject(generation_config_obj, "maxOutputTokens", 250);
+    cJSON_AddNumberToObject(generation_config_obj, "temperature", AI_TEMPERATURE);
+    cJSON_AddNumberToObject(generation_config_obj, "maxOutputTokens", max_output_tokens);
     cJSON_AddItemToObject(json_root, "generationConfig", generation_config_obj);
+    return finish_template(json_root);
+}
+
+// Serializes the sampling fields of an OpenAI-style chat completion body.
+static char *build_openai_template(bool streaming, long max_output_tokens) {
+    cJSON *json_root = cJSON_CreateObject();
+    if (json_root == NULL) {
+        app_log("Gemini_API", "ERROR", "Failed to create JSON object for request template.");
+        return NULL;
+    }
+    cJSON_AddNumberToObject(json_root, "temperature", AI_TEMPERATURE);
+    cJSON_AddNumberToObject(json_root, "max_tokens", max_output_tokens);
+    if (streaming) {
+        cJSON_AddTrueToObject(json_root, "stream");
+        cJSON *stream_options = cJSON_AddObjectToObject(json_root, "stream_options");
+        if (stream_options) cJSON_AddTrueToObject(stream_options, "include_usage"); // Token counts in the last chunk
+    }
+    return finish_template(json_root);
+}
+
+static bool buffer_reserve(GeminiBuffer *buf, size_t extra) {
+    if (buf->len + extra + 1 <= buf->cap) return true;
+    size_t new_cap = buf->cap ? buf->cap : 1024;
+    while (new_cap < buf->len + extra + 1) new_cap *= 2;
+    char *grown = (char *)realloc(buf->data, new_cap);
+    if (grown == NULL) {
+        app_log("Gemini_API", "ERROR", "not enough memory (realloc returned NULL)");
+        return false;
+    }
+    buf->data = grown;
+    buf->cap = new_cap;
+    return true;
+}
+
+static bool buffer_append(GeminiBuffer *buf, const char *data, size_t len) {
+    if (!buffer_reserve(buf, len)) return false;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+    return true;
+}
+
+// Appends text as a quoted JSON string. Bytes >= 0x80 pass through, as cJSON does.
+static bool buffer_append_json_string(GeminiBuffer *buf, const char *text) {
+    static const char hex[] = "0123456789abcdef";
+    size_t text_len = strlen(text);
+    if (!buffer_reserve(buf, text_len * 6 + 2)) return false; // Worst case: every byte as \u00XX
+    char *out = buf->data + buf->len;
+    *out++ = '"';
+    for (const unsigned char *p = (const unsigned char *)text; *p; ++p) {
+        switch (*p) {
+        case '"':  *out++ = '\\'; *out++ = '"'; break;
+        case '\\': *out++ = '\\'; *out++ = '\\'; break;
+        case '\n': *out++ = '\\'; *out++ = 'n'; break;
+        case '\r': *out++ = '\\'; *out++ = 'r'; break;
+        case '\t': *out++ = '\\'; *out++ = 't'; break;
+        case '\b': *out++ = '\\'; *out++ = 'b'; break;
+        case '\f': *out++ = '\\'; *out++ = 'f'; break;
+        default:
+            if (*p < 0x20) {
+                memcpy(out, "\\u00", 4);
+                out[4] = hex[*p >> 4];
+                out[5] = hex[*p & 0x0F];
+                out += 6;
+            } else {
+                *out++ = (char)*p;
+            }
+        }
+    }
+    *out++ = '"';
+    *out = '\0';
+    buf->len = (size_t)(out - buf->data);
+    return true;
+}
 
+static bool buffer_append_str(GeminiBuffer *buf, const char *text) {
+    return buffer_append(buf, text, strlen(text));
+}
 
-    json_payload = cJSON_PrintUnformatted(json_root);
-    if (json_payload == NULL) {
-        app_log("Gemini_API", "ERROR", "Failed to print JSON payload to string.");
-        goto cleanup;
+// Appends a text part to contents, starting a new message only when the role
+// changes so user and model messages alternate as the API expects.
+static bool append_content_part(GeminiBuffer *buf, const char **current_role, const char *role, const char *text) {
+    bool new_message = (*current_role == NULL || strcmp(*current_role, role) != 0);
+    bool ok;
+    if (*current_role == NULL) ok = buffer_append_str(buf, "{\"role\":\"");
+    else if (new_message) ok = buffer_append_str(buf, "]},{\"role\":\"");
+    else ok = buffer_append_str(buf, ",");
+    if (ok && new_message) {
+        ok = buffer_append_str(buf, role) && buffer_append_str(buf, "\",\"parts\":[");
+        *current_role = role;
     }
-    app_log("Gemini_API", "DEBUG", "Request Payload: %s", json_payload);
+    return ok && buffer_append_str(buf, "{\"text\":") && buffer_append_json_string(buf, text) && buffer_append_str(buf, "}");
+}
 
-    // Set libcurl options
-    char full_url[512]; // Adjust size as needed
-    snprintf(full_url, sizeof(full_url), "%s?key=%s", GEMINI_API_ENDPOINT, api_key);
+static bool append_openai_message(GeminiBuffer *buf, bool first, const char *role, const char *text) {
+    return buffer_append_str(buf, first ? "{\"role\":\"" : ",{\"role\":\"") && buffer_append_str(buf, role) &&
+           buffer_append_str(buf, "\",\"content\":") && buffer_append_json_string(buf, text) && buffer_append_str(buf, "}");
+}
 
-    headers = curl_slist_append(headers, "Content-Type: application/json");
+static const char *body_template(const GeminiClient *client, bool streaming, bool short_answer) {
+    if (short_answer) return streaming ? client->short_stream_body_template : client->short_body_template;
+    return streaming ? client->stream_body_template : client->body_template;
+}
 
-    curl_easy_setopt(curl_handle, CURLOPT_URL, full_url);
-    curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, json_payload);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&chunk);
-    curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "irc-bot-gemini/1.0");
-    curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, 30L); // 30 seconds timeout
-    curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 1L);
+// Chat completion body: the persona becomes the system message.
+static bool build_openai_payload(GeminiClient *client, const char *model, const char *persona, const GeminiTurn *history, size_t history_len,
+                                 const char *user_prompt, bool streaming, bool short_answer) {
+    GeminiBuffer *buf = &client->payload;
+    bool first = true;
+    bool built = buffer_append_str(buf, "{\"model\":") && buffer_append_json_string(buf, model) &&
+                 buffer_append_str(buf, ",\"messages\":[");
+    if (built && persona && strlen(persona) > 0) {
+        built = append_openai_message(buf, first, "system", persona);
+        first = false;
+    }
+    for (size_t i = 0; built && i < history_len; ++i) {
+        built = append_openai_message(buf, first, history[i].from_model ? "assistant" : "user", history[i].text);
+        first = false;
+    }
+    if (built) built = append_openai_message(buf, first, "user", user_prompt);
+    if (built) built = buffer_append_str(buf, body_template(client, streaming, short_answer));
+    return built;
+}
+
+// Writes the request body into client->payload. Returns true on success.
+static bool build_request_payload(GeminiClient *client, const char *model, const char *persona, const GeminiTurn *history,
+                                  size_t history_len, const char *user_prompt, bool streaming, bool short_answer) {
+    GeminiBuffer *buf = &client->payload;
+    buf->len = 0;
+    if (client->format == GEMINI_FORMAT_OPENAI) {
+        bool built = build_openai_payload(client, model, persona, history, history_len, user_prompt, streaming, short_answer);
+        if (!built) app_log("Gemini_API", "ERROR", "Failed to build JSON payload.");
+        return built;
+    }
+    const char *current_role = NULL;
 
-    // Perform the request
-    app_log("Gemini_API", "INFO", "Sending request to Gemini...");
-    res = curl_easy_perform(curl_handle);
+    // Persona/system message (as a 'user' role for prompt instruction), then history, then the prompt
+    bool built = buffer_append_str(buf, "{\"contents\":[");
+    if (built && persona && strlen(persona) > 0) {
+        built = append_content_part(buf, &current_role, "user", persona);
+    }
+    for (size_t i = 0; built && i < history_len; ++i) {
+        built = append_content_part(buf, &current_role, history[i].from_model ? "model" : "user", history[i].text);
+    }
+    if (built) built = append_content_part(buf, &current_role, "user", user_prompt);
+    if (built) built = buffer_append_str(buf, "]}") && buffer_append_str(buf, body_template(client, streaming, short_answer));
+    if (!built) app_log("Gemini_API", "ERROR", "Failed to build JSON payload.");
+    return built;
+}
+
+// --- Response parsing ---
+// Only a few fields of a response (or of one stream chunk) are used. They are
+// pulled out with the path-directed scanner in json_scan.c, which skips safety
+// ratings, citations and the rest without building a tree; input it rejects
+// goes through a full cJSON parse of the same paths instead.
+
+typedef struct {
+    char *text; // The answer, or this chunk's part of it
+    char *error_message; // error.message
+    long prompt_tokens; // Usage counts, 0 when absent
+    long output_tokens;
+    long total_tokens; // Can exceed prompt + output, e.g. with thinking tokens
+} ResponseFields;
+
+enum { FIELD_TEXT, FIELD_ERROR, FIELD_PROMPT_TOKENS, FIELD_OUTPUT_TOKENS, FIELD_TOTAL_TOKENS, NUM_RESPONSE_FIELDS };
+
+static const char *const GEMINI_RESPONSE_PATHS[NUM_RESPONSE_FIELDS] = {
+    "candidates[0].content.parts[0].text",
+    "error.message",
+    "usageMetadata.promptTokenCount",
+    "usageMetadata.candidatesTokenCount",
+    "usageMetadata.totalTokenCount"
+};
+
+static const char *const OPENAI_RESPONSE_PATHS[NUM_RESPONSE_FIELDS] = {
+    "choices[0].message.content",
+    "error.message",
+    "usage.prompt_tokens",
+    "usage.completion_tokens",
+    "usage.total_tokens"
+};
+
+static const char *const OPENAI_STREAM_PATHS[NUM_RESPONSE_FIELDS] = {
+    "choices[0].delta.content",
+    "error.message",
+    "usage.prompt_tokens",
+    "usage.completion_tokens",
+    "usage.total_tokens"
+};
+
+static const char *const *response_paths(const GeminiClient *client, bool streaming) {
+    if (client->format == GEMINI_FORMAT_OPENAI) return streaming ? OPENAI_STREAM_PATHS : OPENAI_RESPONSE_PATHS;
+    return GEMINI_RESPONSE_PATHS; // Gemini stream chunks are whole responses
+}
+
+static void free_response_fields(ResponseFields *fields) {
+    free(fields->text);
+    free(fields->error_message);
+    memset(fields, 0, sizeof(*fields));
+}
+
+// Follows a json_scan.h style path through a parsed document.
+static const cJSON *dom_path(const cJSON *node, const char *path) {
+    char key[64];
+    const char *p = path;
+    while (node && *p) {
+        if (*p == '[') {
+            char *close = NULL;
+            long index = strtol(p + 1, &close, 10);
+            if (*close != ']' || !cJSON_IsArray(node)) return NULL;
+            node = cJSON_GetArrayItem(node, (int)index);
+            p = close + 1;
+        } else {
+            size_t len = strcspn(p, ".[");
+            if (len >= sizeof(key)) return NULL;
+            memcpy(key, p, len);
+            key[len] = '\0';
+            node = cJSON_GetObjectItemCaseSensitive(node, key);
+            p += len;
+        }
+        if (*p == '.') p++;
+    }
+    return node;
+}
+
+static char *dom_string(const cJSON *item) {
+    return (cJSON_IsString(item) && item->valuestring != NULL) ? strdup(item->valuestring) : NULL;
+}
+
+static long dom_long(const cJSON *item) {
+    return cJSON_IsNumber(item) ? (long)item->valuedouble : 0;
+}
+
+// Fallback: full parse. Returns false if the body is not valid JSON.
+static bool extract_response_dom(const char *json, const char *const *paths, ResponseFields *fields) {
+    cJSON *json_response = cJSON_Parse(json);
+    if (json_response == NULL) {
+        const char *error_ptr = cJSON_GetErrorPtr();
+        if (error_ptr != NULL) {
+            app_log("Gemini_API", "ERROR", "Failed to parse JSON response: %s (Raw: %s)", error_ptr, json);
+        } else {
+            app_log("Gemini_API", "ERROR", "Failed to parse JSON response (unknown error). Raw: %s", json);
+        }
+        return false;
+    }
+    fields->text = dom_string(dom_path(json_response, paths[FIELD_TEXT]));
+    fields->error_message = dom_string(dom_path(json_response, paths[FIELD_ERROR]));
+    fields->prompt_tokens = dom_long(dom_path(json_response, paths[FIELD_PROMPT_TOKENS]));
+    fields->output_tokens = dom_long(dom_path(json_response, paths[FIELD_OUTPUT_TOKENS]));
+    fields->total_tokens = dom_long(dom_path(json_response, paths[FIELD_TOTAL_TOKENS]));
+    cJSON_Delete(json_response);
+    return true;
+}
+
+static bool extract_response(const char *json, const char *const *paths, ResponseFields *fields) {
+    memset(fields, 0, sizeof(*fields));
+    JsonScanTarget targets[NUM_RESPONSE_FIELDS];
+    for (int i = 0; i < NUM_RESPONSE_FIELDS; ++i) targets[i].path = paths[i];
+    if (json_scan(json, strlen(json), targets, NUM_RESPONSE_FIELDS) != 0) {
+        return extract_response_dom(json, paths, fields);
+    }
+    fields->text = targets[FIELD_TEXT].value;
+    fields->error_message = targets[FIELD_ERROR].value;
+    fields->prompt_tokens = targets[FIELD_PROMPT_TOKENS].value ? strtol(targets[FIELD_PROMPT_TOKENS].value, NULL, 10) : 0;
+    fields->output_tokens = targets[FIELD_OUTPUT_TOKENS].value ? strtol(targets[FIELD_OUTPUT_TOKENS].value, NULL, 10) : 0;
+    fields->total_tokens = targets[FIELD_TOTAL_TOKENS].value ? strtol(targets[FIELD_TOTAL_TOKENS].value, NULL, 10) : 0;
+    free(targets[FIELD_PROMPT_TOKENS].value);
+    free(targets[FIELD_OUTPUT_TOKENS].value);
+    free(targets[FIELD_TOTAL_TOKENS].value);
+    return true;
+}
+
+// Extracts the answer text and token usage. Returns a malloc'd string or NULL.
+static char *parse_response_text(const GeminiClient *client, const char *body, long *prompt_tokens, long *output_tokens,
+                                 long *total_tokens) {
+    ResponseFields fields;
+    if (!extract_response(body, response_paths(client, false), &fields)) return NULL;
+    char *response_text = fields.text;
+    fields.text = NULL;
+    *prompt_tokens = fields.prompt_tokens;
+    *output_tokens = fields.output_tokens;
+    *total_tokens = fields.total_tokens;
+    if (response_text) {
+        app_log("Gemini_API", "INFO", "Successfully extracted AI response.");
+    } else if (fields.error_message) {
+        app_log("Gemini_API", "ERROR", "AI API returned error: %s", fields.error_message);
+    } else {
+        app_log("Gemini_API", "WARN", "No answer text in the response.");
+    }
+    free_response_fields(&fields);
+    return response_text;
+}
+
+// error.message of an error response body as a malloc'd string, or NULL.
+static char *parse_error_message(const GeminiClient *client, const char *body) {
+    ResponseFields fields;
+    if (body == NULL || !extract_response(body, response_paths(client, false), &fields)) return NULL;
+    char *message = fields.error_message;
+    fields.error_message = NULL;
+    free_response_fields(&fields);
+    return message;
+}
+
+// --- Long-lived client ---
+// Requests run on a curl multi handle so several can be in flight at once; the
+// worker drives them from its own event loop via gemini_client_wait() and
+// gemini_client_perform(). A CURLSH shares the DNS cache, TLS session cache and
+// connection pool between transfers, and finished easy handles are parked in a
+// small pool with their options intact. curl_global_init() is done once in
+// main() before the workers are forked.
+
+struct GeminiRequest {
+    CURL *easy;
+    unsigned long id;
+    void *user_data;
+    struct MemoryStruct body; // Whole body, or unconsumed SSE bytes when streaming
+    GeminiClient *client;
+    bool streaming;
+    struct MemoryStruct stream_text; // Text assembled from SSE chunks so far
+    long prompt_tokens; // From usageMetadata
+    long output_tokens;
+    long total_tokens;
+    struct GeminiRequest *next;
+};
+
+// Handles one SSE event ("data: {json}" lines) from streamGenerateContent or a
+// streamed chat completion.
+static void handle_stream_event(struct GeminiRequest *req, char *event) {
+    char *line_saveptr;
+    for (char *line = strtok_r(event, "\n", &line_saveptr); line; line = strtok_r(NULL, "\n", &line_saveptr)) {
+        if (strncmp(line, "data:", 5) != 0) continue;
+        char *json_text = line + 5;
+        while (*json_text == ' ') json_text++;
+
+        if (strcmp(json_text, "[DONE]") == 0) continue; // OpenAI-style end marker
+
+        ResponseFields fields;
+        if (!extract_response(json_text, response_paths(req->client, true), &fields)) {
+            app_log("Gemini_API", "WARN", "Skipping unparsable stream chunk for request %lu.", req->id);
+            continue;
+        }
+        const char *text = fields.text;
+        if (text && *text && append_memory(&req->stream_text, text, strlen(text)) && req->client->on_stream_text) {
+            req->client->on_stream_text(req->user_data, text);
+        }
+        if (fields.error_message) app_log("Gemini_API", "ERROR", "AI API returned error in stream: %s", fields.error_message);
+        if (fields.prompt_tokens) req->prompt_tokens = fields.prompt_tokens; // Running totals; the last chunk has the final counts
+        if (fields.output_tokens) req->output_tokens = fields.output_tokens;
+        if (fields.total_tokens) req->total_tokens = fields.total_tokens;
+        free_response_fields(&fields);
+    }
+}
+
+// Write callback for streaming requests: buffers bytes and dispatches each
+// complete SSE event (terminated by a blank line) as soon as it arrives.
+static size_t StreamCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct GeminiRequest *req = (struct GeminiRequest *)userp;
+    const char *data = (const char *)contents;
+
+    for (size_t i = 0; i < realsize; ++i) { // Drop CRs so events always end in "\n\n"
+        size_t run = 0;
+        while (i + run < realsize && data[i + run] != '\r') run++;
+        if (run > 0 && !append_memory(&req->body, data + i, run)) return 0;
+        i += run;
+    }
 
+    char *event_end;
+    while ((event_end = strstr(req->body.memory, "\n\n")) != NULL) {
+        *event_end = '\0';
+        handle_stream_event(req, req->body.memory);
+        size_t consumed = (size_t)(event_end + 2 - req->body.memory);
+        memmove(req->body.memory, event_end + 2, req->body.size - consumed + 1);
+        req->body.size -= consumed;
+    }
+    return realsize;
+}
+
+static CURL *acquire_easy_handle(GeminiClient *client) {
+    if (client->num_idle_handles > 0) return client->idle_handles[--client->num_idle_handles];
+
+    CURL *easy = curl_easy_init();
+    if (easy == NULL) return NULL;
+    curl_easy_setopt(easy, CURLOPT_SHARE, client->share);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, client->headers);
+    curl_easy_setopt(easy, CURLOPT_USERAGENT, "irc-bot-gemini/1.0");
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    return easy;
+}
+
+static void release_easy_handle(GeminiClient *client, CURL *easy) {
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, NULL);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, NULL);
+    if (client->num_idle_handles < GEMINI_HANDLE_POOL_SIZE) {
+        client->idle_handles[client->num_idle_handles++] = easy;
+    } else {
+        curl_easy_cleanup(easy);
+    }
+}
+
+static void free_request(GeminiClient *client, struct GeminiRequest *req) {
+    if (req->easy) {
+        curl_multi_remove_handle(client->multi, req->easy);
+        release_easy_handle(client, req->easy);
+    }
+    free(req->body.memory);
+    free(req->stream_text.memory);
+    free(req);
+}
+
+// Sets up the share and multi handles common to both formats.
+static int init_transport(GeminiClient *client, int max_inflight) {
+    client->max_inflight = max_inflight > 0 ? max_inflight : 1;
+
+    client->share = curl_share_init();
+    if (client->share == NULL) {
+        app_log("Gemini_API", "ERROR", "curl_share_init() failed.");
+        return -1;
+    }
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    client->multi = curl_multi_init();
+    if (client->multi == NULL) {
+        app_log("Gemini_API", "ERROR", "curl_multi_init() failed.");
+        return -1;
+    }
+    curl_multi_setopt(client->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)client->max_inflight);
+    client->headers = curl_slist_append(NULL, "Content-Type: application/json");
+    return 0;
+}
+
+// Builds the body templates capping answers at tokens. Returns 0 or -1.
+static int build_templates(const GeminiClient *client, long tokens, char **body_out, char **stream_body_out) {
+    char *body_template, *stream_body_template;
+    if (client->format == GEMINI_FORMAT_OPENAI) {
+        body_template = build_openai_template(false, tokens);
+        stream_body_template = build_openai_template(true, tokens);
+    } else {
+        body_template = build_request_template(tokens);
+        stream_body_template = body_template ? strdup(body_template) : NULL;
+    }
+    if (body_template == NULL || stream_body_template == NULL) {
+        app_log("Gemini_API", "ERROR", "Failed to build the request template.");
+        free(body_template);
+        free(stream_body_template);
+        return -1;
+    }
+    *body_out = body_template;
+    *stream_body_out = stream_body_template;
+    return 0;
+}
+
+// Full-length and short-answer templates; each request picks one.
+static int init_templates(GeminiClient *client) {
+    if (build_templates(client, AI_MAX_OUTPUT_TOKENS, &client->body_template, &client->stream_body_template) != 0) return -1;
+    return build_templates(client, AI_OVERLOAD_SHORT_OUTPUT_TOKENS, &client->short_body_template, &client->short_stream_body_template);
+}
+
+// Gemini model names go into the request URL path, right before "?key=".
+bool gemini_model_name_valid(const char *model) {
+    return model[0] != '\0' && strlen(model) < GEMINI_MODEL_NAME_MAX && strpbrk(model, "/?&:#% ") == NULL;
+}
+
+int gemini_client_init(GeminiClient *client, const char *api_key, const char *model, int max_inflight) {
+    memset(client, 0, sizeof(*client));
+    if (api_key == NULL || strlen(api_key) == 0) {
+        app_log("Gemini_API", "ERROR", "API key is not set. Cannot create client.");
+        return -1;
+    }
+    if (model == NULL || model[0] == '\0') model = GEMINI_MODEL;
+    if (!gemini_model_name_valid(model)) {
+        app_log("Gemini_API", "ERROR", "Bad Gemini model name '%s'. Cannot create client.", model);
+        return -1;
+    }
+    client->format = GEMINI_FORMAT_GEMINI;
+    client->api_key = api_key;
+    snprintf(client->model, sizeof(client->model), "%s", model);
+    if (init_transport(client, max_inflight) != 0) return -1;
+
+    if (init_templates(client) != 0) return -1;
+
+    snprintf(client->url, sizeof(client->url), "%s%s:generateContent?key=%s", GEMINI_API_BASE, client->model, api_key);
+    snprintf(client->stream_url, sizeof(client->stream_url), "%s%s:streamGenerateContent?alt=sse&key=%s", GEMINI_API_BASE, client->model, api_key);
+    snprintf(client->warmup_url, sizeof(client->warmup_url), "%s%s?key=%s", GEMINI_API_BASE, client->model, api_key);
+    return 0;
+}
+
+int gemini_client_init_openai(GeminiClient *client, const char *url, const char *model, const char *api_key, int max_inflight) {
+    memset(client, 0, sizeof(*client));
+    if (url == NULL || strlen(url) == 0 || strlen(url) >= sizeof(client->url)) {
+        app_log("Gemini_API", "ERROR", "Chat completions URL is missing or too long. Cannot create client.");
+        return -1;
+    }
+    client->format = GEMINI_FORMAT_OPENAI;
+    client->api_key = api_key;
+    snprintf(client->model, sizeof(client->model), "%s", model ? model : "");
+    if (init_transport(client, max_inflight) != 0) return -1;
+
+    if (init_templates(client) != 0) return -1;
+
+    // Streaming is selected in the body, so both URLs are the same.
+    snprintf(client->url, sizeof(client->url), "%s", url);
+    snprintf(client->stream_url, sizeof(client->stream_url), "%s", url);
+    snprintf(client->warmup_url, sizeof(client->warmup_url), "%s", url);
+    if (api_key && strlen(api_key) > 0) {
+        char auth_header[300];
+        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", api_key);
+        client->headers = curl_slist_append(client->headers, auth_header);
+    }
+    return 0;
+}
+
+// Opens the connection ahead of the first !ask with a bodyless request (the
+// model resource for Gemini, the endpoint itself otherwise). The connection
+// lands in the shared pool and later transfers pick it up.
+void gemini_client_warmup(GeminiClient *client) {
+    if (client == NULL || client->share == NULL) return;
+    CURL *warm = curl_easy_init();
+    if (warm == NULL) return;
+
+    curl_easy_setopt(warm, CURLOPT_SHARE, client->share);
+    curl_easy_setopt(warm, CURLOPT_URL, client->warmup_url);
+    curl_easy_setopt(warm, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(warm, CURLOPT_USERAGENT, "irc-bot-gemini/1.0");
+    curl_easy_setopt(warm, CURLOPT_TIMEOUT, 10L);
+
+    CURLcode res = curl_easy_perform(warm);
     if (res != CURLE_OK) {
-        app_log("Gemini_API", "ERROR", "curl_easy_perform() failed: %s", curl_easy_strerror(res));
+        app_log("Gemini_API", "WARN", "Connection warmup failed: %s", curl_easy_strerror(res));
     } else {
-        long http_code = 0;
-        curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_code);
-        app_log("Gemini_API", "INFO", "Received HTTP response code: %ld", http_code);
-        app_log("Gemini_API", "DEBUG", "Response Data: %s", chunk.memory ? chunk.memory : "N/A");
-
-        if (http_code == 200 && chunk.memory) {
-            cJSON *json_response = cJSON_Parse(chunk.memory);
-            if (json_response == NULL) {
-                const char *error_ptr = cJSON_GetErrorPtr();
-                if (error_ptr != NULL) {
-                    app_log("Gemini_API", "ERROR", "Failed to parse JSON response: %s (Raw: %s)", error_ptr, chunk.memory);
-                } else {
-                    app_log("Gemini_API", "ERROR", "Failed to parse JSON response (unknown error). Raw: %s", chunk.memory);
-                }
-            } else {
-                // --- Parse Gemini specific response structure ---
-                cJSON *candidates = cJSON_GetObjectItemCaseSensitive(json_response, "candidates");
-                if (cJSON_IsArray(candidates) && cJSON_GetArraySize(candidates) > 0) {
-                    cJSON *first_candidate = cJSON_GetArrayItem(candidates, 0);
-                    cJSON *content = cJSON_GetObjectItemCaseSensitive(first_candidate, "content");
-                    if (content) {
-                        cJSON *parts = cJSON_GetObjectItemCaseSensitive(content, "parts");
-                        if (cJSON_IsArray(parts) && cJSON_GetArraySize(parts) > 0) {
-                            cJSON *first_part = cJSON_GetArrayItem(parts, 0);
-                            cJSON *text_content = cJSON_GetObjectItemCaseSensitive(first_part, "text");
-                            if (cJSON_IsString(text_content) && (text_content->valuestring != NULL)) {
-                                response_text = strdup(text_content->valuestring);
-                                app_log("Gemini_API", "INFO", "Successfully extracted AI response.");
-                            } else {
-                                app_log("Gemini_API", "WARN", "Could not find 'text' string in Gemini response content part.");
-                            }
-                        } else {
-                            app_log("Gemini_API", "WARN", "No 'parts' array in Gemini response content or it's empty.");
-                        }
-                    } else {
-                        app_log("Gemini_API", "WARN", "No 'content' object in Gemini response candidate.");
-                    }
-                } else {
-                    app_log("Gemini_API", "WARN", "No 'candidates' array in Gemini response or it's empty.");
-                    // Check for error object if no candidates
-                    cJSON *error_obj = cJSON_GetObjectItemCaseSensitive(json_response, "error");
-                    if (error_obj) {
-                        cJSON *error_message = cJSON_GetObjectItemCaseSensitive(error_obj, "message");
-                        if (cJSON_IsString(error_message)) {
-                            app_log("Gemini_API", "ERROR", "Gemini API returned error: %s", error_message->valuestring);
-                        } else {
-                            app_log("Gemini_API", "ERROR", "Gemini API returned error without a clear message.");
-                        }
-                    }
-                }
-                cJSON_Delete(json_response);
-            }
+        double connect_time = 0, tls_time = 0;
+        curl_easy_getinfo(warm, CURLINFO_CONNECT_TIME, &connect_time);
+        curl_easy_getinfo(warm, CURLINFO_APPCONNECT_TIME, &tls_time);
+        app_log("Gemini_API", "INFO", "Connection warmed up (connect %.0f ms, TLS %.0f ms).", connect_time * 1000, tls_time * 1000);
+    }
+    curl_easy_cleanup(warm);
+}
+
+void gemini_client_set_stream_handler(GeminiClient *client, GeminiStreamHandler handler) {
+    client->on_stream_text = handler;
+}
+
+bool gemini_client_has_capacity(const GeminiClient *client) {
+    return client != NULL && client->multi != NULL && client->inflight < client->max_inflight;
+}
+
+// URL for a request to model: the client's own unless a Gemini request names another model.
+static const char *request_url(const GeminiClient *client, const char *model, bool streaming, char *out, size_t out_size) {
+    if (client->format != GEMINI_FORMAT_GEMINI || strcmp(model, client->model) == 0) {
+        return streaming ? client->stream_url : client->url;
+    }
+    snprintf(out, out_size, streaming ? "%s%s:streamGenerateContent?alt=sse&key=%s" : "%s%s:generateContent?key=%s",
+             GEMINI_API_BASE, model, client->api_key);
+    return out;
+}
+
+int gemini_client_submit(GeminiClient *client, const char *model, const char *persona, const GeminiTurn *history, size_t history_len,
+                         const char *user_prompt, bool short_answer, long timeout_ms, void *user_data, unsigned long *request_id_out) {
+    if (client == NULL || client->multi == NULL) {
+        app_log("Gemini_API", "ERROR", "Gemini client is not initialized. Cannot make request.");
+        return -1;
+    }
+    if (user_prompt == NULL || strlen(user_prompt) == 0) {
+        app_log("Gemini_API", "ERROR", "User prompt is empty. Cannot make request.");
+        return -1;
+    }
+    if (!gemini_client_has_capacity(client)) return -1;
+    if (model == NULL || model[0] == '\0') model = client->model;
+
+    struct GeminiRequest *req = (struct GeminiRequest *)calloc(1, sizeof(struct GeminiRequest));
+    if (req == NULL) {
+        app_log("Gemini_API", "ERROR", "Failed to allocate request: %s", strerror(errno));
+        return -1;
+    }
+    req->body.memory = (char *)calloc(1, 1);
+    req->stream_text.memory = (char *)calloc(1, 1);
+    req->streaming = (client->on_stream_text != NULL);
+    req->easy = acquire_easy_handle(client);
+    if (req->body.memory == NULL || req->stream_text.memory == NULL || req->easy == NULL ||
+        !build_request_payload(client, model, persona, history, history_len, user_prompt, req->streaming, short_answer)) {
+        app_log("Gemini_API", "ERROR", "Failed to prepare request.");
+        free_request(client, req);
+        return -1;
+    }
+    req->id = ++client->next_request_id;
+    req->user_data = user_data;
+    req->client = client;
+    app_log("Gemini_API", "DEBUG", "Request Payload: %s", client->payload.data);
+
+    // curl keeps its own copies, so the buffers are free for the next request right away.
+    char url[sizeof(client->url)];
+    curl_easy_setopt(req->easy, CURLOPT_POSTFIELDSIZE, (long)client->payload.len);
+    curl_easy_setopt(req->easy, CURLOPT_COPYPOSTFIELDS, client->payload.data);
+    curl_easy_setopt(req->easy, CURLOPT_URL, request_url(client, model, req->streaming, url, sizeof(url)));
+    if (req->streaming) {
+        curl_easy_setopt(req->easy, CURLOPT_WRITEFUNCTION, StreamCallback);
+        curl_easy_setopt(req->easy, CURLOPT_WRITEDATA, (void *)req);
+    } else {
+        curl_easy_setopt(req->easy, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+        curl_easy_setopt(req->easy, CURLOPT_WRITEDATA, (void *)&req->body);
+    }
+    curl_easy_setopt(req->easy, CURLOPT_TIMEOUT_MS, timeout_ms > 0 ? timeout_ms : GEMINI_DEFAULT_TIMEOUT_MS);
+    curl_easy_setopt(req->easy, CURLOPT_PRIVATE, (void *)req);
+
+    CURLMcode mres = curl_multi_add_handle(client->multi, req->easy);
+    if (mres != CURLM_OK) {
+        app_log("Gemini_API", "ERROR", "curl_multi_add_handle() failed: %s", curl_multi_strerror(mres));
+        CURL *easy = req->easy;
+        req->easy = NULL;
+        release_easy_handle(client, easy);
+        free_request(client, req);
+        return -1;
+    }
+    req->next = client->active;
+    client->active = req;
+    client->inflight++;
+
+    app_log("Gemini_API", "INFO", "Sending request %lu to %s (%d in flight)...", req->id, model, client->inflight);
+    if (request_id_out) *request_id_out = req->id;
+    return 0;
+}
+
+int gemini_client_wait(GeminiClient *client, int extra_fd, int timeout_ms, bool *extra_fd_ready) {
+    struct curl_waitfd wait_fd;
+    wait_fd.fd = extra_fd;
+    wait_fd.events = CURL_WAIT_POLLIN;
+    wait_fd.revents = 0;
+
+    int numfds = 0;
+    CURLMcode mres = curl_multi_wait(client->multi, extra_fd >= 0 ? &wait_fd : NULL, extra_fd >= 0 ? 1 : 0, timeout_ms, &numfds);
+    if (extra_fd_ready) *extra_fd_ready = (extra_fd >= 0 && (wait_fd.revents & CURL_WAIT_POLLIN));
+    if (mres != CURLM_OK) {
+        app_log("Gemini_API", "ERROR", "curl_multi_wait() failed: %s", curl_multi_strerror(mres));
+        return -1;
+    }
+    return numfds;
+}
+
+int gemini_client_perform(GeminiClient *client) {
+    int running = 0;
+    CURLMcode mres = curl_multi_perform(client->multi, &running);
+    if (mres != CURLM_OK) {
+        app_log("Gemini_API", "ERROR", "curl_multi_perform() failed: %s", curl_multi_strerror(mres));
+        return -1;
+    }
+    return running;
+}
+
+int gemini_client_next_result(GeminiClient *client, GeminiResult *out) {
+    CURLMsg *msg;
+    int msgs_left = 0;
+    while ((msg = curl_multi_info_read(client->multi, &msgs_left)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        struct GeminiRequest *req = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+        if (req == NULL) continue;
+
+        // Unlink from the active list
+        struct GeminiRequest **link = &client->active;
+        while (*link && *link != req) link = &(*link)->next;
+        if (*link) *link = req->next;
+        client->inflight--;
+
+        memset(out, 0, sizeof(*out));
+        out->request_id = req->id;
+        out->user_data = req->user_data;
+        out->curl_code = msg->data.result;
+
+        long new_connections = 0;
+        double total_time = 0;
+        curl_easy_getinfo(req->easy, CURLINFO_RESPONSE_CODE, &out->http_code);
+        curl_easy_getinfo(req->easy, CURLINFO_NUM_CONNECTS, &new_connections);
+        curl_easy_getinfo(req->easy, CURLINFO_TOTAL_TIME, &total_time);
+        out->total_ms = total_time * 1000;
+#if LIBCURL_VERSION_NUM >= 0x074200 // 7.66.0
+        curl_off_t retry_after = 0;
+        if (curl_easy_getinfo(req->easy, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK && retry_after > 0) {
+            out->retry_after_ms = (long)retry_after * 1000;
+        }
+#endif
+
+        if (out->curl_code != CURLE_OK) {
+            app_log("Gemini_API", "ERROR", "Request %lu failed: %s (HTTP %ld)", req->id, curl_easy_strerror(out->curl_code), out->http_code);
         } else {
-             app_log("Gemini_API", "ERROR", "Gemini API request failed with HTTP code %ld. Response: %s", http_code, chunk.memory ? chunk.memory : "N/A");
+            app_log("Gemini_API", "INFO", "Request %lu: HTTP %ld (%.0f ms, %s connection)",
+                    req->id, out->http_code, out->total_ms, new_connections > 0 ? "new" : "reused");
+            app_log("Gemini_API", "DEBUG", "Response Data: %s", req->streaming ? req->stream_text.memory : req->body.memory);
+            if (out->http_code == 200 && req->streaming) {
+                out->text = req->stream_text.size > 0 ? strdup(req->stream_text.memory) : NULL;
+                if (out->text == NULL) app_log("Gemini_API", "WARN", "Stream for request %lu ended without any text.", req->id);
+            } else if (out->http_code == 200) {
+                out->text = parse_response_text(client, req->body.memory, &req->prompt_tokens, &req->output_tokens, &req->total_tokens);
+            } else { // Error statuses come with their body; a streamed request leaves it unconsumed
+                char *message = parse_error_message(client, req->body.memory);
+                app_log("Gemini_API", "ERROR", "Request %lu failed with HTTP %ld: %s", req->id, out->http_code,
+                        message ? message : req->body.memory);
+                free(message);
+            }
         }
+        out->prompt_tokens = req->prompt_tokens;
+        out->output_tokens = req->output_tokens;
+        out->total_tokens = req->total_tokens ? req->total_tokens : req->prompt_tokens + req->output_tokens;
+        free_request(client, req);
+        return 1;
     }
+    return 0;
+}
+
+int gemini_client_cancel(GeminiClient *client, unsigned long request_id) {
+    struct GeminiRequest **link = &client->active;
+    while (*link && (*link)->id != request_id) link = &(*link)->next;
+    if (*link == NULL) return -1;
+    struct GeminiRequest *req = *link;
+    *link = req->next;
+    client->inflight--;
+    free_request(client, req); // Removes the easy handle from the multi and parks it
+    app_log("Gemini_API", "INFO", "Cancelled request %lu (%d in flight).", request_id, client->inflight);
+    return 0;
+}
 
-cleanup:
-    if (curl_handle) curl_easy_cleanup(curl_handle);
-    if (headers) curl_slist_free_all(headers);
-    if (json_payload) free(json_payload);
-    if (json_root) cJSON_Delete(json_root);
-    if (chunk.memory) free(chunk.memory);
-    curl_global_cleanup();
+void gemini_client_cleanup(GeminiClient *client) {
+    if (client == NULL) return;
+    while (client->active) {
+        struct GeminiRequest *req = client->active;
+        client->active = req->next;
+        free_request(client, req);
+    }
+    client->inflight = 0;
+    for (int i = 0; i < client->num_idle_handles; ++i) curl_easy_cleanup(client->idle_handles[i]);
+    client->num_idle_handles = 0;
+    if (client->multi) curl_multi_cleanup(client->multi);
+    if (client->share) curl_share_cleanup(client->share);
+    if (client->headers) curl_slist_free_all(client->headers);
+    free(client->body_template);
+    free(client->stream_body_template);
+    free(client->short_body_template);
+    free(client->short_stream_body_template);
+    free(client->payload.data);
+    client->body_template = NULL;
+    client->stream_body_template = NULL;
+    client->short_body_template = NULL;
+    client->short_stream_body_template = NULL;
+    memset(&client->payload, 0, sizeof(client->payload));
+    client->multi = NULL;
+    client->share = NULL;
+    client->headers = NULL;
+}
 
+char* get_gemini_response(const char* persona, const char* user_prompt, const char* api_key) {
+    GeminiClient client;
+    char *response_text = NULL;
+    if (gemini_client_init(&client, api_key, NULL, 1) == 0 &&
+        gemini_client_submit(&client, NULL, persona, NULL, 0, user_prompt, false, 0, NULL, NULL) == 0) {
+        GeminiResult result;
+        while (gemini_client_perform(&client) > 0) {
+            if (gemini_client_wait(&client, -1, 1000, NULL) < 0) break;
+        }
+        if (gemini_client_next_result(&client, &result) == 1) response_text = result.text;
+    }
+    gemini_client_cleanup(&client);
     return response_text;
-}
\ No newline at end of file
+}
@@ -2,6 +2,111 @@
 #define GEMINI_INTEGRATION_H
 
 #include <stddef.h> // For size_t
+#include <curl/curl.h>
+
+#include <stdbool.h>
+
+#define GEMINI_HANDLE_POOL_SIZE 8 // Idle easy handles kept for reuse
+#define GEMINI_DEFAULT_TIMEOUT_MS 30000L // Per request, when the caller gives no timeout
+#define GEMINI_MODEL_NAME_MAX 64 // Including the terminating NUL
+#define AI_MAX_OUTPUT_TOKENS 250
+
+struct GeminiRequest;
+
+// One earlier message sent as conversation history ahead of the prompt.
+typedef struct {
+    bool from_model; // false = "user" role, true = "model" role
+    const char *text;
+} GeminiTurn;
+
+// Growable byte buffer, kept by the client and reused for every request body.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} GeminiBuffer;
+
+// Called from inside gemini_client_perform() with each text fragment of a streamed answer.
+typedef void (*GeminiStreamHandler)(void *user_data, const char *text);
+
+// Wire format spoken by a client: Gemini generateContent, or an
+// OpenAI-compatible /v1/chat/completions endpoint (local model servers, the
+// fake_ai_server stand-in).
+typedef enum {
+    GEMINI_FORMAT_GEMINI,
+    GEMINI_FORMAT_OPENAI
+} GeminiApiFormat;
+
+// Persistent per-worker client on the curl multi interface. Up to max_inflight
+// requests run concurrently over a share handle for DNS, TLS sessions and
+// connections, so repeated requests skip the handshakes.
+typedef struct {
+    CURLM *multi;
+    CURLSH *share;
+    struct curl_slist *headers;
+    GeminiApiFormat format;
+    const char *api_key; // May be NULL for OpenAI-compatible servers
+    char model[GEMINI_MODEL_NAME_MAX];
+    char url[512];
+    char stream_url[512];
+    char warmup_url[512];
+    char *body_template; // Serialized fields that follow the messages, built once
+    char *stream_body_template; // Same, for streamed requests
+    char *short_body_template; // Same pair capping answers at AI_OVERLOAD_SHORT_OUTPUT_TOKENS
+    char *short_stream_body_template;
+    GeminiBuffer payload;
+    GeminiStreamHandler on_stream_text; // Non-NULL switches requests to streamGenerateContent
+    int max_inflight;
+    int inflight;
+    unsigned long next_request_id;
+    struct GeminiRequest *active;
+    CURL *idle_handles[GEMINI_HANDLE_POOL_SIZE];
+    int num_idle_handles;
+} GeminiClient;
+
+// Outcome of one finished request. text is malloc'd (caller frees) or NULL on error.
+typedef struct {
+    unsigned long request_id;
+    void *user_data;
+    char *text;
+    long http_code;
+    CURLcode curl_code;
+    double total_ms;
+    long prompt_tokens; // usageMetadata counts, 0 if the response had none
+    long output_tokens;
+    long total_tokens; // Reported total, or prompt + output if none was given
+    long retry_after_ms; // From a Retry-After header, 0 if none
+} GeminiResult;
+
+// Whether model can be put into a Gemini request URL.
+bool gemini_model_name_valid(const char *model);
+// model may be NULL for the default. Returns 0 on success, -1 on failure.
+// Call gemini_client_cleanup() either way.
+int gemini_client_init(GeminiClient *client, const char *api_key, const char *model, int max_inflight);
+// Same client speaking the OpenAI chat completions format to url. api_key may be NULL.
+int gemini_client_init_openai(GeminiClient *client, const char *url, const char *model, const char *api_key, int max_inflight);
+// Pre-opens the TLS connection so the first request does not pay for it.
+void gemini_client_warmup(GeminiClient *client);
+// Streams later requests over SSE, passing each text fragment to handler as it arrives.
+void gemini_client_set_stream_handler(GeminiClient *client, GeminiStreamHandler handler);
+bool gemini_client_has_capacity(const GeminiClient *client);
+// Starts a request without blocking; history (may be NULL) is sent between the
+// persona and the prompt. model overrides the client's model for this request
+// (NULL for the client's own). short_answer caps the answer at
+// AI_OVERLOAD_SHORT_OUTPUT_TOKENS instead of AI_MAX_OUTPUT_TOKENS. The transfer
+// is aborted after timeout_ms (0 for the default). Returns 0, or -1 on error or
+// when at max_inflight.
+int gemini_client_submit(GeminiClient *client, const char *model, const char *persona, const GeminiTurn *history, size_t history_len,
+                         const char *user_prompt, bool short_answer, long timeout_ms, void *user_data, unsigned long *request_id_out);
+// Waits up to timeout_ms for transfer activity or for extra_fd (-1 for none) to become readable.
+int gemini_client_wait(GeminiClient *client, int extra_fd, int timeout_ms, bool *extra_fd_ready);
+// Drives transfers; returns the number still running or -1 on error.
+int gemini_client_perform(GeminiClient *client);
+// Pops one finished request into *out. Returns 1 if a result was produced, 0 otherwise.
+int gemini_client_next_result(GeminiClient *client, GeminiResult *out);
+// Aborts an in-flight request; it will not produce a result. Returns 0, or -1 if unknown.
+int gemini_client_cancel(GeminiClient *client, unsigned long request_id);
+void gemini_client_cleanup(GeminiClient *client);
 
 // Function to get a response from the Gemini API
 // persona: A system message to set the AI's role (optional, can be NULL)
@@ -9,6 +114,7 @@
 // api_key: Your Google Gemini API key
 // Returns a dynamically allocated string containing the AI's response, or NULL on error.
 // The caller is responsible for freeing the returned string.
+// One-shot convenience wrapper; long-running callers should keep a GeminiClient.
 char* get_gemini_response(const char* persona, const char* user_prompt, const char* api_key);
 
 #endif // GEMINI_INTEGRATION_H
\ No newline at end of file
@@ -45,16 +45,236 @@ extern const char *ADMIN_CHANNEL_NAME_CONST;
 #define PIPE_MSG_DELIMITER_CHAR '\t'
 #define PIPE_MSG_DELIMITER_STR "\t"
 #define MAX_PIPE_MSG_LEN 512 
+#define MAX_BACKEND_OPTIONS_LEN 256 // Optional "backend=..." segment of a channels.txt line
+#define WORKER_ADVERT_INTERVAL_SECONDS 30 // How often workers post their command list
+
+// --- AI request concurrency ---
+#define AI_FAKE_BACKEND_URL "http://127.0.0.1:8089/v1/chat/completions" // Default for backend=fake
+#define AI_MAX_CONCURRENT_REQUESTS 4 // In-flight Gemini requests per worker
+#define AI_OUT_OF_ORDER_REPLIES 0 // 1 = post answers as they finish instead of in ask order
+#define AI_STREAMING_ENABLED 1 // Use streamGenerateContent and post each line as it arrives
+#define AI_STREAM_MIN_LINE 60 // Sentence breaks before this many chars don't end a line
+#define AI_STREAM_MAX_LINE 350 // Longer text is wrapped at the last space
+#define AI_REQUEST_DEADLINE_MS 30000L // Default !ask deadline, per channel with "deadline=<seconds>"
+
+// --- AI request retries, circuit breaker and hedging ---
+#define AI_RETRY_MAX_ATTEMPTS 3 // Sends per !ask, first try included
+#define AI_RETRY_BASE_MS 500 // Backoff ceiling for the first retry, doubled each time
+#define AI_RETRY_MAX_BACKOFF_MS 8000
+#define AI_BREAKER_FAILURE_THRESHOLD 5 // Consecutive retryable failures that open the circuit
+#define AI_BREAKER_OPEN_SECONDS 30 // Fail fast this long before probing again
+#define AI_HEDGE_ENABLED 1 // Send a second copy of a request slower than the percentile below
+#define AI_HEDGE_PERCENTILE 95
+#define AI_HEDGE_MIN_SAMPLES 20 // Latencies needed before hedging starts
+#define AI_LATENCY_WINDOW 128 // Recent request latencies kept per worker
+
+// --- Shared API quota (all workers; a channel opts out with "quota=off") ---
+#define AI_QUOTA_ENABLED 1
+#define AI_QUOTA_REQUESTS_PER_MINUTE 60
+#define AI_QUOTA_TOKENS_PER_MINUTE 60000
+#define AI_QUOTA_CHANNEL_REQUESTS_PER_MINUTE 30 // Per channel sub-limit
+#define AI_QUOTA_NICK_REQUESTS_PER_MINUTE 6 // Per nick sub-limit, across channels
+#define AI_QUOTA_NICK_SLOTS 256 // Nicks tracked at once; the least recently seen are recycled
+
+// --- AI request scheduling ---
+#define AI_SCHED_FAIR 1 // Take turns between askers, cheapest ask first; 0 = send in arrival order
+#define AI_SCHED_NICK_SLOTS 32 // Askers whose last turn each worker remembers
+#define AI_SCHED_REPORT_POSITION 2 // Tell an asker their place in line when it is this far back or more
+#define AI_SCHED_ADMIN_MEMBERS 64 // Admin channel members tracked for priority
+
+// --- AI request batching (per channel with "batch=<ms>") ---
+#define AI_BATCH_WINDOW_MS 0 // Default window in which short asks are collected into one request; 0 = off
+#define AI_BATCH_MAX_ASKS 4 // Questions per batched request; all answers must fit AI_MAX_OUTPUT_TOKENS
+#define AI_BATCH_MAX_PROMPT_CHARS 200 // Longer asks are always sent on their own
+
+// --- Token accounting and budgets (per channel with "budget=<tokens per hour>") ---
+#define AI_USAGE_HOURS 24 // Hourly buckets kept per channel and per nick
+#define AI_USAGE_NICK_SLOTS 256 // Nicks tracked at once; the least recently active are recycled
+#define AI_USAGE_BUDGET_TOKENS_PER_HOUR 0 // Default channel budget; 0 = none
+#define AI_USAGE_THROTTLE_PERCENT 80 // Past this share of the budget a channel sends one request at a time
+#define AI_USAGE_TOP_NICKS 5 // Heaviest users listed by !usage
+
+// --- Model routing (per channel with "models=<name>[:<slo ms>],..." and "route=<policy>") ---
+#define AI_ROUTE_MAX_MODELS 4
+#define AI_ROUTE_LONG_PROMPT_TOKENS 300 // Under "route=size", estimated requests this big start at the first model
+#define AI_ROUTE_PERCENTILE 95 // Compared against each model's SLO
+#define AI_ROUTE_MIN_SAMPLES 10 // Latencies needed before a model can be judged over its SLO
+#define AI_ROUTE_PROBE_MS 30000 // A model over its SLO still gets one request this often
+#define AI_ROUTE_HISTOGRAM_BOUNDS { 250, 500, 1000, 2000, 4000, 8000 } // Bucket upper bounds in ms; a last bucket takes the rest
+#define AI_ROUTE_HISTOGRAM_BUCKETS 7
+
+// --- Overload control (per worker, from queued asks and how long the oldest has waited) ---
+// Level 1 shortens answers, level 2 also sends new asks without history, level 3
+// also turns new asks away as busy; admin channel members are always served.
+#define AI_OVERLOAD_ENABLED 1
+#define AI_OVERLOAD_QUEUE_LEVELS { 8, 16, 32 } // Queued asks that raise the level to 1, 2 and 3
+#define AI_OVERLOAD_AGE_LEVELS_MS { 4000, 8000, 15000 } // Same, by the oldest queued ask's wait
+#define AI_OVERLOAD_RECOVER_PERCENT 50 // A level is left once load stays below this share of what raises it...
+#define AI_OVERLOAD_RECOVER_MS 5000 // ...for this long, one level at a time
+#define AI_OVERLOAD_SHORT_OUTPUT_TOKENS 80 // Answer cap from level 1 up
+
+// --- Offline fallback answers (per channel Markov model learnt from channel messages) ---
+#define AI_MARKOV_ENABLED 1
+#define AI_MARKOV_WORD_SLOTS 8192 // Vocabulary per channel; the least recently seen words are recycled
+#define AI_MARKOV_CONTEXT_SLOTS 32768 // Word pair and single word contexts per channel
+#define AI_MARKOV_FOLLOWERS 4 // Next words remembered per context
+#define AI_MARKOV_MAX_REPLY_WORDS 30
+
+// --- Recall of earlier channel messages for !ask (BM25 over a per channel index) ---
+#define AI_RECALL_ENABLED 1
+#define AI_RECALL_WINDOW 5000 // Most recent messages indexed per channel
+#define AI_RECALL_TOP_K 3 // Earlier lines added to an ask at most
+#define AI_RECALL_MAX_K 16
+#define AI_RECALL_MIN_SCORE 2.0 // BM25 score a line needs to be worth sending
+#define AI_RECALL_MAX_CHARS 600 // Budget for the recalled lines in one prompt
+#define AI_RECALL_LINE_MAX 300 // Characters kept per indexed message
+
+// --- Channel FAQ (prompts matched by character trigrams before any API call) ---
+#define AI_FAQ_ENABLED 1
+#define AI_FAQ_DIR "faq" // <channel>.txt per channel, see README for the format
+#define AI_FAQ_THRESHOLD 0.75 // Trigram (Dice) similarity a prompt needs to get the FAQ answer
+#define AI_FAQ_REFRESH_SECONDS 86400 // Generated answers are regenerated when idle after this long
+#define AI_FAQ_RETRY_SECONDS 300 // Wait before trying again after a failed generation
+#define AI_FAQ_CHECK_MS 10000 // How often an idle worker checks the FAQ file for changes
+#define AI_FAQ_USAGE_NICK "(FAQ)" // Name generation requests are accounted under in !usage and the quota
+
+// --- AI response cache ---
+#define AI_CACHE_TTL_SECONDS 3600
+#define AI_CACHE_MEMORY_BUDGET (256 * 1024) // Bytes of cached answers per worker
+#define AI_CACHE_BUCKETS 1024
+#define AI_CACHE_DISK_ENABLED 1 // Back the cache with a memory-mapped table per channel
+#define AI_CACHE_DIR "ai_cache"
+#define AI_CACHE_DISK_SLOTS 1024
+#define AI_CACHE_DISK_KEY_MAX 512
+#define AI_CACHE_DISK_RESPONSE_MAX 1536
+
+// --- Near-duplicate prompt matching (MinHash + LSH) ---
+#define AI_SIMILAR_ENABLED 1
+#define AI_SIMILAR_THRESHOLD 0.6 // Minimum estimated Jaccard similarity to reuse an answer
+#define AI_SIMILAR_MAX_ENTRIES 4096 // Indexed prompts per worker
+#define AI_SIMILAR_SHINGLE 2 // Characters per shingle; bigrams separate short prompts best
+#define AI_SIMILAR_BANDS 16
+#define AI_SIMILAR_ROWS 4 // Signature rows per band; 16 x 4 = 64 hash functions (2-row bigram bands were too common to narrow anything)
+#define AI_SIMILAR_MAX_CANDIDATES 512 // Entries compared per lookup, newest first
+
+// --- Conversation memory ---
+#define AI_MEMORY_ENABLED 1 // Send recent !ask turns as history so follow-up questions work
+#define AI_MEMORY_PER_NICK 0 // 1 = each nick only sees its own earlier turns
+#define AI_MEMORY_ARENA_BYTES (16 * 1024) // Fixed history storage per channel
+#define AI_MEMORY_MAX_TURNS 64
+#define AI_MEMORY_TURN_MAX_CHARS 1024 // Longer questions/answers are cut when stored
+#define AI_MEMORY_TOKEN_BUDGET 1024 // Estimated tokens for persona + history + prompt
+#define AI_MEMORY_MAX_AGE_SECONDS 1800 // Older turns are left out of the history
+
+// --- Cross-worker coalescing of identical in-flight requests ---
+#define AI_FLIGHT_ENABLED 1
+#define AI_FLIGHT_SLOTS 64 // Pending requests tracked across all workers
+#define AI_FLIGHT_KEY_MAX 512
+#define AI_FLIGHT_RESPONSE_MAX 4096 // Longer answers are not shared
+#define AI_FLIGHT_LINGER_SECONDS 10 // A finished answer stays available to late arrivals this long
+#define AI_FLIGHT_STALE_SECONDS 120 // Pending entries older than this are treated as abandoned
+#define AI_FLIGHT_POLL_MS 50 // Worker wake-up interval while waiting on another worker's request
 
 #define LOG_FILE_PATH "irc_chat.log"
 #define MUTED_USERS_FILE_PATH "muted_users.txt"
 
+// --- Mute list journal ---
+#define MUTE_JOURNAL_SUFFIX ".journal" // Appended to MUTED_USERS_FILE_PATH
+#define MUTE_JOURNAL_FLUSH_MS 200 // Mute changes are written and fsynced in batches at most this old
+#define MUTE_JOURNAL_BUFFER_BYTES 65536 // A batch this large is written at once
+#define MUTE_JOURNAL_COMPACT_RECORDS 1024 // Records that trigger a compaction, if they outnumber the muted nicks
+
+// --- Log sampling ---
+#define LOG_SAMPLED_LEVELS { "RECV", "MSG", "SENT", "PIPE_RECV" } // Only these levels are ever sampled
+#define LOG_SAMPLE_WINDOW_SECONDS 10
+#define LOG_SAMPLE_THRESHOLD 50 // Lines per (level, channel) per window written in full
+#define LOG_SAMPLE_RATE 20 // Past the threshold keep 1 in N lines
+#define LOG_SAMPLER_SLOTS 128
+
+// --- Transcript store ---
+#define TRANSCRIPT_DIR "transcripts"
+#define TRANSCRIPT_INDEX_STRIDE_BYTES 65536 // One index record per 64KB of transcript
+#define HISTORY_MAX_REPLY_LINES 15 // Cap on lines !history sends to the admin channel
+
 // --- Structure for Channel Info ---
 typedef struct {
     char *name;
     char *persona; // Persona for the AI in this channel
+    char *backend_options; // "backend=..." options, NULL for the default (Gemini)
 } ChannelInfo;
 
+// --- Muted nicks ---
+// An open-addressed hash set (linear probing, at most half full) keyed by the
+// nick folded with rfc1459 casemapping, so a mute on "spammer" also covers
+// "SPAMMER", and one on "[bot]" covers "{bot}". Slots keep the nick as muted.
+typedef struct {
+    uint64_t hash; // Of the folded nick
+    char nick[MAX_NICK_LEN]; // "" = empty slot
+} MutedNick;
+
+typedef struct {
+    MutedNick *slots;
+    size_t capacity; // Power of two, 0 before the first mute
+    size_t count;
+} MuteSet;
+
+// --- Shared AI statistics ---
+// Per model a worker routes to, for !models.
+typedef struct {
+    char name[64];
+    long slo_ms; // 0 = none
+    long p95_ms; // Over the recent window, -1 until there are enough samples
+    bool over_slo;
+    unsigned long routed; // Requests sent to this model
+    unsigned long fallbacks; // Requests it took because a preferred model was over its SLO
+    unsigned long probes; // Requests sent to it while it was over its SLO
+    unsigned long histogram[AI_ROUTE_HISTOGRAM_BUCKETS]; // Answer times, see AI_ROUTE_HISTOGRAM_BOUNDS
+} AiModelStats;
+
+// One slot per worker in shared memory; the worker writes, the parent reads for !aistats.
+typedef struct {
+    unsigned long asks;
+    unsigned long answered;
+    unsigned long errors;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    unsigned long cache_entries;
+    unsigned long cache_bytes;
+    unsigned long similar_hits;
+    unsigned long coalesced; // Asks answered by attaching to another pending request
+    unsigned long expired; // Asks that ran past their deadline
+    unsigned long cancelled; // Asks dropped because the asker left or asked again
+    unsigned long wasted_calls; // API requests sent whose answer was never posted
+    unsigned long retries;
+    unsigned long breaker_rejects; // Asks failed fast while the circuit was open
+    unsigned long hedges; // Second copies sent for slow requests
+    unsigned long hedge_wins; // Hedges that answered first
+    unsigned long quota_waits; // Asks held back until the shared quota refilled
+    unsigned long quota_rejects; // Asks turned away for lack of quota
+    unsigned long priority_asks; // Asks from admin channel members, sent ahead of the rest
+    unsigned long queue_wait_ms_total; // Ask to first send, summed over sent asks
+    unsigned long queue_wait_samples;
+    unsigned long api_calls; // Requests sent to the backend, hedges and batches included
+    unsigned long batches; // Requests that carried several asks
+    unsigned long batched_asks;
+    unsigned long batch_fallbacks; // Batches whose answers could not be split, re-sent one by one
+    unsigned long budget_holds; // Asks slowed down because the channel neared its token budget
+    unsigned long budget_rejects; // Asks refused because the budget was spent
+    unsigned long latency_ms_total; // Ask to final answer, summed over answered asks
+    unsigned long first_line_ms_total; // Ask to first streamed line
+    unsigned long first_line_samples;
+    unsigned long faq_answers; // Asks answered from the channel FAQ
+    unsigned long faq_refreshes; // FAQ answers generated while idle
+    unsigned long recalled_asks; // Asks sent with earlier channel lines recalled for context
+    unsigned long offline_answers; // Asks answered by the offline model while the backend was unavailable
+    int overload_level; // Current, 0 = normal
+    unsigned long overload_raises; // Level increases
+    unsigned long overload_recoveries; // Level decreases
+    unsigned long overload_shed; // Asks turned away as busy
+    int num_models;
+    AiModelStats models[AI_ROUTE_MAX_MODELS];
+} AiWorkerStats;
+
 
 // --- Global Variables (declared as extern) ---
 extern volatile sig_atomic_t shutdown_requested;
@@ -68,12 +288,12 @@ extern int numChildren; // Total number of channels (admin + workers)
 extern int numWorkerChildren; // Number of worker channels (numChildren - 1 if admin channel exists)
 
 extern sem_t *socket_lock;
+extern AiWorkerStats *g_ai_stats; // numWorkerChildren slots, shared with workers
 
 // extern char **CHANNELS; // Replaced by array of ChannelInfo
 extern ChannelInfo *g_channel_infos; // Array of ChannelInfo structs
 
-extern char **g_muted_nicks;
-extern int g_num_muted_users;
+extern MuteSet g_muted_users;
 
 // --- Function Prototypes ---
 
@@ -85,10 +305,23 @@ void free_channels_memory(void); // Modified
 int load_muted_users_from_file(const char *filename);
 void free_muted_users_memory(void);
 bool is_user_globally_muted(const char *nick);
+int irc_tolower(int c); // rfc1459 casemapping, as the server compares nicks
+bool irc_nick_equal(const char *a, const char *b);
+uint64_t irc_nick_hash(const char *nick); // Equal for nicks irc_nick_equal() matches
+// Writes nick folded to lower case into out, truncated to fit, and returns its hash.
+uint64_t irc_nick_fold(const char *nick, char *out, size_t out_size);
 void app_log(const char *process_tag, const char *level, const char *format, ...); // Modified for dual logging
+void app_log_sampled(const char *process_tag, const char *level, const char *channel, const char *format, ...);
+void log_sampler_flush(const char *process_tag, bool force);
+void irc_line_channel(const char *line, char *out, size_t out_size);
 int add_muted_user(const char *nick);
 int remove_muted_user(const char *nick);
 int save_muted_users_to_file(const char *filename);
+bool mute_journal_pending(void);
+// Writes batched mute changes once due (or now if force) and starts a compaction when the journal has grown.
+void mute_journal_flush(bool force);
+// Returns true if pid was the journal compaction child.
+bool mute_journal_reap(pid_t pid, int status);
 
 // From irc_network.c
 void send_irc(int sock_param, const char *fmt, ...);
@@ -101,12 +334,23 @@ void child_PING(int sock_param, const char* ip_override);
 void child_WORKER(int worker_id, const ChannelInfo* channel_info, int local_socket_fd, int pipe_read_fd); // Takes ChannelInfo
 int forkChildren(const char *ip_override);
 
+// From transcript.c
+int transcript_init(void);
+void transcript_close_all(void);
+void transcript_append(const char *channel, const char *nick, const char *text);
+// Emits lines in [from, to]; returns lines emitted, max_lines + 1 if truncated, or -1 for an unknown channel.
+int transcript_query(const char *channel, time_t from, time_t to, int max_lines,
+                     void (*emit)(const char *line, void *ctx), void *ctx);
+int parse_history_time(const char *text, time_t *out);
+
 // From irc_core.c
 void SIG_parent_handler(int numSignal);
 void SIG_child_handler(int numSignal);
 int initSIGNALS(void);
 int initSemaphores(void);
 void cleanup_semaphore(void);
+int initAiStats(void);
+void cleanup_ai_stats(void);
 void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status);
 void softShutdown(int *child_status);
 
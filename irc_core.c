@@ -3,7 +3,10 @@
 #endif
 
 #include "irc_bot.h"
+#include "ai_quota.h"
+#include "ai_usage.h"
 #include <string.h> 
+#include <strings.h>
 
 void SIG_parent_handler(int numSignal) {
     char parent_tag[32];
@@ -70,6 +73,112 @@ void cleanup_semaphore(void) {
     }
 }
 
+static size_t g_ai_stats_size = 0;
+
+int initAiStats(void) {
+    char parent_tag[32];
+    snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
+    if (numWorkerChildren <= 0) return EXIT_SUCCESS;
+    g_ai_stats_size = numWorkerChildren * sizeof(AiWorkerStats);
+    g_ai_stats = (AiWorkerStats *)mmap(NULL, g_ai_stats_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_ai_stats == MAP_FAILED) {
+        app_log(parent_tag, "ERROR", "mmap for AI statistics failed: %s", strerror(errno));
+        g_ai_stats = NULL;
+        return EXIT_FAILURE;
+    }
+    memset(g_ai_stats, 0, g_ai_stats_size);
+    app_log(parent_tag, "INFO", "Shared AI statistics initialized for %d worker(s).", numWorkerChildren);
+    return EXIT_SUCCESS;
+}
+
+void cleanup_ai_stats(void) {
+    if (g_ai_stats != NULL) {
+        munmap(g_ai_stats, g_ai_stats_size);
+        g_ai_stats = NULL;
+    }
+}
+
+// Relays one transcript line ("<epoch>\t<nick>\t<text>") to the admin channel.
+// One worker's !aistats, split over several PRIVMSGs to stay well inside the 512 byte IRC line limit.
+static void send_worker_ai_stats(int socket_fd, const char *channel, const AiWorkerStats *st) {
+    unsigned long lookups = st->cache_hits + st->cache_misses;
+    send_irc(socket_fd, "PRIVMSG %s :%s: asks %lu, answered %lu, errors %lu, %lu priority | avg latency %lu ms, first line %lu ms, queue wait %lu ms | %lu expired, %lu cancelled, %lu wasted calls",
+             ADMIN_CHANNEL_NAME_CONST, channel, st->asks, st->answered, st->errors, st->priority_asks,
+             st->answered ? st->latency_ms_total / st->answered : 0,
+             st->first_line_samples ? st->first_line_ms_total / st->first_line_samples : 0,
+             st->queue_wait_samples ? st->queue_wait_ms_total / st->queue_wait_samples : 0, st->expired, st->cancelled, st->wasted_calls);
+    send_irc(socket_fd, "PRIVMSG %s :%s cache: %lu/%lu hits (%lu%%), %lu similar, %lu coalesced, %lu entries, %lu bytes | %lu API calls (%.2f per answer), %lu asks in %lu batches, %lu batch fallbacks",
+             ADMIN_CHANNEL_NAME_CONST, channel, st->cache_hits, lookups, lookups ? st->cache_hits * 100 / lookups : 0, st->similar_hits,
+             st->coalesced, st->cache_entries, st->cache_bytes, st->api_calls, st->answered ? (double)st->api_calls / st->answered : 0.0,
+             st->batched_asks, st->batches, st->batch_fallbacks);
+    send_irc(socket_fd, "PRIVMSG %s :%s retries: %lu retries, %lu failed fast, %lu/%lu hedges won | quota: %lu held, %lu refused | budget: %lu held, %lu refused",
+             ADMIN_CHANNEL_NAME_CONST, channel, st->retries, st->breaker_rejects, st->hedge_wins, st->hedges, st->quota_waits, st->quota_rejects,
+             st->budget_holds, st->budget_rejects);
+    send_irc(socket_fd, "PRIVMSG %s :%s overload: level %d, %lu raised, %lu recovered, %lu turned away | %lu FAQ answers, %lu FAQ refreshes | %lu recalled, %lu offline answers",
+             ADMIN_CHANNEL_NAME_CONST, channel, st->overload_level, st->overload_raises, st->overload_recoveries, st->overload_shed,
+             st->faq_answers, st->faq_refreshes, st->recalled_asks, st->offline_answers);
+}
+
+static void send_history_line(const char *line, void *ctx) {
+    (void)ctx;
+    char *nick_start = strchr(line, '\t');
+    if (nick_start == NULL) return;
+    char *text_start = strchr(nick_start + 1, '\t');
+    if (text_start == NULL) return;
+
+    time_t ts = (time_t)strtoll(line, NULL, 10);
+    char time_buffer[32];
+    struct tm *local_time_info = localtime(&ts);
+    if (local_time_info == NULL || strftime(time_buffer, sizeof(time_buffer), "%Y-%m-%d %H:%M:%S", local_time_info) == 0) {
+        snprintf(time_buffer, sizeof(time_buffer), "%lld", (long long)ts);
+    }
+    send_irc(socket_fd, "PRIVMSG %s :[%s] <%.*s> %s", ADMIN_CHANNEL_NAME_CONST, time_buffer,
+             (int)(text_start - nick_start - 1), nick_start + 1, text_start + 1);
+    usleep(100000);
+}
+
+// Tells the worker for channel (every worker when channel is NULL, i.e. on QUIT)
+// that nick left, so its unanswered !ask requests are dropped.
+static void notify_workers_nick_gone(const char *parent_tag, const char *nick, const char *channel) {
+    if (worker_write_pipe_fds == NULL || g_channel_infos == NULL) return;
+    char pipe_msg[MAX_PIPE_MSG_LEN];
+    // Pipe Format: "GONE\tNICK\n"
+    snprintf(pipe_msg, sizeof(pipe_msg), "GONE%c%s\n", PIPE_MSG_DELIMITER_CHAR, nick);
+    for (int i = 0; i < numWorkerChildren; ++i) {
+        if (worker_write_pipe_fds[i] == -1 || g_channel_infos[i+1].name == NULL) continue;
+        if (channel && strcmp(channel, g_channel_infos[i+1].name) != 0) continue;
+        if (write(worker_write_pipe_fds[i], pipe_msg, strlen(pipe_msg)) == -1 && errno != EAGAIN) {
+            app_log(parent_tag, "ERROR", "Write to worker pipe for %s failed: %s", g_channel_infos[i+1].name, strerror(errno));
+        }
+    }
+}
+
+// Nicks currently in the admin channel, learnt from NAMES, JOIN, PART, KICK,
+// QUIT and NICK. Their !ask requests are sent ahead of everyone else's.
+static char g_admin_members[AI_SCHED_ADMIN_MEMBERS][MAX_NICK_LEN];
+
+static int find_admin_member(const char *nick) {
+    for (int i = 0; i < AI_SCHED_ADMIN_MEMBERS; ++i) {
+        if (g_admin_members[i][0] != '\0' && irc_nick_equal(g_admin_members[i], nick)) return i;
+    }
+    return -1;
+}
+
+static void add_admin_member(const char *nick) {
+    nick += strspn(nick, "~&@%+"); // NAMES prefixes channel modes
+    if (nick[0] == '\0' || find_admin_member(nick) != -1) return;
+    for (int i = 0; i < AI_SCHED_ADMIN_MEMBERS; ++i) {
+        if (g_admin_members[i][0] == '\0') {
+            snprintf(g_admin_members[i], MAX_NICK_LEN, "%s", nick);
+            return;
+        }
+    }
+}
+
+static void remove_admin_member(const char *nick) {
+    int index = find_admin_member(nick);
+    if (index != -1) g_admin_members[index][0] = '\0';
+}
 
 void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
     char parent_tag[32];
@@ -88,6 +197,7 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
         }
 
         tv.tv_sec = 1; tv.tv_usec = 0;
+        if (mute_journal_pending()) { tv.tv_sec = 0; tv.tv_usec = MUTE_JOURNAL_FLUSH_MS * 1000; } // Wake up to write it
         int activity = select(socket_fd + 1, &read_fds, NULL, NULL, &tv);
 
         if (activity < 0) {
@@ -115,7 +225,9 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
                     full_line = strtok_r(NULL, "\r\n", &line_saveptr_outer);
                     continue;
                 }
-                app_log(parent_tag, "RECV", "%s", line_copy_for_parsing);
+                char line_channel[MAX_CHANNEL_NAME_LEN];
+                irc_line_channel(line_copy_for_parsing, line_channel, sizeof(line_channel));
+                app_log_sampled(parent_tag, "RECV", line_channel, "%s", line_copy_for_parsing);
                 
                 if (strncmp(line_copy_for_parsing, "PING :", 6) == 0) {
                     send_irc(socket_fd, "PONG :%s", line_copy_for_parsing + 6);
@@ -156,11 +268,46 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
                         }
                         if (ADMIN_CHANNEL_NAME_CONST && channel_name_353 && users_list_start) {
                              send_irc(socket_fd, "PRIVMSG %s :Users in %s: %s", ADMIN_CHANNEL_NAME_CONST, channel_name_353, users_list_start);
+                             if (strcmp(channel_name_353, ADMIN_CHANNEL_NAME_CONST) == 0) {
+                                 char *saveptr_names;
+                                 for (char *member = strtok_r(users_list_start, " ", &saveptr_names); member; member = strtok_r(NULL, " ", &saveptr_names)) {
+                                     add_admin_member(member);
+                                 }
+                             }
+                        }
+                    }
+
+                    else if (sender_nick_dup && command && target && strcmp(command, "JOIN") == 0) {
+                        const char *joined_channel = target[0] == ':' ? target + 1 : target;
+                        if (ADMIN_CHANNEL_NAME_CONST && strcmp(joined_channel, ADMIN_CHANNEL_NAME_CONST) == 0) add_admin_member(sender_nick_dup);
+                    }
+
+                    else if (sender_nick_dup && command && target && strcmp(command, "NICK") == 0) {
+                        if (find_admin_member(sender_nick_dup) != -1) {
+                            remove_admin_member(sender_nick_dup);
+                            add_admin_member(target[0] == ':' ? target + 1 : target);
+                        }
+                    }
+
+                    else if (sender_nick_dup && command && target && (strcmp(command, "PART") == 0 || strcmp(command, "QUIT") == 0 || strcmp(command, "KICK") == 0)) {
+                        // Pending !ask answers for someone who left are no longer worth waiting for
+                        const char *gone_nick = sender_nick_dup;
+                        char kicked_nick[MAX_NICK_LEN];
+                        if (strcmp(command, "KICK") == 0) {
+                            kicked_nick[0] = '\0';
+                            if (message_text_ptr) sscanf(message_text_ptr, "%31s", kicked_nick);
+                            gone_nick = kicked_nick;
+                        }
+                        const char *gone_channel = strcmp(command, "QUIT") == 0 ? NULL : (target[0] == ':' ? target + 1 : target);
+                        if (gone_nick[0] != '\0') notify_workers_nick_gone(parent_tag, gone_nick, gone_channel);
+                        if (gone_nick[0] != '\0' && (gone_channel == NULL || (ADMIN_CHANNEL_NAME_CONST && strcmp(gone_channel, ADMIN_CHANNEL_NAME_CONST) == 0))) {
+                            remove_admin_member(gone_nick);
                         }
                     }
 
                     else if (sender_nick_dup && command && target && message_text_ptr && strcmp(command, "PRIVMSG") == 0) {
-                        app_log(parent_tag, "MSG", "<%s> [%s] %s", target, sender_nick_dup, message_text_ptr);
+                        app_log_sampled(parent_tag, "MSG", target, "<%s> [%s] %s", target, sender_nick_dup, message_text_ptr);
+                        if (target[0] == '#') transcript_append(target, sender_nick_dup, message_text_ptr);
 
                         if (is_user_globally_muted(sender_nick_dup)) {
                             app_log(parent_tag, "INFO", "Ignored PRIVMSG from globally muted user: %s in %s", sender_nick_dup, target);
@@ -171,7 +318,20 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
                             send_irc(socket_fd, "PRIVMSG %s :I'm a channel bot, please talk to me in my channels!", sender_nick_dup);
                         } else if (ADMIN_CHANNEL_NAME_CONST && strcmp(target, ADMIN_CHANNEL_NAME_CONST) == 0) {
                             app_log(parent_tag, "CMD", "Admin Channel <%s> from [%s]: %s", target, sender_nick_dup, message_text_ptr);
-                            if (strncmp(message_text_ptr, "!mute ", 6) == 0) {
+                            bool bulk_mute = strncmp(message_text_ptr, "!mute ", 6) == 0;
+                            if ((bulk_mute || strncmp(message_text_ptr, "!unmute ", 8) == 0) && strchr(message_text_ptr + (bulk_mute ? 6 : 8), ' ')) {
+                                // Several nicks at once; the journal writes them as one batch
+                                int done = 0, total = 0;
+                                char *nick_saveptr;
+                                for (char *nick = strtok_r(message_text_ptr + (bulk_mute ? 6 : 8), " ", &nick_saveptr); nick;
+                                     nick = strtok_r(NULL, " ", &nick_saveptr)) {
+                                    total++;
+                                    if (strlen(nick) >= MAX_NICK_LEN) continue;
+                                    if ((bulk_mute ? add_muted_user(nick) : remove_muted_user(nick)) == 0) done++;
+                                }
+                                app_log(parent_tag, "CMD_ACT", "%s %d of %d nick(s) at the request of %s.", bulk_mute ? "Muted" : "Unmuted", done, total, sender_nick_dup);
+                                send_irc(socket_fd, "PRIVMSG %s :%s %d of %d nick(s).", ADMIN_CHANNEL_NAME_CONST, bulk_mute ? "Muted" : "Unmuted", done, total);
+                            } else if (strncmp(message_text_ptr, "!mute ", 6) == 0) {
                                 char *nick_to_mute = message_text_ptr + 6;
                                 app_log(parent_tag, "CMD_ACT", "Attempting to mute '%s' by %s.", nick_to_mute, sender_nick_dup);
                                 if (strlen(nick_to_mute) > 0 && strlen(nick_to_mute) < MAX_NICK_LEN) {
@@ -230,6 +390,119 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
                                     send_irc(socket_fd, "PRIVMSG %s :Pinger is INACTIVE/TERMINATED.", ADMIN_CHANNEL_NAME_CONST);
                                 }
                                 send_irc(socket_fd, "PRIVMSG %s :--- End Status ---", ADMIN_CHANNEL_NAME_CONST);
+                            } else if (strncmp(message_text_ptr, "!history ", 9) == 0) {
+                                char history_args[MAX_PIPE_MSG_LEN];
+                                snprintf(history_args, sizeof(history_args), "%s", message_text_ptr + 9);
+                                char *args_saveptr;
+                                char *history_channel = strtok_r(history_args, " ", &args_saveptr);
+                                char *from_text = strtok_r(NULL, " ", &args_saveptr);
+                                char *to_text = strtok_r(NULL, " ", &args_saveptr);
+                                time_t from_time, to_time;
+                                app_log(parent_tag, "CMD", "User '%s' requested !history in admin channel.", sender_nick_dup);
+                                if (!history_channel || parse_history_time(from_text, &from_time) != 0 || parse_history_time(to_text, &to_time) != 0) {
+                                    send_irc(socket_fd, "PRIVMSG %s :Usage: !history <channel> <from> <to> (epoch or YYYY-MM-DDTHH:MM[:SS])", ADMIN_CHANNEL_NAME_CONST);
+                                } else {
+                                    int lines = transcript_query(history_channel, from_time, to_time, HISTORY_MAX_REPLY_LINES, send_history_line, NULL);
+                                    if (lines < 0) {
+                                        send_irc(socket_fd, "PRIVMSG %s :No transcript for %s.", ADMIN_CHANNEL_NAME_CONST, history_channel);
+                                    } else if (lines == 0) {
+                                        send_irc(socket_fd, "PRIVMSG %s :No messages in %s for that range.", ADMIN_CHANNEL_NAME_CONST, history_channel);
+                                    } else if (lines > HISTORY_MAX_REPLY_LINES) {
+                                        send_irc(socket_fd, "PRIVMSG %s :--- Output truncated at %d lines, narrow the range ---", ADMIN_CHANNEL_NAME_CONST, HISTORY_MAX_REPLY_LINES);
+                                    }
+                                }
+                            } else if (strcmp(message_text_ptr, "!aistats") == 0) {
+                                app_log(parent_tag, "CMD", "User '%s' requested !aistats in admin channel.", sender_nick_dup);
+                                send_irc(socket_fd, "PRIVMSG %s :--- AI Stats ---", ADMIN_CHANNEL_NAME_CONST);
+                                unsigned long total_coalesced = 0, total_wasted = 0;
+                                for (int i = 0; g_ai_stats && i < numWorkerChildren; i++) {
+                                    const AiWorkerStats *st = &g_ai_stats[i];
+                                    send_worker_ai_stats(socket_fd, g_channel_infos[i+1].name, st);
+                                    total_coalesced += st->coalesced;
+                                    total_wasted += st->wasted_calls;
+                                    usleep(100000);
+                                }
+                                send_irc(socket_fd, "PRIVMSG %s :API requests saved by coalescing: %lu, wasted on answers never posted: %lu", ADMIN_CHANNEL_NAME_CONST, total_coalesced, total_wasted);
+                                AiQuotaStatus quota;
+                                if (ai_quota_status(&quota)) {
+                                    send_irc(socket_fd, "PRIVMSG %s :Shared quota: %.0f/%d requests and %.0f/%d tokens available | %lu granted, %lu held back, %lu refused",
+                                             ADMIN_CHANNEL_NAME_CONST, quota.requests_left, AI_QUOTA_REQUESTS_PER_MINUTE, quota.tokens_left,
+                                             AI_QUOTA_TOKENS_PER_MINUTE, quota.granted, quota.deferred, quota.rejected);
+                                }
+                                AiUsageReport usage;
+                                if (ai_usage_total_report(&usage)) {
+                                    send_irc(socket_fd, "PRIVMSG %s :Tokens this hour: %lu (%lu prompt, %lu output), last %d h: %lu. See !usage for a breakdown.",
+                                             ADMIN_CHANNEL_NAME_CONST, usage.hour.total_tokens, usage.hour.prompt_tokens, usage.hour.output_tokens,
+                                             AI_USAGE_HOURS, usage.day.total_tokens);
+                                }
+                                send_irc(socket_fd, "PRIVMSG %s :--- End AI Stats ---", ADMIN_CHANNEL_NAME_CONST);
+                            } else if (strcmp(message_text_ptr, "!usage") == 0) {
+                                app_log(parent_tag, "CMD", "User '%s' requested !usage in admin channel.", sender_nick_dup);
+                                send_irc(socket_fd, "PRIVMSG %s :--- Token Usage ---", ADMIN_CHANNEL_NAME_CONST);
+                                AiUsageReport usage;
+                                if (!ai_usage_total_report(&usage)) {
+                                    send_irc(socket_fd, "PRIVMSG %s :Token accounting is unavailable.", ADMIN_CHANNEL_NAME_CONST);
+                                } else {
+                                    send_irc(socket_fd, "PRIVMSG %s :All channels: this hour %lu requests, %lu tokens (%lu prompt, %lu output) | last %d h %lu requests, %lu tokens | since start %lu requests, %lu tokens",
+                                             ADMIN_CHANNEL_NAME_CONST, usage.hour.requests, usage.hour.total_tokens, usage.hour.prompt_tokens,
+                                             usage.hour.output_tokens, AI_USAGE_HOURS, usage.day.requests, usage.day.total_tokens,
+                                             usage.lifetime.requests, usage.lifetime.total_tokens);
+                                    for (int i = 0; i < numWorkerChildren && g_channel_infos && g_channel_infos[i+1].name != NULL; i++) {
+                                        if (!ai_usage_channel_report(i, &usage)) continue;
+                                        char budget_text[96] = "no budget";
+                                        if (usage.budget_per_hour > 0) {
+                                            unsigned long percent = usage.hour.total_tokens * 100 / (unsigned long)usage.budget_per_hour;
+                                            snprintf(budget_text, sizeof(budget_text), "%lu%% of %ld/h budget%s", percent, usage.budget_per_hour,
+                                                     percent >= 100 ? ", spent" : percent >= AI_USAGE_THROTTLE_PERCENT ? ", throttled" : "");
+                                        }
+                                        send_irc(socket_fd, "PRIVMSG %s :%s: this hour %lu requests, %lu tokens (%s) | last %d h %lu requests, %lu tokens",
+                                                 ADMIN_CHANNEL_NAME_CONST, g_channel_infos[i+1].name, usage.hour.requests, usage.hour.total_tokens,
+                                                 budget_text, AI_USAGE_HOURS, usage.day.requests, usage.day.total_tokens);
+                                        usleep(100000);
+                                    }
+                                    AiUsageNick top[AI_USAGE_TOP_NICKS];
+                                    int num_top = ai_usage_top_nicks(top, AI_USAGE_TOP_NICKS);
+                                    char top_text[AI_USAGE_TOP_NICKS * (MAX_NICK_LEN + 32) + 1] = "";
+                                    size_t top_len = 0;
+                                    for (int i = 0; i < num_top && top_len < sizeof(top_text); i++) {
+                                        top_len += (size_t)snprintf(top_text + top_len, sizeof(top_text) - top_len, "%s%s %lu (%lu requests)",
+                                                                    i ? ", " : "", top[i].nick, top[i].day.total_tokens, top[i].day.requests);
+                                    }
+                                    send_irc(socket_fd, "PRIVMSG %s :Top users, last %d h: %s", ADMIN_CHANNEL_NAME_CONST, AI_USAGE_HOURS, num_top ? top_text : "none");
+                                }
+                                send_irc(socket_fd, "PRIVMSG %s :--- End Token Usage ---", ADMIN_CHANNEL_NAME_CONST);
+                            } else if (strcmp(message_text_ptr, "!models") == 0) {
+                                app_log(parent_tag, "CMD", "User '%s' requested !models in admin channel.", sender_nick_dup);
+                                send_irc(socket_fd, "PRIVMSG %s :--- Model Routing ---", ADMIN_CHANNEL_NAME_CONST);
+                                static const long bounds[] = AI_ROUTE_HISTOGRAM_BOUNDS;
+                                for (int i = 0; g_ai_stats && i < numWorkerChildren; i++) {
+                                    const AiWorkerStats *st = &g_ai_stats[i];
+                                    for (int m = 0; m < st->num_models && m < AI_ROUTE_MAX_MODELS; m++) {
+                                        const AiModelStats *model = &st->models[m];
+                                        char latency_text[64] = "p95 n/a";
+                                        if (model->p95_ms >= 0) snprintf(latency_text, sizeof(latency_text), "p95 %ld ms", model->p95_ms);
+                                        char slo_text[48] = "no SLO";
+                                        if (model->slo_ms > 0) {
+                                            snprintf(slo_text, sizeof(slo_text), "SLO %ld ms%s", model->slo_ms, model->over_slo ? ", OVER" : "");
+                                        }
+                                        char histogram_text[AI_ROUTE_HISTOGRAM_BUCKETS * 32] = "";
+                                        size_t histogram_len = 0;
+                                        for (int b = 0; b < AI_ROUTE_HISTOGRAM_BUCKETS && histogram_len < sizeof(histogram_text); b++) {
+                                            if (b < AI_ROUTE_HISTOGRAM_BUCKETS - 1) {
+                                                histogram_len += (size_t)snprintf(histogram_text + histogram_len, sizeof(histogram_text) - histogram_len,
+                                                                                  "%s<=%ld:%lu", b ? " " : "", bounds[b], model->histogram[b]);
+                                            } else {
+                                                histogram_len += (size_t)snprintf(histogram_text + histogram_len, sizeof(histogram_text) - histogram_len,
+                                                                                  " >%ld:%lu", bounds[b - 1], model->histogram[b]);
+                                            }
+                                        }
+                                        send_irc(socket_fd, "PRIVMSG %s :%s %s: %lu routed, %lu as fallback, %lu probes | %s (%s) | ms %s",
+                                                 ADMIN_CHANNEL_NAME_CONST, g_channel_infos[i+1].name, model->name, model->routed, model->fallbacks,
+                                                 model->probes, latency_text, slo_text, histogram_text);
+                                        usleep(100000);
+                                    }
+                                }
+                                send_irc(socket_fd, "PRIVMSG %s :--- End Model Routing ---", ADMIN_CHANNEL_NAME_CONST);
                             } else if (strcmp(message_text_ptr, "!users") == 0) {
 
                                 app_log(parent_tag, "CMD", "User '%s' requested !users in admin channel.", sender_nick_dup);
@@ -261,9 +534,10 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
                                     if (strlen(user_prompt) > 0) {
                                         app_log(parent_tag, "CMD_AI", "AI Ask from [%s] in <%s>: %s. Forwarding to worker %d.", sender_nick_dup, target, user_prompt, worker_idx);
                                         char pipe_msg[MAX_PIPE_MSG_LEN];
-                                        // Pipe Format: "ASK\tSENDER_NICK\tPERSONA\tPROMPT\n"
-                                        snprintf(pipe_msg, sizeof(pipe_msg), "ASK%c%s%c%s%c%s\n",
+                                        // Pipe Format: "ASK\tSENDER_NICK\tPRIORITY\tPERSONA\tPROMPT\n"
+                                        snprintf(pipe_msg, sizeof(pipe_msg), "ASK%c%s%c%d%c%s%c%s\n",
                                                  PIPE_MSG_DELIMITER_CHAR, sender_nick_dup,
+                                                 PIPE_MSG_DELIMITER_CHAR, find_admin_member(sender_nick_dup) != -1,
                                                  PIPE_MSG_DELIMITER_CHAR, channel_persona,
                                                  PIPE_MSG_DELIMITER_CHAR, user_prompt);
                                         
@@ -282,6 +556,14 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
                                     }
                                 } else if (strcmp(message_text_ptr, "!status") == 0) { 
                                      send_irc(socket_fd, "PRIVMSG %s :Hi %s! I'm worker for this channel. For detailed bot status, ask in %s", target, sender_nick_dup, ADMIN_CHANNEL_NAME_CONST ? ADMIN_CHANNEL_NAME_CONST : "the admin channel");
+                                } else if (message_text_ptr[0] != '!') {
+                                    // Ordinary chatter trains the worker's offline model and is indexed for recall
+                                    char pipe_msg[MAX_PIPE_MSG_LEN];
+                                    // Pipe Format: "MSG\tSENDER_NICK\tTEXT\n"
+                                    snprintf(pipe_msg, sizeof(pipe_msg), "MSG%c%s%c%s\n", PIPE_MSG_DELIMITER_CHAR, sender_nick_dup, PIPE_MSG_DELIMITER_CHAR, message_text_ptr);
+                                    if (write(worker_write_pipe_fds[worker_idx], pipe_msg, strlen(pipe_msg)) == -1 && errno != EAGAIN) {
+                                        app_log(parent_tag, "ERROR", "Write to worker pipe for %s failed: %s", target, strerror(errno));
+                                    }
                                 }
                             }
                         }
@@ -293,6 +575,9 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
             }
         }
 
+        log_sampler_flush(parent_tag, false);
+        mute_journal_flush(false);
+
         pid_t terminated_pid;
         while ((terminated_pid = waitpid(-1, child_status, WNOHANG)) > 0) {
             char exit_reason[100];
@@ -305,6 +590,8 @@ void mainLoop(char recv_buffer[], size_t recv_buffer_size, int *child_status) {
             if (terminated_pid == pinger_child_pid) { 
                 app_log(parent_tag, "CRITICAL", "PINGER (PID %d) terminated! Requesting shutdown.", pinger_child_pid);
                 pinger_child_pid = -1; shutdown_requested = 1; 
+            } else if (mute_journal_reap(terminated_pid, *child_status)) {
+                // Mute journal compaction finished; logged there
             } else {
                 if (worker_child_pids != NULL) {
                     for (int i = 0; i < numWorkerChildren; i++) { // Iterate numWorkerChildren
@@ -325,6 +612,7 @@ void softShutdown(int *child_status) {
     char parent_tag[32];
     snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
     app_log(parent_tag, "INFO", "Initializing graceful shutdown...");
+    log_sampler_flush(parent_tag, true);
     
     if (socket_fd != -1) {
         send_irc(socket_fd, "QUIT :%s", QUIT_MESSAGE); 
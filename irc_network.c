@@ -76,7 +76,9 @@ void send_irc(int sock_param, const char *fmt, ...) {
     } else if (len >=1 && log_buffer[len-1] == '\n') { // Check for just \n
         log_buffer[len-1] = '\0';
     }
-    app_log(proc_tag, "SENT", "%s", log_buffer);
+    char line_channel[MAX_CHANNEL_NAME_LEN];
+    irc_line_channel(log_buffer, line_channel, sizeof(line_channel));
+    app_log_sampled(proc_tag, "SENT", line_channel, "%s", log_buffer);
 
 
     if (socket_lock != NULL) {
@@ -0,0 +1,339 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include "json_scan.h"
+#include <stdint.h>
+
+#define JSON_SCAN_MAX_NESTING 512 // Deeper documents are rejected rather than skipped
+
+typedef struct {
+    const char *key; // NULL for an array index
+    size_t key_len;
+    long index;
+} PathSegment;
+
+typedef struct {
+    PathSegment segments[JSON_SCAN_MAX_DEPTH];
+    int num_segments;
+} CompiledPath;
+
+typedef struct {
+    const char *p;
+    const char *end;
+    JsonScanTarget *targets;
+    CompiledPath paths[JSON_SCAN_MAX_TARGETS];
+    int num_targets;
+} Scanner;
+
+static bool compile_path(const char *path, CompiledPath *out) {
+    out->num_segments = 0;
+    const char *p = path;
+    while (*p) {
+        if (out->num_segments == JSON_SCAN_MAX_DEPTH) return false;
+        PathSegment *seg = &out->segments[out->num_segments++];
+        if (*p == '[') {
+            char *close = NULL;
+            seg->key = NULL;
+            seg->index = strtol(p + 1, &close, 10);
+            if (close == p + 1 || *close != ']' || seg->index < 0) return false;
+            p = close + 1;
+        } else {
+            size_t len = strcspn(p, ".[");
+            if (len == 0) return false;
+            seg->key = p;
+            seg->key_len = len;
+            p += len;
+        }
+        if (*p == '.') p++;
+    }
+    return out->num_segments > 0;
+}
+
+static void skip_ws(Scanner *sc) {
+    while (sc->p < sc->end && (*sc->p == ' ' || *sc->p == '\t' || *sc->p == '\n' || *sc->p == '\r')) sc->p++;
+}
+
+// Moves past a string starting at the opening quote. Sets the raw contents and
+// whether they contain escapes. Returns false on an unterminated string.
+static bool skip_string(Scanner *sc, const char **raw, size_t *raw_len, bool *has_escapes) {
+    const char *start = ++sc->p;
+    bool escapes = false;
+    while (sc->p < sc->end && *sc->p != '"') {
+        if (*sc->p == '\\') {
+            escapes = true;
+            sc->p++;
+            if (sc->p >= sc->end) return false;
+        }
+        sc->p++;
+    }
+    if (sc->p >= sc->end) return false;
+    if (raw) *raw = start;
+    if (raw_len) *raw_len = (size_t)(sc->p - start);
+    if (has_escapes) *has_escapes = escapes;
+    sc->p++;
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool read_hex4(const char *p, const char *end, uint32_t *out) {
+    if (end - p < 4) return false;
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        int h = hex_value(p[i]);
+        if (h < 0) return false;
+        v = (v << 4) | (uint32_t)h;
+    }
+    *out = v;
+    return true;
+}
+
+static size_t encode_utf8(uint32_t cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Unescapes raw string contents into a malloc'd buffer. Escapes never expand,
+// so raw_len + 1 bytes are always enough.
+static char *unescape_string(const char *raw, size_t raw_len) {
+    char *out = (char *)malloc(raw_len + 1);
+    if (out == NULL) return NULL;
+    const char *p = raw;
+    const char *end = raw + raw_len;
+    size_t j = 0;
+    while (p < end) {
+        if (*p != '\\') {
+            out[j++] = *p++;
+            continue;
+        }
+        p++;
+        char c = *p++;
+        switch (c) {
+        case '"': out[j++] = '"'; break;
+        case '\\': out[j++] = '\\'; break;
+        case '/': out[j++] = '/'; break;
+        case 'b': out[j++] = '\b'; break;
+        case 'f': out[j++] = '\f'; break;
+        case 'n': out[j++] = '\n'; break;
+        case 'r': out[j++] = '\r'; break;
+        case 't': out[j++] = '\t'; break;
+        case 'u': {
+            uint32_t cp;
+            if (!read_hex4(p, end, &cp)) goto fail;
+            p += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF) { // High surrogate: needs its low half
+                uint32_t low;
+                if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !read_hex4(p + 2, end, &low) || low < 0xDC00 || low > 0xDFFF) goto fail;
+                p += 6;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                goto fail;
+            }
+            j += encode_utf8(cp, out + j);
+            break;
+        }
+        default:
+            goto fail;
+        }
+    }
+    out[j] = '\0';
+    return out;
+
+fail:
+    free(out);
+    return NULL;
+}
+
+// Skips any value without looking inside it beyond bracket matching.
+static bool skip_value(Scanner *sc) {
+    int nesting = 0;
+    do {
+        skip_ws(sc);
+        if (sc->p >= sc->end) return false;
+        char c = *sc->p;
+        if (c == '"') {
+            if (!skip_string(sc, NULL, NULL, NULL)) return false;
+        } else if (c == '{' || c == '[') {
+            if (++nesting > JSON_SCAN_MAX_NESTING) return false;
+            sc->p++;
+        } else if (c == '}' || c == ']') {
+            if (--nesting < 0) return false;
+            sc->p++;
+        } else if (c == ',' || c == ':') {
+            if (nesting == 0) return false;
+            sc->p++;
+        } else {
+            const char *start = sc->p;
+            while (sc->p < sc->end && (isalnum((unsigned char)*sc->p) || *sc->p == '-' || *sc->p == '+' || *sc->p == '.')) sc->p++;
+            if (sc->p == start) return false;
+        }
+    } while (nesting > 0);
+    return true;
+}
+
+static bool segment_matches_key(const PathSegment *seg, const char *key, size_t key_len) {
+    return seg->key && seg->key_len == key_len && memcmp(seg->key, key, key_len) == 0;
+}
+
+// Scans the value at sc->p. mask holds the targets whose first depth segments
+// match the path to this value; the value itself is captured for targets that
+// end here, and only children some target still needs are descended into.
+static bool scan_value(Scanner *sc, int depth, uint32_t mask) {
+    if (mask == 0) return skip_value(sc);
+    skip_ws(sc);
+    if (sc->p >= sc->end) return false;
+    char c = *sc->p;
+
+    uint32_t capture = 0;
+    for (int t = 0; t < sc->num_targets; ++t) {
+        if ((mask & (1u << t)) && sc->paths[t].num_segments == depth) capture |= 1u << t;
+    }
+
+    if (c == '"') {
+        const char *raw;
+        size_t raw_len;
+        bool escapes;
+        if (!skip_string(sc, &raw, &raw_len, &escapes)) return false;
+        for (int t = 0; t < sc->num_targets; ++t) {
+            if (!(capture & (1u << t)) || sc->targets[t].value) continue;
+            sc->targets[t].value = escapes ? unescape_string(raw, raw_len) : strndup(raw, raw_len);
+            if (sc->targets[t].value == NULL) return false;
+        }
+        return true;
+    }
+
+    if (c == '{') {
+        sc->p++;
+        skip_ws(sc);
+        if (sc->p < sc->end && *sc->p == '}') {
+            sc->p++;
+            return true;
+        }
+        for (;;) {
+            skip_ws(sc);
+            if (sc->p >= sc->end || *sc->p != '"') return false;
+            const char *key;
+            size_t key_len;
+            if (!skip_string(sc, &key, &key_len, NULL)) return false;
+            skip_ws(sc);
+            if (sc->p >= sc->end || *sc->p != ':') return false;
+            sc->p++;
+
+            uint32_t child_mask = 0;
+            if (depth < JSON_SCAN_MAX_DEPTH) {
+                for (int t = 0; t < sc->num_targets; ++t) {
+                    if ((mask & (1u << t)) && sc->paths[t].num_segments > depth &&
+                        segment_matches_key(&sc->paths[t].segments[depth], key, key_len)) child_mask |= 1u << t;
+                }
+            }
+            if (!scan_value(sc, depth + 1, child_mask)) return false;
+            skip_ws(sc);
+            if (sc->p >= sc->end) return false;
+            if (*sc->p == ',') {
+                sc->p++;
+                continue;
+            }
+            if (*sc->p != '}') return false;
+            sc->p++;
+            return true;
+        }
+    }
+
+    if (c == '[') {
+        sc->p++;
+        skip_ws(sc);
+        if (sc->p < sc->end && *sc->p == ']') {
+            sc->p++;
+            return true;
+        }
+        for (long index = 0;; ++index) {
+            uint32_t child_mask = 0;
+            if (depth < JSON_SCAN_MAX_DEPTH) {
+                for (int t = 0; t < sc->num_targets; ++t) {
+                    const PathSegment *seg = &sc->paths[t].segments[depth];
+                    if ((mask & (1u << t)) && sc->paths[t].num_segments > depth && seg->key == NULL && seg->index == index) {
+                        child_mask |= 1u << t;
+                    }
+                }
+            }
+            if (!scan_value(sc, depth + 1, child_mask)) return false;
+            skip_ws(sc);
+            if (sc->p >= sc->end) return false;
+            if (*sc->p == ',') {
+                sc->p++;
+                continue;
+            }
+            if (*sc->p != ']') return false;
+            sc->p++;
+            return true;
+        }
+    }
+
+    // Number or literal: captured as its raw text
+    const char *start = sc->p;
+    if (!skip_value(sc)) return false;
+    for (int t = 0; t < sc->num_targets; ++t) {
+        if (!(capture & (1u << t)) || sc->targets[t].value) continue;
+        sc->targets[t].value = strndup(start, (size_t)(sc->p - start));
+        if (sc->targets[t].value == NULL) return false;
+    }
+    return true;
+}
+
+int json_scan(const char *json, size_t len, JsonScanTarget *targets, int num_targets) {
+    if (num_targets <= 0 || num_targets > JSON_SCAN_MAX_TARGETS) return -1;
+    Scanner sc;
+    sc.p = json;
+    sc.end = json + len;
+    sc.targets = targets;
+    sc.num_targets = num_targets;
+    uint32_t mask = 0;
+    for (int t = 0; t < num_targets; ++t) {
+        targets[t].value = NULL;
+        if (!compile_path(targets[t].path, &sc.paths[t])) return -1;
+        mask |= 1u << t;
+    }
+
+    bool ok = scan_value(&sc, 0, mask);
+    if (ok) {
+        skip_ws(&sc);
+        ok = (sc.p == sc.end);
+    }
+    if (!ok) {
+        json_scan_free(targets, num_targets);
+        return -1;
+    }
+    return 0;
+}
+
+void json_scan_free(JsonScanTarget *targets, int num_targets) {
+    for (int t = 0; t < num_targets; ++t) {
+        free(targets[t].value);
+        targets[t].value = NULL;
+    }
+}
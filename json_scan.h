@@ -0,0 +1,25 @@
+#ifndef JSON_SCAN_H
+#define JSON_SCAN_H
+
+#include <stddef.h>
+
+// --- Path-directed JSON extraction ---
+// Walks a JSON document once and pulls out the values at a few known paths.
+// Every other subtree is skipped without allocating, and only the values that
+// are asked for get unescaped. Paths use dots for object keys and [n] for
+// array elements, e.g. "candidates[0].content.parts[0].text".
+
+#define JSON_SCAN_MAX_TARGETS 16
+#define JSON_SCAN_MAX_DEPTH 12 // Segments per path
+
+typedef struct {
+    const char *path;
+    char *value; // malloc'd on a match: the unescaped string, or the raw text of a number or literal
+} JsonScanTarget;
+
+// Returns 0, or -1 if the document is malformed or a path is invalid. On -1
+// every value is NULL, and the caller should fall back to a full parser.
+int json_scan(const char *json, size_t len, JsonScanTarget *targets, int num_targets);
+void json_scan_free(JsonScanTarget *targets, int num_targets);
+
+#endif // JSON_SCAN_H
@@ -1,5 +1,8 @@
 #include "irc_bot.h"
 #include "gemini_integration.h"
+#include "ai_flight.h"
+#include "ai_quota.h"
+#include "ai_usage.h"
 
 // Global Variables
 volatile sig_atomic_t shutdown_requested = 0;
@@ -11,11 +14,11 @@ pid_t *worker_child_pids = NULL;
 int numChildren = 0;
 int numWorkerChildren = 0;
 sem_t *socket_lock = NULL;
+AiWorkerStats *g_ai_stats = NULL;
 ChannelInfo *g_channel_infos = NULL;
 
 const char *ADMIN_CHANNEL_NAME_CONST = NULL;
-char **g_muted_nicks = NULL;
-int g_num_muted_users = 0;
+MuteSet g_muted_users = { NULL, 0, 0 };
 const char *g_gemini_api_key = NULL; 
 
 int main(int argc, char *argv[]) {
@@ -62,6 +65,10 @@ int main(int argc, char *argv[]) {
         app_log(parent_tag, "WARN", "Error loading muted users from %s. Starting with no users muted.", MUTED_USERS_FILE_PATH);
     }
 
+    if (transcript_init() != EXIT_SUCCESS) {
+        app_log(parent_tag, "WARN", "Transcript store unavailable. Channel history will not be recorded.");
+    }
+
     if (initSIGNALS() != EXIT_SUCCESS) {
         app_log(parent_tag, "FATAL", "Signal initialization failed. Exiting.");
         goto cleanup_before_init_socket;
@@ -70,6 +77,18 @@ int main(int argc, char *argv[]) {
         app_log(parent_tag, "FATAL", "Semaphore initialization failed. Exiting.");
         goto cleanup_before_init_socket;
     }
+    if (initAiStats() != EXIT_SUCCESS) {
+        app_log(parent_tag, "WARN", "AI statistics unavailable. !aistats will report nothing.");
+    }
+    if (AI_FLIGHT_ENABLED && ai_flight_init() != EXIT_SUCCESS) {
+        app_log(parent_tag, "WARN", "In-flight request table unavailable. Identical questions will not be coalesced.");
+    }
+    if (AI_QUOTA_ENABLED && ai_quota_init(numWorkerChildren) != EXIT_SUCCESS) {
+        app_log(parent_tag, "WARN", "API quota table unavailable. Workers will send without a shared budget.");
+    }
+    if (ai_usage_init(numWorkerChildren) != EXIT_SUCCESS) {
+        app_log(parent_tag, "WARN", "Token usage table unavailable. !usage will report nothing and budgets are not enforced.");
+    }
     int server_port_num = atoi(server_port);
     if (initSocket(server_ip, server_port_num) != EXIT_SUCCESS) {
         app_log(parent_tag, "FATAL", "Socket connection failed. Exiting.");
@@ -99,9 +118,14 @@ int main(int argc, char *argv[]) {
 
 cleanup_after_socket_init:
 cleanup_before_init_socket: 
+    transcript_close_all();
     free_channels_memory();
     free_muted_users_memory();
     cleanup_semaphore();
+    cleanup_ai_stats();
+    ai_flight_cleanup();
+    ai_quota_cleanup();
+    ai_usage_cleanup();
 cleanup_curl_global:
     curl_global_cleanup();
 
@@ -0,0 +1,259 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include "irc_bot.h"
+#include <sys/stat.h>
+#include <stdint.h>
+
+// --- Per-channel transcript store ---
+// Each managed channel gets an append-only "<channel>.log" with one line per
+// PRIVMSG ("<epoch>\t<nick>\t<text>\n") and a sparse "<channel>.idx" of fixed
+// size records mapping a timestamp to the byte offset of the line carrying it.
+// A new index record is written every TRANSCRIPT_INDEX_STRIDE_BYTES of log, so
+// a range query binary searches the index and then scans at most one stride
+// worth of lines before reaching the requested start time.
+
+typedef struct {
+    int64_t ts;
+    int64_t offset;
+} TranscriptIndexRecord;
+
+typedef struct {
+    int log_fd;
+    int idx_fd;
+    int64_t size;          // Current log size, i.e. offset of the next line
+    int64_t last_indexed;  // Offset of the most recent index record (-1 if none)
+    int64_t last_ts;       // Timestamp of the last appended line
+} TranscriptStore;
+
+static TranscriptStore *g_transcripts = NULL;
+static int g_num_transcripts = 0;
+
+static void transcript_path(char *out, size_t out_size, const char *channel, const char *ext) {
+    char safe_name[MAX_CHANNEL_NAME_LEN];
+    size_t j = 0;
+    for (size_t i = 0; channel[i] != '\0' && j < sizeof(safe_name) - 1; ++i) {
+        unsigned char c = (unsigned char)channel[i];
+        safe_name[j++] = (isalnum(c) || c == '-' || c == '_' || c == '#') ? (char)c : '_';
+    }
+    safe_name[j] = '\0';
+    snprintf(out, out_size, "%s/%s.%s", TRANSCRIPT_DIR, safe_name, ext);
+}
+
+static int find_transcript_index(const char *channel) {
+    if (channel == NULL || g_channel_infos == NULL) return -1;
+    for (int i = 0; i < g_num_transcripts; ++i) {
+        if (g_channel_infos[i].name && strcmp(g_channel_infos[i].name, channel) == 0) return i;
+    }
+    return -1;
+}
+
+static int open_transcript(TranscriptStore *store, const char *channel, const char *proc_tag) {
+    char log_path[256];
+    char idx_path[256];
+    transcript_path(log_path, sizeof(log_path), channel, "log");
+    transcript_path(idx_path, sizeof(idx_path), channel, "idx");
+
+    store->log_fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (store->log_fd == -1) {
+        app_log(proc_tag, "ERROR", "Failed to open transcript '%s': %s", log_path, strerror(errno));
+        return -1;
+    }
+    store->idx_fd = open(idx_path, O_RDWR | O_APPEND | O_CREAT, 0644);
+    if (store->idx_fd == -1) {
+        app_log(proc_tag, "ERROR", "Failed to open transcript index '%s': %s", idx_path, strerror(errno));
+        close(store->log_fd);
+        store->log_fd = -1;
+        return -1;
+    }
+
+    struct stat st;
+    store->size = (fstat(store->log_fd, &st) == 0) ? (int64_t)st.st_size : 0;
+    store->last_indexed = -1;
+    store->last_ts = 0;
+
+    // Resume from the last index record so the stride stays consistent across restarts.
+    if (fstat(store->idx_fd, &st) == 0 && st.st_size >= (off_t)sizeof(TranscriptIndexRecord)) {
+        off_t records = st.st_size / (off_t)sizeof(TranscriptIndexRecord);
+        TranscriptIndexRecord rec;
+        if (pread(store->idx_fd, &rec, sizeof(rec), (records - 1) * (off_t)sizeof(rec)) == (ssize_t)sizeof(rec)) {
+            store->last_indexed = rec.offset;
+            store->last_ts = rec.ts;
+        }
+    }
+    return 0;
+}
+
+int transcript_init(void) {
+    char parent_tag[32];
+    snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
+
+    if (mkdir(TRANSCRIPT_DIR, 0755) == -1 && errno != EEXIST) {
+        app_log(parent_tag, "ERROR", "Failed to create transcript directory '%s': %s", TRANSCRIPT_DIR, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (g_channel_infos == NULL || numChildren <= 0) return EXIT_SUCCESS;
+
+    g_transcripts = (TranscriptStore *)calloc(numChildren, sizeof(TranscriptStore));
+    if (g_transcripts == NULL) {
+        app_log(parent_tag, "ERROR", "Failed to allocate transcript stores: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    g_num_transcripts = numChildren;
+    for (int i = 0; i < g_num_transcripts; ++i) {
+        g_transcripts[i].log_fd = -1;
+        g_transcripts[i].idx_fd = -1;
+        if (g_channel_infos[i].name) open_transcript(&g_transcripts[i], g_channel_infos[i].name, parent_tag);
+    }
+    app_log(parent_tag, "INFO", "Transcript store initialized for %d channel(s) in '%s'.", g_num_transcripts, TRANSCRIPT_DIR);
+    return EXIT_SUCCESS;
+}
+
+void transcript_close_all(void) {
+    if (g_transcripts == NULL) return;
+    for (int i = 0; i < g_num_transcripts; ++i) {
+        if (g_transcripts[i].log_fd != -1) close(g_transcripts[i].log_fd);
+        if (g_transcripts[i].idx_fd != -1) close(g_transcripts[i].idx_fd);
+    }
+    free(g_transcripts);
+    g_transcripts = NULL;
+    g_num_transcripts = 0;
+}
+
+void transcript_append(const char *channel, const char *nick, const char *text) {
+    int idx = find_transcript_index(channel);
+    if (idx == -1 || nick == NULL || text == NULL) return;
+    TranscriptStore *store = &g_transcripts[idx];
+    if (store->log_fd == -1) return;
+
+    // Clamp to the previous timestamp so the log stays sorted even if the clock steps back.
+    int64_t ts = (int64_t)time(NULL);
+    if (ts < store->last_ts) ts = store->last_ts;
+
+    char line[MAX_NICK_LEN + MAX_PIPE_MSG_LEN + 64];
+    int len = snprintf(line, sizeof(line), "%lld\t%s\t%s\n", (long long)ts, nick, text);
+    if (len < 0) return;
+    if ((size_t)len >= sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+
+    if (store->last_indexed == -1 || store->size - store->last_indexed >= TRANSCRIPT_INDEX_STRIDE_BYTES) {
+        TranscriptIndexRecord rec = { ts, store->size };
+        if (write(store->idx_fd, &rec, sizeof(rec)) == (ssize_t)sizeof(rec)) {
+            store->last_indexed = store->size;
+        }
+    }
+
+    ssize_t written = write(store->log_fd, line, (size_t)len);
+    if (written != len) {
+        char parent_tag[32];
+        snprintf(parent_tag, sizeof(parent_tag), "Parent %d", getpid());
+        app_log(parent_tag, "ERROR", "Short write to transcript for %s: %s", channel, written < 0 ? strerror(errno) : "partial write");
+        if (written < 0) return;
+    }
+    store->size += written;
+    store->last_ts = ts;
+}
+
+// Binary search for the last index record with ts < from; its offset is a safe scan start.
+static int64_t transcript_seek_offset(int idx_fd, time_t from) {
+    struct stat st;
+    if (fstat(idx_fd, &st) == -1 || st.st_size < (off_t)sizeof(TranscriptIndexRecord)) return 0;
+    size_t count = (size_t)st.st_size / sizeof(TranscriptIndexRecord);
+
+    TranscriptIndexRecord *records = (TranscriptIndexRecord *)mmap(NULL, count * sizeof(TranscriptIndexRecord), PROT_READ, MAP_SHARED, idx_fd, 0);
+    if (records == MAP_FAILED) return 0;
+
+    size_t lo = 0, hi = count; // First record with ts >= from lies in [lo, hi)
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (records[mid].ts < (int64_t)from) lo = mid + 1;
+        else hi = mid;
+    }
+    int64_t offset = (lo == 0) ? 0 : records[lo - 1].offset;
+    munmap(records, count * sizeof(TranscriptIndexRecord));
+    return offset;
+}
+
+int transcript_query(const char *channel, time_t from, time_t to, int max_lines,
+                     void (*emit)(const char *line, void *ctx), void *ctx) {
+    int idx = find_transcript_index(channel);
+    if (idx == -1 || g_transcripts[idx].idx_fd == -1) return -1;
+
+    char log_path[256];
+    transcript_path(log_path, sizeof(log_path), channel, "log");
+    int read_fd = open(log_path, O_RDONLY);
+    if (read_fd == -1) return -1;
+
+    int64_t offset = transcript_seek_offset(g_transcripts[idx].idx_fd, from);
+    char buffer[16384];
+    size_t buffered = 0;
+    int emitted = 0;
+    bool done = false;
+
+    while (!done) {
+        ssize_t n = pread(read_fd, buffer + buffered, sizeof(buffer) - 1 - buffered, (off_t)offset);
+        if (n <= 0) break;
+        offset += n;
+        buffered += (size_t)n;
+        buffer[buffered] = '\0';
+
+        char *line_start = buffer;
+        char *newline;
+        while ((newline = memchr(line_start, '\n', buffered - (size_t)(line_start - buffer))) != NULL) {
+            *newline = '\0';
+            long long ts = strtoll(line_start, NULL, 10);
+            if (ts > (long long)to) { done = true; break; }
+            if (ts >= (long long)from) {
+                if (emitted >= max_lines) { done = true; emitted++; break; }
+                emit(line_start, ctx);
+                emitted++;
+            }
+            line_start = newline + 1;
+        }
+        if (done) break;
+
+        size_t remaining = buffered - (size_t)(line_start - buffer);
+        if (remaining == sizeof(buffer) - 1) remaining = 0; // Overlong line: drop it rather than stall
+        memmove(buffer, line_start, remaining);
+        buffered = remaining;
+    }
+    close(read_fd);
+    return emitted;
+}
+
+// Accepts either epoch seconds or local time as YYYY-MM-DDTHH:MM[:SS].
+int parse_history_time(const char *text, time_t *out) {
+    if (text == NULL || *text == '\0') return -1;
+
+    char *end = NULL;
+    long long epoch = strtoll(text, &end, 10);
+    if (end && *end == '\0') {
+        *out = (time_t)epoch;
+        return 0;
+    }
+
+    struct tm tm_info;
+    memset(&tm_info, 0, sizeof(tm_info));
+    int consumed = 0;
+    if (sscanf(text, "%d-%d-%dT%d:%d%n", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday,
+               &tm_info.tm_hour, &tm_info.tm_min, &consumed) != 5) {
+        return -1;
+    }
+    if (text[consumed] == ':') {
+        int seconds_consumed = 0;
+        if (sscanf(text + consumed, ":%d%n", &tm_info.tm_sec, &seconds_consumed) != 1) return -1;
+        consumed += seconds_consumed;
+    }
+    if (text[consumed] != '\0') return -1;
+
+    tm_info.tm_year -= 1900;
+    tm_info.tm_mon -= 1;
+    tm_info.tm_isdst = -1;
+    time_t parsed = mktime(&tm_info);
+    if (parsed == (time_t)-1) return -1;
+    *out = parsed;
+    return 0;
+}
@@ -5,15 +5,10 @@
 
 #include "irc_bot.h"
 #include <string.h> 
+#include <sys/stat.h>
 
 // --- Versatile Logging Function (Dual Output) ---
-void app_log(const char *process_tag, const char *level, const char *format, ...) {
-    char message_buffer[MAX_PIPE_MSG_LEN + 256]; // Buffer for the formatted message
-    va_list args_for_sprintf;
-    va_start(args_for_sprintf, format);
-    vsnprintf(message_buffer, sizeof(message_buffer), format, args_for_sprintf);
-    va_end(args_for_sprintf);
-
+static void app_log_write(const char *process_tag, const char *level, const char *message_buffer) {
     time_t now;
     struct tm *local_time_info;
     char time_buffer[80];
@@ -42,6 +37,118 @@ void app_log(const char *process_tag, const char *level, const char *format, ...
     fclose(logFile);
 }
 
+void app_log(const char *process_tag, const char *level, const char *format, ...) {
+    char message_buffer[MAX_PIPE_MSG_LEN + 256]; // Buffer for the formatted message
+    va_list args_for_sprintf;
+    va_start(args_for_sprintf, format);
+    vsnprintf(message_buffer, sizeof(message_buffer), format, args_for_sprintf);
+    va_end(args_for_sprintf);
+    app_log_write(process_tag, level, message_buffer);
+}
+
+// --- Log Sampling ---
+// High-volume categories (see LOG_SAMPLED_LEVELS) are counted per (level, channel)
+// in fixed windows. The first LOG_SAMPLE_THRESHOLD lines of a window are written,
+// after that only 1 in LOG_SAMPLE_RATE. Every other level, and anything about the
+// admin channel, is always written. Suppressed counts are reported by
+// log_sampler_flush() once the window closes. State is per process.
+typedef struct {
+    char level[16];
+    char channel[MAX_CHANNEL_NAME_LEN];
+    time_t window_start;
+    unsigned long seen;
+    unsigned long suppressed;
+} LogSampleSlot;
+
+static LogSampleSlot g_log_sample_slots[LOG_SAMPLER_SLOTS];
+
+static bool is_sampled_level(const char *level) {
+    static const char *sampled_levels[] = LOG_SAMPLED_LEVELS;
+    for (size_t i = 0; i < sizeof(sampled_levels) / sizeof(sampled_levels[0]); ++i) {
+        if (strcmp(level, sampled_levels[i]) == 0) return true;
+    }
+    return false;
+}
+
+static LogSampleSlot *find_sample_slot(const char *level, const char *channel) {
+    unsigned long hash = 5381;
+    for (const char *p = level; *p; ++p) hash = hash * 33 + (unsigned char)*p;
+    for (const char *p = channel; *p; ++p) hash = hash * 33 + (unsigned char)*p;
+
+    for (int probe = 0; probe < LOG_SAMPLER_SLOTS; ++probe) {
+        LogSampleSlot *slot = &g_log_sample_slots[(hash + probe) % LOG_SAMPLER_SLOTS];
+        if (slot->level[0] == '\0') {
+            snprintf(slot->level, sizeof(slot->level), "%s", level);
+            snprintf(slot->channel, sizeof(slot->channel), "%s", channel);
+            return slot;
+        }
+        if (strcmp(slot->level, level) == 0 && strcmp(slot->channel, channel) == 0) return slot;
+    }
+    return NULL; // Table full: caller logs unsampled
+}
+
+static void report_suppressed(const char *process_tag, LogSampleSlot *slot, time_t now) {
+    if (slot->suppressed > 0) {
+        app_log(process_tag, "LOG_SAMPLE", "Suppressed %lu of %lu %s lines for %s in the last %lds.",
+                slot->suppressed, slot->seen, slot->level, slot->channel, (long)(now - slot->window_start));
+    }
+    slot->window_start = now;
+    slot->seen = 0;
+    slot->suppressed = 0;
+}
+
+void app_log_sampled(const char *process_tag, const char *level, const char *channel, const char *format, ...) {
+    if (channel && channel[0] != '\0' && is_sampled_level(level) &&
+        !(ADMIN_CHANNEL_NAME_CONST && strcmp(channel, ADMIN_CHANNEL_NAME_CONST) == 0)) {
+        LogSampleSlot *slot = find_sample_slot(level, channel);
+        if (slot != NULL) {
+            time_t now = time(NULL);
+            if (now - slot->window_start >= LOG_SAMPLE_WINDOW_SECONDS) report_suppressed(process_tag, slot, now);
+            slot->seen++;
+            if (slot->seen > LOG_SAMPLE_THRESHOLD && (slot->seen - LOG_SAMPLE_THRESHOLD) % LOG_SAMPLE_RATE != 0) {
+                slot->suppressed++;
+                return;
+            }
+        }
+    }
+
+    char message_buffer[MAX_PIPE_MSG_LEN + 256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message_buffer, sizeof(message_buffer), format, args);
+    va_end(args);
+    app_log_write(process_tag, level, message_buffer);
+}
+
+void log_sampler_flush(const char *process_tag, bool force) {
+    time_t now = time(NULL);
+    for (int i = 0; i < LOG_SAMPLER_SLOTS; ++i) {
+        LogSampleSlot *slot = &g_log_sample_slots[i];
+        if (slot->level[0] == '\0') continue;
+        if (force || now - slot->window_start >= LOG_SAMPLE_WINDOW_SECONDS) report_suppressed(process_tag, slot, now);
+    }
+}
+
+// Returns the channel a raw IRC line is addressed to (":src CMD #chan ..."), or "" if none.
+void irc_line_channel(const char *line, char *out, size_t out_size) {
+    out[0] = '\0';
+    if (line == NULL || out_size == 0) return;
+    const char *p = line;
+    if (*p == ':') { // Skip source prefix
+        p = strchr(p, ' ');
+        if (p == NULL) return;
+        p++;
+    }
+    p = strchr(p, ' '); // Skip command
+    if (p == NULL) return;
+    p++;
+    if (*p != '#' && *p != '&') return;
+    size_t len = strcspn(p, " ");
+    if (len >= out_size) len = out_size - 1;
+    memcpy(out, p, len);
+    out[len] = '\0';
+}
+
 
 void clearBuffer(char buffer[], size_t size) {
     memset(buffer, 0, size);
@@ -67,7 +174,7 @@ int load_channels_from_file(const char *filename) {
         return -1;
     }
 
-    char line[MAX_CHANNEL_NAME_LEN + MAX_PERSONA_LEN + 5]; // Room for channel, ';', persona, \n, \0
+    char line[MAX_CHANNEL_NAME_LEN + MAX_PERSONA_LEN + MAX_BACKEND_OPTIONS_LEN + 6]; // Room for channel, ';', persona, ';', options, \n, \0
     int count = 0;
     while (fgets(line, sizeof(line), file) != NULL) {
         line[strcspn(line, "\r\n")] = 0; // Remove newline
@@ -99,6 +206,7 @@ int load_channels_from_file(const char *filename) {
     for(int k=0; k<count; ++k) {
         g_channel_infos[k].name = NULL;
         g_channel_infos[k].persona = NULL;
+        g_channel_infos[k].backend_options = NULL;
     }
 
 
@@ -110,13 +218,21 @@ int load_channels_from_file(const char *filename) {
 
         char *channel_part = line;
         char *persona_part = NULL;
+        char *options_part = NULL;
         char *semicolon = strchr(line, ';');
 
         if (semicolon != NULL) {
             *semicolon = '\0'; // Null-terminate channel part
             persona_part = semicolon + 1;
+            // A trailing ";backend=..." segment selects the AI backend for this channel
+            char *options_semicolon = strrchr(persona_part, ';');
+            if (options_semicolon != NULL && strncmp(options_semicolon + 1, "backend=", 8) == 0) {
+                *options_semicolon = '\0';
+                options_part = options_semicolon + 1;
+            }
             // Validate lengths
-            if (strlen(channel_part) >= MAX_CHANNEL_NAME_LEN || strlen(persona_part) >= MAX_PERSONA_LEN) {
+            if (strlen(channel_part) >= MAX_CHANNEL_NAME_LEN || strlen(persona_part) >= MAX_PERSONA_LEN ||
+                (options_part && strlen(options_part) >= MAX_BACKEND_OPTIONS_LEN)) {
                 app_log(parent_tag, "WARN", "Skipping line due to length: %s", line); // Log original line before modification
                 *semicolon = ';'; // Restore for logging if needed elsewhere
                 continue;
@@ -134,7 +250,7 @@ int load_channels_from_file(const char *filename) {
             app_log(parent_tag, "ERROR", "Failed to duplicate channel name: %s", strerror(errno));
             // Cleanup partially filled g_channel_infos
             for(int k=0; k <= current_channel_idx; ++k) {
-                free(g_channel_infos[k].name); free(g_channel_infos[k].persona);
+                free(g_channel_infos[k].name); free(g_channel_infos[k].persona); free(g_channel_infos[k].backend_options);
             }
             free(g_channel_infos); g_channel_infos = NULL;
             fclose(file);
@@ -148,7 +264,7 @@ int load_channels_from_file(const char *filename) {
                 free(g_channel_infos[current_channel_idx].name);
                 // Cleanup partially filled g_channel_infos
                 for(int k=0; k < current_channel_idx; ++k) { // Note: k < current_channel_idx
-                    free(g_channel_infos[k].name); free(g_channel_infos[k].persona);
+                    free(g_channel_infos[k].name); free(g_channel_infos[k].persona); free(g_channel_infos[k].backend_options);
                 }
                 free(g_channel_infos); g_channel_infos = NULL;
                 fclose(file);
@@ -161,6 +277,12 @@ int load_channels_from_file(const char *filename) {
                  // Handle error similar to above
              }
         }
+        if (options_part && strlen(options_part) > 0) {
+            g_channel_infos[current_channel_idx].backend_options = strdup(options_part);
+            if (g_channel_infos[current_channel_idx].backend_options == NULL) {
+                app_log(parent_tag, "WARN", "Failed to duplicate backend options for %s; using the default backend.", channel_part);
+            }
+        }
         current_channel_idx++;
     }
     fclose(file);
@@ -187,6 +309,7 @@ void free_channels_memory(void) {
         for (int i = 0; i < numChildren; i++) { // Iterate numChildren times
             free(g_channel_infos[i].name);
             free(g_channel_infos[i].persona);
+            free(g_channel_infos[i].backend_options);
         }
         free(g_channel_infos);
         g_channel_infos = NULL;
@@ -197,112 +320,352 @@ void free_channels_memory(void) {
     app_log(parent_tag, "INFO", "Freed channels memory.");
 }
 
-int load_muted_users_from_file(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        app_log("Setup", "INFO", "Muted users file '%s' not found or not readable. No users pre-muted.", filename);
-        g_num_muted_users = 0; 
-        g_muted_nicks = NULL;  
-        return 0; 
+// --- Nick comparison ---
+// rfc1459 casemapping: besides A-Z, the characters [\]^ are the upper case of {|}~.
+int irc_tolower(int c) {
+    if (c >= 'A' && c <= '^') return c + ('a' - 'A');
+    return c;
+}
+
+bool irc_nick_equal(const char *a, const char *b) {
+    for (; *a && *b; ++a, ++b) {
+        if (irc_tolower((unsigned char)*a) != irc_tolower((unsigned char)*b)) return false;
     }
+    return *a == *b;
+}
 
-    char line[MAX_NICK_LEN + 2]; 
-    int count = 0;
+uint64_t irc_nick_hash(const char *nick) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a over the folded nick
+    for (const unsigned char *p = (const unsigned char *)nick; *p; ++p) {
+        hash ^= (unsigned char)irc_tolower(*p);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t irc_nick_fold(const char *nick, char *out, size_t out_size) {
+    size_t len = 0;
+    for (; nick[len] && len + 1 < out_size; ++len) out[len] = (char)irc_tolower((unsigned char)nick[len]);
+    out[len] = '\0';
+    return irc_nick_hash(out);
+}
+
+// --- Muted nicks ---
+#define MUTE_SET_MIN_CAPACITY 16
+
+
+// Slot holding nick, or the empty slot where it would go.
+static MutedNick *mute_set_find(const MuteSet *set, const char *nick, uint64_t hash) {
+    size_t mask = set->capacity - 1;
+    for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+        MutedNick *slot = &set->slots[i];
+        if (slot->nick[0] == '\0' || (slot->hash == hash && irc_nick_equal(slot->nick, nick))) return slot;
+    }
+}
+
+static int mute_set_grow(MuteSet *set) {
+    size_t capacity = set->capacity ? set->capacity * 2 : MUTE_SET_MIN_CAPACITY;
+    MutedNick *slots = (MutedNick *)calloc(capacity, sizeof(MutedNick));
+    if (slots == NULL) return -1;
+    MuteSet grown = { slots, capacity, set->count };
+    for (size_t i = 0; i < set->capacity; ++i) {
+        if (set->slots[i].nick[0] != '\0') *mute_set_find(&grown, set->slots[i].nick, set->slots[i].hash) = set->slots[i];
+    }
+    free(set->slots);
+    *set = grown;
+    return 0;
+}
+
+// Returns 1 if nick was added, 0 if it was already there, -1 if out of memory.
+static int mute_set_insert(MuteSet *set, const char *nick) {
+    if ((set->count + 1) * 2 > set->capacity && mute_set_grow(set) != 0) return -1; // At most half full
+    uint64_t hash = irc_nick_hash(nick);
+    MutedNick *slot = mute_set_find(set, nick, hash);
+    if (slot->nick[0] != '\0') return 0;
+    slot->hash = hash;
+    snprintf(slot->nick, sizeof(slot->nick), "%s", nick);
+    set->count++;
+    return 1;
+}
+
+// Returns true if nick was there. Later entries of the probe run are shifted
+// back into the hole, so lookups never need tombstones.
+static bool mute_set_remove(MuteSet *set, const char *nick) {
+    if (set->count == 0) return false;
+    MutedNick *slot = mute_set_find(set, nick, irc_nick_hash(nick));
+    if (slot->nick[0] == '\0') return false;
+    size_t mask = set->capacity - 1;
+    size_t hole = (size_t)(slot - set->slots);
+    for (size_t i = (hole + 1) & mask; set->slots[i].nick[0] != '\0'; i = (i + 1) & mask) {
+        size_t home = (size_t)set->slots[i].hash & mask;
+        // The entry may fill the hole unless its home lies cyclically in (hole, i]
+        bool home_after_hole = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (home_after_hole) continue;
+        set->slots[hole] = set->slots[i];
+        hole = i;
+    }
+    set->slots[hole].nick[0] = '\0';
+    set->count--;
+    return true;
+}
+
+// --- Mute list persistence ---
+// The list lives in a snapshot (one nick per line) plus an append-only
+// journal of "+nick" and "-nick" records. Records are buffered and written
+// in batches, each with one write() and one fdatasync(); at load the journal
+// is replayed over the snapshot, and a torn last line is cut off. Replaying
+// a record twice is harmless, since the last record for a nick decides.
+// Compaction renames the journal to <journal>.old and starts a new one, and a
+// child process writes the set as it was at the fork to a temporary file and
+// renames it over the snapshot before deleting the .old journal, so a crash
+// at any point leaves a snapshot and journals that replay to the same list.
+typedef struct {
+    int fd; // -1 while the journal cannot be written
+    char snapshot_path[256];
+    char path[256];
+    char old_path[256 + 8];
+    char buffer[MUTE_JOURNAL_BUFFER_BYTES]; // Records not yet written
+    size_t buffered;
+    struct timeval oldest_buffered;
+    unsigned long records; // In the journal since the last compaction
+    pid_t compactor; // Child writing a snapshot, -1 if none
+    pid_t owner; // Process that loaded the list; forked children leave the journal alone
+} MuteJournal;
+
+static MuteJournal g_mute_journal = { .fd = -1, .compactor = -1 };
+
+// Applies the records of a journal file to the set. Returns the number of
+// records, and sets *valid_len to the length of the complete lines.
+static unsigned long replay_mute_journal(const char *path, off_t *valid_len) {
+    *valid_len = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 0;
+    unsigned long records = 0;
+    char line[MAX_NICK_LEN + 8];
     while (fgets(line, sizeof(line), file) != NULL) {
-        line[strcspn(line, "\r\n")] = 0;
-        if (strlen(line) > 0 && strlen(line) < MAX_NICK_LEN) { 
-            count++;
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') break; // Torn by a crash mid-write, or garbage
+        *valid_len += (off_t)len;
+        line[len - 1] = '\0';
+        const char *nick = line + 1;
+        if ((line[0] != '+' && line[0] != '-') || nick[0] == '\0' || strlen(nick) >= MAX_NICK_LEN) continue;
+        if (line[0] == '+') mute_set_insert(&g_muted_users, nick);
+        else mute_set_remove(&g_muted_users, nick);
+        records++;
+    }
+    fclose(file);
+    return records;
+}
+
+static long ms_since(const struct timeval *since) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_usec - since->tv_usec) / 1000L;
+}
+
+// Writes the buffered records with one write() and makes them durable.
+static int write_mute_journal(void) {
+    MuteJournal *journal = &g_mute_journal;
+    if (journal->buffered == 0) return 0;
+    if (journal->fd < 0) return -1;
+    size_t done = 0;
+    while (done < journal->buffered) {
+        ssize_t written = write(journal->fd, journal->buffer + done, journal->buffered - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            app_log("MuteJournal", "ERROR", "Error writing %s: %s", journal->path, strerror(errno));
+            return -1; // Kept buffered for the next try
         }
+        done += (size_t)written;
     }
-    
-    if (g_muted_nicks != NULL) free_muted_users_memory();
+    if (fdatasync(journal->fd) != 0) {
+        app_log("MuteJournal", "ERROR", "Error syncing %s: %s", journal->path, strerror(errno));
+    }
+    journal->buffered = 0;
+    return 0;
+}
 
-    if (count == 0) {
-        fclose(file);
-        g_num_muted_users = 0;
-        g_muted_nicks = NULL;
-        app_log("Setup", "INFO", "No nicks found in muted users file %s.", filename);
-        return 0;
+static int open_mute_journal(void) {
+    g_mute_journal.fd = open(g_mute_journal.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (g_mute_journal.fd < 0) {
+        app_log("MuteJournal", "ERROR", "Cannot open %s: %s. Mute changes will not be saved.", g_mute_journal.path, strerror(errno));
+        return -1;
     }
+    return 0;
+}
 
-    g_muted_nicks = (char **)malloc((count + 1) * sizeof(char *)); 
-    if (g_muted_nicks == NULL) {
-        app_log("Setup", "ERROR", "Failed to allocate memory for muted nicks array: %s", strerror(errno));
-        fclose(file);
-        return -1; 
+static int append_mute_record(char op, const char *nick) {
+    MuteJournal *journal = &g_mute_journal;
+    if (journal->fd < 0 || journal->owner != getpid()) return -1;
+    size_t len = strlen(nick) + 2;
+    if (journal->buffered + len > sizeof(journal->buffer) && write_mute_journal() != 0) return -1;
+    if (journal->buffered == 0) gettimeofday(&journal->oldest_buffered, NULL);
+    journal->buffer[journal->buffered++] = op;
+    memcpy(journal->buffer + journal->buffered, nick, len - 2);
+    journal->buffered += len - 2;
+    journal->buffer[journal->buffered++] = '\n';
+    journal->records++;
+    return 0;
+}
+
+// Moves the journal aside and has a child process write the snapshot; done
+// in this process if the fork fails.
+static void compact_mute_journal(void) {
+    MuteJournal *journal = &g_mute_journal;
+    if (journal->compactor > 0 || write_mute_journal() != 0) return;
+    if (access(journal->old_path, F_OK) != 0) { // Else an earlier compaction failed; the new snapshot covers that file too
+        if (rename(journal->path, journal->old_path) != 0) {
+            app_log("MuteJournal", "ERROR", "Cannot move %s aside: %s", journal->path, strerror(errno));
+            return;
+        }
+        close(journal->fd);
+        open_mute_journal();
+        journal->records = 0;
     }
 
-    rewind(file);
-    int current_idx = 0;
-    while (fgets(line, sizeof(line), file) != NULL && current_idx < count) {
-        line[strcspn(line, "\r\n")] = 0;
-        if (strlen(line) > 0 && strlen(line) < MAX_NICK_LEN) {
-            g_muted_nicks[current_idx] = strdup(line);
-            if (g_muted_nicks[current_idx] == NULL) {
-                app_log("Setup", "ERROR", "Failed to duplicate muted nick string: %s", strerror(errno));
-                for (int i = 0; i < current_idx; i++) free(g_muted_nicks[i]);
-                free(g_muted_nicks); g_muted_nicks = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        int rc = save_muted_users_to_file(journal->snapshot_path);
+        if (rc == 0) unlink(journal->old_path);
+        _exit(rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (pid < 0) {
+        app_log("MuteJournal", "WARN", "Cannot fork to compact the mute journal (%s); compacting in place.", strerror(errno));
+        if (save_muted_users_to_file(journal->snapshot_path) == 0) unlink(journal->old_path);
+        return;
+    }
+    journal->compactor = pid;
+    app_log("MuteJournal", "INFO", "Compacting the mute journal in PID %d (%zu nicks).", pid, g_muted_users.count);
+}
+
+bool mute_journal_pending(void) {
+    return g_mute_journal.buffered > 0;
+}
+
+void mute_journal_flush(bool force) {
+    MuteJournal *journal = &g_mute_journal;
+    if (journal->owner != getpid()) return;
+    if (journal->buffered > 0 && (force || ms_since(&journal->oldest_buffered) >= MUTE_JOURNAL_FLUSH_MS)) write_mute_journal();
+    if (!force && journal->records >= MUTE_JOURNAL_COMPACT_RECORDS && journal->records > g_muted_users.count) compact_mute_journal();
+}
+
+bool mute_journal_reap(pid_t pid, int status) {
+    if (pid <= 0 || pid != g_mute_journal.compactor) return false;
+    g_mute_journal.compactor = -1;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+        app_log("MuteJournal", "INFO", "Mute journal compacted into %s.", g_mute_journal.snapshot_path);
+    } else {
+        app_log("MuteJournal", "WARN", "Compacting the mute journal failed; it will be retried.");
+    }
+    return true;
+}
+
+int load_muted_users_from_file(const char *filename) {
+    free_muted_users_memory();
+    MuteJournal *journal = &g_mute_journal;
+    journal->owner = getpid();
+    snprintf(journal->snapshot_path, sizeof(journal->snapshot_path), "%s", filename);
+    snprintf(journal->path, sizeof(journal->path), "%s%s", filename, MUTE_JOURNAL_SUFFIX);
+    snprintf(journal->old_path, sizeof(journal->old_path), "%.*s.old", (int)sizeof(journal->path) - 1, journal->path);
+
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        app_log("Setup", "INFO", "Muted users file '%s' not found or not readable. No users pre-muted.", filename);
+    } else {
+        char line[MAX_NICK_LEN + 2];
+        while (fgets(line, sizeof(line), file) != NULL) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (strlen(line) == 0 || strlen(line) >= MAX_NICK_LEN) continue;
+            if (mute_set_insert(&g_muted_users, line) < 0) {
+                app_log("Setup", "ERROR", "Failed to allocate memory for the mute list: %s", strerror(errno));
                 fclose(file);
-                return -1; 
+                free_muted_users_memory();
+                return -1;
             }
-            current_idx++;
+        }
+        fclose(file);
+    }
+
+    off_t valid_len;
+    unsigned long old_records = replay_mute_journal(journal->old_path, &valid_len);
+    journal->records = replay_mute_journal(journal->path, &valid_len);
+    struct stat st;
+    if (stat(journal->path, &st) == 0 && st.st_size > valid_len) {
+        app_log("Setup", "WARN", "Dropping %lld bytes of an incomplete record at the end of %s.", (long long)(st.st_size - valid_len), journal->path);
+        if (truncate(journal->path, valid_len) != 0) {
+            app_log("Setup", "ERROR", "Cannot truncate %s: %s", journal->path, strerror(errno));
         }
     }
-    g_muted_nicks[count] = NULL; 
-    fclose(file);
+    if (open_mute_journal() == 0 && access(journal->old_path, F_OK) == 0) compact_mute_journal(); // Finish what a crash interrupted
 
-    g_num_muted_users = count;
-    app_log("Setup", "INFO", "Loaded %d muted user(s) from %s.", g_num_muted_users, filename);
-    return count;
+    if (g_muted_users.count == 0) {
+        app_log("Setup", "INFO", "No nicks found in muted users file %s.", filename);
+    } else {
+        app_log("Setup", "INFO", "Loaded %zu muted user(s) from %s (%lu journal record(s) replayed).", g_muted_users.count, filename,
+                old_records + journal->records);
+    }
+    return (int)g_muted_users.count;
 }
 
 void free_muted_users_memory(void) {
-    if (g_muted_nicks != NULL) {
-        for (int i = 0; g_muted_nicks[i] != NULL; i++) { 
-            free(g_muted_nicks[i]);
-        }
-        free(g_muted_nicks);
-        g_muted_nicks = NULL;
+    MuteJournal *journal = &g_mute_journal;
+    if (journal->fd >= 0 && journal->owner == getpid()) {
+        write_mute_journal();
+        close(journal->fd);
+        journal->fd = -1;
     }
-    g_num_muted_users = 0;
-    app_log("Shutdown", "INFO", "Freed muted users memory.");
+    free(g_muted_users.slots);
+    g_muted_users.slots = NULL;
+    g_muted_users.capacity = 0;
+    g_muted_users.count = 0;
 }
 
+// Writes a snapshot of the list: to a temporary file, synced and then renamed
+// over filename, so readers see either the old or the new list.
 int save_muted_users_to_file(const char *filename) {
     char proc_tag[32]; // Generic tag, could be improved if context is available
     snprintf(proc_tag, sizeof(proc_tag), "PID %d", getpid());
 
-    FILE *file = fopen(filename, "w"); 
+    char tmp_path[sizeof(g_mute_journal.snapshot_path) + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filename);
+    FILE *file = fopen(tmp_path, "w");
     if (file == NULL) {
-        app_log(proc_tag, "ERROR", "Error opening muted users file '%s' for writing: %s", filename, strerror(errno));
+        app_log(proc_tag, "ERROR", "Error opening muted users file '%s' for writing: %s", tmp_path, strerror(errno));
         return -1;
     }
-    if (g_muted_nicks != NULL) {
-        for (int i = 0; g_muted_nicks[i] != NULL; i++) { 
-            if (fprintf(file, "%s\n", g_muted_nicks[i]) < 0) {
-                app_log(proc_tag, "ERROR", "Error writing to muted users file '%s': %s", filename, strerror(errno));
-                fclose(file);
-                return -1;
-            }
+    for (size_t i = 0; i < g_muted_users.capacity; i++) {
+        if (g_muted_users.slots[i].nick[0] == '\0') continue;
+        if (fprintf(file, "%s\n", g_muted_users.slots[i].nick) < 0) {
+            app_log(proc_tag, "ERROR", "Error writing to muted users file '%s': %s", tmp_path, strerror(errno));
+            fclose(file);
+            unlink(tmp_path);
+            return -1;
         }
     }
-    fclose(file);
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0 || fclose(file) != 0 || rename(tmp_path, filename) != 0) {
+        app_log(proc_tag, "ERROR", "Error saving muted users file '%s': %s", filename, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    // Make the rename itself durable before anything relies on it
+    char dir[sizeof(tmp_path)];
+    snprintf(dir, sizeof(dir), "%s", filename);
+    char *slash = strrchr(dir, '/');
+    if (slash) *slash = '\0';
+    int dir_fd = open(slash ? dir : ".", O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
     app_log(proc_tag, "INFO", "Muted users list saved to %s.", filename);
     return 0;
 }
-// ... (ensure other mute functions also use app_log similarly) ...
-// (load_muted_users_from_file, free_muted_users_memory, add_muted_user, remove_muted_user 
-// are already updated in the previous turn to use app_log - verify and keep those changes)
+
 bool is_user_globally_muted(const char *nick) {
-    if (nick == NULL || g_muted_nicks == NULL) {
+    if (nick == NULL || g_muted_users.count == 0) {
         return false;
     }
-    for (int i = 0; g_muted_nicks[i] != NULL; i++) { 
-        if (strcmp(nick, g_muted_nicks[i]) == 0) {
-            return true;
-        }
-    }
-    return false;
+    return mute_set_find(&g_muted_users, nick, irc_nick_hash(nick))->nick[0] != '\0';
 }
 
 int add_muted_user(const char *nick) {
@@ -310,73 +673,32 @@ int add_muted_user(const char *nick) {
     snprintf(proc_tag, sizeof(proc_tag), "PID %d", getpid());
     if (nick == NULL || strlen(nick) == 0 || strlen(nick) >= MAX_NICK_LEN) {
         app_log(proc_tag, "WARN", "Invalid nick '%s' provided for muting.", nick ? nick : "NULL");
-        return -1; 
-    }
-    if (is_user_globally_muted(nick)) {
-        app_log(proc_tag, "INFO", "User '%s' is already muted.", nick);
-        return 0; 
+        return -1;
     }
-
-    char **new_muted_nicks = (char **)realloc(g_muted_nicks, (g_num_muted_users + 2) * sizeof(char *));
-    if (new_muted_nicks == NULL) {
-        app_log(proc_tag, "ERROR", "Failed to realloc memory for muted nicks array: %s", strerror(errno));
-        return -1; 
+    int added = mute_set_insert(&g_muted_users, nick);
+    if (added < 0) {
+        app_log(proc_tag, "ERROR", "Failed to grow the mute list: %s", strerror(errno));
+        return -1;
     }
-    g_muted_nicks = new_muted_nicks;
-
-    g_muted_nicks[g_num_muted_users] = strdup(nick);
-    if (g_muted_nicks[g_num_muted_users] == NULL) {
-        app_log(proc_tag, "ERROR", "Failed to duplicate nick string for muting: %s", strerror(errno));
-        g_muted_nicks = (char **)realloc(g_muted_nicks, (g_num_muted_users + 1) * sizeof(char *));
-        if(g_muted_nicks) g_muted_nicks[g_num_muted_users] = NULL; 
-        return -1; 
+    if (added == 0) {
+        app_log(proc_tag, "INFO", "User '%s' is already muted.", nick);
+        return 0;
     }
 
-    g_num_muted_users++;
-    g_muted_nicks[g_num_muted_users] = NULL; 
-
-    app_log(proc_tag, "MUTE_ADD", "User '%s' added to mute list. Total muted: %d.", nick, g_num_muted_users);
-    return save_muted_users_to_file(MUTED_USERS_FILE_PATH);
+    app_log(proc_tag, "MUTE_ADD", "User '%s' added to mute list. Total muted: %zu.", nick, g_muted_users.count);
+    return append_mute_record('+', nick);
 }
 
 int remove_muted_user(const char *nick) {
     char proc_tag[32];
     snprintf(proc_tag, sizeof(proc_tag), "PID %d", getpid());
-    if (nick == NULL || g_muted_nicks == NULL || g_num_muted_users == 0) {
-        return 0; 
-    }
-
-    int found_idx = -1;
-    for (int i = 0; i < g_num_muted_users; i++) { 
-        if (g_muted_nicks[i] != NULL && strcmp(nick, g_muted_nicks[i]) == 0) {
-            found_idx = i;
-            break;
-        }
+    if (nick == NULL) {
+        return 0;
     }
-
-    if (found_idx == -1) {
+    if (!mute_set_remove(&g_muted_users, nick)) {
         app_log(proc_tag, "MUTE_REMOVE", "User '%s' not found in mute list for unmuting.", nick);
-        return 0; 
-    }
-
-    free(g_muted_nicks[found_idx]); 
-
-    if (found_idx < g_num_muted_users - 1) {
-        g_muted_nicks[found_idx] = g_muted_nicks[g_num_muted_users - 1];
+        return 0;
     }
-    
-    g_num_muted_users--;
-    g_muted_nicks[g_num_muted_users] = NULL; 
-    
-    if (g_num_muted_users == 0) {
-        free(g_muted_nicks);
-        g_muted_nicks = NULL;
-    } else {
-        char **shrunk_list = (char **)realloc(g_muted_nicks, (g_num_muted_users + 1) * sizeof(char*));
-        if (shrunk_list != NULL) {
-            g_muted_nicks = shrunk_list;
-        } 
-    }
-    app_log(proc_tag, "MUTE_REMOVE", "User '%s' removed from mute list. Total muted: %d.", nick, g_num_muted_users);
-    return save_muted_users_to_file(MUTED_USERS_FILE_PATH); 
-}
\ No newline at end of file
+    app_log(proc_tag, "MUTE_REMOVE", "User '%s' removed from mute list. Total muted: %zu.", nick, g_muted_users.count);
+    return append_mute_record('-', nick);
+}